@@ -15,6 +15,10 @@
 #include "env.hpp"
 #include "clone.hpp"
 #include "objects.hpp"
+#include "timing.hpp"
+#include "profiler.hpp"
+#include "prebuilt.hpp"
+#include "sharing.hpp"
 
 
 #pragma clang diagnostic ignored "-Wcovered-switch-default"
@@ -2517,6 +2521,8 @@ static void unifyInterfaceReturns(InvokeEntry* entry)
 
 void analyzeCodeBody(InvokeEntry* entry)
 {
+    TimingPhase phase("analysis");
+    InstantiationProfileScope profile(entry, PROFILE_ANALYSIS);
     CompilerState* cst = entry->env->cst;
     assert(!entry->analyzed);
 
@@ -2531,6 +2537,10 @@ void analyzeCodeBody(InvokeEntry* entry)
         return;
     }
 
+    // a loaded manifest already knows what a prebuilt body returns
+    if (prebuiltUseEnabled(cst) && analyzePrebuiltEntry(entry))
+        return;
+
     EnvPtr bodyEnv = new Env(entry->env);
 
     size_t i = 0;
@@ -2567,6 +2577,9 @@ void analyzeCodeBody(InvokeEntry* entry)
 
     unifyInterfaceReturns(entry);
 
+    if (cst->layoutSharing)
+        entry->sharedBody = findLayoutTwin(entry);
+
     entry->analyzed = true;
 }
 
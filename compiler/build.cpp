@@ -0,0 +1,388 @@
+#include "clay.hpp"
+#include "build.hpp"
+#include "fingerprint.hpp"
+#include "hirestimer.hpp"
+#include "loader.hpp"
+#include "threads.hpp"
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Support/Format.h>
+
+
+namespace clay {
+
+namespace {
+    struct BuildJob {
+        Module *module;
+        string name;
+        string source;
+        string output;
+        string interfaceFile;
+        string stampFile;
+        vector<string> args;
+        string fingerprint;
+        vector<BuildJob *> imports;
+        unsigned level;
+        // a library module compiled only for its globals
+        bool globalsOnly;
+        bool cached;
+        bool finished;
+        bool failed;
+        double millis;
+
+        BuildJob()
+            : module(NULL), level(0), globalsOnly(false), cached(false),
+              finished(false), failed(false), millis(0) {}
+    };
+}
+
+
+
+//
+// fingerprints
+//
+
+static void importClosure(Module *m, set<Module *> &closure)
+{
+    if (!closure.insert(m).second)
+        return;
+    for (size_t i = 0; i < m->imports.size(); ++i)
+        importClosure(m->imports[i]->module.ptr(), closure);
+}
+
+static string jobFingerprint(Module *m,
+                             BuildOptions const &options,
+                             llvm::ArrayRef<string> args)
+{
+    Fingerprint f;
+    f.add(options.compiler);
+    llvm::sys::Path compiler(options.compiler);
+    const llvm::sys::FileStatus *status = compiler.getFileStatus();
+    if (status != NULL) {
+        f.add(llvm::utostr(status->getTimestamp().toEpochTime()));
+        f.add(llvm::utostr(status->getSize()));
+    }
+    for (size_t i = 0; i < args.size(); ++i)
+        f.add(args[i]);
+
+    set<Module *> closure;
+    importClosure(m, closure);
+    importClosure(preludeModule(m->cst).ptr(), closure);
+    // in name order, so the fingerprint doesn't depend on load order
+    map<string, Module *> sorted;
+    for (set<Module *>::const_iterator i = closure.begin(); i != closure.end(); ++i)
+        sorted[(*i)->moduleName] = *i;
+    for (map<string, Module *>::const_iterator i = sorted.begin(); i != sorted.end(); ++i) {
+        f.add(i->first);
+        SourcePtr source = i->second->source;
+        if (source != NULL)
+            f.add(llvm::StringRef(source->data(), source->size()));
+    }
+    return f.str();
+}
+
+static bool jobUpToDate(BuildJob const &job)
+{
+    bool exists;
+    if (llvm::sys::fs::exists(job.output, exists) || !exists)
+        return false;
+    if (!job.interfaceFile.empty()
+        && (llvm::sys::fs::exists(job.interfaceFile, exists) || !exists))
+        return false;
+    llvm::OwningPtr<llvm::MemoryBuffer> stamp;
+    if (llvm::MemoryBuffer::getFile(job.stampFile, stamp))
+        return false;
+    return stamp->getBuffer().rtrim() == job.fingerprint;
+}
+
+static void writeStamp(BuildJob const &job)
+{
+    string errorInfo;
+    llvm::raw_fd_ostream out(job.stampFile.c_str(), errorInfo);
+    if (errorInfo.empty())
+        out << job.fingerprint << '\n';
+}
+
+
+
+//
+// jobs
+//
+
+static bool isProjectSource(llvm::StringRef source, llvm::StringRef projectDir)
+{
+    PathString path(source);
+    llvm::sys::fs::make_absolute(path);
+    llvm::StringRef p = path.str();
+    return p.startswith(projectDir)
+        && p.size() > projectDir.size()
+        && llvm::sys::path::is_separator(p[projectDir.size()]);
+}
+
+// whether m has global variables other than indexed ones, which must
+// live in one object however many modules use them
+static bool ownsModuleGlobals(Module *m)
+{
+    for (size_t i = 0; i < m->topLevelItems.size(); ++i) {
+        TopLevelItem *x = m->topLevelItems[i].ptr();
+        if (x->objKind == GLOBAL_VARIABLE && !((GlobalVariable *)x)->hasParams())
+            return true;
+    }
+    return false;
+}
+
+static string buildPath(BuildOptions const &options, llvm::StringRef file)
+{
+    PathString path(options.buildDir);
+    llvm::sys::path::append(path, file);
+    return path.str();
+}
+
+static void importedJobs(Module *m,
+                         map<Module *, size_t> const &moduleJobs,
+                         set<Module *> &visited,
+                         set<size_t> &jobs);
+
+static void importedJob(Module *m,
+                        map<Module *, size_t> const &moduleJobs,
+                        set<Module *> &visited,
+                        set<size_t> &jobs)
+{
+    if (!visited.insert(m).second)
+        return;
+    map<Module *, size_t>::const_iterator job = moduleJobs.find(m);
+    if (job != moduleJobs.end())
+        jobs.insert(job->second);
+    else
+        importedJobs(m, moduleJobs, visited, jobs);
+}
+
+// the jobs of the modules m imports, directly or through modules that have
+// no job of their own
+static void importedJobs(Module *m,
+                         map<Module *, size_t> const &moduleJobs,
+                         set<Module *> &visited,
+                         set<size_t> &jobs)
+{
+    for (size_t i = 0; i < m->imports.size(); ++i)
+        importedJob(m->imports[i]->module.ptr(), moduleJobs, visited, jobs);
+}
+
+static unsigned jobLevel(BuildJob *job, set<BuildJob *> &visiting)
+{
+    if (job->level > 0)
+        return job->level;
+    // an import cycle is broken where it was entered
+    if (!visiting.insert(job).second)
+        return 0;
+    unsigned level = 1;
+    for (size_t i = 0; i < job->imports.size(); ++i)
+        level = std::max(level, jobLevel(job->imports[i], visiting) + 1);
+    visiting.erase(job);
+    job->level = level;
+    return level;
+}
+
+// runs on worker threads
+static bool runBuildJob(size_t i, void *jobs)
+{
+    BuildJob &job = (*(vector<BuildJob> *)jobs)[i];
+    if (job.cached)
+        return true;
+    vector<const char *> args;
+    for (size_t j = 0; j < job.args.size(); ++j)
+        args.push_back(job.args[j].c_str());
+    args.push_back(NULL);
+
+    WallTimer timer;
+    timer.start();
+    string errorInfo;
+    int result = llvm::sys::Program::ExecuteAndWait(
+        llvm::sys::Path(job.args[0]), &args[0], NULL, NULL, 0, 0, &errorInfo);
+    timer.stop();
+    job.millis = timer.elapsedMillis();
+    job.failed = result != 0;
+    return !job.failed;
+}
+
+// the interfaces of the modules job imports, directly or not, that are
+// built before level. a set keeps them sorted, so the order the modules
+// were loaded in doesn't change the fingerprint.
+static void importedInterfaces(BuildJob const *job,
+                               unsigned level,
+                               set<string> &interfaces)
+{
+    for (size_t i = 0; i < job->imports.size(); ++i) {
+        BuildJob const *imported = job->imports[i];
+        if (imported->level < level
+            && interfaces.insert("-prebuilt=" + imported->interfaceFile).second)
+            importedInterfaces(imported, level, interfaces);
+    }
+}
+
+static void printJob(llvm::raw_ostream &out, BuildJob const &job)
+{
+    out << "  ";
+    if (job.cached)
+        out << "cached          ";
+    else if (job.failed)
+        out << "failed          ";
+    else
+        out << "built " << llvm::format("%8.3fs ", job.millis / 1000);
+    out << job.name << '\n';
+}
+
+static void printCommand(llvm::raw_ostream &out, BuildJob const &job)
+{
+    out << "executing";
+    for (size_t i = 0; i < job.args.size(); ++i)
+        out << ' ' << job.args[i];
+    out << '\n';
+}
+
+// called for one job at a time, as each finishes
+static void finishBuildJob(size_t i, void *jobs)
+{
+    BuildJob &job = (*(vector<BuildJob> *)jobs)[i];
+    job.finished = true;
+    printJob(llvm::errs(), job);
+    if (!job.cached && !job.failed)
+        writeStamp(job);
+}
+
+bool buildProgram(ModulePtr main, BuildOptions const &options)
+{
+    CompilerState* cst = main->cst;
+    WallTimer total;
+    total.start();
+
+    PathString projectDir(options.mainFile);
+    llvm::sys::fs::make_absolute(projectDir);
+    llvm::sys::path::remove_filename(projectDir);
+
+    bool existed;
+    if (llvm::sys::fs::create_directories(options.buildDir, existed)) {
+        llvm::errs() << "error: unable to create build directory '"
+                     << options.buildDir << "'\n";
+        return false;
+    }
+
+    // the project's modules, and the library modules whose globals the
+    // objects of the project's modules would otherwise each keep a copy of
+    vector<BuildJob> jobs;
+    map<Module *, size_t> moduleJobs;
+    llvm::StringMap<ModulePtr>::const_iterator mi, mend;
+    for (mi = cst->globalModules.begin(), mend = cst->globalModules.end(); mi != mend; ++mi) {
+        Module *m = mi->getValue().ptr();
+        if (m == main.ptr() || m->source == NULL)
+            continue;
+        bool globalsOnly = !isProjectSource(m->source->fileName, projectDir.str());
+        if (globalsOnly && !ownsModuleGlobals(m))
+            continue;
+        moduleJobs[m] = jobs.size();
+        jobs.push_back(BuildJob());
+        BuildJob &job = jobs.back();
+        job.module = m;
+        job.globalsOnly = globalsOnly;
+        job.name = m->moduleName;
+        job.source = m->source->fileName;
+        job.output = buildPath(options, m->moduleName + options.objExtension);
+        job.interfaceFile = buildPath(options, m->moduleName + ".clayi");
+        job.stampFile = buildPath(options, m->moduleName + ".stamp");
+    }
+    jobs.push_back(BuildJob());
+    BuildJob &program = jobs.back();
+    program.module = main.ptr();
+    program.name = options.outputFile;
+    program.source = options.mainFile;
+    program.output = options.outputFile;
+    program.stampFile = buildPath(options, "__main__.stamp");
+
+    // every module imports the prelude
+    ModulePtr prelude = preludeModule(cst);
+    for (map<Module *, size_t>::const_iterator i = moduleJobs.begin(); i != moduleJobs.end(); ++i) {
+        BuildJob &job = jobs[i->second];
+        Module *m = i->first;
+        set<Module *> visited;
+        set<size_t> imported;
+        visited.insert(m);
+        importedJobs(m, moduleJobs, visited, imported);
+        importedJob(prelude.ptr(), moduleJobs, visited, imported);
+        for (set<size_t>::const_iterator j = imported.begin(); j != imported.end(); ++j)
+            job.imports.push_back(&jobs[*j]);
+        program.imports.push_back(&job);
+    }
+
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        set<BuildJob *> visiting;
+        jobLevel(&jobs[i], visiting);
+    }
+
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        BuildJob &job = jobs[i];
+        job.args.push_back(options.compiler);
+        job.args.insert(job.args.end(), options.flags.begin(), options.flags.end());
+        if (&job != &program) {
+            job.args.push_back("-c");
+            job.args.push_back(job.globalsOnly ? "-module-globals" : "-module");
+            job.args.push_back("-module-name");
+            job.args.push_back(job.name);
+        }
+        set<string> interfaces;
+        importedInterfaces(&job, job.level, interfaces);
+        job.args.insert(job.args.end(), interfaces.begin(), interfaces.end());
+        job.args.push_back("-o");
+        job.args.push_back(job.output);
+        job.args.push_back(job.source);
+    }
+
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        BuildJob &job = jobs[i];
+        // the first argument is the compiler, which has a fingerprint of
+        // its own
+        job.fingerprint = jobFingerprint(job.module, options,
+            llvm::makeArrayRef(job.args).slice(1));
+        job.cached = jobUpToDate(job);
+    }
+
+    // a job waits for the imports whose interfaces it is given, which
+    // excludes those that close an import cycle
+    vector<vector<size_t> > dependencies(jobs.size());
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        BuildJob &job = jobs[i];
+        for (size_t j = 0; j < job.imports.size(); ++j) {
+            if (job.imports[j]->level < job.level)
+                dependencies[i].push_back(job.imports[j] - &jobs[0]);
+        }
+        if (options.verbose && !job.cached)
+            printCommand(llvm::errs(), job);
+    }
+    parallelForDependencies(jobs.size(), options.jobs, dependencies,
+                            runBuildJob, finishBuildJob, &jobs);
+
+    // jobs that import a failed job are never started
+    unsigned built = 0, cached = 0, failed = 0, skipped = 0;
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        BuildJob const &job = jobs[i];
+        if (!job.finished) {
+            llvm::errs() << "  skipped         " << job.name << '\n';
+            ++skipped;
+        }
+        else if (job.failed)
+            ++failed;
+        else if (job.cached)
+            ++cached;
+        else
+            ++built;
+    }
+
+    total.stop();
+    llvm::errs() << "build: " << built << " built, " << cached << " cached";
+    if (failed > 0)
+        llvm::errs() << ", " << failed << " failed";
+    if (skipped > 0)
+        llvm::errs() << ", " << skipped << " skipped";
+    llvm::errs() << llvm::format(" in %.3fs\n", total.elapsedMillis() / 1000);
+    return failed == 0 && skipped == 0;
+}
+
+}
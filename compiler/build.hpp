@@ -0,0 +1,38 @@
+#ifndef __CLAY_BUILD_HPP
+#define __CLAY_BUILD_HPP
+
+#include "clay.hpp"
+
+namespace clay {
+
+// 'clay -build' compiles a program module by module. Every module whose
+// source lies in the main file's directory tree gets a job running
+// 'clay -c -module' with the interfaces of the project modules it
+// imports, and starts as soon as the jobs of those modules have finished,
+// with up to -build-jobs jobs running at once. The main module is
+// compiled last and linked with all of the modules' objects. After a
+// failure no more jobs are started.
+//
+// A job is skipped when its fingerprint (the compiler executable, the
+// forwarded options and the contents of every module it imports,
+// transitively) matches the one recorded by its last successful run.
+// Library modules are not jobs of their own; the jobs that use them
+// compile what they need, as a whole-program build does.
+
+struct BuildOptions {
+    string compiler;
+    vector<string> flags;   // passed to every job
+    string mainFile;
+    string outputFile;
+    string buildDir;
+    string objExtension;
+    unsigned jobs;
+    bool verbose;
+};
+
+// runs the jobs and reports them; false if one of them failed
+bool buildProgram(ModulePtr main, BuildOptions const &options);
+
+}
+
+#endif
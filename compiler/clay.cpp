@@ -1,11 +1,23 @@
 #include "clay.hpp"
-#include "hirestimer.hpp"
+#include "timing.hpp"
+#include "build.hpp"
+#include "jit.hpp"
+#include "multiversion.hpp"
+#include "optimizer.hpp"
+#include "pgo.hpp"
+#include "prebuilt.hpp"
+#include "profiler.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
 #include "error.hpp"
 #include "codegen.hpp"
 #include "loader.hpp"
 #include "invoketables.hpp"
 #include "externals.hpp"
 #include "evaluator.hpp"
+#include "threads.hpp"
+
+#include <llvm/Support/Timer.h>
 
 // for _exit
 #ifdef _WIN32
@@ -30,116 +42,28 @@ namespace clay {
 
 using namespace std;
 
-static void addOptimizationPasses(llvm::PassManager &passes,
-                                  llvm::FunctionPassManager &fpasses,
-                                  unsigned optLevel,
-                                  bool internalize)
+// the features LLVM detects on the host, followed by the ones given with
+// -mattr so that those take precedence. hosts whose features LLVM can't
+// list get only what the CPU name implies
+static string hostCPUFeatures(llvm::StringRef userFeatures)
 {
-    llvm::Pass *inliningPass = 0;
-    if (optLevel > 1) {
-        int threshold = 225;
-        if (optLevel > 2)
-            threshold = 275;
-        inliningPass = llvm::createFunctionInliningPass(threshold);
-    } else {
-        inliningPass = llvm::createAlwaysInlinerPass();
-    }
-
-    llvm::PassManagerBuilder builder;
-    builder.OptLevel = optLevel;
-    builder.Inliner = inliningPass;
-
-    builder.populateFunctionPassManager(fpasses);
-
-    // If all optimizations are disabled, just run the always-inline pass.
-    if (optLevel == 0) {
-        if (builder.Inliner) {
-            passes.add(builder.Inliner);
-            builder.Inliner = 0;
+    llvm::StringMap<bool> hostFeatures;
+    string features;
+    if (llvm::sys::getHostCPUFeatures(hostFeatures)) {
+        llvm::StringMap<bool>::const_iterator i;
+        for (i = hostFeatures.begin(); i != hostFeatures.end(); ++i) {
+            if (!features.empty())
+                features += ',';
+            features += i->getValue() ? '+' : '-';
+            features += i->getKey();
         }
-    } else {
-        passes.add(llvm::createTypeBasedAliasAnalysisPass());
-        passes.add(llvm::createBasicAliasAnalysisPass());
-        
-        passes.add(llvm::createGlobalOptimizerPass());     // Optimize out global vars
-
-        passes.add(llvm::createIPSCCPPass());              // IP SCCP
-        passes.add(llvm::createDeadArgEliminationPass());  // Dead argument elimination
-
-        passes.add(llvm::createInstructionCombiningPass());// Clean up after IPCP & DAE
-        passes.add(llvm::createCFGSimplificationPass());   // Clean up after IPCP & DAE
-        
-        // Start of CallGraph SCC passes.
-        if (builder.Inliner) {
-            passes.add(builder.Inliner);
-            builder.Inliner = 0;
-        }
-        if (optLevel > 2)
-            passes.add(llvm::createArgumentPromotionPass());   // Scalarize uninlined fn args
-
-        // Start of function pass.
-        // Break up aggregate allocas, using SSAUpdater.
-        passes.add(llvm::createScalarReplAggregatesPass(-1, false));
-        passes.add(llvm::createEarlyCSEPass());              // Catch trivial redundancies
-        
-        passes.add(llvm::createJumpThreadingPass());         // Thread jumps.
-        // Disable Value Propagation pass until fixed LLVM bug #12503
-        // passes.add(llvm::createCorrelatedValuePropagationPass()); // Propagate conditionals
-        passes.add(llvm::createCFGSimplificationPass());     // Merge & remove BBs
-        passes.add(llvm::createInstructionCombiningPass());  // Combine silly seq's
-
-        passes.add(llvm::createTailCallEliminationPass());   // Eliminate tail calls
-        passes.add(llvm::createCFGSimplificationPass());     // Merge & remove BBs
-        passes.add(llvm::createReassociatePass());           // Reassociate expressions
-        passes.add(llvm::createLoopRotatePass());            // Rotate Loop
-        passes.add(llvm::createLICMPass());                  // Hoist loop invariants
-        passes.add(llvm::createLoopUnswitchPass(builder.SizeLevel || optLevel < 3));
-        passes.add(llvm::createInstructionCombiningPass());
-        passes.add(llvm::createIndVarSimplifyPass());        // Canonicalize indvars
-        passes.add(llvm::createLoopIdiomPass());             // Recognize idioms like memset.
-        passes.add(llvm::createLoopDeletionPass());          // Delete dead loops
-        
-        if (optLevel > 1)
-            passes.add(llvm::createGVNPass());                 // Remove redundancies
-        passes.add(llvm::createMemCpyOptPass());             // Remove memcpy / form memset
-        passes.add(llvm::createSCCPPass());                  // Constant prop with SCCP
-
-        // Run instcombine after redundancy elimination to exploit opportunities
-        // opened up by them.
-        passes.add(llvm::createInstructionCombiningPass());
-        passes.add(llvm::createJumpThreadingPass());         // Thread jumps
-        // Disable Value Propagation pass until fixed LLVM bug #12503
-        // passes.add(llvm::createCorrelatedValuePropagationPass());
-        passes.add(llvm::createDeadStoreEliminationPass());  // Delete dead stores
-
-        if (builder.Vectorize) {
-            passes.add(llvm::createBBVectorizePass());
-            passes.add(llvm::createInstructionCombiningPass());
-            if (optLevel > 1)
-                passes.add(llvm::createGVNPass());                 // Remove redundancies
-        }
-
-        passes.add(llvm::createAggressiveDCEPass());         // Delete dead instructions
-        passes.add(llvm::createCFGSimplificationPass());     // Merge & remove BBs
-        passes.add(llvm::createInstructionCombiningPass());  // Clean up after everything.
-
-        // GlobalOpt already deletes dead functions and globals, at -O3 try a
-        // late pass of GlobalDCE.  It is capable of deleting dead cycles.
-        if (optLevel > 2)
-            passes.add(llvm::createGlobalDCEPass());         // Remove dead fns and globals.
-
-        if (optLevel > 1)
-            passes.add(llvm::createConstantMergePass());     // Merge dup global constants
     }
-
-    if (optLevel > 2) {
-        if (internalize) {
-            vector<const char*> do_not_internalize;
-            do_not_internalize.push_back("main");
-            passes.add(llvm::createInternalizePass(do_not_internalize));
-        }
-        builder.populateLTOPassManager(passes, false, true);
+    if (!userFeatures.empty()) {
+        if (!features.empty())
+            features += ',';
+        features += userFeatures;
     }
+    return features;
 }
 
 static bool linkLibraries(llvm::Module *module, llvm::ArrayRef<string>  libSearchPaths, llvm::ArrayRef<string>  libs, CompilerState* cst)
@@ -202,17 +126,23 @@ static bool linkLibraries(llvm::Module *module, llvm::ArrayRef<string>  libSearc
     return true;
 }
 
+// tierThreshold is 0 unless functions should be recompiled after that
+// many calls; see jit.hpp
 static bool runModule(llvm::Module *module,
                       vector<string> &argv,
                       char const* const* envp,
                       llvm::ArrayRef<string>  libSearchPaths,
                       llvm::ArrayRef<string>  libs,
+                      bool lazyJIT,
+                      unsigned tierThreshold,
                       CompilerState* cst)
 {
     if (!linkLibraries(module, libSearchPaths, libs, cst)) {
         return false;
     }
     llvm::EngineBuilder eb(cst->llvmModule);
+    if (lazyJIT)
+        eb.setOptLevel(llvm::CodeGenOpt::None);
     llvm::ExecutionEngine *engine = eb.create();
     llvm::Function *mainFunc = module->getFunction("main");
     if (!mainFunc) {
@@ -220,6 +150,12 @@ static bool runModule(llvm::Module *module,
         delete engine;
         return false;
     }
+    if (lazyJIT) {
+        // functions are compiled through stubs when first called
+        engine->DisableLazyCompilation(false);
+        if (tierThreshold > 0)
+            enableJITTiers(engine, module, tierThreshold);
+    }
     engine->runStaticConstructorsDestructors(false);
     engine->runFunctionAsMain(mainFunc, argv, envp);
     engine->runStaticConstructorsDestructors(true);
@@ -228,29 +164,41 @@ static bool runModule(llvm::Module *module,
     return true;
 }
 
-static void optimizeLLVM(llvm::Module *module, unsigned optLevel, bool internalize)
+static void countDefinitions(llvm::Module *module,
+                             uint64_t &functions,
+                             uint64_t &instructions)
 {
-    llvm::PassManager passes;
-
-    string moduleDataLayout = module->getDataLayout();
-    llvm::DataLayout *dl = new llvm::DataLayout(moduleDataLayout);
-    passes.add(dl);
-
-    llvm::FunctionPassManager fpasses(module);
-
-    fpasses.add(new llvm::DataLayout(*dl));
-
-    addOptimizationPasses(passes, fpasses, optLevel, internalize);
-
-    fpasses.doInitialization();
-    for (llvm::Module::iterator i = module->begin(), e = module->end();
-         i != e; ++i)
-    {
-        fpasses.run(*i);
+    functions = 0;
+    instructions = 0;
+    for (llvm::Module::iterator f = module->begin(); f != module->end(); ++f) {
+        if (f->isDeclaration())
+            continue;
+        ++functions;
+        for (llvm::Function::iterator bb = f->begin(); bb != f->end(); ++bb)
+            instructions += bb->size();
     }
+}
+
+// instantiations for types with the same layout often produce identical
+// bodies. MergeFunctions keeps one of each; callers of an internal
+// duplicate are redirected, other duplicates become thunks.
+static void mergeFunctions(llvm::Module *module)
+{
+    uint64_t functionsBefore, instructionsBefore;
+    countDefinitions(module, functionsBefore, instructionsBefore);
 
-    passes.add(llvm::createVerifierPass());
+    llvm::PassManager passes;
+    passes.add(new llvm::DataLayout(module->getDataLayout()));
+    passes.add(llvm::createMergeFunctionsPass());
     passes.run(*module);
+
+    uint64_t functionsAfter, instructionsAfter;
+    countDefinitions(module, functionsAfter, instructionsAfter);
+    addStatistic("functions removed by -merge-functions",
+                 functionsBefore - functionsAfter);
+    if (instructionsBefore > instructionsAfter)
+        addStatistic("instructions removed by -merge-functions",
+                     instructionsBefore - instructionsAfter);
 }
 
 static void generateLLVM(llvm::Module *module, bool emitAsm, llvm::raw_ostream *out)
@@ -263,35 +211,6 @@ static void generateLLVM(llvm::Module *module, bool emitAsm, llvm::raw_ostream *
     passes.run(*module);
 }
 
-static void generateAssembly(llvm::Module *module,
-                             llvm::TargetMachine *targetMachine,
-                             llvm::raw_ostream *out,
-                             bool emitObject)
-{
-    llvm::FunctionPassManager fpasses(module);
-
-    fpasses.add(new llvm::DataLayout(module));
-    fpasses.add(llvm::createVerifierPass());
-
-    targetMachine->setAsmVerbosityDefault(true);
-
-    llvm::formatted_raw_ostream fout(*out);
-    llvm::TargetMachine::CodeGenFileType fileType = emitObject
-        ? llvm::TargetMachine::CGFT_ObjectFile
-        : llvm::TargetMachine::CGFT_AssemblyFile;
-
-    bool result = targetMachine->addPassesToEmitFile(fpasses, fout, fileType);
-    assert(!result);
-
-    fpasses.doInitialization();
-    for (llvm::Module::iterator i = module->begin(), e = module->end();
-         i != e; ++i)
-    {
-        fpasses.run(*i);
-    }
-    fpasses.doFinalization();
-}
-
 static string joinCmdArgs(llvm::ArrayRef<const char*>  args) {
     string s;
     llvm::raw_string_ostream ss(s);
@@ -310,13 +229,40 @@ static string joinCmdArgs(llvm::ArrayRef<const char*>  args) {
     return s;
 }
 
+// compiles each multiversion module for its features into a temporary
+// object file
+static bool generateMultiversionObjects(llvm::ArrayRef<MultiversionModule> modules,
+                                        llvm::TargetMachine *targetMachine,
+                                        vector<string> &objects)
+{
+    for (size_t i = 0; i < modules.size(); ++i) {
+        int fd;
+        PathString tempObj;
+        if (llvm::error_code ec = llvm::sys::fs::unique_file("clayobj-%%%%%%%%.obj", fd, tempObj)) {
+            llvm::errs() << "error creating temporary object file: " << ec.message() << '\n';
+            return false;
+        }
+        llvm::sys::RemoveFileOnSignal(llvm::sys::Path(tempObj));
+        objects.push_back(string(tempObj.begin(), tempObj.end()));
+
+        llvm::TargetMachine *variantMachine =
+            multiversionTargetMachine(targetMachine, modules[i].features);
+        llvm::raw_fd_ostream objOut(fd, /*shouldClose=*/ true);
+        generateAssembly(modules[i].module, variantMachine, &objOut, true);
+        delete variantMachine;
+    }
+    return true;
+}
+
 static bool generateBinary(llvm::Module *module,
+                           llvm::ArrayRef<MultiversionModule> multiversionModules,
                            llvm::TargetMachine *targetMachine,
                            llvm::Twine const &outputFilePath,
                            llvm::sys::Path const &clangPath,
                            bool /*exceptions*/,
                            bool sharedLib,
                            bool debug,
+                           llvm::ArrayRef<string> dependencyObjects,
                            llvm::ArrayRef<string> arguments,
                            bool verbose,
                            CompilerState* cst)
@@ -335,6 +281,10 @@ static bool generateBinary(llvm::Module *module,
         generateAssembly(module, targetMachine, &objOut, true);
     }
 
+    vector<string> multiversionObjs;
+    if (!generateMultiversionObjects(multiversionModules, targetMachine, multiversionObjs))
+        return false;
+
     string outputFilePathStr = outputFilePath.str();
 
     vector<const char *> clangArgs;
@@ -374,7 +324,13 @@ static bool generateBinary(llvm::Module *module,
     }
     clangArgs.push_back("-o");
     clangArgs.push_back(outputFilePathStr.c_str());
+    // the objects of imported modules come first, since constructors
+    // without priorities run in link order
+    for (unsigned i = 0; i < dependencyObjects.size(); ++i)
+        clangArgs.push_back(dependencyObjects[i].c_str());
     clangArgs.push_back(tempObj.c_str());
+    for (unsigned i = 0; i < multiversionObjs.size(); ++i)
+        clangArgs.push_back(multiversionObjs[i].c_str());
     for (unsigned i = 0; i < arguments.size(); ++i)
         clangArgs.push_back(arguments[i].c_str());
     clangArgs.push_back(NULL);
@@ -384,7 +340,9 @@ static bool generateBinary(llvm::Module *module,
         llvm::errs() << "    " << joinCmdArgs(clangArgs) << "\n";
     }
 
+    TimingPhase linkPhase("link");
     int result = llvm::sys::Program::ExecuteAndWait(clangPath, &clangArgs[0]);
+    linkPhase.stop();
 
     if (debug && triple.getOS() == llvm::Triple::Darwin) {
         llvm::sys::Path dsymutilPath = llvm::sys::Program::FindProgramByName("dsymutil");
@@ -415,6 +373,8 @@ static bool generateBinary(llvm::Module *module,
 
     bool dontcare;
     llvm::sys::fs::remove(llvm::StringRef(tempObj), dontcare);
+    for (unsigned i = 0; i < multiversionObjs.size(); ++i)
+        llvm::sys::fs::remove(multiversionObjs[i], dontcare);
 
     return (result == 0);
 }
@@ -426,7 +386,8 @@ static void usage(char *argv0)
     llvm::errs() << "options:\n";
     llvm::errs() << "  -o <file>             specify output file\n";
     llvm::errs() << "  -target <target>      set target platform for code generation\n";
-    llvm::errs() << "  -mcpu <CPU>           set target CPU for code generation\n";
+    llvm::errs() << "  -mcpu <CPU>           set target CPU for code generation\n"
+        << "                        ('native' selects the host CPU and features)\n";
     llvm::errs() << "  -mattr <features>     set target features for code generation\n"
         << "                        use +feature to enable a feature\n"
         << "                        or -feature to disable it\n"
@@ -441,6 +402,8 @@ static void usage(char *argv0)
     llvm::errs() << "  -O0 -O1 -O2 -O3       set optimization level\n";
     llvm::errs() << "                        (default -O2, or -O0 with -g)\n";
     llvm::errs() << "  -g                    keep debug symbol information\n";
+    llvm::errs() << "  -gline-tables-only    keep only function names and line numbers,\n"
+        << "                        without changing the optimization level\n";
     llvm::errs() << "  -exceptions           enable exception handling\n";
     llvm::errs() << "  -no-exceptions        disable exception handling\n";
     llvm::errs() << "  -inline               inline procedures marked 'forceinline'\n"; 
@@ -448,15 +411,68 @@ static void usage(char *argv0)
     llvm::errs() << "  -no-inline            ignore 'inline' and 'forceinline' keyword\n";
     llvm::errs() << "  -import-externals     include externals from imported modules\n"
         << "                        in compilation unit\n"
-        << "                        (default when building standalone or -shared)\n";
+        << "                        (default when building -shared; standalone\n"
+        << "                        builds include only those they reference)\n";
     llvm::errs() << "  -no-import-externals  don't include externals from imported modules\n"
         << "                        in compilation unit\n"
         << "                        (default when building -c or -S)\n";
     llvm::errs() << "  -pic                  generate position independent code\n";
+    llvm::errs() << "  -share-instantiations generate one body for instantiations whose scalar\n"
+        << "                        types have the same layout and that never\n"
+        << "                        look at them\n";
+    llvm::errs() << "  -strict-aliasing      let the optimizer assume that values of different\n"
+        << "                        scalar types don't overlap, except where memory\n"
+        << "                        is reinterpreted (default; see the language\n"
+        << "                        reference)\n";
+    llvm::errs() << "  -no-strict-aliasing   don't\n";
+    llvm::errs() << "  -vectorize            run the loop and straight-line vectorizers at -O3\n"
+        << "                        (default)\n";
+    llvm::errs() << "  -no-vectorize         don't run the vectorizers\n";
+    llvm::errs() << "  -merge-functions      replace functions identical to another function\n"
+        << "                        with calls or references to it\n";
     llvm::errs() << "  -run                  execute the program without writing to disk\n";
-    llvm::errs() << "  -timing               show timing information\n";
+    llvm::errs() << "  -lazy-jit             with -run, compile each function unoptimized\n"
+        << "                        when it is first called\n";
+    llvm::errs() << "  -tiered-jit[=<n>]     like -lazy-jit, and recompile functions called\n"
+        << "                        <n> (default 1000) times with optimization\n";
+    llvm::errs() << "  -stats                show counts of code removed by optimizations\n";
+    llvm::errs() << "  -timing               show a tree of compiler phase times\n";
+    llvm::errs() << "  -timing=json          show compiler phase times as JSON\n";
+    llvm::errs() << "  -trace-file=<file>    write a Chrome trace of analysis, evaluation,\n"
+        << "                        module loading and code generation to <file>\n";
+    llvm::errs() << "  -profile-instantiations[=<n>]\n"
+        << "                        show the <n> (default 20) callables and instantiations\n"
+        << "                        that cost the most compile time and code size\n";
+    llvm::errs() << "  -profile-generate[=<file>]\n"
+        << "                        instrument the program to append branch and call\n"
+        << "                        counts to <file> (default default.clayprof) on exit\n";
+    llvm::errs() << "  -profile-use=<file>   optimize branches and inlining using the counts\n"
+        << "                        in <file>\n";
+    llvm::errs() << "  -prebuilt-out=<file>  with -c, export the instantiations the object\n"
+        << "                        makes from imported modules and list them in\n"
+        << "                        the manifest <file>\n";
+    llvm::errs() << "  -module               with -c, compile a module's externals and\n"
+        << "                        non-generic overloads for separate compilation\n"
+        << "                        and list them in an interface file (.clayi)\n"
+        << "                        for importers to pass to -prebuilt\n";
+    llvm::errs() << "  -module-globals       like -module, but compile only the module's\n"
+        << "                        global variables, so that the objects of its\n"
+        << "                        importers share them\n";
+    llvm::errs() << "  -module-name <name>   with -module, compile the module under the name\n"
+        << "                        <name> that importers use\n";
+    llvm::errs() << "  -build                compile each module of the main file's directory\n"
+        << "                        tree on its own, in parallel, recompiling only\n"
+        << "                        the modules whose sources or imports changed,\n"
+        << "                        then compile the main module and link\n";
+    llvm::errs() << "  -build-dir <dir>      keep the objects of -build in <dir>\n"
+        << "                        (default clay-build)\n";
+    llvm::errs() << "  -build-jobs <n>       run <n> -build jobs at once\n"
+        << "                        (default one per processor)\n";
+    llvm::errs() << "  -prebuilt=<file>      link with the object described by the manifest\n"
+        << "                        <file> and use the instantiations it lists\n";
     llvm::errs() << "  -verbose              be verbose\n";
     llvm::errs() << "  -full-match-errors    show universal patterns in match failure errors\n";
+    llvm::errs() << "  -check-all            parse all procedure bodies, including unused ones\n";
     llvm::errs() << "  -log-match <module.symbol>\n"
         << "                        log overload matching behavior for calls to <symbol>\n"
         << "                        in module <module>\n";
@@ -469,6 +485,13 @@ static void usage(char *argv0)
     llvm::errs() << "  -Wl,<opts>            pass flags to linker\n";
     llvm::errs() << "  -l<lib>               link with library <lib>\n";
     llvm::errs() << "  -I<path>              add <path> to clay module search path\n";
+    llvm::errs() << "  -module-index <file>  cache module search directory listings in <file>\n";
+    llvm::errs() << "  -emit-ast             write an AST snapshot (.clayast) beside each\n"
+        << "                        imported module's source\n";
+    llvm::errs() << "  -ast-cache <dir>      read and write AST snapshots of imported modules\n"
+        << "                        in <dir>\n";
+    llvm::errs() << "  -load-threads <n>     read, tokenize and parse imported modules on <n>\n"
+        << "                        threads (0 uses one per processor; default 1)\n";
     llvm::errs() << "  -deps                 keep track of the dependencies of the currently\n";
     llvm::errs() << "                        compiling file and write them to the file\n";
     llvm::errs() << "                        specified by -o-deps\n";
@@ -502,6 +525,24 @@ static string objExtensionForTarget(llvm::Triple const &triple) {
     }
 }
 
+// the options of a -build that its jobs share
+static void buildJobFlags(int argc, char **argv,
+                          llvm::StringRef clayFile,
+                          vector<string> &flags)
+{
+    for (int i = 1; i < argc; ++i) {
+        llvm::StringRef arg = argv[i];
+        if (arg == "-o" || arg == "-build-dir" || arg == "-build-jobs") {
+            ++i;
+            continue;
+        }
+        if (arg == "-build" || arg == "-deps" || arg == "-no-deps"
+            || arg == clayFile)
+            continue;
+        flags.push_back(arg);
+    }
+}
+
 static string exeExtensionForTarget(llvm::Triple const &triple) {
     if (triple.getOS() == llvm::Triple::Win32
         || triple.getOS() == llvm::Triple::MinGW32
@@ -540,11 +581,29 @@ int main2(int argc, char **argv, char const* const* envp) {
     bool genPIC = false;
     bool inlineEnabled = true;
     bool exceptions = true;
+    bool mergeFunctionsFlag = false;
+    bool shareInstantiations = false;
+    bool strictAliasing = true;
+    bool vectorize = true;
     bool run = false;
+    bool lazyJIT = false;
+    unsigned tierThreshold = 0;
     bool repl = false;
     bool verbose = false;
     bool crossCompiling = false;
     bool showTiming = false;
+    bool timingJSON = false;
+    unsigned profileTopN = 20;
+    string traceFile;
+    string profileGenerateFile;
+    string profileUseFile;
+    vector<string> prebuiltFiles;
+    string prebuiltOutputFile;
+    bool moduleInterface = false;
+    bool moduleGlobalsOnly = false;
+    bool build = false;
+    string buildDir = "clay-build";
+    unsigned buildJobs = 0;
     bool codegenExternals = false;
     bool codegenExternalsSet = false;
 
@@ -580,12 +639,14 @@ int main2(int argc, char **argv, char const* const* envp) {
     vector<PathString> searchPath;
 
     string dependenciesOutputFile;
+    string moduleIndexFile;
 #ifdef __APPLE__
     vector<string> frameworkSearchPath;
     vector<string> frameworks;
 #endif
 
     bool debug = false;
+    bool lineTablesOnly = false;
 
     CompilerState compilerState;
     CompilerState* cst = &compilerState;
@@ -606,9 +667,14 @@ int main2(int argc, char **argv, char const* const* envp) {
         }
         else if (strcmp(argv[i], "-g") == 0) {
             debug = true;
+            lineTablesOnly = false;
             if (!optLevelSet)
                 optLevel = 0;
         }
+        else if (strcmp(argv[i], "-gline-tables-only") == 0) {
+            debug = true;
+            lineTablesOnly = true;
+        }
         else if (strcmp(argv[i], "-O0") == 0) {
             optLevel = 0;
             optLevelSet = true;
@@ -648,15 +714,166 @@ int main2(int argc, char **argv, char const* const* envp) {
         else if (strcmp(argv[i], "-run") == 0) {
             run = true;
         }
+        else if (strcmp(argv[i], "-share-instantiations") == 0) {
+            shareInstantiations = true;
+        }
+        else if (strcmp(argv[i], "-strict-aliasing") == 0) {
+            strictAliasing = true;
+        }
+        else if (strcmp(argv[i], "-no-strict-aliasing") == 0) {
+            strictAliasing = false;
+        }
+        else if (strcmp(argv[i], "-vectorize") == 0) {
+            vectorize = true;
+        }
+        else if (strcmp(argv[i], "-no-vectorize") == 0) {
+            vectorize = false;
+        }
+        else if (strcmp(argv[i], "-merge-functions") == 0) {
+            mergeFunctionsFlag = true;
+        }
+        else if (strcmp(argv[i], "-stats") == 0) {
+            enableStatistics();
+        }
+        else if (strcmp(argv[i], "-lazy-jit") == 0) {
+            lazyJIT = true;
+        }
+        else if (strcmp(argv[i], "-tiered-jit") == 0) {
+            lazyJIT = true;
+            tierThreshold = 1000;
+        }
+        else if (strncmp(argv[i], "-tiered-jit=", 12) == 0) {
+            char *end;
+            unsigned long n = strtoul(argv[i] + 12, &end, 10);
+            if (argv[i][12] == '\0' || *end != '\0' || n == 0) {
+                llvm::errs() << "error: invalid call count in " << argv[i] << "\n";
+                return 1;
+            }
+            lazyJIT = true;
+            tierThreshold = (unsigned)n;
+        }
         else if (strcmp(argv[i], "-repl") == 0) {
             repl = true;
         }
         else if (strcmp(argv[i], "-timing") == 0) {
             showTiming = true;
         }
+        else if (strcmp(argv[i], "-timing=json") == 0) {
+            showTiming = true;
+            timingJSON = true;
+        }
+        else if (strncmp(argv[i], "-trace-file=", 12) == 0) {
+            traceFile = argv[i] + 12;
+            if (traceFile.empty()) {
+                llvm::errs() << "error: filename missing after -trace-file=\n";
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-profile-instantiations") == 0) {
+            enableInstantiationProfiling();
+        }
+        else if (strncmp(argv[i], "-profile-instantiations=", 24) == 0) {
+            char *end;
+            unsigned long n = strtoul(argv[i] + 24, &end, 10);
+            if (argv[i][24] == '\0' || *end != '\0' || n == 0) {
+                llvm::errs() << "error: invalid count in " << argv[i] << "\n";
+                return 1;
+            }
+            profileTopN = (unsigned)n;
+            enableInstantiationProfiling();
+        }
+        else if (strcmp(argv[i], "-profile-generate") == 0) {
+            profileGenerateFile = "default.clayprof";
+        }
+        else if (strncmp(argv[i], "-profile-generate=", 18) == 0) {
+            profileGenerateFile = argv[i] + 18;
+            if (profileGenerateFile.empty()) {
+                llvm::errs() << "error: filename missing after -profile-generate=\n";
+                return 1;
+            }
+        }
+        else if (strncmp(argv[i], "-profile-use=", 13) == 0) {
+            profileUseFile = argv[i] + 13;
+            if (profileUseFile.empty()) {
+                llvm::errs() << "error: filename missing after -profile-use=\n";
+                return 1;
+            }
+        }
+        else if (strncmp(argv[i], "-prebuilt=", 10) == 0) {
+            string prebuiltFile = argv[i] + 10;
+            if (prebuiltFile.empty()) {
+                llvm::errs() << "error: filename missing after -prebuilt=\n";
+                return 1;
+            }
+            prebuiltFiles.push_back(prebuiltFile);
+        }
+        else if (strncmp(argv[i], "-prebuilt-out=", 14) == 0) {
+            prebuiltOutputFile = argv[i] + 14;
+            if (prebuiltOutputFile.empty()) {
+                llvm::errs() << "error: filename missing after -prebuilt-out=\n";
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-module") == 0) {
+            moduleInterface = true;
+        }
+        else if (strcmp(argv[i], "-module-globals") == 0) {
+            moduleInterface = true;
+            moduleGlobalsOnly = true;
+        }
+        else if (strcmp(argv[i], "-module-name") == 0) {
+            if (i+1 == argc) {
+                llvm::errs() << "error: name missing after -module-name\n";
+                return 1;
+            }
+            ++i;
+            cst->mainModuleName = argv[i];
+        }
+        else if (strcmp(argv[i], "-build") == 0) {
+            build = true;
+        }
+        else if (strcmp(argv[i], "-build-dir") == 0) {
+            if (i+1 == argc) {
+                llvm::errs() << "error: directory missing after -build-dir\n";
+                return 1;
+            }
+            ++i;
+            buildDir = argv[i];
+        }
+        else if (strcmp(argv[i], "-build-jobs") == 0) {
+            if (i+1 == argc) {
+                llvm::errs() << "error: job count missing after -build-jobs\n";
+                return 1;
+            }
+            ++i;
+            char *end;
+            unsigned long jobs = strtoul(argv[i], &end, 10);
+            if (*argv[i] == '\0' || *end != '\0' || jobs == 0) {
+                llvm::errs() << "error: invalid job count " << argv[i] << "\n";
+                return 1;
+            }
+            buildJobs = (unsigned)jobs;
+        }
+        else if (strcmp(argv[i], "-load-threads") == 0) {
+            if (i+1 == argc) {
+                llvm::errs() << "error: thread count missing after -load-threads\n";
+                return 1;
+            }
+            ++i;
+            char *end;
+            unsigned long threads = strtoul(argv[i], &end, 10);
+            if (*argv[i] == '\0' || *end != '\0') {
+                llvm::errs() << "error: invalid thread count " << argv[i] << "\n";
+                return 1;
+            }
+            cst->loadThreads = threads == 0 ? hardwareThreadCount() : (unsigned)threads;
+        }
         else if (strcmp(argv[i], "-full-match-errors") == 0) {
             shouldPrintFullMatchErrors = true;
         }
+        else if (strcmp(argv[i], "-check-all") == 0) {
+            cst->lazyBodies = false;
+        }
         else if (strcmp(argv[i], "-log-match") == 0) {
             if (i+1 == argc) {
                 llvm::errs() << "error: symbol name missing after -log-match\n";
@@ -792,6 +1009,13 @@ int main2(int argc, char **argv, char const* const* envp) {
                 return 1;
             }
         }
+        else if (strncmp(argv[i], "-mcpu=", 6) == 0) {
+            targetCPU = argv[i] + strlen("-mcpu=");
+            if (targetCPU.empty()) {
+                llvm::errs() << "error: CPU name missing after -mcpu=\n";
+                return 1;
+            }
+        }
         else if (strcmp(argv[i], "-mattr") == 0) {
             if (i+1 == argc) {
                 llvm::errs() << "error: features missing after -mattr\n";
@@ -884,6 +1108,25 @@ int main2(int argc, char **argv, char const* const* envp) {
             }
             searchPath.push_back(PathString(path));
         }
+        else if (strcmp(argv[i], "-module-index") == 0) {
+            if (i+1 == argc) {
+                llvm::errs() << "error: filename missing after -module-index\n";
+                return 1;
+            }
+            ++i;
+            moduleIndexFile = argv[i];
+        }
+        else if (strcmp(argv[i], "-emit-ast") == 0) {
+            cst->emitSnapshots = true;
+        }
+        else if (strcmp(argv[i], "-ast-cache") == 0) {
+            if (i+1 == argc) {
+                llvm::errs() << "error: directory missing after -ast-cache\n";
+                return 1;
+            }
+            ++i;
+            cst->snapshotCacheDir = argv[i];
+        }
         else if (strstr(argv[i], "-version") == argv[i]
                  || strcmp(argv[i], "--version") == 0) {
             printVersion();
@@ -984,6 +1227,15 @@ int main2(int argc, char **argv, char const* const* envp) {
         return 1;
     }
 
+    if (targetCPU == "native") {
+        if (crossCompiling) {
+            llvm::errs() << "error: cannot use -mcpu native when cross compiling\n";
+            return 1;
+        }
+        targetCPU = llvm::sys::getHostCPUName();
+        targetFeatures = hostCPUFeatures(targetFeatures);
+    }
+
     if (crossCompiling && run) {
         llvm::errs() << "error: cannot use -run when cross compiling\n";
         return 1;
@@ -1004,10 +1256,43 @@ int main2(int argc, char **argv, char const* const* envp) {
     if ((emitLLVM || emitAsm || emitObject) && run)
         run = false;
 
+    if (!prebuiltOutputFile.empty() && !(emitObject && !emitLLVM)) {
+        llvm::errs() << "error: -prebuilt-out can only be used with -c\n";
+        return 1;
+    }
+    if (moduleInterface && !(emitObject && !emitLLVM)) {
+        llvm::errs() << "error: -module can only be used with -c\n";
+        return 1;
+    }
+    if (!cst->mainModuleName.empty() && !moduleInterface) {
+        llvm::errs() << "error: -module-name can only be used with -module\n";
+        return 1;
+    }
+    if (build && (emitLLVM || emitAsm || emitObject || run || repl
+                  || !clayScript.empty() || moduleInterface
+                  || !prebuiltOutputFile.empty())) {
+        llvm::errs() << "error: -build cannot be used with -c, -S, -emit-llvm, -run, -e,\n"
+                     << "       -repl, -module or -prebuilt-out\n";
+        return 1;
+    }
+    if (moduleInterface && !prebuiltOutputFile.empty()) {
+        llvm::errs() << "error: -module and -prebuilt-out cannot be used together\n";
+        return 1;
+    }
+    if (!prebuiltFiles.empty() && (run || repl)) {
+        llvm::errs() << "error: -prebuilt cannot be used with -run or -repl\n";
+        return 1;
+    }
+
     setInlineEnabled(inlineEnabled, cst);
     setExceptionsEnabled(exceptions, cst);
     
     setFinalOverloadsEnabled(finalOverloadsEnabled, cst);
+    cst->lifetimeMarkers = optLevel > 0;
+    // shared bodies would lose the per-instantiation debug info
+    cst->layoutSharing = shareInstantiations && !debug;
+    cst->debugLineTablesOnly = lineTablesOnly;
+    cst->strictAliasing = strictAliasing;
     
     llvm::Triple llvmTriple(targetTriple);
     targetTriple = llvmTriple.str();
@@ -1073,7 +1358,16 @@ int main2(int argc, char **argv, char const* const* envp) {
     }
 
     setSearchPath(searchPath, cst);
-
+    if (!moduleIndexFile.empty())
+        loadModuleIndex(moduleIndexFile, cst);
+    if (!cst->snapshotCacheDir.empty()) {
+        bool existed;
+        if (llvm::sys::fs::create_directories(cst->snapshotCacheDir, existed)) {
+            llvm::errs() << "warning: unable to create directory "
+                         << cst->snapshotCacheDir << "\n";
+            cst->snapshotCacheDir.clear();
+        }
+    }
 
     if (outputFile.empty()) {
         llvm::StringRef clayFileBasename = llvm::sys::path::stem(clayFile);
@@ -1119,13 +1413,41 @@ int main2(int argc, char **argv, char const* const* envp) {
         llvm::sys::RemoveFileOnSignal(llvm::sys::Path(dependenciesOutputFile));
     }
 
-    HiResTimer loadTimer, compileTimer, optTimer, outputTimer;
+    if (showTiming) {
+        enableTiming();
+        llvm::TimePassesIsEnabled = true;
+    }
+    if (!traceFile.empty() && !openTraceFile(traceFile))
+        return 1;
+    if (!profileGenerateFile.empty())
+        enableProfileGenerate(profileGenerateFile);
+    if (!profileUseFile.empty() && !loadProfile(profileUseFile)) {
+        llvm::errs() << "error: unable to read profile '" << profileUseFile << "'\n";
+        return 1;
+    }
+    for (size_t i = 0; i < prebuiltFiles.size(); ++i) {
+        string errorInfo;
+        if (!loadPrebuiltManifest(prebuiltFiles[i], errorInfo, cst)) {
+            llvm::errs() << "error: " << errorInfo << '\n';
+            return 1;
+        }
+    }
+    vector<string> prebuiltObjects;
+    prebuiltLibraries(cst, prebuiltObjects);
+    if (!prebuiltOutputFile.empty())
+        enablePrebuiltOutput(cst);
+    if (moduleInterface) {
+        PathString interfaceFile(outputFile);
+        llvm::sys::path::replace_extension(interfaceFile, "clayi");
+        prebuiltOutputFile = interfaceFile.str();
+        enableModuleInterface(cst, moduleGlobalsOnly);
+    }
 
 
 	//compiler
 
-    loadTimer.start();
     try {
+        TimingPhase loadPhase("load");
         initLoader(cst);
 
         ModulePtr m;
@@ -1138,11 +1460,44 @@ int main2(int argc, char **argv, char const* const* envp) {
             m = loadProgram(clayFile, &sourceFiles, verbose, repl, cst);
         else
             m = loadProgram(clayFile, NULL, verbose, repl, cst);
-
-        loadTimer.stop();
-        compileTimer.start();
-        codegenEntryPoints(m, codegenExternals);
-        compileTimer.stop();
+        saveModuleIndex(cst);
+        if (prebuiltUseEnabled(cst)) {
+            string errorInfo;
+            if (!checkPrebuiltModules(cst, errorInfo)) {
+                llvm::errs() << "error: " << errorInfo << '\n';
+                return 1;
+            }
+        }
+        if (moduleInterface)
+            cst->initPriority = moduleInitPriority(m);
+
+        loadPhase.stop();
+        if (build) {
+            BuildOptions options;
+            options.compiler = clayExe.str();
+            buildJobFlags(argc, argv, clayFile, options.flags);
+            options.mainFile = clayFile;
+            options.outputFile = outputFile;
+            options.buildDir = buildDir;
+            options.objExtension = objExtensionForTarget(llvmTriple);
+            options.jobs = buildJobs == 0 ? hardwareThreadCount() : buildJobs;
+            options.verbose = verbose;
+            bool built = buildProgram(m, options);
+            closeTraceFile();
+            return built ? 0 : 1;
+        }
+        TimingPhase compilePhase("compile");
+        // an explicit -import-externals generates all of them
+        bool externalsOnDemand = !sharedLib && !codegenExternalsSet;
+        codegenEntryPoints(m, codegenExternals, externalsOnDemand);
+        compilePhase.stop();
+
+        if (!prebuiltOutputFile.empty()) {
+            PathString library(outputFile);
+            llvm::sys::fs::make_absolute(library);
+            if (!writePrebuiltManifest(prebuiltOutputFile, library.str(), m))
+                return 1;
+        }
 
         if (generateDeps) {
             string errorInfo;
@@ -1167,22 +1522,31 @@ int main2(int argc, char **argv, char const* const* envp) {
         }
 
         bool internalize = true;
-        if (debug || sharedLib || run || !codegenExternals)
+        if ((debug && !lineTablesOnly) || sharedLib || run || !codegenExternals)
             internalize = false;
 
-        optTimer.start();
+        vector<MultiversionModule> multiversionModules;
+        TimingPhase optPhase("optimization");
 
         if (!repl)
         {
-            if (optLevel > 0)
-                optimizeLLVM(cst->llvmModule, optLevel, internalize);
-        }
-        optTimer.stop();
+            if (optLevel > 0 && !(run && lazyJIT))
+                optimizeLLVM(cst->llvmModule, targetMachine, optLevel,
+                             internalize, vectorize && optLevel > 2);
+            // ahead of -merge-functions, which would fold the identical
+            // multiversion copies into each other
+            if (!run && !(emitLLVM || emitAsm || emitObject))
+                splitMultiversionModules(cst->llvmModule, multiversionModules);
+            if (mergeFunctionsFlag)
+                mergeFunctions(cst->llvmModule);
+        }
+        optPhase.stop();
 
         if (run) {
             vector<string> argv;
             argv.push_back(clayFile);
-            runModule(cst->llvmModule, argv, envp, libSearchPath, libraries, cst);
+            runModule(cst->llvmModule, argv, envp, libSearchPath, libraries,
+                      lazyJIT, tierThreshold, cst);
         }
         else if (repl) {
             linkLibraries(cst->llvmModule, libSearchPath, libraries, cst);
@@ -1197,12 +1561,12 @@ int main2(int argc, char **argv, char const* const* envp) {
                 llvm::errs() << "error: " << errorInfo << '\n';
                 return 1;
             }
-            outputTimer.start();
+            TimingPhase outputPhase("codegen");
             if (emitLLVM)
                 generateLLVM(cst->llvmModule, emitAsm, &out);
             else if (emitAsm || emitObject)
                 generateAssembly(cst->llvmModule, targetMachine, &out, emitObject);
-            outputTimer.stop();
+            outputPhase.stop();
         }
         else {
             bool result;
@@ -1236,24 +1600,38 @@ int main2(int argc, char **argv, char const* const* envp) {
                     );
             copy(librariesArgs.begin(), librariesArgs.end(), back_inserter(arguments));
 
-            outputTimer.start();
-            result = generateBinary(cst->llvmModule, targetMachine, 
+            TimingPhase outputPhase("codegen");
+            result = generateBinary(cst->llvmModule, multiversionModules,
+                                    targetMachine,
                                     outputFile, clangPath,
                                     exceptions, sharedLib, debug, 
-                                    arguments, verbose, cst);
-            outputTimer.stop();
+                                    prebuiltObjects, arguments, verbose, cst);
+            outputPhase.stop();
             if (!result)
                 return 1;
         }
     } catch (const CompilerError&) {
+        closeTraceFile();
         return 1;
     }
+    closeTraceFile();
+    if (instantiationProfilingEnabled)
+        printInstantiationProfile(llvm::errs(), profileTopN);
+    printStatistics(llvm::errs());
     if (showTiming) {
-        llvm::errs() << "load time = " << (size_t)loadTimer.elapsedMillis() << " ms\n";
-        llvm::errs() << "compile time = " << (size_t)compileTimer.elapsedMillis() << " ms\n";
-        llvm::errs() << "optimization time = " << (size_t)optTimer.elapsedMillis() << " ms\n";
-        llvm::errs() << "codegen time = " << (size_t)outputTimer.elapsedMillis() << " ms\n";
-        llvm::errs().flush();
+        // LLVM only reports pass times from static destructors, which
+        // _exit skips, so collect the report here
+        if (timingJSON) {
+            string passReport;
+            llvm::raw_string_ostream passOut(passReport);
+            llvm::TimerGroup::printAll(passOut);
+            passOut.flush();
+            printTimingJSON(llvm::errs(), passReport);
+        } else {
+            printTimingTree(llvm::errs());
+            llvm::TimerGroup::printAll(llvm::errs());
+            llvm::errs().flush();
+        }
     }
 
     _exit(0);
@@ -29,6 +29,7 @@
 #include <llvm/ADT/SmallString.h>
 #include <llvm/ADT/SmallVector.h>
 #include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringSet.h>
 #include <llvm/ADT/StringRef.h>
 #include <llvm/ADT/Triple.h>
 #include <llvm/Analysis/Passes.h>
@@ -69,6 +70,7 @@
 #include <llvm/Support/TargetSelect.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Target/TargetOptions.h>
+#include <llvm/TargetTransformInfo.h>
 #include <llvm/Transforms/IPO/PassManagerBuilder.h>
 #include <llvm/Transforms/IPO.h>
 #include <llvm/Transforms/Scalar.h>
@@ -598,6 +600,8 @@ struct MatchResult;
 struct MatchFailureError;
 
 struct CompilerState;
+struct LayoutSharingState;
+struct PrebuiltState;
 
 
 //
@@ -991,12 +995,42 @@ struct CodegenContext;
 struct InvokeSet;
 struct ExternalTarget;
 
+// file names in one module search directory, keyed by the directory's
+// path in CompilerState::moduleDirectories
+struct ModuleDirectory {
+    llvm::StringSet<> entries;
+    unsigned long long modTime; // 0 if the directory does not exist
+    bool indexed:1; // listed or validated during this compilation
+    // listed during the second of modTime, so a file added later in that
+    // second is missing from entries without changing modTime
+    bool listedInModSecond:1;
+
+    ModuleDirectory()
+        : modTime(0), indexed(false), listedInModSecond(false) {}
+};
+
+// a module parsed ahead of loadModuleByName by the parallel loader
+struct PrefetchedModule {
+    ModulePtr module;
+    string path;
+};
+
 struct CompilerState {
     CompilerState();
 
     //loader
     vector<PathString> searchPath;
     vector<llvm::SmallString<32> > moduleSuffixes;
+    llvm::StringMap<ModuleDirectory> moduleDirectories;
+    string moduleIndexFile;
+    bool moduleIndexDirty;
+    unsigned loadThreads;
+    llvm::StringMap<PrefetchedModule> prefetchedModules;
+    bool lazyBodies;
+    string snapshotCacheDir;
+    bool emitSnapshots;
+    // the name of the main module when it is compiled as an importable one
+    string mainModuleName;
 
     llvm::StringMap<ModulePtr> globalModules;
     llvm::StringMap<string> globalFlags;
@@ -1099,6 +1133,12 @@ struct CompilerState {
 
     map<int, string> primOpNames;
 
+    //desugar
+    // pristine parses of eval-generated source and the sources they were
+    // parsed from, keyed by the source text, one map per parse entry point
+    llvm::StringMap<pair<SourcePtr, ExprListPtr> > evalExprCache;
+    llvm::StringMap<pair<SourcePtr, vector<StatementPtr> > > evalStatementCache;
+
     //codegen
     llvm::Module *llvmModule;
     llvm::DIBuilder *llvmDIBuilder;
@@ -1112,6 +1152,28 @@ struct CompilerState {
 
     bool _inlineEnabled;
     bool _exceptionsEnabled;
+    bool lifetimeMarkers;
+    bool layoutSharing;
+    bool debugLineTablesOnly;
+    bool strictAliasing;
+    llvm::StringMap<llvm::MDNode *> tbaaNodes;
+    // functions that punned memory can reach, and functions that can't
+    // hand their callers an address; see propagateTypePunning
+    set<llvm::Function *> punningFunctions;
+    set<llvm::Function *> scalarInterfaces;
+    // -share-instantiations' shared bodies; see sharing.cpp
+    LayoutSharingState *layoutSharingState;
+    // what -prebuilt loaded and what -prebuilt-out and -module export; see
+    // prebuilt.cpp
+    PrebuiltState *prebuiltState;
+    // of llvm.global_ctors and llvm.global_dtors; -module objects use a
+    // lower one than their importers, so their globals are initialized
+    // first and destroyed last
+    unsigned initPriority;
+    // imported externals get bodies only once referenced; those still
+    // waiting for theirs
+    bool externalsOnDemand;
+    vector<ExternalProcedurePtr> demandedExternals;
 
     //types
     TypePtr boolType;
@@ -1189,12 +1251,23 @@ struct CompilerState {
 
 static llvm::BumpPtrAllocator *ANodeAllocator = new llvm::BumpPtrAllocator();
 
+// while modules are parsed on worker threads (see prefetchModules), each
+// thread allocates nodes from an allocator of its own. all three are in
+// parser.cpp; freeThreadANodeAllocators is for when no nodes from those
+// allocators are left, once the compiler state is gone.
+extern bool threadANodeAllocatorsEnabled;
+llvm::BumpPtrAllocator *threadANodeAllocator();
+void freeThreadANodeAllocators();
+
 struct ANode : public Object {
     Location location;
     ANode(ObjectKind objKind)
         : Object(objKind) {}
     void *operator new(size_t num_bytes) {
-        return ANodeAllocator->Allocate(num_bytes, llvm::AlignOf<ANode>::Alignment);
+        llvm::BumpPtrAllocator *allocator = ANodeAllocator;
+        if (threadANodeAllocatorsEnabled)
+            allocator = threadANodeAllocator();
+        return allocator->Allocate(num_bytes, llvm::AlignOf<ANode>::Alignment);
     }
     void operator delete(void* anode) {
         ANodeAllocator->Deallocate(anode);
@@ -1973,11 +2046,19 @@ struct Code : public ANode {
     ReturnSpecPtr varReturnSpec;
     StatementPtr body;
     LLVMCodePtr llvmBody;
+
+    // source range of a body that has not been parsed yet, see ensureBody()
+    Location lazyBodyLocation;
+    unsigned lazyBodyLength;
+
     bool hasVarArg:1;
     bool returnSpecsDeclared:1;
+    bool exprReturnSpecs:1;
 
     Code()
-        : ANode(CODE),  hasVarArg(false), returnSpecsDeclared(false) {}
+        : ANode(CODE), lazyBodyLength(0),
+          hasVarArg(false), returnSpecsDeclared(false),
+          exprReturnSpecs(false) {}
     Code(llvm::ArrayRef<PatternVar> patternVars,
          ExprPtr predicate,
          llvm::ArrayRef<FormalArgPtr> formalArgs,
@@ -1987,8 +2068,9 @@ struct Code : public ANode {
         : ANode(CODE), patternVars(patternVars), predicate(predicate),
           formalArgs(formalArgs),
           returnSpecs(returnSpecs), varReturnSpec(varReturnSpec),
-          body(body),
-          hasVarArg(false), returnSpecsDeclared(false)
+          body(body), lazyBodyLength(0),
+          hasVarArg(false), returnSpecsDeclared(false),
+          exprReturnSpecs(false)
           {}
 
     bool hasReturnSpecs() {
@@ -2004,8 +2086,11 @@ struct Code : public ANode {
     bool isLLVMBody() {
         return llvmBody.ptr() != NULL;
     }
+    bool isLazyBody() {
+        return lazyBodyLocation.ok();
+    }
     bool hasBody() {
-        return body.ptr() || isLLVMBody();
+        return body.ptr() || isLazyBody() || isLLVMBody();
     }
 };
 
@@ -2163,6 +2248,8 @@ struct Overload : public TopLevelItem {
     PatternPtr callablePattern;
     vector<PatternPtr> argPatterns;
     MultiPatternPtr varArgPattern;
+    // feature sets from 'multiversion', each like "+avx2,+fma"
+    vector<string> multiversions;
     InlineAttribute isInline:3;
     int patternsInitializedState:2; // 0:notinit, -1:initing, +1:inited
     bool callByName:1;
@@ -2726,6 +2813,16 @@ struct SafePrintNameEnabler {
     ~SafePrintNameEnabler() { disableSafePrintName(); }
 };
 
+// qualify the names of records, variants, enums, newtypes, procedures and
+// globals with their modules
+void enableQualifiedPrintName();
+void disableQualifiedPrintName();
+
+struct QualifiedPrintNameEnabler {
+    QualifiedPrintNameEnabler() { enableQualifiedPrintName(); }
+    ~QualifiedPrintNameEnabler() { disableQualifiedPrintName(); }
+};
+
 void printNameList(llvm::raw_ostream &out, llvm::ArrayRef<ObjectPtr> x);
 void printNameList(llvm::raw_ostream &out, llvm::ArrayRef<ObjectPtr> x, llvm::ArrayRef<unsigned> dispatchIndices);
 void printNameList(llvm::raw_ostream &out, llvm::ArrayRef<TypePtr> x);
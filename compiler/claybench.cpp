@@ -0,0 +1,653 @@
+#include "clay.hpp"
+#include "analyzer.hpp"
+#include "codegen.hpp"
+#include "env.hpp"
+#include "error.hpp"
+#include "hirestimer.hpp"
+#include "lexer.hpp"
+#include "loader.hpp"
+#include "optimizer.hpp"
+#include "parser.hpp"
+#include "timing.hpp"
+#include "types.hpp"
+#include <algorithm>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Support/Format.h>
+
+// clay-bench times the compiler's phases in isolation, so that a change to
+// one of them can be measured without the noise of the others:
+//
+//   tokenize, parse     over every module of lib-clay, the shootout
+//                       programs and the synthetic programs below
+//   load, analyze,      for each program, with a fresh compiler state per
+//   codegen, optimize,  run. "prelude" is an empty program, which loads
+//   emit                little but the prelude.
+//
+// The analyzer runs lazily, and codegen analyzes whatever analyzing main
+// didn't reach (externals, constructors, destructors), so the analyze
+// and codegen times are approximate. Every phase is timed -repeat times
+// after -warmup untimed runs, and the report gives the minimum, median,
+// mean and maximum of each as JSON.
+
+namespace clay {
+
+namespace {
+    struct SourceFile {
+        string name;
+        SourcePtr source;
+        vector<Token> tokens;
+    };
+
+    struct FileCorpus {
+        string name;
+        vector<SourceFile> files;
+        uint64_t bytes;
+        FileCorpus() : bytes(0) {}
+    };
+
+    // loaded from fileName, or from source if that's not empty
+    struct Program {
+        string name;
+        string fileName;
+        string source;
+    };
+
+    struct BenchResult {
+        string corpus;
+        string phase;
+        uint64_t bytes;   // of the source, or of the object for emit
+        vector<double> millis;
+    };
+
+    struct BenchOptions {
+        vector<PathString> searchPath;
+        string targetTriple;
+        unsigned optLevel;
+        unsigned repeat;
+        unsigned warmup;
+        bool verbose;
+    };
+
+    enum ProgramPhase {
+        LOAD_PHASE,
+        ANALYZE_PHASE,
+        CODEGEN_PHASE,
+        OPTIMIZE_PHASE,
+        EMIT_PHASE,
+        PROGRAM_PHASES
+    };
+
+    const char *programPhaseNames[PROGRAM_PHASES] = {
+        "load", "analyze", "codegen", "optimize", "emit"
+    };
+}
+
+static void usage(char *argv0)
+{
+    llvm::errs() << "usage: " << argv0 << " <options>\n";
+    llvm::errs() << "options:\n";
+    llvm::errs() << "  -I<path>              add <path> to the module search path\n";
+    llvm::errs() << "  -lib-dir <dir>        the library to tokenize and parse\n";
+    llvm::errs() << "                        (default: lib-clay beside clay-bench)\n";
+    llvm::errs() << "  -shootout-dir <dir>   the shootout programs, one per directory\n";
+    llvm::errs() << "                        (default: test/example/shootout)\n";
+    llvm::errs() << "  -repeat <n>           time each phase n times (default 5)\n";
+    llvm::errs() << "  -warmup <n>           run each phase n times untimed first\n";
+    llvm::errs() << "                        (default 1)\n";
+    llvm::errs() << "  -scale <n>            scale the synthetic programs (default 1)\n";
+    llvm::errs() << "  -O0 -O1 -O2 -O3       optimization level (default -O2)\n";
+    llvm::errs() << "  -o <file>             write the report to <file> (default stdout)\n";
+    llvm::errs() << "  -v                    report progress\n";
+}
+
+
+
+//
+// synthetic programs
+//
+
+// generic procedures nested depth deep, instantiated with ever deeper
+// record types
+static string deepGenericsSource(unsigned depth)
+{
+    string s;
+    llvm::raw_string_ostream out(s);
+    out << "record Wrap[T] (value:T);\n\n";
+    out << "define depth;\n";
+    out << "overload depth(x) = 0;\n";
+    out << "[T]\n";
+    out << "overload depth(x:Wrap[T]) = 1 + depth(x.value);\n\n";
+    out << "nest0(x) = x;\n";
+    for (unsigned i = 1; i <= depth; ++i)
+        out << "nest" << i << "(x) = Wrap(nest" << (i - 1) << "(x));\n";
+    out << "\nmain() {\n";
+    out << "    var x = nest" << depth << "(1);\n";
+    out << "    return depth(x) - " << depth << ";\n";
+    out << "}\n";
+    return out.str();
+}
+
+// count overloads of one symbol, each called once
+static string manyOverloadsSource(unsigned count)
+{
+    string s;
+    llvm::raw_string_ostream out(s);
+    for (unsigned i = 0; i < count; ++i)
+        out << "record Item" << i << " (value:Int);\n";
+    out << "\ndefine weight;\n";
+    for (unsigned i = 0; i < count; ++i)
+        out << "overload weight(x:Item" << i << ") = x.value + " << i << ";\n";
+    out << "\nmain() {\n";
+    out << "    var total = 0;\n";
+    for (unsigned i = 0; i < count; ++i)
+        out << "    total +: weight(Item" << i << "(" << i << "));\n";
+    out << "    return total - " << (uint64_t)count * (count - 1) << ";\n";
+    out << "}\n";
+    return out.str();
+}
+
+// count small procedures in one module. main calls them in groups, so
+// that nothing recurses deeply.
+static string hugeFileSource(unsigned count)
+{
+    static const unsigned GROUP = 100;
+    string s;
+    llvm::raw_string_ostream out(s);
+    for (unsigned i = 0; i < count; ++i) {
+        out << "f" << i << "(a:Int) : Int {\n";
+        out << "    var b = a * " << (i % 7 + 2) << ";\n";
+        out << "    if (b % 3 == 0)\n";
+        out << "        return b + " << i << ";\n";
+        out << "    return b - 1;\n";
+        out << "}\n\n";
+    }
+    unsigned groups = (count + GROUP - 1) / GROUP;
+    for (unsigned g = 0; g < groups; ++g) {
+        out << "group" << g << "() : Int {\n";
+        out << "    var s = " << g << ";\n";
+        for (unsigned i = g * GROUP; i < count && i < (g + 1) * GROUP; ++i)
+            out << "    s +: f" << i << "(s);\n";
+        out << "    return s;\n";
+        out << "}\n\n";
+    }
+    out << "main() {\n";
+    out << "    var s = 0;\n";
+    for (unsigned g = 0; g < groups; ++g)
+        out << "    s +: group" << g << "();\n";
+    out << "    return s % 2;\n";
+    out << "}\n";
+    return out.str();
+}
+
+static void syntheticPrograms(unsigned scale, vector<Program> &programs)
+{
+    Program deep = { "synthetic/deep-generics", "", deepGenericsSource(32 * scale) };
+    Program overloads = { "synthetic/many-overloads", "", manyOverloadsSource(500 * scale) };
+    Program huge = { "synthetic/huge-file", "", hugeFileSource(2000 * scale) };
+    programs.push_back(deep);
+    programs.push_back(overloads);
+    programs.push_back(huge);
+}
+
+
+
+//
+// corpora
+//
+
+static void findFiles(llvm::StringRef dir, vector<string> &files)
+{
+    llvm::error_code ec;
+    for (llvm::sys::fs::recursive_directory_iterator i(dir, ec), end;
+         i != end && !ec;
+         i.increment(ec))
+    {
+        llvm::sys::fs::file_status status;
+        if (!i->status(status) && is_regular_file(status)
+            && llvm::StringRef(i->path()).endswith(".clay"))
+            files.push_back(i->path());
+    }
+    std::sort(files.begin(), files.end());
+}
+
+static void findShootoutPrograms(llvm::StringRef dir, vector<Program> &programs)
+{
+    vector<string> dirs;
+    llvm::error_code ec;
+    for (llvm::sys::fs::directory_iterator i(dir, ec), end;
+         i != end && !ec;
+         i.increment(ec))
+    {
+        dirs.push_back(i->path());
+    }
+    std::sort(dirs.begin(), dirs.end());
+    for (size_t i = 0; i < dirs.size(); ++i) {
+        PathString main(dirs[i]);
+        llvm::sys::path::append(main, "main.clay");
+        bool exists;
+        if (llvm::sys::fs::exists(main.str(), exists) || !exists)
+            continue;
+        Program program;
+        program.name = "shootout/" + llvm::sys::path::filename(dirs[i]).str();
+        program.fileName = main.str();
+        programs.push_back(program);
+    }
+}
+
+// tokenizes and parses each file once, dropping the ones with errors
+static void addSourceFile(FileCorpus &corpus, string const &name,
+                          SourcePtr source, CompilerState* cst)
+{
+    SourceFile file;
+    file.name = name;
+    file.source = source;
+    try {
+        tokenize(source, file.tokens);
+        parse(name, source, file.tokens, cst);
+    } catch (const CompilerError&) {
+        llvm::errs() << "skipping " << name << "\n";
+        return;
+    }
+    corpus.bytes += source->size();
+    corpus.files.push_back(file);
+}
+
+static void addSourceFile(FileCorpus &corpus, string const &fileName,
+                          CompilerState* cst)
+{
+    SourcePtr source;
+    try {
+        source = new Source(fileName);
+    } catch (const CompilerError&) {
+        return;
+    }
+    addSourceFile(corpus, fileName, source, cst);
+}
+
+
+
+//
+// timing
+//
+
+static double timeTokenize(FileCorpus const &corpus)
+{
+    HiResTimer timer;
+    timer.start();
+    for (size_t i = 0; i < corpus.files.size(); ++i) {
+        vector<Token> tokens;
+        tokenize(corpus.files[i].source, tokens);
+    }
+    timer.stop();
+    return timer.elapsedMillis();
+}
+
+static double timeParse(FileCorpus &corpus, CompilerState* cst)
+{
+    HiResTimer timer;
+    timer.start();
+    for (size_t i = 0; i < corpus.files.size(); ++i) {
+        SourceFile &file = corpus.files[i];
+        parse(file.name, file.source, file.tokens, cst);
+    }
+    timer.stop();
+    return timer.elapsedMillis();
+}
+
+// compiles program as 'clay -c' would, timing each phase
+static bool timeProgram(Program const &program,
+                        BenchOptions const &options,
+                        double millis[PROGRAM_PHASES],
+                        uint64_t &objectSize)
+{
+    CompilerState* cst = new CompilerState();
+    llvm::TargetMachine *targetMachine = initLLVM(options.targetTriple,
+        "", "", false, program.name, "", false, false, options.optLevel, cst);
+    if (targetMachine == NULL) {
+        llvm::errs() << "error: unable to initialize LLVM for target "
+                     << options.targetTriple << "\n";
+        delete cst;
+        return false;
+    }
+    cst->lifetimeMarkers = options.optLevel > 0;
+    initTypes(cst);
+    initExternalTarget(options.targetTriple, cst);
+    setSearchPath(options.searchPath, cst);
+
+    bool ok = true;
+    try {
+        HiResTimer load;
+        load.start();
+        initLoader(cst);
+        ModulePtr m = program.source.empty()
+            ? loadProgram(program.fileName, NULL, false, false, cst)
+            : loadProgramSource(program.name, program.source, false, false, cst);
+        load.stop();
+        millis[LOAD_PHASE] = load.elapsedMillis();
+
+        ObjectPtr mainProc = lookupPrivate(m, Identifier::get("main"));
+        if (mainProc == NULL)
+            error("no main procedure");
+        HiResTimer analyze;
+        analyze.start();
+        safeAnalyzeCallable(mainProc, vector<TypePtr>(), vector<ValueTempness>(), cst);
+        analyze.stop();
+        millis[ANALYZE_PHASE] = analyze.elapsedMillis();
+
+        HiResTimer codegen;
+        codegen.start();
+        codegenEntryPoints(m, false, true);
+        codegen.stop();
+        millis[CODEGEN_PHASE] = codegen.elapsedMillis();
+
+        HiResTimer optimize;
+        optimize.start();
+        if (options.optLevel > 0)
+            optimizeLLVM(cst->llvmModule, targetMachine, options.optLevel,
+                         false, options.optLevel > 2);
+        optimize.stop();
+        millis[OPTIMIZE_PHASE] = optimize.elapsedMillis();
+
+        string object;
+        llvm::raw_string_ostream out(object);
+        HiResTimer emit;
+        emit.start();
+        generateAssembly(cst->llvmModule, targetMachine, &out, true);
+        out.flush();
+        emit.stop();
+        millis[EMIT_PHASE] = emit.elapsedMillis();
+        objectSize = object.size();
+    } catch (const CompilerError&) {
+        ok = false;
+    }
+
+    delete cst->llvmModule;
+    delete targetMachine;
+    delete cst;
+    freeThreadANodeAllocators();
+    return ok;
+}
+
+
+
+//
+// report
+//
+
+static void printResult(llvm::raw_ostream &out, BenchResult const &result)
+{
+    vector<double> sorted(result.millis);
+    std::sort(sorted.begin(), sorted.end());
+    size_t n = sorted.size();
+    double sum = 0;
+    for (size_t i = 0; i < n; ++i)
+        sum += sorted[i];
+    double median = n % 2 == 1
+        ? sorted[n / 2]
+        : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+
+    out << "{\"corpus\":";
+    printJSONString(out, result.corpus);
+    out << ",\"phase\":";
+    printJSONString(out, result.phase);
+    out << ",\"bytes\":" << result.bytes;
+    out << ",\"min\":" << llvm::format("%.3f", sorted.front());
+    out << ",\"median\":" << llvm::format("%.3f", median);
+    out << ",\"mean\":" << llvm::format("%.3f", sum / n);
+    out << ",\"max\":" << llvm::format("%.3f", sorted.back());
+    out << ",\"ms\":[";
+    for (size_t i = 0; i < result.millis.size(); ++i) {
+        if (i > 0)
+            out << ',';
+        out << llvm::format("%.3f", result.millis[i]);
+    }
+    out << "]}";
+}
+
+static void printReport(llvm::raw_ostream &out,
+                        BenchOptions const &options,
+                        vector<BenchResult> const &results)
+{
+    out << "{\"target\":";
+    printJSONString(out, options.targetTriple);
+    out << ",\"optLevel\":" << options.optLevel;
+    out << ",\"repeat\":" << options.repeat;
+    out << ",\"warmup\":" << options.warmup;
+    out << ",\"results\":[";
+    for (size_t i = 0; i < results.size(); ++i) {
+        if (i > 0)
+            out << ',';
+        out << "\n";
+        printResult(out, results[i]);
+    }
+    out << "\n]}\n";
+    out.flush();
+}
+
+static void printProgress(BenchResult const &result)
+{
+    vector<double> sorted(result.millis);
+    std::sort(sorted.begin(), sorted.end());
+    llvm::errs() << llvm::format("  %-28s %-9s %10.3f ms\n",
+                                 result.corpus.c_str(),
+                                 result.phase.c_str(),
+                                 sorted[sorted.size() / 2]);
+}
+
+
+
+//
+// main
+//
+
+static bool parseCount(char const *arg, unsigned &n)
+{
+    char *end;
+    unsigned long value = strtoul(arg, &end, 10);
+    if (*end != '\0' || value == 0)
+        return false;
+    n = (unsigned)value;
+    return true;
+}
+
+int benchMain(int argc, char **argv, char const* const* envp)
+{
+    BenchOptions options;
+    options.targetTriple = llvm::sys::getDefaultTargetTriple();
+    options.optLevel = 2;
+    options.repeat = 5;
+    options.warmup = 1;
+    options.verbose = false;
+    unsigned scale = 1;
+    string libDir, shootoutDir, outputFile;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strncmp(argv[i], "-I", 2) == 0 && argv[i][2] != '\0') {
+            options.searchPath.push_back(PathString(argv[i] + 2));
+        }
+        else if (strcmp(argv[i], "-lib-dir") == 0 && i + 1 < argc) {
+            libDir = argv[++i];
+        }
+        else if (strcmp(argv[i], "-shootout-dir") == 0 && i + 1 < argc) {
+            shootoutDir = argv[++i];
+        }
+        else if (strcmp(argv[i], "-repeat") == 0 && i + 1 < argc) {
+            if (!parseCount(argv[++i], options.repeat)) {
+                llvm::errs() << "error: -repeat needs a positive count\n";
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-warmup") == 0 && i + 1 < argc) {
+            char *end;
+            options.warmup = (unsigned)strtoul(argv[++i], &end, 10);
+            if (*end != '\0') {
+                llvm::errs() << "error: -warmup needs a count\n";
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-scale") == 0 && i + 1 < argc) {
+            if (!parseCount(argv[++i], scale)) {
+                llvm::errs() << "error: -scale needs a positive count\n";
+                return 1;
+            }
+        }
+        else if (strncmp(argv[i], "-O", 2) == 0 && argv[i][2] >= '0'
+                 && argv[i][2] <= '3' && argv[i][3] == '\0') {
+            options.optLevel = argv[i][2] - '0';
+        }
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            outputFile = argv[++i];
+        }
+        else if (strcmp(argv[i], "-v") == 0) {
+            options.verbose = true;
+        }
+        else if (strcmp(argv[i], "-help") == 0 || strcmp(argv[i], "--help") == 0) {
+            usage(argv[0]);
+            return 0;
+        }
+        else {
+            llvm::errs() << "error: unrecognized option " << argv[i] << "\n";
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    // the same layouts clay searches for lib-clay
+    PathString benchExe(llvm::sys::Path::GetMainExecutable(argv[0], (void *)(uintptr_t)&usage).c_str());
+    llvm::StringRef benchDir = llvm::sys::path::parent_path(benchExe);
+    if (libDir.empty()) {
+        const char *layouts[] = { "../../lib-clay", "../lib/lib-clay", "lib-clay" };
+        for (size_t i = 0; i < sizeof(layouts) / sizeof(layouts[0]); ++i) {
+            PathString dir(benchDir);
+            llvm::sys::path::append(dir, layouts[i]);
+            bool isDir;
+            if (!llvm::sys::fs::is_directory(dir.str(), isDir) && isDir) {
+                libDir = dir.str();
+                break;
+            }
+        }
+        if (libDir.empty()) {
+            llvm::errs() << "error: unable to find lib-clay; use -lib-dir\n";
+            return 1;
+        }
+    }
+    if (shootoutDir.empty()) {
+        PathString dir(benchDir);
+        llvm::sys::path::append(dir, "../../test/example/shootout");
+        shootoutDir = dir.str();
+    }
+    options.searchPath.push_back(PathString(libDir));
+    options.searchPath.push_back(PathString("."));
+
+    llvm::OwningPtr<llvm::raw_fd_ostream> outputStream;
+    if (!outputFile.empty()) {
+        string errorInfo;
+        outputStream.reset(new llvm::raw_fd_ostream(outputFile.c_str(), errorInfo));
+        if (!errorInfo.empty()) {
+            llvm::errs() << "error: " << errorInfo << '\n';
+            return 1;
+        }
+    }
+
+    vector<Program> programs;
+    Program prelude = { "prelude", "", "main() {}\n" };
+    programs.push_back(prelude);
+    findShootoutPrograms(shootoutDir, programs);
+    if (programs.size() == 1)
+        llvm::errs() << "warning: no shootout programs in " << shootoutDir << "\n";
+    syntheticPrograms(scale, programs);
+
+    // the parser only needs the compiler state for its error context
+    CompilerState* cst = new CompilerState();
+    vector<FileCorpus> corpora(3);
+    corpora[0].name = "lib-clay";
+    corpora[1].name = "shootout";
+    corpora[2].name = "synthetic";
+    vector<string> libFiles;
+    findFiles(libDir, libFiles);
+    for (size_t i = 0; i < libFiles.size(); ++i)
+        addSourceFile(corpora[0], libFiles[i], cst);
+    for (size_t i = 0; i < programs.size(); ++i) {
+        Program const &program = programs[i];
+        if (!program.fileName.empty())
+            addSourceFile(corpora[1], program.fileName, cst);
+        else if (program.name != "prelude")
+            addSourceFile(corpora[2], program.name,
+                new Source(program.name,
+                    llvm::MemoryBuffer::getMemBufferCopy(program.source)),
+                cst);
+    }
+
+    vector<BenchResult> results;
+    for (size_t i = 0; i < corpora.size(); ++i) {
+        FileCorpus &corpus = corpora[i];
+        if (corpus.files.empty())
+            continue;
+        BenchResult tokenizeResult = { corpus.name, "tokenize", corpus.bytes, vector<double>() };
+        BenchResult parseResult = { corpus.name, "parse", corpus.bytes, vector<double>() };
+        for (unsigned run = 0; run < options.warmup + options.repeat; ++run) {
+            double tokenizeMillis = timeTokenize(corpus);
+            double parseMillis = timeParse(corpus, cst);
+            if (run < options.warmup)
+                continue;
+            tokenizeResult.millis.push_back(tokenizeMillis);
+            parseResult.millis.push_back(parseMillis);
+        }
+        results.push_back(tokenizeResult);
+        results.push_back(parseResult);
+        if (options.verbose) {
+            printProgress(tokenizeResult);
+            printProgress(parseResult);
+        }
+    }
+
+    bool failed = false;
+    for (size_t i = 0; i < programs.size(); ++i) {
+        Program const &program = programs[i];
+        uint64_t sourceBytes = program.source.size();
+        if (program.source.empty()) {
+            uint64_t size;
+            if (!llvm::sys::fs::file_size(program.fileName, size))
+                sourceBytes = size;
+        }
+        vector<BenchResult> programResults(PROGRAM_PHASES);
+        for (unsigned p = 0; p < PROGRAM_PHASES; ++p) {
+            programResults[p].corpus = program.name;
+            programResults[p].phase = programPhaseNames[p];
+            programResults[p].bytes = sourceBytes;
+        }
+        bool ok = true;
+        for (unsigned run = 0; run < options.warmup + options.repeat && ok; ++run) {
+            double millis[PROGRAM_PHASES];
+            uint64_t objectSize = 0;
+            ok = timeProgram(program, options, millis, objectSize);
+            if (!ok || run < options.warmup)
+                continue;
+            for (unsigned p = 0; p < PROGRAM_PHASES; ++p)
+                programResults[p].millis.push_back(millis[p]);
+            programResults[EMIT_PHASE].bytes = objectSize;
+        }
+        if (!ok) {
+            llvm::errs() << "error: unable to compile " << program.name << "\n";
+            failed = true;
+            continue;
+        }
+        for (unsigned p = 0; p < PROGRAM_PHASES; ++p) {
+            results.push_back(programResults[p]);
+            if (options.verbose)
+                printProgress(programResults[p]);
+        }
+    }
+
+    if (outputStream)
+        printReport(*outputStream, options, results);
+    else
+        printReport(llvm::outs(), options, results);
+    return failed ? 1 : 0;
+}
+
+}
+
+int main(int argc, char **argv, char const* const* envp) {
+    return clay::parachute(clay::benchMain, argc, argv, envp);
+}
@@ -8,10 +8,51 @@
 
 namespace clay {
 
+// while cloneRelocated runs, the copies of nodes located in relocateFrom
+// are located at the same offsets in relocateTo
+static Source *relocateFrom = NULL;
+static Source *relocateTo = NULL;
+
+static Location cloneLocation(Location const &x)
+{
+    if (relocateFrom != NULL && x.source.ptr() == relocateFrom)
+        return Location(relocateTo, x.offset);
+    return x;
+}
+
+namespace {
+    struct Relocation {
+        Source *savedFrom, *savedTo;
+        Relocation(Source *from, Source *to)
+            : savedFrom(relocateFrom), savedTo(relocateTo)
+        {
+            relocateFrom = from;
+            relocateTo = to;
+        }
+        ~Relocation() {
+            relocateFrom = savedFrom;
+            relocateTo = savedTo;
+        }
+    };
+}
+
+ExprListPtr cloneRelocated(ExprListPtr x, SourcePtr from, SourcePtr to)
+{
+    Relocation relocation(from.ptr(), to.ptr());
+    return clone(x);
+}
+
+void cloneRelocated(llvm::ArrayRef<StatementPtr> x, vector<StatementPtr> &out,
+                    SourcePtr from, SourcePtr to)
+{
+    Relocation relocation(from.ptr(), to.ptr());
+    clone(x, out);
+}
+
 CodePtr clone(CodePtr x)
 {
     CodePtr y = new Code();
-    y->location = x->location;
+    y->location = cloneLocation(x->location);
     clone(x->patternVars, y->patternVars);
     y->predicate = cloneOpt(x->predicate);
     clone(x->formalArgs, y->formalArgs);
@@ -21,6 +62,9 @@ CodePtr clone(CodePtr x)
     y->varReturnSpec = cloneOpt(x->varReturnSpec);
     y->body = cloneOpt(x->body);
     y->llvmBody = x->llvmBody;
+    y->lazyBodyLocation = x->lazyBodyLocation;
+    y->lazyBodyLength = x->lazyBodyLength;
+    y->exprReturnSpecs = x->exprReturnSpecs;
     return y;
 }
 
@@ -208,9 +252,9 @@ ExprPtr clone(ExprPtr x)
 
     }
 
-    out->location = x->location;
-    out->startLocation = x->startLocation;
-    out->endLocation = x->endLocation;
+    out->location = cloneLocation(x->location);
+    out->startLocation = cloneLocation(x->startLocation);
+    out->endLocation = cloneLocation(x->endLocation);
     return out;
 }
 
@@ -238,7 +282,7 @@ void clone(llvm::ArrayRef<FormalArgPtr> x, vector<FormalArgPtr> &out)
 FormalArgPtr clone(FormalArgPtr x)
 {
     FormalArgPtr out = new FormalArg(x->name, cloneOpt(x->type), x->tempness, x->varArg);
-    out->location = x->location;
+    out->location = cloneLocation(x->location);
     return out;
 }
 
@@ -448,7 +492,7 @@ StatementPtr clone(StatementPtr x)
 
     }
 
-    out->location = x->location;
+    out->location = cloneLocation(x->location);
     return out;
 }
 
@@ -468,7 +512,7 @@ void clone(llvm::ArrayRef<StatementPtr> x, vector<StatementPtr> &out)
 CaseBlockPtr clone(CaseBlockPtr x)
 {
     CaseBlockPtr y = new CaseBlock(clone(x->caseLabels), clone(x->body));
-    y->location = x->location;
+    y->location = cloneLocation(x->location);
     return y;
 }
 
@@ -484,7 +528,7 @@ CatchPtr clone(CatchPtr x)
                            cloneOpt(x->exceptionType),
                            x->contextVar,
                            clone(x->body));
-    y->location = x->location;
+    y->location = cloneLocation(x->location);
     return y;
 }
 
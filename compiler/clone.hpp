@@ -27,6 +27,12 @@ void clone(llvm::ArrayRef<CaseBlockPtr> x, vector<CaseBlockPtr> &out);
 CatchPtr clone(CatchPtr x);
 void clone(llvm::ArrayRef<CatchPtr> x, vector<CatchPtr> &out);
 
+// like clone, but the copies of nodes located in from are located at the
+// same offsets in to, which must hold the same text
+ExprListPtr cloneRelocated(ExprListPtr x, SourcePtr from, SourcePtr to);
+void cloneRelocated(llvm::ArrayRef<StatementPtr> x, vector<StatementPtr> &out,
+                    SourcePtr from, SourcePtr to);
+
 } // namespace clay
 
 #endif // __CLONE_HPP
@@ -14,6 +14,14 @@
 #include "parser.hpp"
 #include "env.hpp"
 #include "objects.hpp"
+#include "timing.hpp"
+#include "pgo.hpp"
+#include "prebuilt.hpp"
+#include "multiversion.hpp"
+#include "profiler.hpp"
+#include "trace.hpp"
+#include "stats.hpp"
+#include <llvm/MDBuilder.h>
 
 
 #pragma clang diagnostic ignored "-Wcovered-switch-default"
@@ -22,9 +30,21 @@
 namespace clay {
 
 CompilerState::CompilerState() :
+    moduleIndexDirty(false),
+    loadThreads(1),
+    lazyBodies(true),
+    emitSnapshots(false),
     _finalOverloadsEnabled(false),
     _inlineEnabled(true),
     _exceptionsEnabled(true),
+    lifetimeMarkers(false),
+    layoutSharing(false),
+    debugLineTablesOnly(false),
+    strictAliasing(true),
+    layoutSharingState(NULL),
+    prebuiltState(NULL),
+    initPriority(65535),
+    externalsOnDemand(false),
     invokeTablesInitialized(false),
     analysisCachingDisabled(0)   
 {
@@ -254,6 +274,346 @@ void setInlineEnabled(bool enabled, CompilerState* cst)
     cst->_inlineEnabled = enabled;
 }
 
+// -gline-tables-only keeps subprograms and line locations, and drops
+// type, variable and lexical block descriptors
+static bool fullDebugInfo(CompilerState* cst)
+{
+    return cst->llvmDIBuilder != NULL && !cst->debugLineTablesOnly;
+}
+
+
+
+//
+// TBAA
+//
+
+// scalar type-based alias analysis, unless -no-strict-aliasing is given.
+// 8-bit integers alias everything, as C's char does; integers of one width
+// share a node regardless of sign, and all pointer types share one. LLVM
+// 3.2 has no struct-path TBAA, so record, tuple and array elements are
+// tagged with their scalar type.
+//
+// a body that reads memory as a type other than the one it was written as
+// has no tags, and once every body exists propagateTypePunning strips the
+// tags of every function the punned memory can reach, so that no two
+// tagged accesses see the same memory under different types.
+
+static llvm::MDNode *tbaaNode(llvm::StringRef name, CompilerState* cst)
+{
+    llvm::StringMap<llvm::MDNode *>::const_iterator i = cst->tbaaNodes.find(name);
+    if (i != cst->tbaaNodes.end())
+        return i->getValue();
+
+    llvm::MDBuilder md(llvm::getGlobalContext());
+    llvm::MDNode *node;
+    if (name == "omnipotent char")
+        node = md.createTBAANode(name, md.createTBAARoot("Clay TBAA"));
+    else
+        node = md.createTBAANode(name, tbaaNode("omnipotent char", cst));
+    cst->tbaaNodes[name] = node;
+    return node;
+}
+
+static llvm::MDNode *tbaaTag(TypePtr t, CompilerState* cst)
+{
+    if (!cst->strictAliasing)
+        return NULL;
+
+    llvm::SmallString<32> name;
+    llvm::raw_svector_ostream out(name);
+    switch (t->typeKind) {
+    case BOOL_TYPE :
+        out << "bool";
+        break;
+    case INTEGER_TYPE : {
+        IntegerType *x = (IntegerType *)t.ptr();
+        if (x->bits == 8)
+            out << "omnipotent char";
+        else
+            out << "int" << x->bits;
+        break;
+    }
+    case FLOAT_TYPE : {
+        FloatType *x = (FloatType *)t.ptr();
+        out << "float" << x->bits;
+        break;
+    }
+    case POINTER_TYPE :
+    case CODE_POINTER_TYPE :
+    case CCODE_POINTER_TYPE :
+        out << "any pointer";
+        break;
+    default :
+        return NULL;
+    }
+    return tbaaNode(out.str(), cst);
+}
+
+static llvm::LoadInst *codegenLoad(CValuePtr cv, CodegenContext* ctx)
+{
+    llvm::LoadInst *load = ctx->builder->CreateLoad(cv->llValue);
+    if (llvm::MDNode *tag = tbaaTag(cv->type, ctx->cst))
+        load->setMetadata(llvm::LLVMContext::MD_tbaa, tag);
+    return load;
+}
+
+static llvm::StoreInst *codegenStore(llvm::Value *v,
+                                     CValuePtr dest,
+                                     CodegenContext* ctx)
+{
+    llvm::StoreInst *store = ctx->builder->CreateStore(v, dest->llValue);
+    if (llvm::MDNode *tag = tbaaTag(dest->type, ctx->cst))
+        store->setMetadata(llvm::LLVMContext::MD_tbaa, tag);
+    return store;
+}
+
+// whether a value of type t can hold an address. integers don't count:
+// turning one back into a pointer takes intToPointer, which puns itself.
+static bool mayCarryAddress(TypePtr t)
+{
+    switch (t->typeKind) {
+    case BOOL_TYPE :
+    case INTEGER_TYPE :
+    case FLOAT_TYPE :
+    case COMPLEX_TYPE :
+    case CODE_POINTER_TYPE :
+    case CCODE_POINTER_TYPE :
+    case STATIC_TYPE :
+    case ENUM_TYPE :
+        return false;
+    default :
+        return true;
+    }
+}
+
+// whether reading a value of type src as type dest keeps the tags its
+// accesses get, following pointers to what they point at. reading
+// anything as 8-bit integers does.
+static bool sameAccessTags(TypePtr dest, TypePtr src, CompilerState* cst)
+{
+    while (dest->typeKind == POINTER_TYPE && src->typeKind == POINTER_TYPE) {
+        dest = ((PointerType *)dest.ptr())->pointeeType;
+        src = ((PointerType *)src.ptr())->pointeeType;
+    }
+    llvm::MDNode *tag = tbaaTag(dest, cst);
+    if (tag == NULL)
+        return false;
+    if (tag == tbaaNode("omnipotent char", cst))
+        return true;
+    switch (dest->typeKind) {
+    case BOOL_TYPE :
+    case INTEGER_TYPE :
+    case FLOAT_TYPE :
+        return tag == tbaaTag(src, cst);
+    default :
+        return false;
+    }
+}
+
+static void stripTBAA(llvm::Function *func)
+{
+    for (llvm::Function::iterator bb = func->begin(); bb != func->end(); ++bb)
+        for (llvm::BasicBlock::iterator i = bb->begin(); i != bb->end(); ++i)
+            i->setMetadata(llvm::LLVMContext::MD_tbaa, NULL);
+}
+
+// func reads memory as a type other than the one it was written as, so
+// none of its accesses can be told apart by type
+static void notePunning(llvm::Function *func, CompilerState* cst)
+{
+    cst->punningFunctions.insert(func);
+    stripTBAA(func);
+}
+
+// notes whether entry's function can hand its callers an address, through
+// a reference or a value that can hold one
+static void noteCodeInterface(InvokeEntry* entry)
+{
+    CompilerState* cst = entry->env->cst;
+    if (entry->typePunning)
+        notePunning(entry->llvmFunc, cst);
+    for (size_t i = 0; i < entry->argsKey.size(); ++i)
+        if (mayCarryAddress(entry->argsKey[i]))
+            return;
+    for (size_t i = 0; i < entry->returnTypes.size(); ++i)
+        if (entry->returnIsRef[i] || mayCarryAddress(entry->returnTypes[i]))
+            return;
+    cst->scalarInterfaces.insert(entry->llvmFunc);
+}
+
+namespace {
+    struct PunningGraph {
+        map<llvm::Function *, vector<llvm::Function *> > callees;
+        map<llvm::Function *, vector<llvm::Function *> > callers;
+        map<llvm::Function *, set<llvm::GlobalVariable *> > globals;
+        map<llvm::GlobalVariable *, vector<llvm::Function *> > globalUsers;
+        set<llvm::Function *> indirectCallers;
+        vector<llvm::Function *> addressTaken;
+    };
+}
+
+// whether memory of type t can hold an address. bytes can hold anything.
+static bool mayHoldAddress(llvm::Type *t)
+{
+    if (t->isFloatingPointTy())
+        return false;
+    if (llvm::IntegerType *it = llvm::dyn_cast<llvm::IntegerType>(t))
+        return it->getBitWidth() == 8;
+    if (llvm::StructType *st = llvm::dyn_cast<llvm::StructType>(t)) {
+        for (unsigned i = 0; i < st->getNumElements(); ++i)
+            if (mayHoldAddress(st->getElementType(i)))
+                return true;
+        return false;
+    }
+    if (llvm::SequentialType *at = llvm::dyn_cast<llvm::SequentialType>(t))
+        if (!at->isPointerTy())
+            return mayHoldAddress(at->getElementType());
+    return true;
+}
+
+static void addGlobalUses(llvm::Value *v, llvm::Function *user,
+                          PunningGraph &graph)
+{
+    if (llvm::GlobalVariable *gv = llvm::dyn_cast<llvm::GlobalVariable>(v)) {
+        if (mayHoldAddress(gv->getType()->getElementType())
+            && graph.globals[user].insert(gv).second)
+            graph.globalUsers[gv].push_back(user);
+    }
+    else if (llvm::ConstantExpr *ce = llvm::dyn_cast<llvm::ConstantExpr>(v)) {
+        for (unsigned i = 0; i < ce->getNumOperands(); ++i)
+            addGlobalUses(ce->getOperand(i), user, graph);
+    }
+}
+
+static void addCall(llvm::Function *caller, llvm::Value *callee,
+                    PunningGraph &graph)
+{
+    llvm::Function *f =
+        llvm::dyn_cast<llvm::Function>(callee->stripPointerCasts());
+    if (f == NULL) {
+        graph.indirectCallers.insert(caller);
+        return;
+    }
+    if (f->isIntrinsic())
+        return;
+    graph.callees[caller].push_back(f);
+    graph.callers[f].push_back(caller);
+}
+
+static void buildPunningGraph(llvm::Module *module, PunningGraph &graph)
+{
+    for (llvm::Module::iterator f = module->begin(); f != module->end(); ++f) {
+        if (f->hasAddressTaken())
+            graph.addressTaken.push_back(&*f);
+        for (llvm::Function::iterator bb = f->begin(); bb != f->end(); ++bb) {
+            for (llvm::BasicBlock::iterator i = bb->begin(); i != bb->end(); ++i) {
+                if (llvm::CallInst *call = llvm::dyn_cast<llvm::CallInst>(&*i))
+                    addCall(&*f, call->getCalledValue(), graph);
+                else if (llvm::InvokeInst *call = llvm::dyn_cast<llvm::InvokeInst>(&*i))
+                    addCall(&*f, call->getCalledValue(), graph);
+                for (unsigned j = 0; j < i->getNumOperands(); ++j)
+                    addGlobalUses(i->getOperand(j), &*f, graph);
+            }
+        }
+    }
+}
+
+static void taintFunction(llvm::Function *f,
+                          set<llvm::Function *> &tainted,
+                          vector<llvm::Function *> &worklist)
+{
+    if (tainted.insert(f).second)
+        worklist.push_back(f);
+}
+
+// punned memory reaches what a tainted function calls, the callers it can
+// hand an address to, and the functions that use a global it uses that can
+// hold an address. calls through pointers can reach any function whose
+// address is taken. declarations have no tags to strip.
+static void taintReachable(PunningGraph &graph,
+                           set<llvm::Function *> &tainted,
+                           vector<llvm::Function *> &worklist,
+                           CompilerState* cst)
+{
+    bool indirectCalleesTainted = false;
+    bool indirectCallersTainted = false;
+    while (!worklist.empty()) {
+        llvm::Function *f = worklist.back();
+        worklist.pop_back();
+
+        vector<llvm::Function *> const &callees = graph.callees[f];
+        for (size_t i = 0; i < callees.size(); ++i)
+            if (!callees[i]->isDeclaration())
+                taintFunction(callees[i], tainted, worklist);
+
+        bool handsAddresses = cst->scalarInterfaces.count(f) == 0;
+        if (handsAddresses) {
+            vector<llvm::Function *> const &callers = graph.callers[f];
+            for (size_t i = 0; i < callers.size(); ++i)
+                taintFunction(callers[i], tainted, worklist);
+        }
+
+        set<llvm::GlobalVariable *> const &globals = graph.globals[f];
+        for (set<llvm::GlobalVariable *>::const_iterator i = globals.begin();
+             i != globals.end(); ++i) {
+            vector<llvm::Function *> const &users = graph.globalUsers[*i];
+            for (size_t j = 0; j < users.size(); ++j)
+                taintFunction(users[j], tainted, worklist);
+        }
+
+        if (!indirectCalleesTainted && graph.indirectCallers.count(f) > 0) {
+            indirectCalleesTainted = true;
+            for (size_t i = 0; i < graph.addressTaken.size(); ++i)
+                if (!graph.addressTaken[i]->isDeclaration())
+                    taintFunction(graph.addressTaken[i], tainted, worklist);
+        }
+        if (!indirectCallersTainted && handsAddresses && f->hasAddressTaken()) {
+            indirectCallersTainted = true;
+            for (set<llvm::Function *>::const_iterator i = graph.indirectCallers.begin();
+                 i != graph.indirectCallers.end(); ++i)
+                taintFunction(*i, tainted, worklist);
+        }
+    }
+}
+
+// strips the tags of every function that punned memory can reach from the
+// punning functions. functions that -prebuilt-out or -module can export
+// lose their tags too, since their callers in other programs may pass them
+// punned memory, but they only count as punning in the manifest if their
+// own library reaches them with it.
+static void propagateTypePunning(CompilerState* cst)
+{
+    if (!cst->strictAliasing)
+        return;
+
+    PunningGraph graph;
+    buildPunningGraph(cst->llvmModule, graph);
+
+    set<llvm::Function *> tainted;
+    vector<llvm::Function *> worklist;
+    for (set<llvm::Function *>::const_iterator i = cst->punningFunctions.begin();
+         i != cst->punningFunctions.end(); ++i)
+        taintFunction(*i, tainted, worklist);
+    taintReachable(graph, tainted, worklist, cst);
+    cst->punningFunctions = tainted;
+
+    if (prebuiltOutputEnabled(cst)) {
+        vector<llvm::Function *> exportable;
+        prebuiltExportableFunctions(cst, exportable);
+        for (size_t i = 0; i < exportable.size(); ++i)
+            taintFunction(exportable[i], tainted, worklist);
+        taintReachable(graph, tainted, worklist, cst);
+    }
+
+    for (set<llvm::Function *>::const_iterator i = tainted.begin();
+         i != tainted.end(); ++i)
+        stripTBAA(*i);
+    addStatistic("functions without type-based alias analysis tags",
+                 tainted.size());
+}
+
+
+
 bool exceptionsEnabled(CompilerState* cst)
 {
     return cst->_exceptionsEnabled;
@@ -367,8 +727,8 @@ void codegenValueCopy(CValuePtr dest, CValuePtr src, CodegenContext* ctx)
         && (!isPrimitiveAggregateTooLarge(dest->type)))
     {
         if (dest->type->typeKind != STATIC_TYPE) {
-            llvm::Value *v = ctx->builder->CreateLoad(src->llValue);
-            ctx->builder->CreateStore(v, dest->llValue);
+            llvm::Value *v = codegenLoad(src, ctx);
+            codegenStore(v, dest, ctx);
         }
         return;
     }
@@ -385,8 +745,8 @@ void codegenValueMove(CValuePtr dest, CValuePtr src, CodegenContext* ctx)
         && (!isPrimitiveAggregateTooLarge(dest->type)))
     {
         if (dest->type->typeKind != STATIC_TYPE) {
-            llvm::Value *v = ctx->builder->CreateLoad(src->llValue);
-            ctx->builder->CreateStore(v, dest->llValue);
+            llvm::Value *v = codegenLoad(src, ctx);
+            codegenStore(v, dest, ctx);
         }
         return;
     }
@@ -420,8 +780,8 @@ static void codegenValueAssign(
         && (!isPrimitiveAggregateTooLarge(dest->type)))
     {
         if (dest->type->typeKind != STATIC_TYPE) {
-            llvm::Value *v = ctx->builder->CreateLoad(src->llValue);
-            ctx->builder->CreateStore(v, dest->llValue);
+            llvm::Value *v = codegenLoad(src, ctx);
+            codegenStore(v, dest, ctx);
         }
         return;
     }
@@ -447,6 +807,81 @@ llvm::Value *codegenToBoolFlag(CValuePtr a, CodegenContext* ctx)
 
 
 
+//
+// lifetime markers
+//
+// temporaries and locals are bracketed by llvm.lifetime.start/end so that
+// stack coloring can overlap allocas of any type whose lifetimes don't
+// intersect. a marker is dropped when the builder is past a terminator;
+// a missing end only keeps the slot live for longer.
+//
+// an end must be dominated by its start, so slots allocated under a branch
+// inside an expression (the second operand of and/or, dispatch cases,
+// exception cleanups) get no markers at all, wherever they are reused;
+// a slot without markers is live for the whole function.
+//
+
+static void codegenLifetimeMarker(llvm::Intrinsic::ID id,
+                                  llvm::Value *slot,
+                                  CodegenContext* ctx)
+{
+    if (!ctx->cst->lifetimeMarkers || ctx->builder == NULL)
+        return;
+    llvm::AllocaInst *alloca = llvm::dyn_cast<llvm::AllocaInst>(slot);
+    if (alloca == NULL || ctx->unmarkedSlots.count(alloca))
+        return;
+    llvm::BasicBlock *block = ctx->builder->GetInsertBlock();
+    if (block == NULL
+        || (ctx->builder->GetInsertPoint() == block->end()
+            && block->getTerminator() != NULL))
+        return;
+    uint64_t size =
+        ctx->cst->llvmDataLayout->getTypeAllocSize(alloca->getAllocatedType());
+    if (size == 0)
+        return;
+
+    llvm::Function *marker =
+        llvm::Intrinsic::getDeclaration(ctx->cst->llvmModule, id);
+    llvm::Value *args[2] = {
+        llvm::ConstantInt::get(llvmIntType(64), size),
+        ctx->builder->CreateBitCast(alloca, llvmPointerType(ctx->cst->int8Type)),
+    };
+    ctx->builder->CreateCall(marker, args);
+}
+
+static void codegenLifetimeStart(llvm::Value *slot, CodegenContext* ctx)
+{
+    codegenLifetimeMarker(llvm::Intrinsic::lifetime_start, slot, ctx);
+}
+
+static void codegenLifetimeEnd(llvm::Value *slot, CodegenContext* ctx)
+{
+    codegenLifetimeMarker(llvm::Intrinsic::lifetime_end, slot, ctx);
+}
+
+static void beginBranch(CodegenContext* ctx)
+{
+    ++ctx->branchDepth;
+}
+
+static void endBranch(CodegenContext* ctx)
+{
+    assert(ctx->branchDepth > 0);
+    --ctx->branchDepth;
+}
+
+// a slot reused under a branch must not have markers elsewhere
+static bool reusableSlot(StackSlot const &slot,
+                         llvm::Type *llType,
+                         CodegenContext* ctx)
+{
+    if (slot.llType != llType)
+        return false;
+    return ctx->branchDepth == 0 || ctx->unmarkedSlots.count(slot.llValue);
+}
+
+
+
 //
 // temps
 //
@@ -455,7 +890,7 @@ static llvm::Value *allocTemp(llvm::Type *llType, CodegenContext* ctx)
 {
     llvm::Value *llv = NULL;
     for (size_t i = ctx->discardedSlots.size(); i > 0; --i) {
-        if (ctx->discardedSlots[i-1].llType == llType) {
+        if (reusableSlot(ctx->discardedSlots[i-1], llType, ctx)) {
             llv = ctx->discardedSlots[i-1].llValue;
             ctx->discardedSlots.erase(ctx->discardedSlots.begin() + long(i)-1);
             break;
@@ -463,7 +898,10 @@ static llvm::Value *allocTemp(llvm::Type *llType, CodegenContext* ctx)
     }
     if (!llv)
         llv = ctx->initBuilder->CreateAlloca(llType);
+    if (ctx->branchDepth > 0)
+        ctx->unmarkedSlots.insert(llv);
     ctx->allocatedSlots.push_back(StackSlot(llType, llv));
+    codegenLifetimeStart(llv, ctx);
     return llv;
 }
 
@@ -473,6 +911,7 @@ static size_t markTemps(CodegenContext* ctx) {
 
 static void clearTemps(size_t marker, CodegenContext* ctx) {
     while (marker < ctx->allocatedSlots.size()) {
+        codegenLifetimeEnd(ctx->allocatedSlots.back().llValue, ctx);
         ctx->discardedSlots.push_back(ctx->allocatedSlots.back());
         ctx->allocatedSlots.pop_back();
     }
@@ -513,6 +952,8 @@ void cgDestroyAndPopStack(size_t marker, CodegenContext* ctx, bool exception)
         ValueStackEntry entry = ctx->valueStack.back();
         ctx->valueStack.pop_back();
         codegenStackEntryDestroy(entry, ctx, exception);
+        if (entry.type == LOCAL_VALUE)
+            codegenLifetimeEnd(entry.value->llValue, ctx);
     }
 }
 
@@ -547,6 +988,9 @@ CValuePtr codegenAllocNewValue(TypePtr t, CodegenContext* ctx)
 {
     llvm::Type *llt = llvmType(t);
     llvm::Value *llv = ctx->initBuilder->CreateAlloca(llt);
+    if (ctx->branchDepth > 0)
+        ctx->unmarkedSlots.insert(llv);
+    codegenLifetimeStart(llv, ctx);
     return new CValue(t, llv);
 }
 
@@ -1126,16 +1570,18 @@ void codegenExpr(ExprPtr expr,
         assert(out0->type == ctx->cst->boolType);
 
         ctx->builder->SetInsertPoint(trueBlock);
+        beginBranch(ctx);
         size_t marker = cgMarkStack(ctx);
         CValuePtr cv2 = codegenOneAsRef(x->expr2, env, ctx);
         llvm::Value *flag2 = codegenToBoolFlag(cv2, ctx);
-        ctx->builder->CreateStore(flag2, out0->llValue);
+        codegenStore(flag2, out0, ctx);
         cgDestroyAndPopStack(marker, ctx, false);
+        endBranch(ctx);
         ctx->builder->CreateBr(mergeBlock);
 
         ctx->builder->SetInsertPoint(falseBlock);
         llvm::Value *zero = llvm::ConstantInt::get(llvmType(ctx->cst->boolType), 0);
-        ctx->builder->CreateStore(zero, out0->llValue);
+        codegenStore(zero, out0, ctx);
         ctx->builder->CreateBr(mergeBlock);
 
         ctx->builder->SetInsertPoint(mergeBlock);
@@ -1155,16 +1601,18 @@ void codegenExpr(ExprPtr expr,
         assert(out0->type == ctx->cst->boolType);
 
         ctx->builder->SetInsertPoint(falseBlock);
+        beginBranch(ctx);
         size_t marker = cgMarkStack(ctx);
         CValuePtr cv2 = codegenOneAsRef(x->expr2, env, ctx);
         llvm::Value *flag2 = codegenToBoolFlag(cv2, ctx);
-        ctx->builder->CreateStore(flag2, out0->llValue);
+        codegenStore(flag2, out0, ctx);
         cgDestroyAndPopStack(marker, ctx, false);
+        endBranch(ctx);
         ctx->builder->CreateBr(mergeBlock);
 
         ctx->builder->SetInsertPoint(trueBlock);
         llvm::Value *one = llvm::ConstantInt::get(llvmType(ctx->cst->boolType), 1);
-        ctx->builder->CreateStore(one, out0->llValue);
+        codegenStore(one, out0, ctx);
         ctx->builder->CreateBr(mergeBlock);
 
         ctx->builder->SetInsertPoint(mergeBlock);
@@ -1235,7 +1683,7 @@ void codegenStaticObject(ObjectPtr x,
         initializeEnumType((EnumType*)out0->type.ptr());
         llvm::Value *llv = llvm::ConstantInt::getSigned(
             llvmType(y->type), y->index);
-        ctx->builder->CreateStore(llv, out0->llValue);
+        codegenStore(llv, out0, ctx);
         break;
     }
 
@@ -1277,7 +1725,7 @@ void codegenStaticObject(ObjectPtr x,
         assert(out0->type == y->ptrType);
         llvm::Value *opaqueValue = ctx->builder->CreateBitCast(
             y->llvmFunc, llvmType(out0->type));
-        ctx->builder->CreateStore(opaqueValue, out0->llValue);
+        codegenStore(opaqueValue, out0, ctx);
         break;
     }
 
@@ -1446,11 +1894,15 @@ void codegenGVarInstance(GVarInstancePtr x)
     llvm::DIBuilder* llvmDIBuiler = cst->llvmDIBuilder;
 
     x->staticGlobal = new ValueHolder(y.type);
+    // the object of an imported module defines and initializes it
+    if (codegenPrebuiltGlobal(x.ptr(), symbolStr.str(), llvmType(y.type)))
+        return;
     x->llGlobal = new llvm::GlobalVariable(
         *cst->llvmModule, llvmType(y.type), false,
         llvm::GlobalVariable::InternalLinkage,
         initializer, symbolStr.str());
-    if (cst->llvmDIBuilder != NULL) {
+    exportModuleGlobal(x.ptr(), symbolStr.str());
+    if (fullDebugInfo(cst)) {
         unsigned line, column;
         llvm::DIFile file = getDebugLineCol(x->gvar->location, line, column);
         x->debugInfo = (llvm::MDNode*)cst->llvmDIBuilder->createGlobalVariable(
@@ -1515,7 +1967,7 @@ void codegenExternalVariable(ExternalVariablePtr x, CompilerState* cst)
         new llvm::GlobalVariable(
             *cst->llvmModule, llvmType(pv.type), false,
             linkage, NULL, x->name->str.str());
-    if (llvmDIBuilder != NULL) {
+    if (fullDebugInfo(cst)) {
         unsigned line, column;
         llvm::DIFile file = getDebugLineCol(x->location, line, column);
         x->debugInfo = (llvm::MDNode*)llvmDIBuilder->createGlobalVariable(
@@ -1606,12 +2058,14 @@ void codegenExternalProcedure(ExternalProcedurePtr x, bool codegenBody)
             file = getDebugLineCol(x->location, line, column);
 
             vector<llvm::Value*> debugParamTypes;
-            if (x->returnType2 == NULL)
+            if (x->returnType2 == NULL || cst->debugLineTablesOnly)
                 debugParamTypes.push_back(llvmVoidTypeDebugInfo());
             else
                 debugParamTypes.push_back(llvmTypeDebugInfo(x->returnType2));
-            for (size_t i = 0; i < x->args.size(); ++i)
-                debugParamTypes.push_back(llvmTypeDebugInfo(x->args[i]->type2));
+            if (!cst->debugLineTablesOnly) {
+                for (size_t i = 0; i < x->args.size(); ++i)
+                    debugParamTypes.push_back(llvmTypeDebugInfo(x->args[i]->type2));
+            }
 
             llvm::DIArray debugParamArray = llvmDIBuilder->getOrCreateArray(
                 llvm::makeArrayRef(debugParamTypes));
@@ -1636,8 +2090,14 @@ void codegenExternalProcedure(ExternalProcedurePtr x, bool codegenBody)
         }
     }
 
-    if (!codegenBody)
+    // the object of a module interface already defines it
+    bool prebuilt = prebuiltUseEnabled(cst) && prebuiltExternalDefined(cst, llvmFuncName);
+
+    if (!codegenBody || prebuilt) {
+        if (x->body.ptr() && cst->externalsOnDemand && !prebuilt)
+            cst->demandedExternals.push_back(x);
         return;
+    }
 
     x->bodyCodegenned = true;
     if (!x->body)
@@ -1645,13 +2105,15 @@ void codegenExternalProcedure(ExternalProcedurePtr x, bool codegenBody)
 
     CodegenContext ctx(cst, x->llvmFunc);
 
-    if (llvmDIBuilder != NULL) {
+    if (fullDebugInfo(cst)) {
         ctx.pushDebugScope(llvmDIBuilder->createLexicalBlock(
             x->getDebugInfo(),
             file,
             line,
             column
             ));
+    } else if (llvmDIBuilder != NULL) {
+        ctx.pushDebugScope(llvm::DILexicalBlock(x->debugInfo));
     }
 
     llvm::BasicBlock *initBlock = newBasicBlock("init", &ctx);
@@ -1671,6 +2133,8 @@ void codegenExternalProcedure(ExternalProcedurePtr x, bool codegenBody)
     ctx.exceptionValue = ctx.initBuilder->CreateAlloca(exceptionReturnType(ctx.cst),
                                                        NULL, "exception");
 
+    profileFunctionEntry(&ctx);
+
     EnvPtr env = new Env(x->env);
     vector<CReturn> returns;
 
@@ -1683,7 +2147,7 @@ void codegenExternalProcedure(ExternalProcedurePtr x, bool codegenBody)
         CValuePtr cvalue = target->allocArgumentValue(
             x->callingConv, arg->type2, arg->name->str, ai, &ctx);
         addLocal(env, arg->name, cvalue.ptr());
-        if (llvmDIBuilder != NULL) {
+        if (fullDebugInfo(cst)) {
             unsigned line, column;
             Location argLocation = arg->location;
             llvm::DIFile file = getDebugLineCol(argLocation, line, column);
@@ -1740,6 +2204,9 @@ void codegenExternalProcedure(ExternalProcedurePtr x, bool codegenBody)
     ctx.builder->CreateUnreachable();
 
     ctx.initBuilder->CreateBr(codeBlock);
+
+    if (ctx.typePunning)
+        notePunning(x->llvmFunc, cst);
 }
 
 
@@ -1776,7 +2243,7 @@ void codegenCompileTimeValue(EValuePtr ev,
     case INTEGER_TYPE :
     case FLOAT_TYPE : {
         llvm::Value *llv = codegenSimpleConstant(ev);
-        ctx->builder->CreateStore(llv, out0->llValue);
+        codegenStore(llv, out0, ctx);
         break;
     }
 
@@ -2222,6 +2689,16 @@ void codegenCallExpr(ExprPtr callable,
 //
 // codegenDispatch
 //
+// the tags of all dispatched arguments are read up front and lowered to
+// `switch` instructions.  cases that end up calling the same overload
+// (same argument types and tempness, hence the same invoke entry) branch
+// to a single shared call site, passing the dispatched members through
+// phi nodes, so the callee is only generated once per distinct target.
+//
+
+// multi-argument dispatch switches on one combined tag when the combined
+// case count stays small enough for a jump table
+static const unsigned MAX_COMBINED_DISPATCH_CASES = 64;
 
 llvm::Value *codegenDispatchTag(CValuePtr cv, CodegenContext* ctx)
 {
@@ -2250,6 +2727,186 @@ CValuePtr codegenDispatchIndex(CValuePtr cv, PVData const &pvOut, unsigned tag,
     return derefValueForPValue(cvOut, pvOut, ctx);
 }
 
+namespace {
+    struct DispatchCallee {
+        vector<TypePtr> argsKey;
+        vector<ValueTempness> argsTempness;
+        MultiCValuePtr args;
+        MultiPValuePtr pvArgs;
+        vector<llvm::PHINode *> phis;
+        llvm::BasicBlock *block;
+    };
+
+    struct DispatchLowering {
+        ObjectPtr obj;
+        MultiCValuePtr args;
+        MultiPValuePtr pvArgs;
+        llvm::ArrayRef<unsigned> dispatchIndices;
+        vector<unsigned> memberCounts;
+        vector<llvm::Value *> tags;
+        vector<llvm::BasicBlock *> invalidBlocks;
+        vector<DispatchCallee> callees;
+        CodegenContext *ctx;
+    };
+}
+
+static llvm::BasicBlock *dispatchInvalidBlock(DispatchLowering &d, unsigned level)
+{
+    if (!d.invalidBlocks[level])
+        d.invalidBlocks[level] = newBasicBlock("dispatchInvalid", d.ctx);
+    return d.invalidBlocks[level];
+}
+
+static void codegenDispatchMember(DispatchLowering &d,
+                                  MultiCValuePtr args,
+                                  MultiPValuePtr pvArgs,
+                                  unsigned level,
+                                  unsigned tag)
+{
+    unsigned index = d.dispatchIndices[level];
+    PVData pvMember = analyzeDispatchIndex(d.pvArgs->values[index], tag, d.ctx->cst);
+    pvArgs->values[index] = pvMember;
+    args->values[index] =
+        codegenDispatchIndex(d.args->values[index], pvMember, tag, d.ctx);
+}
+
+static void codegenDispatchBranch(DispatchLowering &d,
+                                  MultiCValuePtr args,
+                                  MultiPValuePtr pvArgs)
+{
+    vector<TypePtr> argsKey;
+    vector<ValueTempness> argsTempness;
+    computeArgsKey(pvArgs, argsKey, argsTempness);
+
+    DispatchCallee *callee = NULL;
+    for (size_t i = 0; i < d.callees.size(); ++i) {
+        if (d.callees[i].argsKey == argsKey
+            && d.callees[i].argsTempness == argsTempness)
+        {
+            callee = &d.callees[i];
+            break;
+        }
+    }
+    if (callee == NULL) {
+        d.callees.push_back(DispatchCallee());
+        callee = &d.callees.back();
+        callee->argsKey = argsKey;
+        callee->argsTempness = argsTempness;
+        callee->pvArgs = pvArgs;
+        callee->args = new MultiCValue();
+        callee->block = newBasicBlock("dispatchCall", d.ctx);
+        for (unsigned i = 0; i < args->size(); ++i)
+            callee->args->add(args->values[i]);
+        for (unsigned i = 0; i < d.dispatchIndices.size(); ++i) {
+            unsigned index = d.dispatchIndices[i];
+            CValuePtr cv = args->values[index];
+            llvm::PHINode *phi = llvm::PHINode::Create(
+                cv->llValue->getType(), 0, "", callee->block);
+            CValuePtr cvPhi = new CValue(cv->type, phi);
+            cvPhi->forwardedRValue = cv->forwardedRValue;
+            callee->args->values[index] = cvPhi;
+            callee->phis.push_back(phi);
+        }
+    }
+
+    llvm::BasicBlock *from = d.ctx->builder->GetInsertBlock();
+    for (unsigned i = 0; i < d.dispatchIndices.size(); ++i) {
+        unsigned index = d.dispatchIndices[i];
+        callee->phis[i]->addIncoming(args->values[index]->llValue, from);
+    }
+    d.ctx->builder->CreateBr(callee->block);
+}
+
+static void codegenDispatchNested(DispatchLowering &d,
+                                  MultiCValuePtr args,
+                                  MultiPValuePtr pvArgs,
+                                  unsigned level)
+{
+    if (level == d.dispatchIndices.size()) {
+        codegenDispatchBranch(d, args, pvArgs);
+        return;
+    }
+
+    unsigned memberCount = d.memberCounts[level];
+    unsigned profileSite = profileBranchSite(d.ctx);
+    llvm::SwitchInst *sw = d.ctx->builder->CreateSwitch(
+        d.tags[level], dispatchInvalidBlock(d, level), memberCount);
+    for (unsigned i = 0; i < memberCount; ++i) {
+        llvm::BasicBlock *caseBlock = newBasicBlock("dispatchCase", d.ctx);
+        sw->addCase(llvm::ConstantInt::get(llvmIntType(32), i), caseBlock);
+        d.ctx->builder->SetInsertPoint(caseBlock);
+        profileCountEdge(profileSite, i+1, d.ctx);
+
+        MultiCValuePtr args2 = new MultiCValue();
+        args2->add(args);
+        MultiPValuePtr pvArgs2 = new MultiPValue();
+        pvArgs2->add(pvArgs);
+        codegenDispatchMember(d, args2, pvArgs2, level, i);
+        codegenDispatchNested(d, args2, pvArgs2, level+1);
+    }
+    profileBranchWeights(sw, profileSite, d.ctx);
+}
+
+static void codegenDispatchCombined(DispatchLowering &d, unsigned caseCount)
+{
+    llvm::IRBuilder<> *builder = d.ctx->builder;
+
+    // an out-of-range tag could alias a valid combination, so every tag
+    // is range checked before the combined switch
+    llvm::Value *inRange = NULL;
+    llvm::Value *combined = NULL;
+    for (unsigned i = 0; i < d.dispatchIndices.size(); ++i) {
+        llvm::Value *count = llvm::ConstantInt::get(llvmIntType(32), d.memberCounts[i]);
+        llvm::Value *valid = builder->CreateICmpULT(d.tags[i], count);
+        inRange = inRange ? builder->CreateAnd(inRange, valid) : valid;
+        combined = combined
+            ? builder->CreateAdd(builder->CreateMul(combined, count), d.tags[i])
+            : d.tags[i];
+    }
+    llvm::BasicBlock *switchBlock = newBasicBlock("dispatchSwitch", d.ctx);
+    llvm::BasicBlock *checkBlock = newBasicBlock("dispatchCheck", d.ctx);
+    builder->CreateCondBr(inRange, switchBlock, checkBlock);
+
+    // find the first invalid tag for invalidDispatch
+    builder->SetInsertPoint(checkBlock);
+    for (unsigned i = 0; i + 1 < d.dispatchIndices.size(); ++i) {
+        llvm::Value *count = llvm::ConstantInt::get(llvmIntType(32), d.memberCounts[i]);
+        llvm::Value *valid = builder->CreateICmpULT(d.tags[i], count);
+        llvm::BasicBlock *nextBlock = newBasicBlock("dispatchCheck", d.ctx);
+        builder->CreateCondBr(valid, nextBlock, dispatchInvalidBlock(d, i));
+        builder->SetInsertPoint(nextBlock);
+    }
+    builder->CreateBr(dispatchInvalidBlock(d, d.dispatchIndices.size() - 1));
+
+    builder->SetInsertPoint(switchBlock);
+    llvm::BasicBlock *unreachableBlock = newBasicBlock("dispatchUnreachable", d.ctx);
+    unsigned profileSite = profileBranchSite(d.ctx);
+    llvm::SwitchInst *sw = builder->CreateSwitch(combined, unreachableBlock, caseCount);
+    for (unsigned c = 0; c < caseCount; ++c) {
+        llvm::BasicBlock *caseBlock = newBasicBlock("dispatchCase", d.ctx);
+        sw->addCase(llvm::ConstantInt::get(llvmIntType(32), c), caseBlock);
+        builder->SetInsertPoint(caseBlock);
+        profileCountEdge(profileSite, c+1, d.ctx);
+
+        MultiCValuePtr args2 = new MultiCValue();
+        args2->add(d.args);
+        MultiPValuePtr pvArgs2 = new MultiPValue();
+        pvArgs2->add(d.pvArgs);
+        unsigned rest = c;
+        for (unsigned i = d.dispatchIndices.size(); i > 0; --i) {
+            unsigned tag = rest % d.memberCounts[i-1];
+            rest /= d.memberCounts[i-1];
+            codegenDispatchMember(d, args2, pvArgs2, i-1, tag);
+        }
+        codegenDispatchBranch(d, args2, pvArgs2);
+    }
+
+    profileBranchWeights(sw, profileSite, d.ctx);
+
+    builder->SetInsertPoint(unreachableBlock);
+    builder->CreateUnreachable();
+}
+
 void codegenDispatch(ObjectPtr obj,
                      MultiCValuePtr args,
                      MultiPValuePtr pvArgs,
@@ -2267,72 +2924,57 @@ void codegenDispatch(ObjectPtr obj,
     computeArgsKey(pvArgs, argsKey, argsTempness);
     CompileContextPusher pusher(obj, argsKey);
 
-    unsigned index = dispatchIndices[0];
-    vector<unsigned> dispatchIndices2(dispatchIndices.begin() + 1,
-                                      dispatchIndices.end());
-
-    MultiCValuePtr prefix = new MultiCValue();
-    MultiPValuePtr pvPrefix = new MultiPValue();
-    for (unsigned i = 0; i < index; ++i) {
-        prefix->add(args->values[i]);
-        pvPrefix->add(pvArgs->values[i]);
-    }
-    MultiCValuePtr suffix = new MultiCValue();
-    MultiPValuePtr pvSuffix = new MultiPValue();
-    for (unsigned i = index+1; i < args->size(); ++i) {
-        suffix->add(args->values[i]);
-        pvSuffix->add(pvArgs->values[i]);
-    }
-    CValuePtr cvDispatch = args->values[index];
-    PVData const &pvDispatch = pvArgs->values[index];
-
-    unsigned memberCount = dispatchTagCount(pvDispatch.type);
-    llvm::Value *llTag = codegenDispatchTag(cvDispatch, ctx);
-
-    vector<llvm::BasicBlock *> callBlocks;
-    vector<llvm::BasicBlock *> elseBlocks;
+    DispatchLowering d;
+    d.obj = obj;
+    d.args = args;
+    d.pvArgs = pvArgs;
+    d.dispatchIndices = dispatchIndices;
+    d.ctx = ctx;
+
+    unsigned caseCount = 1;
+    for (unsigned i = 0; i < dispatchIndices.size(); ++i) {
+        CValuePtr cvDispatch = args->values[dispatchIndices[i]];
+        PVData const &pvDispatch = pvArgs->values[dispatchIndices[i]];
+        unsigned memberCount = dispatchTagCount(pvDispatch.type);
+        d.memberCounts.push_back(memberCount);
+        d.tags.push_back(codegenDispatchTag(cvDispatch, ctx));
+        d.invalidBlocks.push_back(NULL);
+        if (caseCount <= MAX_COMBINED_DISPATCH_CASES)
+            caseCount *= memberCount;
+    }
+
+    beginBranch(ctx);
+    if (dispatchIndices.size() > 1 && caseCount <= MAX_COMBINED_DISPATCH_CASES)
+        codegenDispatchCombined(d, caseCount);
+    else
+        codegenDispatchNested(d, args, pvArgs, 0);
 
-    for (unsigned i = 0; i < memberCount; ++i) {
-        callBlocks.push_back(newBasicBlock("dispatchCase", ctx));
-        elseBlocks.push_back(newBasicBlock("dispatchNext", ctx));
-    }
     llvm::BasicBlock *finalBlock = newBasicBlock("finalBlock", ctx);
 
-    for (unsigned i = 0; i < memberCount; ++i) {
-        llvm::Value *tagCase = llvm::ConstantInt::get(llvmIntType(32), i);
-        llvm::Value *cond = ctx->builder->CreateICmpEQ(llTag, tagCase);
-        ctx->builder->CreateCondBr(cond, callBlocks[i], elseBlocks[i]);
-
-        ctx->builder->SetInsertPoint(callBlocks[i]);
-
-        MultiPValuePtr pvArgs2 = new MultiPValue();
-        pvArgs2->add(pvPrefix);
-        PVData pvDispatch2 = analyzeDispatchIndex(pvDispatch, i, ctx->cst);
-        pvArgs2->add(pvDispatch2);
-        pvArgs2->add(pvSuffix);
-        MultiCValuePtr args2 = new MultiCValue();
-        args2->add(prefix);
-        args2->add(codegenDispatchIndex(cvDispatch, pvDispatch2, i, ctx));
-        args2->add(suffix);
-
-        codegenDispatch(obj, args2, pvArgs2, dispatchIndices2, ctx, out);
-
+    for (size_t i = 0; i < d.callees.size(); ++i) {
+        DispatchCallee &callee = d.callees[i];
+        ctx->builder->SetInsertPoint(callee.block);
+        codegenCallValue(staticCValue(obj, ctx), callee.args, callee.pvArgs, ctx, out);
         ctx->builder->CreateBr(finalBlock);
-
-        ctx->builder->SetInsertPoint(elseBlocks[i]);
     }
 
-    codegenCallValue(staticCValue(operator_invalidDispatch(ctx->cst), ctx),
-                     new MultiCValue(cvDispatch),
-                     ctx,
-                     new MultiCValue());
-    ctx->builder->CreateBr(finalBlock);
+    for (unsigned i = 0; i < dispatchIndices.size(); ++i) {
+        if (!d.invalidBlocks[i])
+            continue;
+        ctx->builder->SetInsertPoint(d.invalidBlocks[i]);
+        codegenCallValue(staticCValue(operator_invalidDispatch(ctx->cst), ctx),
+                         new MultiCValue(args->values[dispatchIndices[i]]),
+                         ctx,
+                         new MultiCValue());
+        ctx->builder->CreateBr(finalBlock);
+    }
+    endBranch(ctx);
 
     ctx->builder->SetInsertPoint(finalBlock);
 }
 
 
-
+
 //
 // codegenCallValue
 //
@@ -2460,7 +3102,7 @@ bool codegenShortcut(ObjectPtr callable,
             CValuePtr out0 = out->values[0];
             assert(out0->type == t);
             llvm::Value *v = ctx->builder->CreateLoad(cv->llValue);
-            ctx->builder->CreateStore(v, out0->llValue);
+            codegenStore(v, out0, ctx);
             return true;
         }
         return false;
@@ -2653,7 +3295,9 @@ void codegenLowlevelCall(llvm::Value *llCallable,
     assert(ctx->exceptionValue != NULL);
     ctx->builder->CreateStore(ptrResult, ctx->exceptionValue);
     JumpTarget *jt = &ctx->exceptionTargets.back();
+    beginBranch(ctx);
     cgDestroyStack(jt->stackMarker, ctx, true);
+    endBranch(ctx);
     // jt might be invalidated at this point
     jt = &ctx->exceptionTargets.back();
     ctx->builder->CreateBr(jt->block);
@@ -2891,15 +3535,13 @@ void codegenLLVMBody(InvokeEntry* entry, llvm::StringRef callableName)
 
 
 //
-// getCodeName
+// printCodeKey, getCodeName
 //
 
-static string getCodeName(InvokeEntry* entry)
+void printCodeKey(llvm::raw_ostream &sout, InvokeEntry* entry)
 {
     SafePrintNameEnabler enabler;
     ObjectPtr x = entry->callable;
-    llvm::SmallString<128> buf;
-    llvm::raw_svector_ostream sout(buf);
 
     printModuleQualification(sout, staticModule(x, entry->env->cst));
 
@@ -2943,6 +3585,36 @@ static string getCodeName(InvokeEntry* entry)
         sout << entry->argsKey[i];
     }
     sout << ')';
+}
+
+void printCodeTempness(llvm::raw_ostream &out, InvokeEntry* entry)
+{
+    vector<FormalArgPtr> const &formalArgs = entry->code->formalArgs;
+    if (!formalArgs.empty()) {
+        out << ' ';
+        for (size_t i = 0; i < formalArgs.size(); ++i) {
+            switch (formalArgs[i]->tempness) {
+            case TEMPNESS_LVALUE : out << 'l'; break;
+            case TEMPNESS_RVALUE : out << 'r'; break;
+            case TEMPNESS_FORWARD : out << 'f'; break;
+            default : out << '-'; break;
+            }
+        }
+    }
+    if (!entry->forwardedRValueFlags.empty()) {
+        out << ' ';
+        for (size_t i = 0; i < entry->forwardedRValueFlags.size(); ++i)
+            out << (entry->forwardedRValueFlags[i] ? 'r' : 'l');
+    }
+}
+
+static string getCodeName(InvokeEntry* entry)
+{
+    SafePrintNameEnabler enabler;
+    llvm::SmallString<128> buf;
+    llvm::raw_svector_ostream sout(buf);
+
+    printCodeKey(sout, entry);
     if (!entry->returnTypes.empty()) {
         sout << ' ';
         for (size_t i = 0; i < entry->returnTypes.size(); ++i) {
@@ -2973,34 +3645,93 @@ static bool blockIsNop(llvm::BasicBlock *codeBlock, llvm::BasicBlock *returnBloc
     return false;
 }
 
+llvm::FunctionType *llvmCodeFunctionType(InvokeEntry* entry)
+{
+    vector<llvm::Type *> llArgTypes;
+    for (size_t i = 0; i < entry->argsKey.size(); ++i)
+        llArgTypes.push_back(llvmPointerType(entry->argsKey[i]));
+    for (size_t i = 0; i < entry->returnTypes.size(); ++i) {
+        TypePtr rt = entry->returnTypes[i];
+        if (entry->returnIsRef[i])
+            llArgTypes.push_back(llvmPointerType(pointerType(rt)));
+        else
+            llArgTypes.push_back(llvmPointerType(rt));
+    }
+    return llvm::FunctionType::get(
+        exceptionReturnType(entry->env->cst), llArgTypes, false);
+}
+
+// the analyzer found that entry's body generates the same code as
+// entry->sharedBody's, so entry's function casts its arguments and calls
+// that one
+static void codegenSharedBody(InvokeEntry* entry, llvm::StringRef callableName)
+{
+    CompilerState* cst = entry->env->cst;
+    InvokeEntry* twin = entry->sharedBody;
+    if (!twin->llvmFunc)
+        codegenCodeBody(twin);
+
+    llvm::Function *llFunc =
+        llvm::Function::Create(llvmCodeFunctionType(entry),
+                               llvm::Function::InternalLinkage,
+                               callableName,
+                               cst->llvmModule);
+    llFunc->addFnAttr(llvm::Attributes::InlineHint);
+    entry->llvmFunc = llFunc;
+    entry->runtimeNop = twin->runtimeNop;
+    entry->typePunning = twin->typePunning;
+
+    llvm::BasicBlock *block =
+        llvm::BasicBlock::Create(llvm::getGlobalContext(), "code", llFunc);
+    llvm::IRBuilder<> builder(block);
+    vector<llvm::Value *> llArgs;
+    llvm::Function::arg_iterator ai = llFunc->arg_begin();
+    llvm::Function::arg_iterator ti = twin->llvmFunc->arg_begin();
+    for (; ai != llFunc->arg_end(); ++ai, ++ti)
+        llArgs.push_back(builder.CreateBitCast(&*ai, ti->getType()));
+    llvm::CallInst *call = builder.CreateCall(twin->llvmFunc, llArgs);
+    call->setTailCall();
+    builder.CreateRet(call);
+}
+
 void codegenCodeBody(InvokeEntry* entry)
 {
+    TimingPhase phase("codegen bodies");
+    InstantiationProfileScope profile(entry, PROFILE_CODEGEN);
+    TraceSpan span("codegen", entry->callable, entry->argsKey);
     CompilerState* cst = entry->env->cst;
     llvm::DIBuilder* llvmDIBuilder = cst->llvmDIBuilder;
 
     assert(entry->analyzed);
     assert(!entry->llvmFunc);
 
+    if (prebuiltUseEnabled(cst) && codegenPrebuiltDeclaration(entry)) {
+        noteCodeInterface(entry);
+        return;
+    }
+    if (prebuiltOutputEnabled(cst))
+        notePrebuiltCandidate(entry);
+
     string callableName = getCodeName(entry);
 
     if (entry->code->isLLVMBody()) {
+        // inline LLVM is free to cast what it returns
+        entry->typePunning = true;
         codegenLLVMBody(entry, callableName);
+        noteCodeInterface(entry);
+        if (!entry->multiversions.empty())
+            codegenMultiversions(entry);
         return;
     }
 
-    vector<llvm::Type *> llArgTypes;
-    for (size_t i = 0; i < entry->argsKey.size(); ++i)
-        llArgTypes.push_back(llvmPointerType(entry->argsKey[i]));
-    for (size_t i = 0; i < entry->returnTypes.size(); ++i) {
-        TypePtr rt = entry->returnTypes[i];
-        if (entry->returnIsRef[i])
-            llArgTypes.push_back(llvmPointerType(pointerType(rt)));
-        else
-            llArgTypes.push_back(llvmPointerType(rt));
+    if (entry->sharedBody != NULL) {
+        codegenSharedBody(entry, callableName);
+        noteCodeInterface(entry);
+        return;
     }
 
-    llvm::FunctionType *llFuncType =
-        llvm::FunctionType::get(exceptionReturnType(cst), llArgTypes, false);
+    llvm::FunctionType *llFuncType = llvmCodeFunctionType(entry);
+    unsigned llArgCount = llFuncType->getNumParams();
 
     string llvmFuncName = callableName;
 
@@ -3022,7 +3753,7 @@ void codegenCodeBody(InvokeEntry* entry)
         break;
     }
 
-    for (unsigned i = 1; i <= llArgTypes.size(); ++i) {
+    for (unsigned i = 1; i <= llArgCount; ++i) {
         llvm::Attributes attrs = llvm::Attributes::get(
             llFunc->getContext(),
             llvm::Attributes::NoAlias);
@@ -3032,6 +3763,11 @@ void codegenCodeBody(InvokeEntry* entry)
     entry->llvmFunc = llFunc;
 
     CodegenContext ctx(cst, entry->llvmFunc);
+    if (profileGenerateEnabled || profileUseEnabled) {
+        llvm::raw_string_ostream profileName(ctx.profileName);
+        profileName << callableName;
+        printCodeTempness(profileName, entry);
+    }
 
     unsigned line, column;
     llvm::DIFile file;
@@ -3040,27 +3776,29 @@ void codegenCodeBody(InvokeEntry* entry)
 
         vector<llvm::Value*> debugParamTypes;
         debugParamTypes.push_back(llvmVoidTypeDebugInfo());
-        for (size_t i = 0; i < entry->argsKey.size(); ++i) {
-            llvm::DIType argType = llvmTypeDebugInfo(entry->argsKey[i]);
-            llvm::DIType argRefType
-                = llvmDIBuilder->createReferenceType(
-                    llvm::dwarf::DW_TAG_reference_type,
-                    argType);
-            debugParamTypes.push_back(argRefType);
-        }
-        for (size_t i = 0; i < entry->returnTypes.size(); ++i) {
-            llvm::DIType returnType = llvmTypeDebugInfo(entry->returnTypes[i]);
-            llvm::DIType returnRefType = entry->returnIsRef[i]
-                ? llvmDIBuilder->createReferenceType(
-                    llvm::dwarf::DW_TAG_reference_type,
-                    llvmDIBuilder->createReferenceType(
+        if (fullDebugInfo(cst)) {
+            for (size_t i = 0; i < entry->argsKey.size(); ++i) {
+                llvm::DIType argType = llvmTypeDebugInfo(entry->argsKey[i]);
+                llvm::DIType argRefType
+                    = llvmDIBuilder->createReferenceType(
                         llvm::dwarf::DW_TAG_reference_type,
-                        returnType))
-                : llvmDIBuilder->createReferenceType(
-                    llvm::dwarf::DW_TAG_reference_type,
-                    returnType);
+                        argType);
+                debugParamTypes.push_back(argRefType);
+            }
+            for (size_t i = 0; i < entry->returnTypes.size(); ++i) {
+                llvm::DIType returnType = llvmTypeDebugInfo(entry->returnTypes[i]);
+                llvm::DIType returnRefType = entry->returnIsRef[i]
+                    ? llvmDIBuilder->createReferenceType(
+                        llvm::dwarf::DW_TAG_reference_type,
+                        llvmDIBuilder->createReferenceType(
+                            llvm::dwarf::DW_TAG_reference_type,
+                            returnType))
+                    : llvmDIBuilder->createReferenceType(
+                        llvm::dwarf::DW_TAG_reference_type,
+                        returnType);
 
-            debugParamTypes.push_back(returnRefType);
+                debugParamTypes.push_back(returnRefType);
+            }
         }
 
         llvm::DIArray debugParamArray = llvmDIBuilder->getOrCreateArray(
@@ -3084,12 +3822,16 @@ void codegenCodeBody(InvokeEntry* entry)
             entry->llvmFunc
         );
 
-        ctx.pushDebugScope(llvmDIBuilder->createLexicalBlock(
-            entry->getDebugInfo(),
-            file,
-            line,
-            column
-            ));
+        if (fullDebugInfo(cst)) {
+            ctx.pushDebugScope(llvmDIBuilder->createLexicalBlock(
+                entry->getDebugInfo(),
+                file,
+                line,
+                column
+                ));
+        } else {
+            ctx.pushDebugScope(llvm::DILexicalBlock(entry->debugInfo));
+        }
     }
 
     llvm::BasicBlock *initBlock = newBasicBlock("init", &ctx);
@@ -3108,6 +3850,8 @@ void codegenCodeBody(InvokeEntry* entry)
 
     ctx.exceptionValue = ctx.initBuilder->CreateAlloca(exceptionReturnType(cst), NULL, "exception");
 
+    profileFunctionEntry(&ctx);
+
     EnvPtr env = new Env(entry->env);
 
     llvm::Function::arg_iterator ai = llFunc->arg_begin();
@@ -3119,7 +3863,7 @@ void codegenCodeBody(InvokeEntry* entry)
         CValuePtr cvalue = new CValue(entry->fixedArgTypes[i], llArgValue);
         cvalue->forwardedRValue = entry->forwardedRValueFlags[i];
         addLocal(env, entry->fixedArgNames[i], cvalue.ptr());
-        if (llvmDIBuilder != NULL) {
+        if (fullDebugInfo(cst)) {
             unsigned line, column;
             Location argLocation = entry->origCode->formalArgs[i]->location;
             llvm::DIFile file = getDebugLineCol(argLocation, line, column);
@@ -3165,7 +3909,7 @@ void codegenCodeBody(InvokeEntry* entry)
             cvalue->forwardedRValue = entry->forwardedRValueFlags[i+j];
             varArgs->add(cvalue);
 
-            if (llvmDIBuilder != NULL) {
+            if (fullDebugInfo(cst)) {
                 llvm::DebugLoc debugLoc = llvm::DebugLoc::get(line, column, entry->getDebugInfo());
                 llvm::DIVariable debugVar = llvmDIBuilder->createLocalVariable(
                     llvm::dwarf::DW_TAG_arg_variable, // tag
@@ -3197,7 +3941,7 @@ void codegenCodeBody(InvokeEntry* entry)
             CValuePtr cvalue = new CValue(entry->fixedArgTypes[i], llArgValue);
             cvalue->forwardedRValue = entry->forwardedRValueFlags[i+j];
             addLocal(env, entry->fixedArgNames[i], cvalue.ptr());
-            if (llvmDIBuilder != NULL) {
+            if (fullDebugInfo(cst)) {
                 unsigned line, column;
                 Location argLocation = entry->origCode->formalArgs[i]->location;
                 llvm::DIFile file = getDebugLineCol(argLocation, line, column);
@@ -3257,7 +4001,7 @@ void codegenCodeBody(InvokeEntry* entry)
                 sout << "return.." << i;
             returns[i].value->llValue->setName(sout.str());
 
-            if (rspec->name != NULL && llvmDIBuilder != NULL) {
+            if (rspec->name != NULL && fullDebugInfo(cst)) {
                 unsigned line, column;
                 Location argLocation = rspec->location;
                 llvm::DIFile file = getDebugLineCol(argLocation, line, column);
@@ -3329,6 +4073,13 @@ void codegenCodeBody(InvokeEntry* entry)
     assert(ctx.exceptionValue != NULL);
     llvm::Value *llExcept = ctx.builder->CreateLoad(ctx.exceptionValue);
     ctx.builder->CreateRet(llExcept);
+
+    if (ctx.typePunning)
+        entry->typePunning = true;
+    noteCodeInterface(entry);
+
+    if (!entry->multiversions.empty())
+        codegenMultiversions(entry);
 }
 
 
@@ -3741,7 +4492,7 @@ static EnvPtr codegenStatementExpressionStatements(llvm::ArrayRef<StatementPtr>
 
 static size_t codegenBeginScope(StatementPtr scopeStmt, CodegenContext* ctx)
 {
-    if (ctx->cst->llvmDIBuilder != NULL) {
+    if (fullDebugInfo(ctx->cst)) {
         llvm::DILexicalBlock outerScope = ctx->getDebugScope();
         unsigned line, column;
         llvm::DIFile file = getDebugLineCol(scopeStmt->location, line, column);
@@ -3757,10 +4508,16 @@ static size_t codegenBeginScope(StatementPtr scopeStmt, CodegenContext* ctx)
 
 static void codegenEndScope(size_t marker, bool terminated, CodegenContext* ctx)
 {
-    if (!terminated)
+    if (!terminated) {
         cgDestroyStack(marker, ctx, false);
+        for (size_t i = ctx->valueStack.size(); i > marker; --i) {
+            ValueStackEntry const &entry = ctx->valueStack[i-1];
+            if (entry.type == LOCAL_VALUE)
+                codegenLifetimeEnd(entry.value->llValue, ctx);
+        }
+    }
     cgPopStack(marker, ctx);
-    if (ctx->cst->llvmDIBuilder != NULL)
+    if (fullDebugInfo(ctx->cst))
         ctx->popDebugScope();
 }
 
@@ -4005,6 +4762,10 @@ bool codegenStatement(StatementPtr stmt,
         size_t marker = cgMarkStack(ctx);
         CValuePtr cv = codegenOneAsRef(x->condition, env2, ctx);
         BoolKind condBoolKind = typeBoolKind(cv->type);
+        // load the flag before the condition's temporaries end
+        llvm::Value *cond = NULL;
+        if (condBoolKind == BOOL_EXPR)
+            cond = codegenToBoolFlag(cv, ctx);
         cgDestroyAndPopStack(marker, ctx, false);
         clearTemps(tempMarker, ctx);
 
@@ -4018,9 +4779,12 @@ bool codegenStatement(StatementPtr stmt,
             falseBlock = newBasicBlock("ifFalse", ctx);
         }
 
+        unsigned profileSite = 0;
         if (condBoolKind == BOOL_EXPR) {
-            llvm::Value *cond = codegenToBoolFlag(cv, ctx);
-            ctx->builder->CreateCondBr(cond, trueBlock, falseBlock);
+            profileSite = profileBranchSite(ctx);
+            llvm::BranchInst *branch =
+                ctx->builder->CreateCondBr(cond, trueBlock, falseBlock);
+            profileBranchWeights(branch, profileSite, ctx);
         } else {
             ctx->builder->CreateBr(condBoolKind == BOOL_STATIC_TRUE ? trueBlock : falseBlock);
         }
@@ -4030,6 +4794,8 @@ bool codegenStatement(StatementPtr stmt,
 
         if (condBoolKind == BOOL_EXPR || condBoolKind == BOOL_STATIC_TRUE) {
             ctx->builder->SetInsertPoint(trueBlock);
+            if (condBoolKind == BOOL_EXPR)
+                profileCountEdge(profileSite, 0, ctx);
             terminated1 = codegenStatement(x->thenPart, env2, ctx);
             if (!terminated1) {
                 if (!mergeBlock)
@@ -4042,6 +4808,8 @@ bool codegenStatement(StatementPtr stmt,
 
         if (condBoolKind == BOOL_EXPR || condBoolKind == BOOL_STATIC_FALSE) {
             ctx->builder->SetInsertPoint(falseBlock);
+            if (condBoolKind == BOOL_EXPR)
+                profileCountEdge(profileSite, 1, ctx);
             if (x->elsePart.ptr())
                 terminated2 = codegenStatement(x->elsePart, env2, ctx);
             if (!terminated2) {
@@ -4111,11 +4879,25 @@ bool codegenStatement(StatementPtr stmt,
         cgDestroyAndPopStack(marker, ctx, false);
         clearTemps(tempMarker, ctx);
 
-        ctx->builder->CreateCondBr(cond, whileBody, whileEnd);
+        // breaks also reach whileEnd, so the exit edge is counted in a
+        // block of its own
+        unsigned profileSite = profileBranchSite(ctx);
+        llvm::BasicBlock *whileExit = whileEnd;
+        if (profileGenerateEnabled)
+            whileExit = newBasicBlock("whileExit", ctx);
+        llvm::BranchInst *branch =
+            ctx->builder->CreateCondBr(cond, whileBody, whileExit);
+        profileBranchWeights(branch, profileSite, ctx);
+        if (whileExit != whileEnd) {
+            ctx->builder->SetInsertPoint(whileExit);
+            profileCountEdge(profileSite, 1, ctx);
+            ctx->builder->CreateBr(whileEnd);
+        }
 
         ctx->breaks.push_back(JumpTarget(whileEnd, cgMarkStack(ctx)));
         ctx->continues.push_back(JumpTarget(whileContinue, cgMarkStack(ctx)));
         ctx->builder->SetInsertPoint(whileBody);
+        profileCountEdge(profileSite, 0, ctx);
         bool terminated = codegenStatement(x->body, env2, ctx);
         if (!terminated) {
             ctx->builder->CreateBr(whileContinue);
@@ -4364,7 +5146,7 @@ EnvPtr codegenBinding(BindingPtr x, EnvPtr env, CodegenContext* ctx)
         for (unsigned i = 0; i < mpv->values.size(); ++i) {
             CValuePtr cv = codegenAllocNewValue(mpv->values[i].type, ctx);
             mcv->add(cv);
-            if (llvmDIBuilder != NULL) {
+            if (fullDebugInfo(ctx->cst)) {
                 llvm::DILexicalBlock debugBlock = ctx->getDebugScope();
                 llvm::DIVariable debugVar = llvmDIBuilder->createLocalVariable(
                     llvm::dwarf::DW_TAG_auto_variable, // tag
@@ -4433,7 +5215,7 @@ EnvPtr codegenBinding(BindingPtr x, EnvPtr env, CodegenContext* ctx)
             TypePtr ptrType = pointerType(pv.type);
             CValuePtr cvRef = codegenAllocNewValue(ptrType, ctx);
             mcv->add(cvRef);
-            if (llvmDIBuilder != NULL) {
+            if (fullDebugInfo(ctx->cst)) {
                 llvm::DILexicalBlock debugBlock = ctx->getDebugScope();
                 llvm::DIVariable debugVar = llvmDIBuilder->createLocalVariable(
                     llvm::dwarf::DW_TAG_auto_variable, // tag
@@ -4506,7 +5288,7 @@ EnvPtr codegenBinding(BindingPtr x, EnvPtr env, CodegenContext* ctx)
                 cv = codegenAllocNewValue(ptrType, ctx);
             }
             mcv->add(cv);
-            if (llvmDIBuilder != NULL) {
+            if (fullDebugInfo(ctx->cst)) {
                 llvm::DILexicalBlock debugBlock = ctx->getDebugScope();
                 llvm::DIType debugType = llvmTypeDebugInfo(pv.type);
                 llvm::DIVariable debugVar = llvmDIBuilder->createLocalVariable(
@@ -4845,7 +5627,7 @@ static llvm::Value *numericValue(MultiCValuePtr args,
         }
         type = cv->type;
     }
-    return ctx->builder->CreateLoad(cv->llValue);
+    return codegenLoad(cv, ctx);
 }
 
 static llvm::Value *floatValue(MultiCValuePtr args,
@@ -4867,7 +5649,7 @@ static llvm::Value *floatValue(MultiCValuePtr args,
         }
         type = (FloatType*)cv->type.ptr();
     }
-    return ctx->builder->CreateLoad(cv->llValue);
+    return codegenLoad(cv, ctx);
 }
 
 static llvm::Value *integerOrPointerLikeValue(MultiCValuePtr args,
@@ -4892,7 +5674,7 @@ static llvm::Value *integerOrPointerLikeValue(MultiCValuePtr args,
         }
         type = cv->type;
     }
-    return ctx->builder->CreateLoad(cv->llValue);
+    return codegenLoad(cv, ctx);
 }
 
 static void checkIntegerValue(MultiCValuePtr args,
@@ -4919,7 +5701,17 @@ static llvm::Value *integerValue(MultiCValuePtr args,
 {
     checkIntegerValue(args, index, type, ctx);
     CValuePtr cv = args->values[index];
-    return ctx->builder->CreateLoad(cv->llValue);
+    return codegenLoad(cv, ctx);
+}
+
+// whether every value of src is also a value of dest
+static bool integerTypeContains(IntegerTypePtr dest, IntegerType *src)
+{
+    if (dest->isSigned == src->isSigned)
+        return dest->bits >= src->bits;
+    if (dest->isSigned)
+        return dest->bits > src->bits;
+    return false;
 }
 
 static llvm::Value *pointerValue(MultiCValuePtr args,
@@ -4938,7 +5730,7 @@ static llvm::Value *pointerValue(MultiCValuePtr args,
         type = (PointerType *)cv->type.ptr();
         llvmType(type->pointeeType); // force the pointee type to be refined
     }
-    return ctx->builder->CreateLoad(cv->llValue);
+    return codegenLoad(cv, ctx);
 }
 
 static llvm::Value *pointerLikeValue(MultiCValuePtr args,
@@ -4958,7 +5750,7 @@ static llvm::Value *pointerLikeValue(MultiCValuePtr args,
                               cv->type);
         type = cv->type;
     }
-    return ctx->builder->CreateLoad(cv->llValue);
+    return codegenLoad(cv, ctx);
 }
 
 static llvm::Value* cCodePointerValue(MultiCValuePtr args,
@@ -5061,7 +5853,7 @@ static llvm::Value *enumValue(MultiCValuePtr args,
             argumentTypeError(index, "enum type", cv->type);
         type = (EnumType *)cv->type.ptr();
     }
-    return ctx->builder->CreateLoad(cv->llValue);
+    return codegenLoad(cv, ctx);
 }
 
 llvm::AtomicOrdering atomicOrderValue(MultiCValuePtr args, unsigned index)
@@ -5302,7 +6094,7 @@ void codegenPrimOp(PrimOpPtr x,
         llvm::Value *flag = ctx->builder->CreateICmpEQ(v, zero);
         CValuePtr out0 = out->values[0];
         assert(out0->type == cst->boolType);
-        ctx->builder->CreateStore(flag, out0->llValue);
+        codegenStore(flag, out0, ctx);
         break;
     }
 
@@ -5344,7 +6136,7 @@ void codegenPrimOp(PrimOpPtr x,
         assert(out->size() == 1);
         CValuePtr out0 = out->values[0];
         assert(out0->type == cst->boolType);
-        ctx->builder->CreateStore(flag, out0->llValue);
+        codegenStore(flag, out0, ctx);
         break;
     }
 
@@ -5420,7 +6212,7 @@ void codegenPrimOp(PrimOpPtr x,
         assert(out->size() == 1);
         CValuePtr out0 = out->values[0];
         assert(out0->type == cst->boolType);
-        ctx->builder->CreateStore(flag, out0->llValue);
+        codegenStore(flag, out0, ctx);
         break;
     }
 
@@ -5443,7 +6235,7 @@ void codegenPrimOp(PrimOpPtr x,
         assert(out->size() == 1);
         CValuePtr out0 = out->values[0];
         assert(out0->type == t);
-        ctx->builder->CreateStore(result, out0->llValue);
+        codegenStore(result, out0, ctx);
         break;
     }
 
@@ -5466,7 +6258,7 @@ void codegenPrimOp(PrimOpPtr x,
         assert(out->size() == 1);
         CValuePtr out0 = out->values[0];
         assert(out0->type == t);
-        ctx->builder->CreateStore(result, out0->llValue);
+        codegenStore(result, out0, ctx);
         break;
     }
 
@@ -5489,7 +6281,7 @@ void codegenPrimOp(PrimOpPtr x,
         assert(out->size() == 1);
         CValuePtr out0 = out->values[0];
         assert(out0->type == t);
-        ctx->builder->CreateStore(result, out0->llValue);
+        codegenStore(result, out0, ctx);
         break;
     }
 
@@ -5503,7 +6295,7 @@ void codegenPrimOp(PrimOpPtr x,
         assert(out->size() == 1);
         CValuePtr out0 = out->values[0];
         assert(out0->type == t.ptr());
-        ctx->builder->CreateStore(result, out0->llValue);
+        codegenStore(result, out0, ctx);
         break;
     }
 
@@ -5525,7 +6317,7 @@ void codegenPrimOp(PrimOpPtr x,
         assert(out->size() == 1);
         CValuePtr out0 = out->values[0];
         assert(out0->type == t);
-        ctx->builder->CreateStore(result, out0->llValue);
+        codegenStore(result, out0, ctx);
         break;
     }
 
@@ -5543,7 +6335,7 @@ void codegenPrimOp(PrimOpPtr x,
         assert(out->size() == 1);
         CValuePtr out0 = out->values[0];
         assert(out0->type == t.ptr());
-        ctx->builder->CreateStore(result, out0->llValue);
+        codegenStore(result, out0, ctx);
         break;
     }
 
@@ -5561,7 +6353,7 @@ void codegenPrimOp(PrimOpPtr x,
         assert(out->size() == 1);
         CValuePtr out0 = out->values[0];
         assert(out0->type == t.ptr());
-        ctx->builder->CreateStore(result, out0->llValue);
+        codegenStore(result, out0, ctx);
         break;
     }
 
@@ -5574,7 +6366,7 @@ void codegenPrimOp(PrimOpPtr x,
         assert(out->size() == 1);
         CValuePtr out0 = out->values[0];
         assert(out0->type == t.ptr());
-        ctx->builder->CreateStore(result, out0->llValue);
+        codegenStore(result, out0, ctx);
         break;
     }
 
@@ -5591,7 +6383,7 @@ void codegenPrimOp(PrimOpPtr x,
         assert(out->size() == 1);
         CValuePtr out0 = out->values[0];
         assert(out0->type == t.ptr());
-        ctx->builder->CreateStore(result, out0->llValue);
+        codegenStore(result, out0, ctx);
         break;
     }
 
@@ -5604,7 +6396,7 @@ void codegenPrimOp(PrimOpPtr x,
         assert(out->size() == 1);
         CValuePtr out0 = out->values[0];
         assert(out0->type == t.ptr());
-        ctx->builder->CreateStore(result, out0->llValue);
+        codegenStore(result, out0, ctx);
         break;
     }
 
@@ -5617,7 +6409,7 @@ void codegenPrimOp(PrimOpPtr x,
         assert(out->size() == 1);
         CValuePtr out0 = out->values[0];
         assert(out0->type == t.ptr());
-        ctx->builder->CreateStore(result, out0->llValue);
+        codegenStore(result, out0, ctx);
         break;
     }
 
@@ -5630,7 +6422,7 @@ void codegenPrimOp(PrimOpPtr x,
         assert(out->size() == 1);
         CValuePtr out0 = out->values[0];
         assert(out0->type == t.ptr());
-        ctx->builder->CreateStore(result, out0->llValue);
+        codegenStore(result, out0, ctx);
         break;
     }
 
@@ -5642,7 +6434,7 @@ void codegenPrimOp(PrimOpPtr x,
         assert(out->size() == 1);
         CValuePtr out0 = out->values[0];
         assert(out0->type == t.ptr());
-        ctx->builder->CreateStore(result, out0->llValue);
+        codegenStore(result, out0, ctx);
         break;
     }
 
@@ -5712,7 +6504,7 @@ void codegenPrimOp(PrimOpPtr x,
         assert(out->size() == 1);
         CValuePtr out0 = out->values[0];
         assert(out0->type == dest);
-        ctx->builder->CreateStore(result, out0->llValue);
+        codegenStore(result, out0, ctx);
         break;
     }
 
@@ -5826,6 +6618,23 @@ void codegenPrimOp(PrimOpPtr x,
         assert(out->size() == 1);
         CValuePtr out0 = out->values[0];
         assert(out0->type == dest.ptr());
+        TypePtr src = args->values[1]->type;
+        if (src->typeKind == INTEGER_TYPE
+            && integerTypeContains(dest, (IntegerType *)src.ptr()))
+        {
+            // every source value fits, so there is nothing to check
+            llvm::Value *v = codegenLoad(args->values[1], ctx);
+            llvm::Value *result;
+            if (src == dest.ptr())
+                result = v;
+            else if (((IntegerType *)src.ptr())->isSigned)
+                result = ctx->builder->CreateSExt(v, llvmType(dest.ptr()));
+            else
+                result = ctx->builder->CreateZExt(v, llvmType(dest.ptr()));
+            codegenStore(result, out0, ctx);
+            addStatistic("integer overflow checks proven unnecessary", 1);
+            break;
+        }
         codegenCallValue(staticCValue(operator_doIntegerConvertChecked(cst), ctx),
                          args,
                          ctx,
@@ -5853,7 +6662,7 @@ void codegenPrimOp(PrimOpPtr x,
         assert(out->size() == 1);
         CValuePtr out0 = out->values[0];
         assert(out0->type == t.ptr());
-        ctx->builder->CreateStore(v, out0->llValue);
+        codegenStore(v, out0, ctx);
         break;
     }
 
@@ -5872,7 +6681,7 @@ void codegenPrimOp(PrimOpPtr x,
         assert(out->size() == 1);
         CValuePtr out0 = out->values[0];
         assert(out0->type == t.ptr());
-        ctx->builder->CreateStore(result, out0->llValue);
+        codegenStore(result, out0, ctx);
         break;
     }
 
@@ -5886,7 +6695,7 @@ void codegenPrimOp(PrimOpPtr x,
         assert(out->size() == 1);
         CValuePtr out0 = out->values[0];
         assert(out0->type == dest.ptr());
-        ctx->builder->CreateStore(result, out0->llValue);
+        codegenStore(result, out0, ctx);
         break;
     }
 
@@ -5901,7 +6710,9 @@ void codegenPrimOp(PrimOpPtr x,
         assert(out->size() == 1);
         CValuePtr out0 = out->values[0];
         assert(out0->type == dest);
-        ctx->builder->CreateStore(result, out0->llValue);
+        codegenStore(result, out0, ctx);
+        // the address may have been taken as any type
+        ctx->typePunning = true;
         break;
     }
 
@@ -5914,7 +6725,7 @@ void codegenPrimOp(PrimOpPtr x,
         llvm::PointerType *llType = llvm::dyn_cast<llvm::PointerType>(llvmType(dest));
         assert(llType != NULL);
         llvm::Value *result = llvm::ConstantPointerNull::get(llType);
-        ctx->builder->CreateStore(result, out0->llValue);
+        codegenStore(result, out0, ctx);
         break;
     }
 
@@ -6061,7 +6872,7 @@ void codegenPrimOp(PrimOpPtr x,
 
         llvm::Value *opaqueValue = ctx->builder->CreateBitCast(
             entry->llvmCWrappers[cc], llvmType(out0->type));
-        ctx->builder->CreateStore(opaqueValue, out0->llValue);
+        codegenStore(opaqueValue, out0, ctx);
         break;
     }
 
@@ -6090,7 +6901,9 @@ void codegenPrimOp(PrimOpPtr x,
         CValuePtr out0 = out->values[0];
         assert(out0->type == pointerType(dest));
         llvm::Value *result = ctx->builder->CreateBitCast(arg1, llvmPointerType(dest));
-        ctx->builder->CreateStore(result, out0->llValue);
+        codegenStore(result, out0, ctx);
+        if (!sameAccessTags(dest, src->type, cst))
+            ctx->typePunning = true;
         break;
     }
 
@@ -6114,7 +6927,7 @@ void codegenPrimOp(PrimOpPtr x,
         assert(out->size() == 1);
         CValuePtr out0 = out->values[0];
         assert(out0->type == pointerType(at->elementType));
-        ctx->builder->CreateStore(ptr, out0->llValue);
+        codegenStore(ptr, out0, ctx);
         break;
     }
 
@@ -6158,7 +6971,7 @@ void codegenPrimOp(PrimOpPtr x,
         assert(out->size() == 1);
         CValuePtr out0 = out->values[0];
         assert(out0->type == pointerType(tt->elementTypes[i]));
-        ctx->builder->CreateStore(ptr, out0->llValue);
+        codegenStore(ptr, out0, ctx);
         break;
     }
 
@@ -6266,14 +7079,14 @@ void codegenPrimOp(PrimOpPtr x,
                 assert(out->size() == 1);
                 CValuePtr out0 = out->values[0];
                 assert(out0->type == pointerType(fieldTypes[k]));
-                ctx->builder->CreateStore(ptr, out0->llValue);
+                codegenStore(ptr, out0, ctx);
             }
         } else {
             llvm::Value *ptr = ctx->builder->CreateConstGEP2_32(vrec, 0, unsigned(i));
             assert(out->size() == 1);
             CValuePtr out0 = out->values[0];
             assert(out0->type == pointerType(fieldTypes[i]));
-            ctx->builder->CreateStore(ptr, out0->llValue);
+            codegenStore(ptr, out0, ctx);
         }
         
         break;
@@ -6310,14 +7123,14 @@ void codegenPrimOp(PrimOpPtr x,
                 assert(out->size() == 1);
                 CValuePtr out0 = out->values[0];
                 assert(out0->type == pointerType(fieldTypes[k]));
-                ctx->builder->CreateStore(ptr, out0->llValue);
+                codegenStore(ptr, out0, ctx);
             }
         } else {
             llvm::Value *ptr = ctx->builder->CreateConstGEP2_32(vrec, 0, i);
             assert(out->size() == 1);
             CValuePtr out0 = out->values[0];
             assert(out0->type == pointerType(fieldTypes[i]));
-            ctx->builder->CreateStore(ptr, out0->llValue);
+            codegenStore(ptr, out0, ctx);
         }
         break;
     }
@@ -6407,7 +7220,7 @@ void codegenPrimOp(PrimOpPtr x,
         assert(out->size() == 1);
         CValuePtr out0 = out->values[0];
         assert(out0->type == pointerType(reprType));
-        ctx->builder->CreateStore(vvar, out0->llValue);
+        codegenStore(vvar, out0, ctx);
         break;
     }
 
@@ -6509,7 +7322,7 @@ void codegenPrimOp(PrimOpPtr x,
         assert(out->size() == 1);
         CValuePtr out0 = out->values[0];
         assert(out0->type == cst->cIntType);
-        ctx->builder->CreateStore(v, out0->llValue);
+        codegenStore(v, out0, ctx);
         break;
     }
 
@@ -6521,7 +7334,7 @@ void codegenPrimOp(PrimOpPtr x,
         assert(out->size() == 1);
         CValuePtr out0 = out->values[0];
         assert(out0->type == et.ptr());
-        ctx->builder->CreateStore(v, out0->llValue);
+        codegenStore(v, out0, ctx);
         break;
     }
 
@@ -6587,7 +7400,7 @@ void codegenPrimOp(PrimOpPtr x,
         assert(out->size() == 1);
         CValuePtr out0 = out->values[0];
         assert(out0->type == pointerType(cst->cSizeTType));
-        ctx->builder->CreateStore(value, out0->llValue);
+        codegenStore(value, out0, ctx);
         break;
     }
 
@@ -6630,7 +7443,7 @@ void codegenPrimOp(PrimOpPtr x,
         assert(out->size() == 1);
         CValuePtr out0 = out->values[0];
         assert(out0->type == argT);
-        ctx->builder->CreateStore(result, out0->llValue);
+        codegenStore(result, out0, ctx);
         break;
     }
 
@@ -6647,7 +7460,7 @@ void codegenPrimOp(PrimOpPtr x,
         assert(out->size() == 1);
         CValuePtr out0 = out->values[0];
         assert(out0->type == ptrT->pointeeType);
-        ctx->builder->CreateStore(result, out0->llValue);
+        codegenStore(result, out0, ctx);
         break;
     }
 
@@ -6691,7 +7504,7 @@ void codegenPrimOp(PrimOpPtr x,
         assert(out->size() == 1);
         CValuePtr out0 = out->values[0];
         assert(out0->type == oldvT);
-        ctx->builder->CreateStore(result, out0->llValue);
+        codegenStore(result, out0, ctx);
         break;
     }
 
@@ -6704,7 +7517,7 @@ void codegenPrimOp(PrimOpPtr x,
         assert(ctx->exceptionValue != NULL);
 
         llvm::Value *expv = ctx->builder->CreateLoad(ctx->exceptionValue);
-        ctx->builder->CreateStore(expv, out0->llValue);
+        codegenStore(expv, out0, ctx);
         break;
     }
 
@@ -6742,7 +7555,7 @@ void codegenPrimOp(PrimOpPtr x,
         CValuePtr out0 = out->values[0];
         assert(out0->type == cst->cIntType);
         llvm::Constant *value = llvm::ConstantInt::get(llvmIntType(32), args->size());
-        ctx->builder->CreateStore(value, out0->llValue);
+        codegenStore(value, out0, ctx);
         break;
     }
 
@@ -6904,7 +7717,7 @@ void codegenPrimOp(PrimOpPtr x,
         assert(out->size() == 1);
         CValuePtr out0 = out->values[0];
         assert(out0->type == args->values[0]->type);
-        ctx->builder->CreateStore(hinted, out0->llValue);
+        codegenStore(hinted, out0, ctx);
         break;
     }
 
@@ -7027,6 +7840,9 @@ static void finalizeSimpleContext(CodegenContext* ctx,
     llvm::Function::iterator bbi = ctx->llvmFunc->begin();
     ++bbi;
     ctx->initBuilder->CreateBr(&(*bbi));
+
+    if (ctx->typePunning)
+        notePunning(ctx->llvmFunc, ctx->cst);
 }
 
 static void initializeCtorsDtors(CompilerState* cst)
@@ -7076,10 +7892,15 @@ static void finalizeCtorsDtors(CompilerState* cst)
 
     finalizeSimpleContext(cst->constructorsCtx, operator_exceptionInInitializer(cst));
 
-    for (size_t i = cst->initializedGlobals.size(); i > 0; --i) {
+    // the destructor bodies were generated with the globals, so calling
+    // them can't initialize any more
+    size_t globalCount = cst->initializedGlobals.size();
+    for (size_t i = globalCount; i > 0; --i) {
         CValuePtr cv = cst->initializedGlobals[i-1];
         codegenValueDestroy(cv, cst->destructorsCtx);
     }
+    assert(cst->initializedGlobals.size() == globalCount);
+    codegenProfileDump(cst);
     finalizeSimpleContext(cst->destructorsCtx, operator_exceptionInFinalizer(cst));
 }
 
@@ -7097,9 +7918,8 @@ static void generateLLVMCtorsAndDtors(CompilerState* cst) {
 
     // make constants for llvm.global_ctors
     vector<llvm::Constant*> structElems1;
-    llvm::ConstantInt *prio1 =
-        llvm::ConstantInt::get(llvm::getGlobalContext(),
-                               llvm::APInt(32, llvm::StringRef("65535"), 10));
+    llvm::Constant *prio1 =
+        llvm::ConstantInt::get(llvmIntType(32), cst->initPriority);
     structElems1.push_back(prio1);
     structElems1.push_back(cst->constructorsCtx->llvmFunc);
     llvm::Constant *structVal1 = llvm::ConstantStruct::get(structType,
@@ -7119,9 +7939,8 @@ static void generateLLVMCtorsAndDtors(CompilerState* cst) {
     if (!isMsvcTarget(cst)) {
         // make constants for llvm.global_dtors
         vector<llvm::Constant*> structElems2;
-        llvm::ConstantInt *prio2 =
-            llvm::ConstantInt::get(llvm::getGlobalContext(),
-                                   llvm::APInt(32, llvm::StringRef("65535"), 10));
+        llvm::Constant *prio2 =
+            llvm::ConstantInt::get(llvmIntType(32), cst->initPriority);
         structElems2.push_back(prio2);
         structElems2.push_back(cst->destructorsCtx->llvmFunc);
         llvm::Constant *structVal2 = llvm::ConstantStruct::get(structType,
@@ -7179,27 +7998,51 @@ void codegenMain(ModulePtr module)
     codegenExternalProcedure(entryProc, true);
 }
 
-static void codegenModuleEntryPoints(ModulePtr module, bool importedExternals)
+static void codegenModuleEntryPoints(ModulePtr module,
+                                     bool importedExternals,
+                                     bool exportedOnly)
 {
     module->externalsGenerated = true;
     for (size_t i = 0; i < module->topLevelItems.size(); ++i) {
         TopLevelItemPtr x = module->topLevelItems[i];
         if (x->objKind == EXTERNAL_PROCEDURE) {
             ExternalProcedurePtr y = (ExternalProcedure *)x.ptr();
-            if (y->body.ptr())
-                codegenExternalProcedure(y, true);
+            if (!y->body)
+                continue;
+            if (exportedOnly) {
+                if (!y->attributesVerified)
+                    verifyAttributes(y, module->cst);
+                if (!y->attrDLLExport)
+                    continue;
+            }
+            codegenExternalProcedure(y, true);
         }
     }
 
     if (importedExternals) {
+        bool importedExportedOnly = module->cst->externalsOnDemand;
         vector<ImportPtr>::iterator ii, iend;
         for (ii = module->imports.begin(), iend = module->imports.end(); ii != iend; ++ii)
             if (!(*ii)->module->externalsGenerated)
-                codegenModuleEntryPoints((*ii)->module, importedExternals);
+                codegenModuleEntryPoints((*ii)->module, importedExternals,
+                                         importedExportedOnly);
+    }
+}
+
+// bodies for the imported externals referenced so far, including those
+// referenced by the bodies generated here
+static void codegenDemandedExternals(CompilerState* cst)
+{
+    while (!cst->demandedExternals.empty()) {
+        ExternalProcedurePtr x = cst->demandedExternals.back();
+        cst->demandedExternals.pop_back();
+        codegenExternalProcedure(x, true);
     }
 }
 
-void codegenEntryPoints(ModulePtr module, bool importedExternals)
+void codegenEntryPoints(ModulePtr module,
+                        bool importedExternals,
+                        bool externalsOnDemand)
 {
     CodegenContext theConstructorCtx(module->cst);
     CodegenContext theDestructorCtx(module->cst);
@@ -7210,14 +8053,27 @@ void codegenEntryPoints(ModulePtr module, bool importedExternals)
     codegenTopLevelLLVM(module);
     initializeCtorsDtors(module->cst);
     generateLLVMCtorsAndDtors(module->cst);
-    codegenModuleEntryPoints(module, importedExternals);
+    module->cst->externalsOnDemand = importedExternals && externalsOnDemand;
+    codegenModuleEntryPoints(module, importedExternals, false);
 
     ObjectPtr mainProc = lookupPrivate(module, Identifier::get("main"));
     
     if (mainProc != NULL)
         codegenMain(module);
-
+    if (moduleInterfaceEnabled(module->cst))
+        codegenModuleInterface(module);
+
+    // every body has to exist before the constructor and destructor
+    // functions are closed, since a body can initialize globals, whose
+    // initializers go in the constructor and whose destructors, generated
+    // along with them, can demand more externals. draining the queue
+    // reaches that fixed point.
+    codegenDemandedExternals(module->cst);
     finalizeCtorsDtors(module->cst);
+    assert(module->cst->demandedExternals.empty());
+    module->cst->externalsOnDemand = false;
+
+    propagateTypePunning(module->cst);
 
     if (module->cst->llvmDIBuilder != NULL)
         module->cst->llvmDIBuilder->finalize();
@@ -7318,7 +8174,7 @@ void codegenBeforeRepl(ModulePtr module) {
     codegenTopLevelLLVMRecursive(module);
     initializeCtorsDtors(module->cst);
     generateLLVMCtorsAndDtors(module->cst);
-    codegenModuleEntryPoints(module, false);
+    codegenModuleEntryPoints(module, false, false);
 }
 
 void codegenAfterRepl(llvm::Function*& ctor, llvm::Function*& dtor, 
@@ -132,6 +132,11 @@ struct CodegenContext {
     vector<StackSlot> allocatedSlots;
     vector<StackSlot> discardedSlots;
 
+    // nonzero while generating code that runs on only some paths through
+    // a statement; slots allocated there never get lifetime markers
+    int branchDepth;
+    set<llvm::Value *> unmarkedSlots;
+
     vector< vector<CReturn> > returnLists;
     vector<JumpTarget> returnTargets;
     llvm::StringMap<JumpTarget> labels;
@@ -144,15 +149,25 @@ struct CodegenContext {
 
     int callByNameDepth;
 
+    // -profile-generate/-profile-use keys; see pgo.hpp
+    string profileName;
+    unsigned profileSites;
+
+    // set when bitcast is generated; the function's TBAA tags are dropped
+    bool typePunning;
+
     CodegenContext(CompilerState* cst)
         : llvmFunc(NULL),
           initBuilder(NULL),
           builder(NULL),
           valueForStatics(NULL),
+          branchDepth(0),
           exceptionValue(NULL),
           inlineDepth(0),
           checkExceptions(true),
           callByNameDepth(0),
+          profileSites(0),
+          typePunning(false),
           cst(cst)
     {
     }
@@ -162,10 +177,13 @@ struct CodegenContext {
           initBuilder(NULL),
           builder(NULL),
           valueForStatics(NULL),
+          branchDepth(0),
           exceptionValue(NULL),
           inlineDepth(0),
           checkExceptions(true),
           callByNameDepth(0),
+          profileSites(0),
+          typePunning(false),
           cst(cst)
     {
     }
@@ -231,7 +249,17 @@ InvokeEntry* codegenCallable(ObjectPtr x,
 void codegenCodeBody(InvokeEntry* entry);
 void codegenCWrapper(InvokeEntry* entry);
 
-void codegenEntryPoints(ModulePtr module, bool importedExternals);
+// prints entry's module, callable and argument types, as in the names of
+// generated functions
+void printCodeKey(llvm::raw_ostream &out, InvokeEntry* entry);
+// prints the tempness of entry's formal arguments and the rvalue flags of
+// its forwarded ones, which tell apart entries printCodeKey prints alike
+void printCodeTempness(llvm::raw_ostream &out, InvokeEntry* entry);
+llvm::FunctionType *llvmCodeFunctionType(InvokeEntry* entry);
+
+void codegenEntryPoints(ModulePtr module,
+                        bool importedExternals,
+                        bool externalsOnDemand);
 void codegenMain(ModulePtr module);
 
 void codegenBeforeRepl(ModulePtr module);
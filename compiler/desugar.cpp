@@ -381,25 +381,61 @@ StatementPtr desugarSwitchStatement(SwitchPtr x, CompilerState* cst) {
     return block.ptr();
 }
 
-static SourcePtr evalToSource(Location const &location, ExprListPtr args, 
-                              EnvPtr env, CompilerState* cst)
+static void evalToText(llvm::SmallVectorImpl<char> &text, ExprListPtr args,
+                       EnvPtr env, CompilerState* cst)
 {
-    llvm::SmallString<128> sourceTextBuf;
-    llvm::raw_svector_ostream sourceTextOut(sourceTextBuf);
+    llvm::raw_svector_ostream sourceTextOut(text);
     MultiStaticPtr values = evaluateMultiStatic(args, env, cst);
     for (size_t i = 0; i < values->size(); ++i) {
         printStaticName(sourceTextOut, values->values[i]);
     }
+    sourceTextOut.flush();
+}
 
-    llvm::SmallString<128> sourceNameBuf;
-    llvm::raw_svector_ostream sourceNameOut(sourceNameBuf);
+static void evalSourceName(llvm::SmallString<128> &name, Location const &location)
+{
+    llvm::raw_svector_ostream sourceNameOut(name);
     sourceNameOut << "<eval ";
     printFileLineCol(sourceNameOut, location);
     sourceNameOut << ">";
+    sourceNameOut.flush();
+}
 
-    sourceTextOut.flush();
-    return new Source(sourceNameOut.str(),
-        llvm::MemoryBuffer::getMemBufferCopy(sourceTextBuf));
+static SourcePtr evalToSource(Location const &location, llvm::StringRef text)
+{
+    llvm::SmallString<128> sourceName;
+    evalSourceName(sourceName, location);
+    return new Source(sourceName.str(),
+        llvm::MemoryBuffer::getMemBufferCopy(text));
+}
+
+static SourcePtr evalToSource(Location const &location, ExprListPtr args, 
+                              EnvPtr env, CompilerState* cst)
+{
+    llvm::SmallString<128> sourceTextBuf;
+    evalToText(sourceTextBuf, args, env, cst);
+    return evalToSource(location, sourceTextBuf);
+}
+
+// an eval in a generic body is desugared once per instantiation, since each
+// InvokeEntry clones its body, and identical evals are common in library
+// code. the parse is cached by the generated text, and each eval gets a
+// clone of it. an eval elsewhere than the one that was parsed gets a source
+// of its own holding the same text, and its clone is located there, so
+// errors point at that eval.
+
+// returns the source an eval at location should locate the nodes parsed
+// from cachedSource in, which is cachedSource itself if it was made for the
+// same location
+static SourcePtr evalSiteSource(Location const &location, SourcePtr cachedSource)
+{
+    llvm::SmallString<128> sourceName;
+    evalSourceName(sourceName, location);
+    if (cachedSource->fileName == sourceName.str())
+        return cachedSource;
+    return new Source(sourceName.str(),
+        llvm::MemoryBuffer::getMemBufferCopy(
+            llvm::StringRef(cachedSource->data(), cachedSource->size())));
 }
 
 ExprListPtr desugarEvalExpr(EvalExprPtr eval, EnvPtr env, CompilerState* cst)
@@ -407,8 +443,20 @@ ExprListPtr desugarEvalExpr(EvalExprPtr eval, EnvPtr env, CompilerState* cst)
     if (eval->evaled)
         return eval->value;
     else {
-        SourcePtr source = evalToSource(eval->location, new ExprList(eval->args), env, cst);
-        eval->value = parseExprList(source, 0, unsigned(source->size()), cst);
+        llvm::SmallString<128> text;
+        evalToText(text, new ExprList(eval->args), env, cst);
+        llvm::StringMap<pair<SourcePtr, ExprListPtr> >::const_iterator cached =
+            cst->evalExprCache.find(text);
+        if (cached != cst->evalExprCache.end()) {
+            SourcePtr source = cached->getValue().first;
+            eval->value = cloneRelocated(cached->getValue().second, source,
+                                         evalSiteSource(eval->location, source));
+        } else {
+            SourcePtr source = evalToSource(eval->location, text);
+            ExprListPtr parsed = parseExprList(source, 0, unsigned(source->size()), cst);
+            cst->evalExprCache[text] = make_pair(source, parsed);
+            eval->value = clone(parsed);
+        }
         eval->evaled = true;
         return eval->value;
     }
@@ -420,8 +468,21 @@ llvm::ArrayRef<StatementPtr> desugarEvalStatement(EvalStatementPtr eval, EnvPtr
     if (eval->evaled)
         return eval->value;
     else {
-        SourcePtr source = evalToSource(eval->location, eval->args, env, cst);
-        parseStatements(source, 0, unsigned(source->size()), eval->value, cst);
+        llvm::SmallString<128> text;
+        evalToText(text, eval->args, env, cst);
+        llvm::StringMap<pair<SourcePtr, vector<StatementPtr> > >::const_iterator cached =
+            cst->evalStatementCache.find(text);
+        if (cached != cst->evalStatementCache.end()) {
+            SourcePtr source = cached->getValue().first;
+            cloneRelocated(cached->getValue().second, eval->value, source,
+                           evalSiteSource(eval->location, source));
+        } else {
+            SourcePtr source = evalToSource(eval->location, text);
+            vector<StatementPtr> parsed;
+            parseStatements(source, 0, unsigned(source->size()), parsed, cst);
+            cst->evalStatementCache[text] = make_pair(source, parsed);
+            clone(parsed, eval->value);
+        }
         eval->evaled = true;
         return eval->value;
     }
@@ -443,6 +504,7 @@ llvm::ArrayRef<TopLevelItemPtr> desugarEvalTopLevel(EvalTopLevelPtr eval, EnvPtr
 
 OverloadPtr desugarAsOverload(OverloadPtr &x, CompilerState* cst) {
     assert(x->hasAsConversion);
+    ensureBody(x->code, cst);
 
     //Generate specialised overload
     CodePtr code = new Code();
@@ -499,6 +561,7 @@ OverloadPtr desugarAsOverload(OverloadPtr &x, CompilerState* cst) {
 
     code->body = x->code->body;
     OverloadPtr spec = new Overload(x->module, x->target, code, x->callByName, x->isInline);
+    spec->multiversions = x->multiversions;
     spec->location = x->location;
     spec->env = x->env;
 
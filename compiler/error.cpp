@@ -4,6 +4,7 @@
 #include "matchinvoke.hpp"
 #include "invoketables.hpp"
 #include "error.hpp"
+#include "trace.hpp"
 
 
 namespace clay {
@@ -26,6 +27,8 @@ void pushCompileContext(ObjectPtr obj) {
     if (!contextStack.empty())
         contextStack.back().location = topLocation();
     contextStack.push_back(CompileContextEntry(obj));
+    if (traceEnabled)
+        traceBegin("context", obj, llvm::ArrayRef<ObjectPtr>());
 }
 
 void pushCompileContext(ObjectPtr obj, llvm::ArrayRef<ObjectPtr> params) {
@@ -34,6 +37,8 @@ void pushCompileContext(ObjectPtr obj, llvm::ArrayRef<ObjectPtr> params) {
     if (!contextStack.empty())
         contextStack.back().location = topLocation();
     contextStack.push_back(CompileContextEntry(obj, params));
+    if (traceEnabled)
+        traceBegin("context", obj, params);
 }
 
 void pushCompileContext(ObjectPtr obj, llvm::ArrayRef<ObjectPtr> params, llvm::ArrayRef<unsigned> dispatchIndices) {
@@ -42,10 +47,14 @@ void pushCompileContext(ObjectPtr obj, llvm::ArrayRef<ObjectPtr> params, llvm::A
     if (!contextStack.empty())
         contextStack.back().location = topLocation();
     contextStack.push_back(CompileContextEntry(obj, params, dispatchIndices));
+    if (traceEnabled)
+        traceBegin("context", obj, params);
 }
 
 void popCompileContext() {
     contextStack.pop_back();
+    if (traceEnabled)
+        traceEnd();
 }
 
 vector<CompileContextEntry> getCompileContext() {
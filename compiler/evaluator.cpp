@@ -11,6 +11,9 @@
 #include "constructors.hpp"
 #include "env.hpp"
 #include "objects.hpp"
+#include "timing.hpp"
+#include "profiler.hpp"
+#include "trace.hpp"
 
 
 #pragma clang diagnostic ignored "-Wcovered-switch-default"
@@ -243,6 +246,7 @@ static void setPtrEValue(EValuePtr v, void* x) {
 
 MultiStaticPtr evaluateExprStatic(ExprPtr expr, EnvPtr env, CompilerState* cst)
 {
+    TimingPhase phase("evaluator");
     AnalysisCachingDisabler disabler(cst);
     MultiPValuePtr mpv = safeAnalyzeExpr(expr, env, cst);
     vector<ValueHolderPtr> valueHolders;
@@ -1863,6 +1867,8 @@ void evalCallCode(InvokeEntry* entry,
         return;
     }
 
+    InstantiationProfileScope profile(entry, PROFILE_EVALUATOR);
+    TraceSpan span("eval", entry->callable, entry->argsKey);
     ensureArity(args, entry->argsKey.size());
 
     EnvPtr env = new Env(entry->env);
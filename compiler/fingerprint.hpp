@@ -0,0 +1,27 @@
+#ifndef __CLAY_FINGERPRINT_HPP
+#define __CLAY_FINGERPRINT_HPP
+
+#include "clay.hpp"
+#include <llvm/ADT/StringExtras.h>
+
+namespace clay {
+
+// A 64-bit FNV-1a hash over a sequence of strings. Each string is followed
+// by a separator so that adjacent strings can't run together.
+struct Fingerprint {
+    uint64_t hash;
+    Fingerprint() : hash(14695981039346656037ULL) {}
+    void add(llvm::StringRef data) {
+        for (size_t i = 0; i < data.size(); ++i) {
+            hash ^= (unsigned char)data[i];
+            hash *= 1099511628211ULL;
+        }
+        hash ^= 0xff;
+        hash *= 1099511628211ULL;
+    }
+    string str() const { return llvm::utohexstr(hash); }
+};
+
+}
+
+#endif
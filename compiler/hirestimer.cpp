@@ -37,6 +37,35 @@ unsigned long long HiResTimer::elapsedNanos()
     return elapsedTicks * timeBaseInfo.numer / timeBaseInfo.denom;
 }
 
+// mach_absolute_time doesn't stop while the process waits
+WallTimer::WallTimer()
+    : elapsedTicks(0), startTicks(0), running(0)
+{
+}
+
+void WallTimer::start()
+{
+    if (++running == 1)
+        startTicks = mach_absolute_time();
+}
+
+void WallTimer::stop()
+{
+    if (--running == 0) {
+        unsigned long long end = mach_absolute_time();
+        elapsedTicks += (end - startTicks);
+    }
+}
+
+unsigned long long WallTimer::elapsedNanos()
+{
+    static mach_timebase_info_data_t timeBaseInfo;
+    if (timeBaseInfo.denom == 0) {
+        mach_timebase_info(&timeBaseInfo);
+    }
+    return elapsedTicks * timeBaseInfo.numer / timeBaseInfo.denom;
+}
+
 }
 
 #elif defined(_WIN32) || defined(_WIN64)
@@ -85,10 +114,43 @@ unsigned long long HiResTimer::elapsedNanos()
     return (unsigned long long)((double)elapsedTicks * performanceCounterRate);
 }
 
+// neither does the performance counter
+WallTimer::WallTimer()
+    : elapsedTicks(0), startTicks(0), running(0)
+{
+}
+
+void WallTimer::start()
+{
+    if (++running == 1)
+        startTicks = _get_counter();
+}
+
+void WallTimer::stop()
+{
+    if (--running == 0) {
+        unsigned long long end = _get_counter();
+        elapsedTicks += (end - startTicks);
+    }
+}
+
+unsigned long long WallTimer::elapsedNanos()
+{
+    LARGE_INTEGER frequency;
+    BOOL status = QueryPerformanceFrequency(&frequency);
+    assert(status != 0);
+
+    double performanceCounterRate = 1000000000.0 / (double)frequency.QuadPart;
+
+    return (unsigned long long)((double)elapsedTicks * performanceCounterRate);
+}
+
 }
 
 #else // Unixes
 
+#include <time.h>
+
 #if defined(CLOCK_PROCESS_CPUTIME_ID) && defined(__linux__)
 #    define CLOCK CLOCK_PROCESS_CPUTIME_ID
 #elif defined(CLOCK_PROF) && defined(__FreeBSD__)
@@ -97,8 +159,6 @@ unsigned long long HiResTimer::elapsedNanos()
 #    define CLOCK CLOCK_REALTIME
 #endif
 
-#include <time.h>
-
 namespace clay {
 
 HiResTimer::HiResTimer()
@@ -120,7 +180,7 @@ void HiResTimer::stop()
     if (--running == 0) {
         struct timespec t;
         clock_gettime(CLOCK, &t);
-        elapsedTicks = (unsigned long long)(t.tv_sec * 1000000000 + t.tv_nsec) - startTicks;
+        elapsedTicks += (unsigned long long)(t.tv_sec * 1000000000 + t.tv_nsec) - startTicks;
     }
 }
 
@@ -129,6 +189,40 @@ unsigned long long HiResTimer::elapsedNanos()
     return elapsedTicks;
 }
 
+#if defined(CLOCK_MONOTONIC)
+#    define WALL_CLOCK CLOCK_MONOTONIC
+#else
+#    define WALL_CLOCK CLOCK_REALTIME
+#endif
+
+WallTimer::WallTimer()
+    : elapsedTicks(0), startTicks(0), running(0)
+{
+}
+
+void WallTimer::start()
+{
+    if (++running == 1) {
+        struct timespec t;
+        clock_gettime(WALL_CLOCK, &t);
+        startTicks = (unsigned long long)(t.tv_sec * 1000000000 + t.tv_nsec);
+    }
+}
+
+void WallTimer::stop()
+{
+    if (--running == 0) {
+        struct timespec t;
+        clock_gettime(WALL_CLOCK, &t);
+        elapsedTicks += (unsigned long long)(t.tv_sec * 1000000000 + t.tv_nsec) - startTicks;
+    }
+}
+
+unsigned long long WallTimer::elapsedNanos()
+{
+    return elapsedTicks;
+}
+
 }
 
 #endif // __APPLE__
@@ -13,6 +13,21 @@ struct HiResTimer {
     unsigned long long elapsedNanos();
     double elapsedMillis() { return (double)elapsedNanos() / (1000 * 1000); }
 };
+
+// HiResTimer measures the process's CPU time where the platform has a clock
+// for it. WallTimer always measures elapsed real time, which is what work
+// spread over threads or waiting on other processes takes.
+struct WallTimer {
+    unsigned long long elapsedTicks;
+    unsigned long long startTicks;
+    int running;
+
+    WallTimer();
+    void start();
+    void stop();
+    unsigned long long elapsedNanos();
+    double elapsedMillis() { return (double)elapsedNanos() / (1000 * 1000); }
+};
 }
 
 #endif
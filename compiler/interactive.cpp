@@ -7,6 +7,8 @@
 #include "invoketables.hpp"
 #include "env.hpp"
 
+#include <llvm/Transforms/Utils/ValueMapper.h>
+
 #include <setjmp.h>
 #include <signal.h>
 #include <stdio.h>
@@ -19,6 +21,7 @@ namespace clay {
 
     static ModulePtr module;
     static llvm::ExecutionEngine *engine;
+    static llvm::Module *baseModule;
 
     jmp_buf recovery;
 
@@ -188,6 +191,104 @@ namespace clay {
         addGlobals(module, toplevels);
     }
 
+    //
+    // each input is compiled into an LLVM module of its own, so the JIT
+    // only sees the code that input generated. functions and globals
+    // generated for earlier inputs are referenced through declarations
+    // mapped to the addresses the JIT already has for them.
+    //
+
+    static llvm::Module *beginSnippetModule(CompilerState* cst)
+    {
+        static int snippetNum = 0;
+        string buf;
+        llvm::raw_string_ostream name(buf);
+        name << "repl" << snippetNum;
+        ++snippetNum;
+
+        llvm::Module *snippet = new llvm::Module(name.str(), baseModule->getContext());
+        snippet->setDataLayout(baseModule->getDataLayout());
+        snippet->setTargetTriple(baseModule->getTargetTriple());
+        cst->llvmModule = snippet;
+        return snippet;
+    }
+
+    static void collectForeignGlobals(llvm::Value *v,
+                                      llvm::Module *snippet,
+                                      llvm::SmallPtrSet<llvm::Constant *, 64> &seen,
+                                      vector<llvm::GlobalValue *> &foreign)
+    {
+        llvm::Constant *c = llvm::dyn_cast<llvm::Constant>(v);
+        if (c == NULL || !seen.insert(c))
+            return;
+        if (llvm::GlobalValue *gv = llvm::dyn_cast<llvm::GlobalValue>(c)) {
+            if (gv->getParent() != snippet)
+                foreign.push_back(gv);
+            return;
+        }
+        for (unsigned i = 0; i < c->getNumOperands(); ++i)
+            collectForeignGlobals(c->getOperand(i), snippet, seen, foreign);
+    }
+
+    static llvm::Constant *localDeclaration(llvm::GlobalValue *gv, llvm::Module *snippet)
+    {
+        if (llvm::Function *f = llvm::dyn_cast<llvm::Function>(gv)) {
+            // externals and intrinsics are still resolved by name
+            if (f->isDeclaration())
+                return snippet->getOrInsertFunction(f->getName(), f->getFunctionType(),
+                                                    f->getAttributes());
+            llvm::Function *decl = llvm::Function::Create(f->getFunctionType(),
+                llvm::GlobalValue::ExternalLinkage, f->getName(), snippet);
+            decl->setAttributes(f->getAttributes());
+            decl->setCallingConv(f->getCallingConv());
+            return decl;
+        }
+        llvm::GlobalVariable *g = llvm::cast<llvm::GlobalVariable>(gv);
+        llvm::Type *type = g->getType()->getElementType();
+        if (g->isDeclaration())
+            return snippet->getOrInsertGlobal(g->getName(), type);
+        return new llvm::GlobalVariable(*snippet, type, g->isConstant(),
+            llvm::GlobalValue::ExternalLinkage, NULL, g->getName());
+    }
+
+    static void endSnippetModule(llvm::Module *snippet)
+    {
+        llvm::SmallPtrSet<llvm::Constant *, 64> seen;
+        vector<llvm::GlobalValue *> foreign;
+        for (llvm::Module::iterator f = snippet->begin(); f != snippet->end(); ++f)
+            for (llvm::Function::iterator bb = f->begin(); bb != f->end(); ++bb)
+                for (llvm::BasicBlock::iterator i = bb->begin(); i != bb->end(); ++i)
+                    for (unsigned j = 0; j < i->getNumOperands(); ++j)
+                        collectForeignGlobals(i->getOperand(j), snippet, seen, foreign);
+        llvm::Module::global_iterator g;
+        for (g = snippet->global_begin(); g != snippet->global_end(); ++g)
+            if (g->hasInitializer())
+                collectForeignGlobals(g->getInitializer(), snippet, seen, foreign);
+
+        llvm::ValueToValueMapTy vmap;
+        for (size_t i = 0; i < foreign.size(); ++i) {
+            llvm::GlobalValue *gv = foreign[i];
+            llvm::Constant *decl = localDeclaration(gv, snippet);
+            vmap[gv] = decl;
+            if (!gv->isDeclaration())
+                engine->addGlobalMapping(llvm::cast<llvm::GlobalValue>(decl),
+                                         engine->getPointerToGlobal(gv));
+        }
+
+        if (!foreign.empty()) {
+            for (llvm::Module::iterator f = snippet->begin(); f != snippet->end(); ++f)
+                for (llvm::Function::iterator bb = f->begin(); bb != f->end(); ++bb)
+                    for (llvm::BasicBlock::iterator i = bb->begin(); i != bb->end(); ++i)
+                        llvm::RemapInstruction(&*i, vmap, llvm::RF_IgnoreMissingEntries);
+            for (g = snippet->global_begin(); g != snippet->global_end(); ++g)
+                if (g->hasInitializer())
+                    g->setInitializer(llvm::MapValue(g->getInitializer(), vmap,
+                                                     llvm::RF_IgnoreMissingEntries));
+        }
+
+        engine->addModule(snippet);
+    }
+
     static void jitStatements(llvm::ArrayRef<StatementPtr> statements, 
                               CompilerState* cst)
     {
@@ -216,17 +317,22 @@ namespace clay {
 
         entryProc->env = module->env;
 
-        codegenBeforeRepl(module);
+        // a failed input's module is still added: instantiations it
+        // completed are cached and may be called by later inputs
+        llvm::Module *snippet = beginSnippetModule(cst);
         try {
+            codegenBeforeRepl(module);
             codegenExternalProcedure(entryProc, true);
         }
         catch (std::exception) {
+            endSnippetModule(snippet);
             return;
         }
 
         llvm::Function* ctor;
         llvm::Function* dtor;
         codegenAfterRepl(ctor, dtor, cst);
+        endSnippetModule(snippet);
 
         engine->runFunction(ctor, std::vector<llvm::GenericValue>());
 
@@ -300,6 +406,7 @@ namespace clay {
         llvm::errs() << "In multi-line mode empty line to exit\n";
 
         CompilerState* cst = module_->cst;
+        baseModule = cst->llvmModule;
         llvm::EngineBuilder eb(cst->llvmModule);
         llvm::TargetOptions targetOptions;
         targetOptions.JITExceptionHandling = true;
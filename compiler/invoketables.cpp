@@ -5,6 +5,8 @@
 #include "constructors.hpp"
 #include "clone.hpp"
 #include "objects.hpp"
+#include "parser.hpp"
+#include "profiler.hpp"
 
 
 #pragma clang diagnostic ignored "-Wcovered-switch-default"
@@ -313,8 +315,10 @@ static bool matchTempness(CodePtr code,
 
 static InvokeEntry* newInvokeEntry(InvokeSet* parent,
                                    MatchSuccessPtr match,
-                                   MatchSuccessPtr interfaceMatch)
+                                   MatchSuccessPtr interfaceMatch,
+                                   CompilerState* cst)
 {
+    ensureBody(match->overload->code, cst);
     InvokeEntry* entry = new InvokeEntry(parent, match->callable, match->argsKey);
     entry->origCode = match->overload->code;
     entry->code = clone(match->overload->code);
@@ -328,6 +332,8 @@ static InvokeEntry* newInvokeEntry(InvokeSet* parent,
     entry->varArgPosition = match->varArgPosition;
     entry->callByName = match->overload->callByName;
     entry->isInline = match->overload->isInline;
+    entry->multiversions = match->overload->multiversions;
+    profileInstantiation(entry);
 
     return entry;
 }
@@ -404,7 +410,7 @@ InvokeEntry* lookupInvokeEntry(ObjectPtr callable,
     }
 
     InvokeEntry* entry = newInvokeEntry(invokeSet, match,
-        (MatchSuccess*)interfaceResult.ptr());
+        (MatchSuccess*)interfaceResult.ptr(), cst);
     entry->forwardedRValueFlags = forwardedRValueFlags;
     
     invokeSet->tempnessMap2[tempnessKey] = entry;
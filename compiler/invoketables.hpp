@@ -34,6 +34,7 @@ struct InvokeEntry {
     unsigned varArgPosition;
 
     InlineAttribute isInline;
+    vector<string> multiversions;
 
     ObjectPtr analysis;
     vector<uint8_t> returnIsRef;
@@ -44,10 +45,17 @@ struct InvokeEntry {
 
     llvm::TrackingVH<llvm::MDNode> debugInfo;
 
+    // -share-instantiations: the instantiation whose generated body this
+    // one calls instead of its own; see sharing.cpp
+    InvokeEntry *sharedBody;
+
     bool analyzed:1;
     bool analyzing:1;
     bool callByName:1; // if callByName the rest of InvokeEntry is not set
     bool runtimeNop:1;
+    // the body reinterprets memory with bitcast or intToPointer, so it has
+    // no TBAA tags
+    bool typePunning:1;
 
     InvokeEntry(InvokeSet *parent,
                 ObjectPtr callable,
@@ -58,10 +66,12 @@ struct InvokeEntry {
           isInline(IGNORE),
           llvmFunc(NULL),
           debugInfo(NULL),
+          sharedBody(NULL),
           analyzed(false),
           analyzing(false),
           callByName(false),
-          runtimeNop(false)
+          runtimeNop(false),
+          typePunning(false)
     {
         for (size_t i = 0; i < CC_Count; ++i)
             llvmCWrappers[i] = NULL;
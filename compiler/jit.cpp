@@ -0,0 +1,187 @@
+#include "jit.hpp"
+#include <llvm/Transforms/Utils/Cloning.h>
+
+
+namespace clay {
+
+namespace {
+    struct TieredFunction {
+        llvm::Function *function;
+        llvm::BasicBlock *body;
+        vector<llvm::BasicBlock *> checkBlocks;
+        llvm::GlobalVariable *tier2;
+    };
+}
+
+static llvm::ExecutionEngine *tierEngine = NULL;
+static vector<TieredFunction> tieredFunctions;
+static llvm::FunctionPassManager *tierPasses = NULL;
+
+// the function-level part of addOptimizationPasses at -O2. promotion is per
+// function, so there is no inlining
+static void addTierPasses(llvm::FunctionPassManager &passes, llvm::Module *module)
+{
+    passes.add(new llvm::DataLayout(module->getDataLayout()));
+    passes.add(llvm::createTypeBasedAliasAnalysisPass());
+    passes.add(llvm::createBasicAliasAnalysisPass());
+    passes.add(llvm::createCFGSimplificationPass());
+    passes.add(llvm::createScalarReplAggregatesPass(-1, false));
+    passes.add(llvm::createEarlyCSEPass());
+    passes.add(llvm::createInstructionCombiningPass());
+    passes.add(llvm::createJumpThreadingPass());
+    passes.add(llvm::createCFGSimplificationPass());
+    passes.add(llvm::createReassociatePass());
+    passes.add(llvm::createLoopRotatePass());
+    passes.add(llvm::createLICMPass());
+    passes.add(llvm::createInstructionCombiningPass());
+    passes.add(llvm::createIndVarSimplifyPass());
+    passes.add(llvm::createLoopDeletionPass());
+    passes.add(llvm::createGVNPass());
+    passes.add(llvm::createMemCpyOptPass());
+    passes.add(llvm::createSCCPPass());
+    passes.add(llvm::createInstructionCombiningPass());
+    passes.add(llvm::createDeadStoreEliminationPass());
+    passes.add(llvm::createAggressiveDCEPass());
+    passes.add(llvm::createCFGSimplificationPass());
+}
+
+static void promoteFunction(int index)
+{
+    TieredFunction &tiered = tieredFunctions[unsigned(index)];
+
+    llvm::ValueToValueMapTy vmap;
+    llvm::Function *fast = llvm::CloneFunction(tiered.function, vmap, false);
+    fast->setName(tiered.function->getName() + " tier2");
+    fast->setLinkage(llvm::GlobalValue::InternalLinkage);
+    tiered.function->getParent()->getFunctionList().push_back(fast);
+
+    // enter the copy's body directly and drop its check blocks
+    llvm::BasicBlock *entry = &fast->getEntryBlock();
+    entry->getTerminator()->eraseFromParent();
+    llvm::BranchInst::Create(llvm::cast<llvm::BasicBlock>(vmap[tiered.body]), entry);
+    vector<llvm::BasicBlock *> checkBlocks;
+    for (size_t i = 0; i < tiered.checkBlocks.size(); ++i)
+        checkBlocks.push_back(llvm::cast<llvm::BasicBlock>(vmap[tiered.checkBlocks[i]]));
+    for (size_t i = 0; i < checkBlocks.size(); ++i)
+        checkBlocks[i]->dropAllReferences();
+    for (size_t i = 0; i < checkBlocks.size(); ++i)
+        checkBlocks[i]->eraseFromParent();
+
+    tierPasses->run(*fast);
+
+    void *code = tierEngine->getPointerToFunction(fast);
+    *(void **)tierEngine->getPointerToGlobal(tiered.tier2) = code;
+}
+
+extern "C" {
+    static void clayJITPromote(int index) {
+        promoteFunction(index);
+    }
+}
+
+static void instrumentFunction(llvm::Function *function,
+                               unsigned index,
+                               unsigned threshold,
+                               llvm::Function *promote)
+{
+    llvm::Module *module = function->getParent();
+    llvm::LLVMContext &context = module->getContext();
+    llvm::Type *countType = llvm::Type::getInt32Ty(context);
+    llvm::PointerType *functionPtrType = function->getType();
+
+    // the check goes after the entry block's allocas, so that they stay
+    // static and the entry block has no predecessors
+    TieredFunction tiered;
+    tiered.function = function;
+    llvm::BasicBlock *entry = &function->getEntryBlock();
+    llvm::BasicBlock::iterator firstInstruction = entry->begin();
+    while (llvm::isa<llvm::AllocaInst>(firstInstruction))
+        ++firstInstruction;
+    tiered.body = entry->splitBasicBlock(firstInstruction, "tierBody");
+    tiered.tier2 = new llvm::GlobalVariable(*module, functionPtrType, false,
+        llvm::GlobalVariable::InternalLinkage,
+        llvm::ConstantPointerNull::get(functionPtrType),
+        function->getName() + " tier2 address");
+    llvm::GlobalVariable *calls = new llvm::GlobalVariable(*module, countType, false,
+        llvm::GlobalVariable::InternalLinkage,
+        llvm::ConstantInt::get(countType, 0),
+        function->getName() + " calls");
+
+    llvm::BasicBlock *checkBlock =
+        llvm::BasicBlock::Create(context, "tierCheck", function, tiered.body);
+    llvm::BasicBlock *tier2Block =
+        llvm::BasicBlock::Create(context, "tier2", function, tiered.body);
+    llvm::BasicBlock *countBlock =
+        llvm::BasicBlock::Create(context, "tierCount", function, tiered.body);
+    llvm::BasicBlock *promoteBlock =
+        llvm::BasicBlock::Create(context, "tierPromote", function, tiered.body);
+
+    llvm::IRBuilder<> builder(checkBlock);
+    llvm::Value *fast = builder.CreateLoad(tiered.tier2);
+    builder.CreateCondBr(builder.CreateIsNull(fast), countBlock, tier2Block);
+
+    builder.SetInsertPoint(tier2Block);
+    vector<llvm::Value *> args;
+    llvm::Function::arg_iterator ai, aend;
+    for (ai = function->arg_begin(), aend = function->arg_end(); ai != aend; ++ai)
+        args.push_back(&*ai);
+    llvm::CallInst *call = builder.CreateCall(fast, args);
+    call->setTailCall();
+    if (function->getReturnType()->isVoidTy())
+        builder.CreateRetVoid();
+    else
+        builder.CreateRet(call);
+
+    builder.SetInsertPoint(countBlock);
+    llvm::Value *count = builder.CreateAdd(builder.CreateLoad(calls),
+        llvm::ConstantInt::get(countType, 1));
+    builder.CreateStore(count, calls);
+    llvm::Value *hot = builder.CreateICmpEQ(count,
+        llvm::ConstantInt::get(countType, threshold));
+    builder.CreateCondBr(hot, promoteBlock, tiered.body);
+
+    builder.SetInsertPoint(promoteBlock);
+    builder.CreateCall(promote, llvm::ConstantInt::get(countType, index));
+    builder.CreateBr(checkBlock);
+
+    entry->getTerminator()->eraseFromParent();
+    llvm::BranchInst::Create(checkBlock, entry);
+
+    tiered.checkBlocks.push_back(checkBlock);
+    tiered.checkBlocks.push_back(tier2Block);
+    tiered.checkBlocks.push_back(countBlock);
+    tiered.checkBlocks.push_back(promoteBlock);
+    tieredFunctions.push_back(tiered);
+}
+
+void enableJITTiers(llvm::ExecutionEngine *engine,
+                    llvm::Module *module,
+                    unsigned threshold)
+{
+    tierEngine = engine;
+    tierPasses = new llvm::FunctionPassManager(module);
+    addTierPasses(*tierPasses, module);
+    tierPasses->doInitialization();
+
+    llvm::LLVMContext &context = module->getContext();
+    llvm::Type *promoteArgs[] = { llvm::Type::getInt32Ty(context) };
+    llvm::Function *promote = llvm::Function::Create(
+        llvm::FunctionType::get(llvm::Type::getVoidTy(context), promoteArgs, false),
+        llvm::Function::ExternalLinkage,
+        "clay.jit.promote",
+        module);
+    engine->addGlobalMapping(promote, (void *)&clayJITPromote);
+
+    // procedure bodies are the internal functions named by getCodeName;
+    // externals keep their C ABI entry points
+    vector<llvm::Function *> functions;
+    for (llvm::Module::iterator i = module->begin(), end = module->end(); i != end; ++i) {
+        if (!i->isDeclaration() && i->hasInternalLinkage()
+            && !i->isVarArg() && i->getName().endswith(" clay"))
+            functions.push_back(&*i);
+    }
+    for (size_t i = 0; i < functions.size(); ++i)
+        instrumentFunction(functions[i], unsigned(i), threshold, promote);
+}
+
+}
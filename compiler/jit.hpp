@@ -0,0 +1,25 @@
+#ifndef __CLAY_JIT_HPP
+#define __CLAY_JIT_HPP
+
+#include "clay.hpp"
+
+namespace clay {
+
+// Tiered compilation for -run -tiered-jit. Every Clay function is given an
+// entry check that counts its calls and, once a tier-2 version exists,
+// tail-calls it. When the count reaches the threshold, a copy of the
+// function without the check is optimized with the -O2 function passes and
+// compiled, and its address is stored for the entry check to pick up.
+// Nothing is patched in place, so a promotion can happen while the slow
+// version is on the stack.
+//
+// LLVM 3.2's JIT and LLVMContext are not thread-safe, so promotion runs on
+// the thread that crosses the threshold.
+
+void enableJITTiers(llvm::ExecutionEngine *engine,
+                    llvm::Module *module,
+                    unsigned threshold);
+
+}
+
+#endif
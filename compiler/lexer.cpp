@@ -4,77 +4,88 @@
 
 namespace clay {
 
-static void initLexer(SourcePtr s, unsigned offset, size_t length);
-static void cleanupLexer();
-static bool nextToken(Token &x);
-static bool nextDocToken(Token &x);
 
-void tokenize(SourcePtr source, vector<Token> &tokens) {
-    tokenize(source, 0, source->size(), tokens);
-}
+//
+// keywords, symbols, operator characters
+//
 
-void tokenize(SourcePtr source, unsigned offset, size_t length,
-              vector<Token> &tokens) {
-    initLexer(source, offset, length);
-    tokens.push_back(Token());
-    while (nextToken(tokens.back())) {
-        switch (tokens.back().tokenKind) {
-        case T_SPACE :
-        case T_LINE_COMMENT :
-        case T_BLOCK_COMMENT :
-            break;
-        case T_DOC_START:
-            while (nextDocToken(tokens.back())) {
-                if (tokens.back().tokenKind == T_DOC_END)
-                    break;
-                tokens.push_back(Token());
-            }
-            break;
-        default :
-            tokens.push_back(Token());
-        }
-    }
-    tokens.pop_back();
-    cleanupLexer();
+static std::set<llvm::StringRef> *keywords = NULL;
+
+void initKeywords() {
+    if (keywords != NULL)
+        return;
+    const char *s[] =
+        {"public", "private", "import", "as",
+         "record", "variant", "instance",
+         "define", "overload", "default",
+         "external", "alias",
+         "rvalue", "ref", "forward",
+         "inline", "noinline", "forceinline", "multiversion",
+         "enum", "var", "and", "or", "not",
+         "if", "else", "goto", "return", "while",
+         "switch", "case", "break", "continue", "for", "in",
+         "true", "false", "try", "catch", "throw",
+         "finally", "onerror", "staticassert",
+         "eval", "when", "newtype",
+         "__FILE__", "__LINE__", "__COLUMN__", "__ARG__", NULL};
+    keywords = new std::set<llvm::StringRef>();
+    for (const char **p = s; *p; ++p)
+        keywords->insert(*p);
 }
 
-static Source *lexerSource;
-static unsigned beginOffset;
-static const char *begin;
-static const char *ptr;
-static const char *end;
-static const char *maxPtr;
+static const char *symbols[] = {
+    "..", "::", "^", "@",  
+    "(", ")", "[", "]", "{", "}",
+    ":", ";", ",", ".", "#",
+    NULL
+};
+
+static llvm::StringRef opchars("=!<>+-*/\\%~|&");
 
-static void initLexer(SourcePtr source, unsigned offset, size_t length) {
-    lexerSource = source.ptr();
-    begin = source->data() + offset;
-    end = begin + length;
-    ptr = begin;
-    maxPtr = begin;
-    beginOffset = offset;
+bool isSpace(char c) {
+    return ((c == ' ') || (c == '\t') || (c == '\n') || (c == '\r') ||
+            (c == '\f') || (c == '\v'));
 }
 
-static void cleanupLexer() {
-    lexerSource = NULL;
-    begin = ptr = end = maxPtr = NULL;
+
+
+//
+// LexerImpl
+//
+
+struct LexerImpl {
+Source *lexerSource;
+unsigned beginOffset;
+const char *begin;
+const char *ptr;
+const char *end;
+const char *maxPtr;
+bool docIsBlock;
+bool quiet; // report invalid tokens by setting failed instead of error()
+bool failed;
+
+LexerImpl(SourcePtr source, unsigned offset, size_t length, bool quiet)
+    : lexerSource(source.ptr()), beginOffset(offset),
+      begin(source->data() + offset), ptr(begin), end(begin + length),
+      maxPtr(begin), docIsBlock(false), quiet(quiet), failed(false) {
 }
 
-static Location locationFor(const char *ptr) {
+Location locationFor(const char *ptr) {
     unsigned offset = unsigned(ptr - begin) + beginOffset;
     return Location(lexerSource, offset);
 }
 
-static const char *save() { return ptr; }
-static void restore(const char *p) { ptr = p; }
+const char *save() { return ptr; }
+void restore(const char *p) { ptr = p; }
 
-static bool next(char &x) {
+bool next(char &x) {
     if (ptr == end) return false;
     if (ptr > maxPtr) maxPtr = ptr;
     x = *(ptr++);
     return true;
 }
 
-static bool str(const char *s) {
+bool str(const char *s) {
     while (*s) {
         char x;
         if (!next(x)) return false;
@@ -90,7 +101,7 @@ static bool str(const char *s) {
 // keywords and identifiers
 //
 
-static bool identChar1(char &x) {
+bool identChar1(char &x) {
     if (!next(x)) return false;
     if ((x >= 'a') && (x <= 'z')) return true;
     if ((x >= 'A') && (x <= 'Z')) return true;
@@ -99,7 +110,7 @@ static bool identChar1(char &x) {
     return false;
 }
 
-static bool identChar2(char &x) {
+bool identChar2(char &x) {
     if (!next(x)) return false;
     if ((x >= 'a') && (x <= 'z')) return true;
     if ((x >= 'A') && (x <= 'Z')) return true;
@@ -110,7 +121,7 @@ static bool identChar2(char &x) {
 }
 
 
-static bool identStr(llvm::SmallString<16> &x) {
+bool identStr(llvm::SmallString<16> &x) {
     char c;
     if (!identChar1(c)) return false;
     x.clear();
@@ -126,32 +137,10 @@ static bool identStr(llvm::SmallString<16> &x) {
     return true;
 }
 
-static std::set<llvm::StringRef> *keywords = NULL;
-
-static void initKeywords() {
-    const char *s[] =
-        {"public", "private", "import", "as",
-         "record", "variant", "instance",
-         "define", "overload", "default",
-         "external", "alias",
-         "rvalue", "ref", "forward",
-         "inline", "noinline", "forceinline",
-         "enum", "var", "and", "or", "not",
-         "if", "else", "goto", "return", "while",
-         "switch", "case", "break", "continue", "for", "in",
-         "true", "false", "try", "catch", "throw",
-         "finally", "onerror", "staticassert",
-         "eval", "when", "newtype",
-         "__FILE__", "__LINE__", "__COLUMN__", "__ARG__", NULL};
-    keywords = new std::set<llvm::StringRef>();
-    for (const char **p = s; *p; ++p)
-        keywords->insert(*p);
-}
 
-static bool keywordIdentifier(Token &x) {
+bool keywordIdentifier(Token &x) {
     x.str.clear();
     if (!identStr(x.str)) return false;
-    if (!keywords) initKeywords();
     if (keywords->find(x.str) != keywords->end())
         x.tokenKind = T_KEYWORD;
     else
@@ -165,14 +154,8 @@ static bool keywordIdentifier(Token &x) {
 // symbols
 //
 
-static const char *symbols[] = {
-    "..", "::", "^", "@",  
-    "(", ")", "[", "]", "{", "}",
-    ":", ";", ",", ".", "#",
-    NULL
-};
 
-static bool symbol(Token &x) {
+bool symbol(Token &x) {
     const char **s = symbols;
     const char *p = save();
     while (*s) {
@@ -191,9 +174,8 @@ static bool symbol(Token &x) {
 //
 
 
-static llvm::StringRef opchars("=!<>+-*/\\%~|&");
 
-static bool opstring(llvm::SmallString<16> &x) {
+bool opstring(llvm::SmallString<16> &x) {
     const char *p = save();
     const char *q = p;
     char y;
@@ -209,7 +191,7 @@ static bool opstring(llvm::SmallString<16> &x) {
     return true;
 }
 
-static bool op(Token &x) {
+bool op(Token &x) {
     x.str.clear();
     if(!opstring(x.str)) return false;
     char c;
@@ -223,7 +205,7 @@ static bool op(Token &x) {
     return true;
 }
 
-static bool opIdentifier(Token &x) {
+bool opIdentifier(Token &x) {
     char c;
     if (!next(c)) return false;
     if (c != '(') return false;
@@ -241,7 +223,7 @@ static bool opIdentifier(Token &x) {
 // hex and decimal digits
 //
 
-static bool hexDigit(int &x) {
+bool hexDigit(int &x) {
     char c;
     if (!next(c)) return false;
     if ((c >= '0') && (c <= '9')) {
@@ -259,7 +241,7 @@ static bool hexDigit(int &x) {
     return false;
 }
 
-static bool decimalDigit(int &x) {
+bool decimalDigit(int &x) {
     char c;
     if (!next(c) || (c < '0') || (c > '9'))
         return false;
@@ -273,7 +255,7 @@ static bool decimalDigit(int &x) {
 // characters and strings
 //
 
-static bool hexEscapeChar(char &x) {
+bool hexEscapeChar(char &x) {
     int digit1, digit2;
     if (!hexDigit(digit1)) return false;
     if (!hexDigit(digit2)) return false;
@@ -281,7 +263,7 @@ static bool hexEscapeChar(char &x) {
     return true;
 }
 
-static bool escapeChar(char &x) {
+bool escapeChar(char &x) {
     char c;
     if (!next(c)) return false;
     if (c != '\\') return false;
@@ -304,7 +286,7 @@ static bool escapeChar(char &x) {
     return false;
 }
 
-static bool oneChar(char &x) {
+bool oneChar(char &x) {
     const char *p = save();
     if (escapeChar(x)) return true;
     restore(p);
@@ -313,7 +295,7 @@ static bool oneChar(char &x) {
     return true;
 }
 
-static bool charToken(Token &x) {
+bool charToken(Token &x) {
     char c;
     if (!next(c) || (c != '\'')) return false;
     const char *p = save();
@@ -326,7 +308,7 @@ static bool charToken(Token &x) {
     return true;
 }
 
-static bool singleQuoteStringToken(Token &x) {
+bool singleQuoteStringToken(Token &x) {
     char c;
     if (!next(c) || (c != '"')) return false;
     x.tokenKind = T_STRING_LITERAL;
@@ -342,7 +324,7 @@ static bool singleQuoteStringToken(Token &x) {
     return true;
 }
 
-static bool stringToken(Token &x) {
+bool stringToken(Token &x) {
     const char *p = save();
     char c;
     if (!next(c) || (c != '"')) return false;
@@ -378,14 +360,14 @@ static bool stringToken(Token &x) {
 // integer tokens
 //
 
-static void optNumericSeparator() {
+void optNumericSeparator() {
     const char *p = save();
     char c;
     if (!next(c) || (c != '_'))
         restore(p);
 }
 
-static bool decimalDigits() {
+bool decimalDigits() {
     int x;
     while (true) {
         optNumericSeparator();
@@ -398,7 +380,7 @@ static bool decimalDigits() {
     return true;
 }
 
-static bool hexDigits() {
+bool hexDigits() {
     int x;
     while (true) {
         optNumericSeparator();
@@ -411,14 +393,14 @@ static bool hexDigits() {
     return true;
 }
 
-static bool hexInt() {
+bool hexInt() {
     if (!str("0x")) return false;
     int x;
     if (!hexDigit(x)) return false;
     return hexDigits();
 }
 
-static bool decimalInt() {
+bool decimalInt() {
     int x;
     if (!decimalDigit(x)) return false;
     while (true) {
@@ -432,13 +414,13 @@ static bool decimalInt() {
     return true;
 }
 
-static bool sign() {
+bool sign() {
     char c;
     if (!next(c)) return false;
     return (c == '+') || (c == '-');
 }
 
-static bool intToken(Token &x) {
+bool intToken(Token &x) {
     const char *begin = save();
     if (!sign()) restore(begin);
     const char *p = save();
@@ -458,7 +440,7 @@ success :
 // float tokens
 //
 
-static bool exponentPart() {
+bool exponentPart() {
     char c;
     if (!next(c)) return false;
     if ((c != 'e') && (c != 'E')) return false;
@@ -467,13 +449,13 @@ static bool exponentPart() {
     return decimalInt();
 }
 
-static bool fractionalPart() {
+bool fractionalPart() {
     char c;
     if (!next(c) || (c != '.')) return false;
     return decimalDigits();
 }
 
-static bool hexExponentPart() {
+bool hexExponentPart() {
     char c;
     if (!next(c)) return false;
     if ((c != 'p') && (c != 'P')) return false;
@@ -482,13 +464,13 @@ static bool hexExponentPart() {
     return decimalInt();
 }
 
-static bool hexFractionalPart() {
+bool hexFractionalPart() {
     char c;
     if (!next(c) || (c != '.')) return false;
     return hexDigits();
 }
 
-static bool floatToken(Token &x) {
+bool floatToken(Token &x) {
     const char *begin = save();
     if (!sign()) restore(begin);
     const char *afterSign = save();
@@ -532,12 +514,8 @@ static bool floatToken(Token &x) {
 // space
 //
 
-bool isSpace(char c) {
-    return ((c == ' ') || (c == '\t') || (c == '\n') || (c == '\r') ||
-            (c == '\f') || (c == '\v'));
-}
 
-static bool space(Token &x) {
+bool space(Token &x) {
     char c;
     if (!next(c) || !isSpace(c)) return false;
     while (true) {
@@ -557,7 +535,7 @@ static bool space(Token &x) {
 // comments
 //
 
-static bool lineComment(Token &x) {
+bool lineComment(Token &x) {
     char c;
     if (!next(c) || (c != '/')) return false;
     if (!next(c) || (c != '/')) return false;
@@ -573,7 +551,7 @@ static bool lineComment(Token &x) {
     return true;
 }
 
-static bool blockComment(Token &x) {
+bool blockComment(Token &x) {
     char c;
     if (!next(c) || (c != '/')) return false;
     if (!next(c) || (c != '*')) return false;
@@ -611,14 +589,8 @@ static bool blockComment(Token &x) {
 //              | Not('"')
 //
 
-static bool llvmBraces();
-static bool llvmBody();
-static bool llvmBodyItem();
-static bool llvmComment();
-static bool llvmStringLiteral();
-static bool llvmStringChar();
 
-static bool llvmToken(Token &x) {
+bool llvmToken(Token &x) {
     const char *prefix = "__llvm__";
     while (*prefix) {
         char c;
@@ -643,7 +615,7 @@ static bool llvmToken(Token &x) {
     return true;
 }
 
-static bool llvmBraces() {
+bool llvmBraces() {
     char c;
     if (!next(c) || (c != '{')) return false;
     if (!llvmBody()) return false;
@@ -651,7 +623,7 @@ static bool llvmBraces() {
     return true;
 }
 
-static bool llvmBody() {
+bool llvmBody() {
     while (true) {
         const char *p = save();
         if (!llvmBodyItem()) {
@@ -662,7 +634,7 @@ static bool llvmBody() {
     return true;
 }
 
-static bool llvmBodyItem() {
+bool llvmBodyItem() {
     const char *p = save();
     if (llvmComment()) return true;
     if (restore(p), llvmBraces()) return true;
@@ -672,14 +644,14 @@ static bool llvmBodyItem() {
     return false;
 }
 
-static bool llvmComment() {
+bool llvmComment() {
     char c;
     if (!next(c) || (c != ';')) return false;
     while (next(c) && (c != '\n')) {}
     return true;
 }
 
-static bool llvmStringLiteral() {
+bool llvmStringLiteral() {
     char c;
     if (!next(c) || (c != '"')) return false;
     while (true) {
@@ -693,7 +665,7 @@ static bool llvmStringLiteral() {
     return true;
 }
 
-static bool llvmStringChar() {
+bool llvmStringChar() {
     char c;
     if (!next(c)) return false;
     if (c == '\\')
@@ -706,7 +678,7 @@ static bool llvmStringChar() {
 // static index
 //
 
-static bool staticIndex(Token &x) {
+bool staticIndex(Token &x) {
     char c;
     if (!next(c)) return false;
     if (c != '.') return false;
@@ -732,10 +704,8 @@ static bool staticIndex(Token &x) {
 // nextToken
 //
 
-static bool docStartLine(Token &x);
-static bool docStartBlock(Token &x);
 
-static bool nextToken(Token &x) {
+bool nextToken(Token &x) {
     x = Token();
     const char *p = save();
     if (space(x)) goto success;
@@ -754,6 +724,10 @@ static bool nextToken(Token &x) {
     restore(p); if (floatToken(x)) goto success;
     restore(p); if (intToken(x)) goto success;
     if (p != end) {
+        if (quiet) {
+            failed = true;
+            return false;
+        }
         pushLocation(locationFor(p));
         error("invalid token");
     }
@@ -770,8 +744,7 @@ success :
 //
 
 
-static bool docIsBlock = false;
-static bool docStartLine(Token &x) {
+bool docStartLine(Token &x) {
     char c;
     if (!next(c) || (c != '/')) return false;
     if (!next(c) || (c != '/')) return false;
@@ -781,7 +754,7 @@ static bool docStartLine(Token &x) {
     return true;
 }
 
-static bool docStartBlock(Token &x) {
+bool docStartBlock(Token &x) {
     char c;
     if (!next(c) || (c != '/')) return false;
     if (!next(c) || (c != '*')) return false;
@@ -793,7 +766,7 @@ static bool docStartBlock(Token &x) {
 }
 
 
-static bool docEndLine(Token &x) {
+bool docEndLine(Token &x) {
     char c;
     if (!next(c)) return false;
 
@@ -804,7 +777,7 @@ static bool docEndLine(Token &x) {
     return false;
 }
 
-static bool docEndBlock(Token &x) {
+bool docEndBlock(Token &x) {
     char c;
     do {
         if (!next(c)) return false;
@@ -814,7 +787,7 @@ static bool docEndBlock(Token &x) {
     return true;
 }
 
-static bool docProperty(Token &x) {
+bool docProperty(Token &x) {
     char c;
     if (!next(c)) return false;
     while (isSpace(c))
@@ -833,7 +806,7 @@ static bool docProperty(Token &x) {
     return true;
 }
 
-static bool maybeDocEnd()
+bool maybeDocEnd()
 {
     char c = '*';
     while (c == '*')
@@ -842,7 +815,7 @@ static bool maybeDocEnd()
     return (c == '/');
 }
 
-static bool docText(Token &x) {
+bool docText(Token &x) {
 
     const char *begin = save();
     char c;
@@ -870,7 +843,7 @@ static bool docText(Token &x) {
     return true;
 }
 
-static bool docSpace()
+bool docSpace()
 {
     char c;
     if (!next(c)) return false;
@@ -891,7 +864,7 @@ static bool docSpace()
     return false;
 }
 
-static bool nextDocToken(Token &x) {
+bool nextDocToken(Token &x) {
     x = Token();
     const char *p = save();
 
@@ -912,6 +885,10 @@ static bool nextDocToken(Token &x) {
     restore(p); if (docProperty(x))  goto success;
     restore(p); if (docText(x)) goto success;
     if (p != end) {
+        if (quiet) {
+            failed = true;
+            return false;
+        }
         pushLocation(locationFor(p));
         error("invalid doc token");
     }
@@ -923,4 +900,52 @@ success :
     return true;
 }
 
+}; // LexerImpl
+
+
+
+//
+// tokenize
+//
+
+static bool tokenize(LexerImpl &lexer, vector<Token> &tokens) {
+    tokens.push_back(Token());
+    while (lexer.nextToken(tokens.back())) {
+        switch (tokens.back().tokenKind) {
+        case T_SPACE :
+        case T_LINE_COMMENT :
+        case T_BLOCK_COMMENT :
+            break;
+        case T_DOC_START:
+            while (lexer.nextDocToken(tokens.back())) {
+                if (tokens.back().tokenKind == T_DOC_END)
+                    break;
+                tokens.push_back(Token());
+            }
+            break;
+        default :
+            tokens.push_back(Token());
+        }
+    }
+    tokens.pop_back();
+    return !lexer.failed;
+}
+
+void tokenize(SourcePtr source, vector<Token> &tokens) {
+    tokenize(source, 0, source->size(), tokens);
+}
+
+void tokenize(SourcePtr source, unsigned offset, size_t length,
+              vector<Token> &tokens) {
+    initKeywords();
+    LexerImpl lexer(source, offset, length, false);
+    tokenize(lexer, tokens);
+}
+
+bool tokenizeQuietly(SourcePtr source, vector<Token> &tokens) {
+    assert(keywords != NULL);
+    LexerImpl lexer(source, 0, source->size(), true);
+    return tokenize(lexer, tokens);
+}
+
 }
@@ -45,6 +45,11 @@ void tokenize(SourcePtr source, vector<Token> &tokens);
 void tokenize(SourcePtr source, unsigned offset, size_t length,
               vector<Token> &tokens);
 
+// Reentrant variant for worker threads: returns false on an invalid token
+// instead of reporting it. initKeywords() must have been called first.
+bool tokenizeQuietly(SourcePtr source, vector<Token> &tokens);
+void initKeywords();
+
 bool isSpace(char c);
 
 }
@@ -8,6 +8,10 @@
 #include "parser.hpp"
 #include "desugar.hpp"
 #include "env.hpp"
+#include "threads.hpp"
+#include "snapshot.hpp"
+#include "timing.hpp"
+#include "trace.hpp"
 
 #pragma clang diagnostic ignored "-Wcovered-switch-default"
 
@@ -140,6 +144,133 @@ static string toKey(DottedNamePtr name) {
 
 
 
+//
+// module directory index
+//
+
+#define MODULE_INDEX_MAGIC "clay-module-index 1"
+
+static bool directoryModTime(llvm::StringRef dir, unsigned long long &modTime) {
+    llvm::sys::PathWithStatus path(dir);
+    const llvm::sys::FileStatus *status = path.getFileStatus();
+    if (status == NULL || !status->isDir)
+        return false;
+    modTime = status->getTimestamp().toEpochTime();
+    return true;
+}
+
+// Lists each search directory once per compilation, so that probing the
+// module suffixes is a hash lookup instead of a stat call per candidate.
+// Directories restored from the module index file are reused as long as
+// their modification time is unchanged; see relistModuleDirectories for
+// failed lookups.
+static ModuleDirectory &indexDirectory(llvm::StringRef dir, CompilerState* cst) {
+    ModuleDirectory &index = cst->moduleDirectories[dir];
+    if (index.indexed)
+        return index;
+    index.indexed = true;
+
+    unsigned long long modTime;
+    if (!directoryModTime(dir, modTime)) {
+        index.entries.clear();
+        index.modTime = 0;
+        index.listedInModSecond = false;
+        return index;
+    }
+    if (index.modTime == modTime)
+        return index;
+
+    index.entries.clear();
+    index.modTime = modTime;
+    index.listedInModSecond =
+        llvm::sys::TimeValue::now().toEpochTime() <= modTime;
+    llvm::error_code ec;
+    for (llvm::sys::fs::directory_iterator i(dir, ec), end;
+         i != end && !ec;
+         i.increment(ec))
+    {
+        index.entries.insert(llvm::sys::path::filename(i->path()));
+    }
+    cst->moduleIndexDirty = true;
+    return index;
+}
+
+void loadModuleIndex(llvm::StringRef fileName, CompilerState* cst) {
+    cst->moduleIndexFile = fileName;
+
+    llvm::OwningPtr<llvm::MemoryBuffer> buffer;
+    if (llvm::MemoryBuffer::getFile(fileName, buffer))
+        return;
+
+    // "<modTime>\t<directory>" lines, each followed by "\t<file name>" lines
+    pair<llvm::StringRef, llvm::StringRef> line = buffer->getBuffer().split('\n');
+    if (line.first != MODULE_INDEX_MAGIC)
+        return;
+    ModuleDirectory *current = NULL;
+    llvm::StringRef rest = line.second;
+    while (!rest.empty()) {
+        line = rest.split('\n');
+        rest = line.second;
+        if (line.first.empty())
+            continue;
+        if (line.first[0] == '\t') {
+            if (current != NULL)
+                current->entries.insert(line.first.substr(1));
+            continue;
+        }
+        pair<llvm::StringRef, llvm::StringRef> fields = line.first.split('\t');
+        unsigned long long modTime;
+        if (fields.second.empty() || fields.first.getAsInteger(10, modTime)) {
+            current = NULL;
+            continue;
+        }
+        current = &cst->moduleDirectories[fields.second];
+        current->modTime = modTime;
+    }
+}
+
+void saveModuleIndex(CompilerState* cst) {
+    if (cst->moduleIndexFile.empty() || !cst->moduleIndexDirty)
+        return;
+
+    // write to a temporary file and rename, so that concurrent compilers
+    // never see a partially written index
+    PathString model(cst->moduleIndexFile);
+    model.append("-%%%%%%%%");
+    int fd;
+    PathString tempPath;
+    if (llvm::sys::fs::unique_file(model.str(), fd, tempPath)) {
+        llvm::errs() << "warning: unable to write module index "
+                     << cst->moduleIndexFile << "\n";
+        return;
+    }
+    {
+        llvm::raw_fd_ostream out(fd, /*shouldClose=*/ true);
+        out << MODULE_INDEX_MAGIC << "\n";
+        llvm::StringMap<ModuleDirectory>::const_iterator i, end;
+        for (i = cst->moduleDirectories.begin(), end = cst->moduleDirectories.end();
+             i != end; ++i) {
+            ModuleDirectory const &index = i->getValue();
+            if (index.modTime == 0 || index.listedInModSecond)
+                continue;
+            out << index.modTime << '\t' << i->getKey() << '\n';
+            llvm::StringSet<>::const_iterator j, jend;
+            for (j = index.entries.begin(), jend = index.entries.end(); j != jend; ++j)
+                out << '\t' << j->getKey() << '\n';
+        }
+    }
+    bool dontcare;
+    if (llvm::sys::fs::rename(tempPath.str(), cst->moduleIndexFile)) {
+        llvm::sys::fs::remove(tempPath.str(), dontcare);
+        llvm::errs() << "warning: unable to write module index "
+                     << cst->moduleIndexFile << "\n";
+        return;
+    }
+    cst->moduleIndexDirty = false;
+}
+
+
+
 //
 // addSearchPath, locateFile, toRelativePath,
 // locateModule
@@ -153,15 +284,24 @@ void setSearchPath(llvm::ArrayRef<PathString>  path,
 static bool locateFile(llvm::StringRef relativePath, PathString &path,
                        CompilerState* cst) {
     // relativePath has no suffix
+    llvm::StringRef relativeDir = llvm::sys::path::parent_path(relativePath);
+    llvm::StringRef stem = llvm::sys::path::filename(relativePath);
     for (size_t i = 0; i < cst->searchPath.size(); ++i) {
-        PathString pathWOSuffix(cst->searchPath[i]);
-        llvm::sys::path::append(pathWOSuffix, relativePath);
+        PathString dir(cst->searchPath[i]);
+        if (!relativeDir.empty())
+            llvm::sys::path::append(dir, relativeDir);
+        ModuleDirectory const &index = indexDirectory(dir.str(), cst);
+        if (index.entries.empty())
+            continue;
         for (size_t j = 0; j < cst->moduleSuffixes.size(); ++j) {
-            path = pathWOSuffix;
-            path.append(cst->moduleSuffixes[j].begin(), 
+            llvm::SmallString<64> name(stem);
+            name.append(cst->moduleSuffixes[j].begin(),
                         cst->moduleSuffixes[j].end());
-            if (llvm::sys::fs::exists(path.str()))
+            if (index.entries.count(name.str())) {
+                path = dir;
+                llvm::sys::path::append(path, name.str());
                 return true;
+            }
         }
     }
     return false;
@@ -187,16 +327,46 @@ static PathString toRelativePath2(DottedNamePtr name) {
     return toRelativePathUpto(name, name->parts.end() - 1);
 }
 
+// files may have been added since the directories were indexed (e.g. in
+// the REPL). each directory is checked again, and listed again only if its
+// modification time changed or it was listed within the second of its
+// modification time, which has one-second granularity.
+static void relistModuleDirectories(CompilerState* cst) {
+    llvm::StringMap<ModuleDirectory>::iterator i, end;
+    for (i = cst->moduleDirectories.begin(), end = cst->moduleDirectories.end();
+         i != end; ++i) {
+        ModuleDirectory &index = i->getValue();
+        if (!index.indexed)
+            continue;
+        index.indexed = false;
+        if (index.listedInModSecond)
+            index.modTime = 0;
+    }
+}
+
+// speculative lookups, such as the prefetcher's, don't relist directories
+// when they fail; the lookup that needs the module will
+static bool findModule(DottedNamePtr name, PathString &path,
+                       CompilerState* cst, bool relist = true) {
+    if (locateFile(toRelativePath1(name), path, cst))
+        return true;
+    if (locateFile(toRelativePath2(name), path, cst))
+        return true;
+    if (!relist)
+        return false;
+
+    relistModuleDirectories(cst);
+    return locateFile(toRelativePath1(name), path, cst)
+        || locateFile(toRelativePath2(name), path, cst);
+}
+
 static PathString locateModule(DottedNamePtr name, CompilerState* cst) {
     PathString path;
-
-    PathString relativePath1 = toRelativePath1(name);
-    if (locateFile(relativePath1, path, cst))
+    if (findModule(name, path, cst))
         return path;
 
+    PathString relativePath1 = toRelativePath1(name);
     PathString relativePath2 = toRelativePath2(name);
-    if (locateFile(relativePath2, path, cst))
-        return path;
 
     string s;
     llvm::raw_string_ostream ss(s);
@@ -233,12 +403,12 @@ static PathString locateModule(DottedNamePtr name, CompilerState* cst) {
 // loadFile
 //
 
-static SourcePtr loadFile(llvm::StringRef fileName, vector<string> *sourceFiles,
-                          CompilerState* cst) {
+static void registerSource(SourcePtr src, vector<string> *sourceFiles,
+                           CompilerState* cst) {
+    llvm::StringRef fileName = src->fileName;
     if (sourceFiles != NULL)
         sourceFiles->push_back(fileName);
 
-    SourcePtr src = new Source(fileName);
     if (cst->llvmDIBuilder != NULL) {
         PathString absFileName(fileName);
         llvm::sys::fs::make_absolute(absFileName);
@@ -246,9 +416,180 @@ static SourcePtr loadFile(llvm::StringRef fileName, vector<string> *sourceFiles,
             llvm::sys::path::filename(absFileName),
             llvm::sys::path::parent_path(absFileName));
     }
+}
+
+static SourcePtr loadFile(llvm::StringRef fileName, vector<string> *sourceFiles,
+                          CompilerState* cst) {
+    SourcePtr src = new Source(fileName);
+    registerSource(src, sourceFiles, cst);
     return src;
 }
 
+
+
+//
+// AST snapshots
+//
+
+// written beside the source by -emit-ast
+static PathString localSnapshotPath(llvm::StringRef sourcePath) {
+    PathString path(sourcePath);
+    path.append(".clayast");
+    return path;
+}
+
+// the absolute source path, escaped into a single file name in -ast-cache
+static PathString cachedSnapshotPath(llvm::StringRef sourcePath, CompilerState* cst) {
+    PathString absPath(sourcePath);
+    llvm::sys::fs::make_absolute(absPath);
+    string name;
+    for (size_t i = 0; i < absPath.size(); ++i) {
+        char c = absPath[i];
+        if (isalnum((unsigned char)c) || c == '.' || c == '-' || c == '_') {
+            name += c;
+        } else {
+            char escape[4];
+            sprintf(escape, "%%%02X", (unsigned char)c);
+            name += escape;
+        }
+    }
+    name += ".clayast";
+    PathString path(cst->snapshotCacheDir);
+    llvm::sys::path::append(path, name);
+    return path;
+}
+
+static ModulePtr readSnapshot(llvm::StringRef key, SourcePtr src, CompilerState* cst) {
+    ModulePtr m = readModuleSnapshot(localSnapshotPath(src->fileName), key, src, cst);
+    if (m == NULL && !cst->snapshotCacheDir.empty())
+        m = readModuleSnapshot(cachedSnapshotPath(src->fileName, cst), key, src, cst);
+    return m;
+}
+
+static void writeSnapshots(ModulePtr m, CompilerState* cst) {
+    if (cst->emitSnapshots) {
+        PathString path = localSnapshotPath(m->source->fileName);
+        if (!writeModuleSnapshot(path, m))
+            llvm::errs() << "warning: unable to write " << path << "\n";
+    }
+    if (!cst->snapshotCacheDir.empty())
+        writeModuleSnapshot(cachedSnapshotPath(m->source->fileName, cst), m);
+}
+
+static ModulePtr parseModule(llvm::StringRef key, SourcePtr src,
+                             bool useSnapshots, CompilerState* cst) {
+    TimingPhase modulePhase("module " + (key.empty() ? llvm::StringRef("main") : key));
+    if (useSnapshots) {
+        TimingPhase snapshotPhase("read snapshot");
+        ModulePtr m = readSnapshot(key, src, cst);
+        if (m != NULL)
+            return m;
+    }
+    vector<Token> tokens;
+    {
+        TimingPhase tokenizePhase("tokenize");
+        tokenize(src, tokens);
+    }
+    ModulePtr m;
+    {
+        TimingPhase parsePhase("parse");
+        m = parse(key, src, tokens, cst);
+    }
+    if (useSnapshots)
+        writeSnapshots(m, cst);
+    return m;
+}
+
+
+
+//
+// prefetchModules
+//
+
+static bool isBuiltinModule(llvm::StringRef key) {
+    return key == "__primitives__"
+        || key == "__operators__"
+        || key == "__intrinsics__";
+}
+
+struct PrefetchJob {
+    string key;
+    PathString path;
+    CompilerState* cst;
+    SourcePtr source;
+    ModulePtr module;
+    bool fromSnapshot;
+
+    PrefetchJob(llvm::StringRef key, llvm::StringRef path, CompilerState* cst)
+        : key(key), path(path), cst(cst), fromSnapshot(false) {}
+};
+
+// runs on worker threads; errors are left for loadModuleByName to report
+static void readAndParse(size_t i, void *jobs) {
+    PrefetchJob &job = (*(vector<PrefetchJob> *)jobs)[i];
+    llvm::OwningPtr<llvm::MemoryBuffer> buffer;
+    if (llvm::MemoryBuffer::getFile(job.path.str(), buffer))
+        return;
+    job.source = new Source(job.path.str(), buffer.take());
+    job.module = readSnapshot(job.key, job.source, job.cst);
+    if (job.module != NULL) {
+        job.fromSnapshot = true;
+        return;
+    }
+    vector<Token> tokens;
+    if (!tokenizeQuietly(job.source, tokens))
+        return;
+    job.module = parseQuietly(job.key, job.source, tokens, job.cst);
+}
+
+// Walks the import graph breadth first, loading each level of modules on
+// cst->loadThreads threads, from their snapshots or by tokenizing and
+// parsing them. Each thread allocates the nodes it reads or parses from an
+// allocator of its own, and neither snapshots nor a quiet parser share
+// nodes with other threads. loadModuleByName picks up the parsed
+// modules, so imports are still installed and initialized in the usual
+// depth-first order.
+static void prefetchModules(llvm::ArrayRef<DottedNamePtr> roots,
+                            CompilerState* cst) {
+    initKeywords();
+    set<string> seen;
+    vector<DottedNamePtr> level(roots.begin(), roots.end());
+    while (!level.empty()) {
+        vector<PrefetchJob> jobs;
+        for (size_t i = 0; i < level.size(); ++i) {
+            string key = toKey(level[i]);
+            if (!seen.insert(key).second || isBuiltinModule(key)
+                || cst->globalModules.count(key))
+                continue;
+            PathString path;
+            if (!findModule(level[i], path, cst, /*relist=*/ false))
+                continue;
+            jobs.push_back(PrefetchJob(key, path.str(), cst));
+        }
+
+        {
+            TimingPhase parsePhase("prefetch read and parse");
+            threadANodeAllocatorsEnabled = true;
+            parallelFor(jobs.size(), cst->loadThreads, readAndParse, &jobs);
+            threadANodeAllocatorsEnabled = false;
+        }
+
+        level.clear();
+        for (size_t i = 0; i < jobs.size(); ++i) {
+            PrefetchJob &job = jobs[i];
+            if (job.module == NULL)
+                continue;
+            if (!job.fromSnapshot)
+                writeSnapshots(job.module, cst);
+            PrefetchedModule &entry = cst->prefetchedModules[job.key];
+            entry.module = job.module;
+            entry.path = job.path.str();
+            for (size_t j = 0; j < job.module->imports.size(); ++j)
+                level.push_back(job.module->imports[j]->dottedName);
+        }
+    }
+}
+
 //
 // loadModuleByName, loadDependents, loadProgram
 //
@@ -310,6 +651,7 @@ static ModulePtr loadModuleByName(DottedNamePtr name,
     if (i != cst->globalModules.end())
         return i->second;
 
+    TraceSpan span("load", "module " + key);
     ModulePtr module;
 
     if (key == "__primitives__") {
@@ -320,11 +662,21 @@ static ModulePtr loadModuleByName(DottedNamePtr name,
         module = makeIntrinsicsModule(cst);
     }
     else {
-        PathString path = locateModule(name, cst);
-        if (verbose) {
-            llvm::errs() << "loading module " << name->join() << " from " << path << "\n";
+        llvm::StringMap<PrefetchedModule>::iterator p = cst->prefetchedModules.find(key);
+        if (p != cst->prefetchedModules.end()) {
+            module = p->second.module;
+            if (verbose) {
+                llvm::errs() << "loading module " << name->join() << " from " << p->second.path << "\n";
+            }
+            cst->prefetchedModules.erase(p);
+            registerSource(module->source, sourceFiles, cst);
+        } else {
+            PathString path = locateModule(name, cst);
+            if (verbose) {
+                llvm::errs() << "loading module " << name->join() << " from " << path << "\n";
+            }
+            module = parseModule(key, loadFile(path, sourceFiles, cst), true, cst);
         }
-        module = parse(key, loadFile(path, sourceFiles, cst), cst);
     }
 
     cst->globalModules[key] = module;
@@ -399,25 +751,39 @@ static void loadDependents(ModulePtr m, vector<string> *sourceFiles, bool verbos
     }
 }
 
+static DottedNamePtr preludeName(bool repl) {
+    DottedNamePtr dottedName = new DottedName();
+    dottedName->parts.push_back(Identifier::get("prelude"));
+    if (repl)
+        dottedName->parts.push_back(Identifier::get("repl"));
+    return dottedName;
+}
+
 static ModulePtr loadPrelude(vector<string> *sourceFiles, bool verbose,
                              bool repl, CompilerState* cst) {
-    if (!repl) {
-        DottedNamePtr dottedName = new DottedName();
-        dottedName->parts.push_back(Identifier::get("prelude"));
-        return loadModuleByName(dottedName, sourceFiles, verbose, cst);
-    } else {
-        DottedNamePtr dottedName = new DottedName();
-        dottedName->parts.push_back(Identifier::get("prelude"));
-        dottedName->parts.push_back(Identifier::get("repl"));
-        ModulePtr m = loadModuleByName(dottedName, sourceFiles, verbose, cst);
+    ModulePtr m = loadModuleByName(preludeName(repl), sourceFiles, verbose, cst);
+    if (repl)
         cst->globalModules["prelude"] = m;
-        return m;
-    }
+    return m;
+}
+
+static void prefetchProgram(ModulePtr m, bool repl, CompilerState* cst) {
+    if (cst->loadThreads <= 1)
+        return;
+    vector<DottedNamePtr> roots;
+    roots.push_back(preludeName(repl));
+    for (size_t i = 0; i < m->imports.size(); ++i)
+        roots.push_back(m->imports[i]->dottedName);
+    prefetchModules(roots, cst);
 }
 
 ModulePtr loadProgram(llvm::StringRef fileName, vector<string> *sourceFiles,
                       bool verbose, bool repl, CompilerState* cst) {
-    cst->globalMainModule = parse("", loadFile(fileName, sourceFiles, cst), cst);
+    cst->globalMainModule = parseModule(cst->mainModuleName,
+        loadFile(fileName, sourceFiles, cst), false, cst);
+    if (!cst->mainModuleName.empty())
+        cst->globalModules[cst->mainModuleName] = cst->globalMainModule;
+    prefetchProgram(cst->globalMainModule, repl, cst);
     ModulePtr prelude = loadPrelude(sourceFiles, verbose, repl, cst);
     loadDependents(cst->globalMainModule, sourceFiles, verbose);
     installGlobals(cst->globalMainModule);
@@ -438,7 +804,8 @@ ModulePtr loadProgramSource(llvm::StringRef name,
             "");
     }
 
-    cst->globalMainModule = parse("", mainSource, cst);
+    cst->globalMainModule = parseModule("", mainSource, false, cst);
+    prefetchProgram(cst->globalMainModule, repl, cst);
     // Don't keep track of source files for -e script
     ModulePtr prelude = loadPrelude(NULL, verbose, repl, cst);
     loadDependents(cst->globalMainModule, NULL, verbose);
@@ -14,6 +14,8 @@ void getProcedureMonoTypes(ProcedureMono &mono, EnvPtr env,
 void initLoader(CompilerState* cst);
 void setSearchPath(const llvm::ArrayRef<PathString> path,
                    CompilerState* cst);
+void loadModuleIndex(llvm::StringRef fileName, CompilerState* cst);
+void saveModuleIndex(CompilerState* cst);
 ModulePtr loadProgram(llvm::StringRef fileName, vector<string> *sourceFiles,
                       bool verbose, bool repl, CompilerState* cst);
 ModulePtr loadProgramSource(llvm::StringRef name, llvm::StringRef source, 
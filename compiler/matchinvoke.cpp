@@ -3,6 +3,7 @@
 #include "matchinvoke.hpp"
 #include "evaluator.hpp"
 #include "env.hpp"
+#include "timing.hpp"
 
 
 namespace clay {
@@ -99,6 +100,7 @@ MatchResultPtr matchInvoke(OverloadPtr overload,
                            ObjectPtr callable,
                            llvm::ArrayRef<TypePtr> argsKey)
 {
+    TimingPhase phase("pattern matching");
     CompilerState* cst = overload->env->cst;
     initializePatterns(overload, cst);
 
@@ -0,0 +1,417 @@
+#include "clay.hpp"
+#include "multiversion.hpp"
+#include "invoketables.hpp"
+#include "codegen.hpp"
+#include <llvm/InlineAsm.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+
+
+namespace clay {
+
+namespace {
+    enum CPUIDRegister { EAX, EBX, ECX, EDX };
+
+    // the cpuid outputs that hold feature bits
+    enum CPUIDWord {
+        LEAF1_ECX,
+        LEAF1_EDX,
+        LEAF7_EBX,
+        EXT1_ECX,
+        CPUID_WORD_COUNT
+    };
+
+    struct X86Feature {
+        const char *name;
+        CPUIDWord word;
+        unsigned bit;
+        // uses the YMM registers, which the OS must also save
+        bool needsAVXState;
+    };
+}
+
+// named as in LLVM's -mattr
+static const X86Feature x86Features[] = {
+    {"cmov", LEAF1_EDX, 15, false},
+    {"mmx", LEAF1_EDX, 23, false},
+    {"sse", LEAF1_EDX, 25, false},
+    {"sse2", LEAF1_EDX, 26, false},
+    {"sse3", LEAF1_ECX, 0, false},
+    {"pclmul", LEAF1_ECX, 1, false},
+    {"ssse3", LEAF1_ECX, 9, false},
+    {"fma", LEAF1_ECX, 12, true},
+    {"sse41", LEAF1_ECX, 19, false},
+    {"sse42", LEAF1_ECX, 20, false},
+    {"movbe", LEAF1_ECX, 22, false},
+    {"popcnt", LEAF1_ECX, 23, false},
+    {"aes", LEAF1_ECX, 25, false},
+    {"avx", LEAF1_ECX, 28, true},
+    {"f16c", LEAF1_ECX, 29, true},
+    {"rdrand", LEAF1_ECX, 30, false},
+    {"bmi", LEAF7_EBX, 3, false},
+    {"avx2", LEAF7_EBX, 5, true},
+    {"bmi2", LEAF7_EBX, 8, false},
+    {"lzcnt", EXT1_ECX, 5, false},
+    {"sse4a", EXT1_ECX, 6, false},
+    {"xop", EXT1_ECX, 11, true},
+    {"fma4", EXT1_ECX, 16, true},
+    {NULL, LEAF1_ECX, 0, false}
+};
+
+
+
+//
+// feature sets
+//
+
+static X86Feature const *lookupFeature(llvm::StringRef name)
+{
+    for (X86Feature const *f = x86Features; f->name != NULL; ++f) {
+        if (name == f->name)
+            return f;
+    }
+    return NULL;
+}
+
+// "avx2, +fma" becomes "+avx2,+fma"
+static string parseFeatureSet(InvokeEntry* entry,
+                              llvm::StringRef text,
+                              vector<X86Feature const *> &parsed)
+{
+    llvm::SmallVector<llvm::StringRef, 4> names;
+    text.split(names, ",");
+    string features;
+    for (size_t i = 0; i < names.size(); ++i) {
+        llvm::StringRef name = names[i];
+        while (name.startswith(" "))
+            name = name.substr(1);
+        while (name.endswith(" "))
+            name = name.substr(0, name.size() - 1);
+        if (name.startswith("+"))
+            name = name.substr(1);
+        X86Feature const *feature = lookupFeature(name);
+        if (feature == NULL)
+            error(entry->origCode,
+                  "unknown target feature in multiversion: \"" + name + "\"");
+        parsed.push_back(feature);
+        if (!features.empty())
+            features += ',';
+        features += '+';
+        features += name;
+    }
+    return features;
+}
+
+
+
+//
+// resolver
+//
+
+static llvm::Value *cpuid(llvm::IRBuilder<> &builder,
+                          unsigned leaf,
+                          CPUIDRegister reg)
+{
+    llvm::Type *i32 = builder.getInt32Ty();
+    llvm::Type *results[] = { i32, i32, i32, i32 };
+    llvm::Type *args[] = { i32, i32 };
+    llvm::FunctionType *type = llvm::FunctionType::get(
+        llvm::StructType::get(builder.getContext(), results), args, false);
+    llvm::InlineAsm *code = llvm::InlineAsm::get(type, "cpuid",
+        "={ax},={bx},={cx},={dx},{ax},{cx},~{dirflag},~{fpsr},~{flags}",
+        false);
+    llvm::Value *values[] = { builder.getInt32(leaf), builder.getInt32(0) };
+    llvm::Value *result = builder.CreateCall(code, values);
+    return builder.CreateExtractValue(result, reg);
+}
+
+// the low word of XCR0, which says what register state the OS saves
+static llvm::Value *xgetbv(llvm::IRBuilder<> &builder)
+{
+    llvm::Type *i32 = builder.getInt32Ty();
+    llvm::Type *results[] = { i32, i32 };
+    llvm::FunctionType *type = llvm::FunctionType::get(
+        llvm::StructType::get(builder.getContext(), results), i32, false);
+    llvm::InlineAsm *code = llvm::InlineAsm::get(type, ".byte 0x0f, 0x01, 0xd0",
+        "={ax},={dx},{cx},~{dirflag},~{fpsr},~{flags}",
+        true);
+    llvm::Value *result = builder.CreateCall(code, builder.getInt32(0));
+    return builder.CreateExtractValue(result, 0);
+}
+
+static llvm::Function *codegenResolver(
+    llvm::Module *module,
+    llvm::StringRef name,
+    llvm::GlobalVariable *dispatch,
+    vector<llvm::Function *> const &variants,
+    vector<vector<X86Feature const *> > const &featureSets)
+{
+    llvm::LLVMContext &context = module->getContext();
+    llvm::Function *resolver = llvm::Function::Create(
+        llvm::FunctionType::get(llvm::Type::getVoidTy(context), false),
+        llvm::Function::InternalLinkage,
+        name + " resolve",
+        module);
+
+    llvm::BasicBlock *entryBlock =
+        llvm::BasicBlock::Create(context, "entry", resolver);
+    llvm::BasicBlock *xgetbvBlock =
+        llvm::BasicBlock::Create(context, "xgetbv", resolver);
+    llvm::BasicBlock *selectBlock =
+        llvm::BasicBlock::Create(context, "select", resolver);
+    llvm::IRBuilder<> builder(entryBlock);
+
+    // leaves above the maximum return another leaf's values, so those are
+    // replaced by zero
+    llvm::Value *words[CPUID_WORD_COUNT];
+    llvm::Value *maxLeaf = cpuid(builder, 0, EAX);
+    words[LEAF1_ECX] = cpuid(builder, 1, ECX);
+    words[LEAF1_EDX] = cpuid(builder, 1, EDX);
+    words[LEAF7_EBX] = builder.CreateSelect(
+        builder.CreateICmpUGE(maxLeaf, builder.getInt32(7)),
+        cpuid(builder, 7, EBX),
+        builder.getInt32(0));
+    llvm::Value *maxExtLeaf = cpuid(builder, 0x80000000, EAX);
+    words[EXT1_ECX] = builder.CreateSelect(
+        builder.CreateICmpUGE(maxExtLeaf, builder.getInt32(0x80000001)),
+        cpuid(builder, 0x80000001, ECX),
+        builder.getInt32(0));
+
+    // xgetbv faults unless the OS has enabled it (OSXSAVE)
+    llvm::Value *osxsave = builder.CreateICmpNE(
+        builder.CreateAnd(words[LEAF1_ECX], builder.getInt32(1u << 27)),
+        builder.getInt32(0));
+    builder.CreateCondBr(osxsave, xgetbvBlock, selectBlock);
+
+    builder.SetInsertPoint(xgetbvBlock);
+    llvm::Value *ymmSaved = builder.CreateICmpEQ(
+        builder.CreateAnd(xgetbv(builder), builder.getInt32(6)),
+        builder.getInt32(6));
+    builder.CreateBr(selectBlock);
+
+    builder.SetInsertPoint(selectBlock);
+    llvm::PHINode *avxState = builder.CreatePHI(builder.getInt1Ty(), 2);
+    avxState->addIncoming(builder.getFalse(), entryBlock);
+    avxState->addIncoming(ymmSaved, xgetbvBlock);
+
+    for (size_t i = 0; i < variants.size(); ++i) {
+        llvm::Value *supported = builder.getTrue();
+        for (size_t j = 0; j < featureSets[i].size(); ++j) {
+            X86Feature const *feature = featureSets[i][j];
+            llvm::Value *mask = builder.getInt32(1u << feature->bit);
+            supported = builder.CreateAnd(supported, builder.CreateICmpEQ(
+                builder.CreateAnd(words[feature->word], mask), mask));
+            if (feature->needsAVXState)
+                supported = builder.CreateAnd(supported, avxState);
+        }
+        llvm::BasicBlock *useBlock =
+            llvm::BasicBlock::Create(context, "use", resolver);
+        llvm::BasicBlock *nextBlock =
+            llvm::BasicBlock::Create(context, "next", resolver);
+        builder.CreateCondBr(supported, useBlock, nextBlock);
+
+        builder.SetInsertPoint(useBlock);
+        builder.CreateStore(variants[i], dispatch);
+        builder.CreateRetVoid();
+
+        builder.SetInsertPoint(nextBlock);
+    }
+    builder.CreateRetVoid();
+
+    return resolver;
+}
+
+
+
+//
+// codegenMultiversions
+//
+
+static llvm::Function *cloneBody(llvm::Function *func, llvm::Twine const &name)
+{
+    llvm::ValueToValueMapTy vmap;
+    llvm::Function *copy = llvm::CloneFunction(func, vmap, false);
+    copy->setName(name);
+    func->getParent()->getFunctionList().push_back(copy);
+    return copy;
+}
+
+void codegenMultiversions(InvokeEntry* entry)
+{
+    CompilerState* cst = entry->env->cst;
+    llvm::Function *llFunc = entry->llvmFunc;
+    llvm::Module *module = llFunc->getParent();
+    llvm::LLVMContext &context = module->getContext();
+
+    vector<string> features;
+    vector<vector<X86Feature const *> > featureSets;
+    for (size_t i = 0; i < entry->multiversions.size(); ++i) {
+        featureSets.push_back(vector<X86Feature const *>());
+        features.push_back(
+            parseFeatureSet(entry, entry->multiversions[i], featureSets.back()));
+    }
+
+    llvm::Triple triple(module->getTargetTriple());
+    if (triple.getArch() != llvm::Triple::x86
+        && triple.getArch() != llvm::Triple::x86_64)
+        return;
+
+    string name = llFunc->getName();
+    llvm::NamedMDNode *variantList =
+        module->getOrInsertNamedMetadata("clay.multiversion");
+
+    llvm::Function *baseline = cloneBody(llFunc, name + " [baseline]");
+    vector<llvm::Function *> variants;
+    for (size_t i = 0; i < features.size(); ++i) {
+        llvm::Function *variant =
+            cloneBody(llFunc, name + " [" + features[i] + "]");
+        variants.push_back(variant);
+        llvm::Value *operands[] = {
+            variant, llvm::MDString::get(context, features[i])
+        };
+        variantList->addOperand(llvm::MDNode::get(context, operands));
+    }
+
+    llvm::GlobalVariable *dispatch = new llvm::GlobalVariable(
+        *module, llFunc->getType(), false,
+        llvm::GlobalVariable::InternalLinkage,
+        baseline,
+        name + " dispatch");
+
+    // the original function becomes the dispatcher, so that calls already
+    // generated, including recursive calls in the copies, go through it
+    llFunc->deleteBody();
+    llFunc->setLinkage(llvm::Function::InternalLinkage);
+    llvm::BasicBlock *block =
+        llvm::BasicBlock::Create(context, "dispatch", llFunc);
+    llvm::IRBuilder<> builder(block);
+    vector<llvm::Value *> args;
+    llvm::Function::arg_iterator ai, aend;
+    for (ai = llFunc->arg_begin(), aend = llFunc->arg_end(); ai != aend; ++ai)
+        args.push_back(&*ai);
+    llvm::CallInst *call = builder.CreateCall(builder.CreateLoad(dispatch), args);
+    call->setTailCall();
+    if (llFunc->getReturnType()->isVoidTy())
+        builder.CreateRetVoid();
+    else
+        builder.CreateRet(call);
+
+    llvm::Function *resolver =
+        codegenResolver(module, name, dispatch, variants, featureSets);
+
+    // the resolver runs ahead of the global initializers. without them
+    // (as in the REPL) the baseline copy is always used
+    CodegenContext *ctors = cst->constructorsCtx;
+    if (ctors != NULL && ctors->initBuilder != NULL
+        && ctors->llvmFunc->getParent() == module)
+        ctors->initBuilder->CreateCall(resolver);
+}
+
+
+
+//
+// splitMultiversionModules
+//
+
+void splitMultiversionModules(llvm::Module *module,
+                              vector<MultiversionModule> &out)
+{
+    llvm::NamedMDNode *variantList =
+        module->getNamedMetadata("clay.multiversion");
+    if (variantList == NULL)
+        return;
+
+    // variants grouped by feature set; optimization may have deleted some
+    map<string, vector<llvm::Function *> > groups;
+    for (unsigned i = 0; i < variantList->getNumOperands(); ++i) {
+        llvm::MDNode *node = variantList->getOperand(i);
+        llvm::Function *variant =
+            llvm::dyn_cast_or_null<llvm::Function>(node->getOperand(0));
+        llvm::MDString *features = llvm::cast<llvm::MDString>(node->getOperand(1));
+        if (variant != NULL && !variant->isDeclaration())
+            groups[features->getString().str()].push_back(variant);
+    }
+    variantList->eraseFromParent();
+
+    map<string, vector<llvm::Function *> >::const_iterator gi;
+    for (gi = groups.begin(); gi != groups.end(); ++gi) {
+        llvm::ValueToValueMapTy vmap;
+        llvm::Module *split = llvm::CloneModule(module, vmap);
+
+        // the global initializers stay in the main module
+        if (llvm::GlobalVariable *ctors = split->getGlobalVariable("llvm.global_ctors"))
+            ctors->eraseFromParent();
+        if (llvm::GlobalVariable *dtors = split->getGlobalVariable("llvm.global_dtors"))
+            dtors->eraseFromParent();
+
+        set<llvm::Function *> kept;
+        for (size_t i = 0; i < gi->second.size(); ++i) {
+            llvm::Function *variant = llvm::cast<llvm::Function>(vmap[gi->second[i]]);
+            variant->setLinkage(llvm::GlobalValue::ExternalLinkage);
+            variant->setVisibility(llvm::GlobalValue::HiddenVisibility);
+            kept.insert(variant);
+        }
+
+        // internal functions the variants call are compiled again with the
+        // variants' features; everything else is referenced in the main
+        // module
+        for (llvm::Module::iterator fi = split->begin(); fi != split->end(); ++fi) {
+            if (!fi->isDeclaration() && !fi->hasLocalLinkage() && !kept.count(&*fi))
+                fi->deleteBody();
+        }
+        llvm::Module::global_iterator vi;
+        for (vi = split->global_begin(); vi != split->global_end(); ++vi) {
+            if (vi->isDeclaration() || vi->getName().startswith("llvm.")
+                || (vi->hasLocalLinkage() && vi->isConstant()))
+                continue;
+            vi->setInitializer(NULL);
+            vi->setLinkage(llvm::GlobalValue::ExternalLinkage);
+        }
+
+        llvm::PassManager passes;
+        passes.add(llvm::createGlobalDCEPass());
+        passes.run(*split);
+
+        // the main module's variables that are still used have to be
+        // visible to the split module's object file
+        for (vi = module->global_begin(); vi != module->global_end(); ++vi) {
+            if (!vi->hasLocalLinkage() || vi->isConstant())
+                continue;
+            llvm::GlobalValue *copy =
+                llvm::dyn_cast_or_null<llvm::GlobalValue>(vmap[&*vi]);
+            if (copy == NULL)
+                continue;
+            if (!vi->hasName())
+                vi->setName("multiversion shared");
+            copy->setName(vi->getName());
+            vi->setLinkage(llvm::GlobalValue::ExternalLinkage);
+            vi->setVisibility(llvm::GlobalValue::HiddenVisibility);
+        }
+
+        for (size_t i = 0; i < gi->second.size(); ++i) {
+            llvm::Function *variant = gi->second[i];
+            variant->deleteBody();
+            variant->setVisibility(llvm::GlobalValue::HiddenVisibility);
+        }
+
+        out.push_back(MultiversionModule(split, gi->first));
+    }
+}
+
+llvm::TargetMachine *multiversionTargetMachine(llvm::TargetMachine *base,
+                                               llvm::StringRef features)
+{
+    string allFeatures = base->getTargetFeatureString();
+    if (!allFeatures.empty())
+        allFeatures += ',';
+    allFeatures += features;
+    return base->getTarget().createTargetMachine(
+        base->getTargetTriple(),
+        base->getTargetCPU(),
+        allFeatures,
+        base->Options,
+        base->getRelocationModel(),
+        base->getCodeModel(),
+        base->getOptLevel());
+}
+
+}
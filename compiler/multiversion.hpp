@@ -0,0 +1,43 @@
+#ifndef __CLAY_MULTIVERSION_HPP
+#define __CLAY_MULTIVERSION_HPP
+
+#include "clay.hpp"
+
+namespace clay {
+
+// 'multiversion("avx2,fma", "sse42")' compiles a procedure once for each
+// listed set of target features as well as for the baseline target. Calls
+// go through a function pointer that starts at the baseline copy; a
+// resolver run before the global initializers checks the host with cpuid
+// and switches it to the first feature set the host supports.
+//
+// LLVM 3.2 selects target features per TargetMachine, not per function, so
+// when an executable or shared library is linked the feature-set copies are
+// moved into modules of their own and compiled separately. Other outputs
+// (-c, -S, -emit-llvm, -run) keep all copies in one module compiled for the
+// baseline target. Only x86 targets have feature sets; elsewhere the
+// attribute is ignored.
+
+struct InvokeEntry;
+
+// turns entry's generated function into the dispatcher for its copies
+void codegenMultiversions(InvokeEntry* entry);
+
+struct MultiversionModule {
+    llvm::Module *module;
+    string features;
+    MultiversionModule(llvm::Module *module, llvm::StringRef features)
+        : module(module), features(features) {}
+};
+
+// moves the feature-set copies out of module, one module per feature set
+void splitMultiversionModules(llvm::Module *module,
+                              vector<MultiversionModule> &out);
+
+// a target machine like base that also has the given features
+llvm::TargetMachine *multiversionTargetMachine(llvm::TargetMachine *base,
+                                               llvm::StringRef features);
+
+}
+
+#endif
@@ -0,0 +1,200 @@
+#include "clay.hpp"
+#include "optimizer.hpp"
+#include "overflowchecks.hpp"
+#include "timing.hpp"
+
+
+namespace clay {
+
+static void addOptimizationPasses(llvm::PassManager &passes,
+                                  llvm::FunctionPassManager &fpasses,
+                                  unsigned optLevel,
+                                  bool internalize,
+                                  bool vectorize)
+{
+    llvm::Pass *inliningPass = 0;
+    if (optLevel > 1) {
+        int threshold = 225;
+        if (optLevel > 2)
+            threshold = 275;
+        inliningPass = llvm::createFunctionInliningPass(threshold);
+    } else {
+        inliningPass = llvm::createAlwaysInlinerPass();
+    }
+
+    llvm::PassManagerBuilder builder;
+    builder.OptLevel = optLevel;
+    builder.Inliner = inliningPass;
+    builder.Vectorize = vectorize;
+
+    builder.populateFunctionPassManager(fpasses);
+
+    // If all optimizations are disabled, just run the always-inline pass.
+    if (optLevel == 0) {
+        if (builder.Inliner) {
+            passes.add(builder.Inliner);
+            builder.Inliner = 0;
+        }
+    } else {
+        passes.add(llvm::createTypeBasedAliasAnalysisPass());
+        passes.add(llvm::createBasicAliasAnalysisPass());
+        
+        passes.add(llvm::createGlobalOptimizerPass());     // Optimize out global vars
+
+        passes.add(llvm::createIPSCCPPass());              // IP SCCP
+        passes.add(llvm::createDeadArgEliminationPass());  // Dead argument elimination
+
+        passes.add(llvm::createInstructionCombiningPass());// Clean up after IPCP & DAE
+        passes.add(llvm::createCFGSimplificationPass());   // Clean up after IPCP & DAE
+        
+        // Start of CallGraph SCC passes.
+        if (builder.Inliner) {
+            passes.add(builder.Inliner);
+            builder.Inliner = 0;
+        }
+        if (optLevel > 2)
+            passes.add(llvm::createArgumentPromotionPass());   // Scalarize uninlined fn args
+
+        // Start of function pass.
+        // Break up aggregate allocas, using SSAUpdater.
+        passes.add(llvm::createScalarReplAggregatesPass(-1, false));
+        passes.add(llvm::createEarlyCSEPass());              // Catch trivial redundancies
+        
+        passes.add(llvm::createJumpThreadingPass());         // Thread jumps.
+        // Disable Value Propagation pass until fixed LLVM bug #12503
+        // passes.add(llvm::createCorrelatedValuePropagationPass()); // Propagate conditionals
+        passes.add(llvm::createCFGSimplificationPass());     // Merge & remove BBs
+        passes.add(llvm::createInstructionCombiningPass());  // Combine silly seq's
+        passes.add(createOverflowCheckEliminationPass());    // Drop overflow checks that can't fail
+
+        passes.add(llvm::createTailCallEliminationPass());   // Eliminate tail calls
+        passes.add(llvm::createCFGSimplificationPass());     // Merge & remove BBs
+        passes.add(llvm::createReassociatePass());           // Reassociate expressions
+        passes.add(llvm::createLoopRotatePass());            // Rotate Loop
+        passes.add(llvm::createLICMPass());                  // Hoist loop invariants
+        passes.add(llvm::createLoopUnswitchPass(builder.SizeLevel || optLevel < 3));
+        passes.add(llvm::createInstructionCombiningPass());
+        passes.add(llvm::createIndVarSimplifyPass());        // Canonicalize indvars
+        passes.add(llvm::createLoopIdiomPass());             // Recognize idioms like memset.
+        passes.add(llvm::createLoopDeletionPass());          // Delete dead loops
+        if (vectorize) {
+            passes.add(llvm::createLoopVectorizePass());     // Vectorize loops
+            passes.add(llvm::createLICMPass());              // Hoist runtime checks
+            passes.add(llvm::createLoopUnrollPass());        // Unroll small loops
+        }
+        
+        if (optLevel > 1)
+            passes.add(llvm::createGVNPass());                 // Remove redundancies
+        passes.add(llvm::createMemCpyOptPass());             // Remove memcpy / form memset
+        passes.add(llvm::createSCCPPass());                  // Constant prop with SCCP
+
+        // Run instcombine after redundancy elimination to exploit opportunities
+        // opened up by them.
+        passes.add(llvm::createInstructionCombiningPass());
+        passes.add(llvm::createJumpThreadingPass());         // Thread jumps
+        // Disable Value Propagation pass until fixed LLVM bug #12503
+        // passes.add(llvm::createCorrelatedValuePropagationPass());
+        passes.add(llvm::createDeadStoreEliminationPass());  // Delete dead stores
+
+        if (builder.Vectorize) {
+            passes.add(llvm::createBBVectorizePass());
+            passes.add(llvm::createInstructionCombiningPass());
+            if (optLevel > 1)
+                passes.add(llvm::createGVNPass());                 // Remove redundancies
+        }
+
+        passes.add(llvm::createAggressiveDCEPass());         // Delete dead instructions
+        passes.add(llvm::createCFGSimplificationPass());     // Merge & remove BBs
+        passes.add(llvm::createInstructionCombiningPass());  // Clean up after everything.
+
+        // GlobalOpt already deletes dead functions and globals, at -O3 try a
+        // late pass of GlobalDCE.  It is capable of deleting dead cycles.
+        if (optLevel > 2)
+            passes.add(llvm::createGlobalDCEPass());         // Remove dead fns and globals.
+
+        if (optLevel > 1)
+            passes.add(llvm::createConstantMergePass());     // Merge dup global constants
+    }
+
+    if (optLevel > 2) {
+        if (internalize) {
+            vector<const char*> do_not_internalize;
+            do_not_internalize.push_back("main");
+            passes.add(llvm::createInternalizePass(do_not_internalize));
+        }
+        builder.populateLTOPassManager(passes, false, true);
+    }
+}
+
+static llvm::TargetTransformInfo *createTargetTransformInfo(
+    llvm::TargetMachine *targetMachine)
+{
+    return new llvm::TargetTransformInfo(
+        targetMachine->getScalarTargetTransformInfo(),
+        targetMachine->getVectorTargetTransformInfo());
+}
+
+void optimizeLLVM(llvm::Module *module,
+                  llvm::TargetMachine *targetMachine,
+                  unsigned optLevel,
+                  bool internalize,
+                  bool vectorize)
+{
+    llvm::PassManager passes;
+
+    string moduleDataLayout = module->getDataLayout();
+    llvm::DataLayout *dl = new llvm::DataLayout(moduleDataLayout);
+    passes.add(dl);
+    // without it the loop vectorizer has no cost model and never
+    // vectorizes, and -mcpu doesn't reach the IR passes
+    passes.add(createTargetTransformInfo(targetMachine));
+
+    llvm::FunctionPassManager fpasses(module);
+
+    fpasses.add(new llvm::DataLayout(*dl));
+    fpasses.add(createTargetTransformInfo(targetMachine));
+
+    addOptimizationPasses(passes, fpasses, optLevel, internalize, vectorize);
+
+    fpasses.doInitialization();
+    for (llvm::Module::iterator i = module->begin(), e = module->end();
+         i != e; ++i)
+    {
+        fpasses.run(*i);
+    }
+
+    passes.add(llvm::createVerifierPass());
+    passes.run(*module);
+}
+
+void generateAssembly(llvm::Module *module,
+                      llvm::TargetMachine *targetMachine,
+                      llvm::raw_ostream *out,
+                      bool emitObject)
+{
+    TimingPhase phase("object emission");
+    llvm::FunctionPassManager fpasses(module);
+
+    fpasses.add(new llvm::DataLayout(module));
+    fpasses.add(llvm::createVerifierPass());
+
+    targetMachine->setAsmVerbosityDefault(true);
+
+    llvm::formatted_raw_ostream fout(*out);
+    llvm::TargetMachine::CodeGenFileType fileType = emitObject
+        ? llvm::TargetMachine::CGFT_ObjectFile
+        : llvm::TargetMachine::CGFT_AssemblyFile;
+
+    bool result = targetMachine->addPassesToEmitFile(fpasses, fout, fileType);
+    assert(!result);
+
+    fpasses.doInitialization();
+    for (llvm::Module::iterator i = module->begin(), e = module->end();
+         i != e; ++i)
+    {
+        fpasses.run(*i);
+    }
+    fpasses.doFinalization();
+}
+
+}
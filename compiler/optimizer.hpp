@@ -0,0 +1,29 @@
+#ifndef __CLAY_OPTIMIZER_HPP
+#define __CLAY_OPTIMIZER_HPP
+
+#include "clay.hpp"
+
+namespace clay {
+
+// The optimization pipeline and object emission shared by the compiler
+// driver and clay-bench.
+
+// runs the pass pipeline for optLevel over module. internalize lets -O3
+// give everything but main internal linkage before the link-time passes.
+// targetMachine supplies the cost models of the loop vectorizer and other
+// target-aware passes.
+void optimizeLLVM(llvm::Module *module,
+                  llvm::TargetMachine *targetMachine,
+                  unsigned optLevel,
+                  bool internalize,
+                  bool vectorize);
+
+// writes module to out as assembly, or as an object if emitObject
+void generateAssembly(llvm::Module *module,
+                      llvm::TargetMachine *targetMachine,
+                      llvm::raw_ostream *out,
+                      bool emitObject);
+
+}
+
+#endif
@@ -0,0 +1,275 @@
+#include "clay.hpp"
+#include "overflowchecks.hpp"
+#include "stats.hpp"
+#include <llvm/ADT/DepthFirstIterator.h>
+#include <llvm/Analysis/Dominators.h>
+#include <llvm/Analysis/ScalarEvolution.h>
+#include <llvm/InitializePasses.h>
+#include <llvm/IntrinsicInst.h>
+#include <llvm/Support/ConstantRange.h>
+
+
+namespace clay {
+
+namespace {
+    struct OverflowCheckElimination : public llvm::FunctionPass {
+        static char ID;
+
+        OverflowCheckElimination() : llvm::FunctionPass(ID) {
+            llvm::PassRegistry &registry = *llvm::PassRegistry::getPassRegistry();
+            llvm::initializeDominatorTreePass(registry);
+            llvm::initializeScalarEvolutionPass(registry);
+        }
+
+        virtual const char *getPassName() const {
+            return "Clay overflow check elimination";
+        }
+
+        virtual void getAnalysisUsage(llvm::AnalysisUsage &usage) const {
+            usage.addRequired<llvm::DominatorTree>();
+            usage.addRequired<llvm::ScalarEvolution>();
+            usage.setPreservesCFG();
+        }
+
+        virtual bool runOnFunction(llvm::Function &f);
+    };
+}
+
+char OverflowCheckElimination::ID = 0;
+
+llvm::Pass *createOverflowCheckEliminationPass()
+{
+    return new OverflowCheckElimination();
+}
+
+
+
+//
+// operand ranges
+//
+
+static bool isOverflowCheck(llvm::Intrinsic::ID id)
+{
+    switch (id) {
+    case llvm::Intrinsic::sadd_with_overflow :
+    case llvm::Intrinsic::uadd_with_overflow :
+    case llvm::Intrinsic::ssub_with_overflow :
+    case llvm::Intrinsic::usub_with_overflow :
+    case llvm::Intrinsic::smul_with_overflow :
+    case llvm::Intrinsic::umul_with_overflow :
+        return true;
+    default :
+        return false;
+    }
+}
+
+static bool isSignedCheck(llvm::Intrinsic::ID id)
+{
+    return id == llvm::Intrinsic::sadd_with_overflow
+        || id == llvm::Intrinsic::ssub_with_overflow
+        || id == llvm::Intrinsic::smul_with_overflow;
+}
+
+// narrows range by the comparisons of v made by the conditional branches
+// that every path to bb takes in the same direction
+static llvm::ConstantRange guardedRange(llvm::Value *v,
+                                        llvm::ConstantRange range,
+                                        llvm::BasicBlock *bb,
+                                        llvm::DominatorTree &dt,
+                                        llvm::ScalarEvolution &se)
+{
+    for (llvm::DomTreeNode *node = dt.getNode(bb);
+         node != NULL;
+         node = node->getIDom())
+    {
+        llvm::BasicBlock *block = node->getBlock();
+        llvm::BasicBlock *pred = block->getSinglePredecessor();
+        if (pred == NULL)
+            continue;
+        llvm::BranchInst *branch =
+            llvm::dyn_cast<llvm::BranchInst>(pred->getTerminator());
+        if (branch == NULL || !branch->isConditional()
+            || branch->getSuccessor(0) == branch->getSuccessor(1))
+            continue;
+        llvm::ICmpInst *cmp =
+            llvm::dyn_cast<llvm::ICmpInst>(branch->getCondition());
+        if (cmp == NULL)
+            continue;
+
+        llvm::CmpInst::Predicate predicate = cmp->getPredicate();
+        if (branch->getSuccessor(1) == block)
+            predicate = cmp->getInversePredicate();
+        llvm::Value *other;
+        if (cmp->getOperand(0) == v) {
+            other = cmp->getOperand(1);
+        } else if (cmp->getOperand(1) == v) {
+            other = cmp->getOperand(0);
+            predicate = llvm::CmpInst::getSwappedPredicate(predicate);
+        } else
+            continue;
+
+        const llvm::SCEV *otherSCEV = se.getSCEV(other);
+        llvm::ConstantRange otherRange = llvm::CmpInst::isSigned(predicate)
+            ? se.getSignedRange(otherSCEV)
+            : se.getUnsignedRange(otherSCEV);
+        range = range.intersectWith(
+            llvm::ConstantRange::makeICmpRegion(predicate, otherRange));
+    }
+    return range;
+}
+
+static llvm::ConstantRange operandRange(llvm::Value *v,
+                                        bool isSigned,
+                                        llvm::BasicBlock *bb,
+                                        llvm::DominatorTree &dt,
+                                        llvm::ScalarEvolution &se)
+{
+    const llvm::SCEV *scev = se.getSCEV(v);
+    llvm::ConstantRange range = isSigned
+        ? se.getSignedRange(scev)
+        : se.getUnsignedRange(scev);
+    return guardedRange(v, range, bb, dt, se);
+}
+
+
+
+//
+// overflow
+//
+
+static bool fitsSigned(llvm::ConstantRange const &r, unsigned bits)
+{
+    unsigned width = r.getBitWidth();
+    return r.getSignedMin().sge(llvm::APInt::getSignedMinValue(bits).sext(width))
+        && r.getSignedMax().sle(llvm::APInt::getSignedMaxValue(bits).sext(width));
+}
+
+static bool fitsUnsigned(llvm::ConstantRange const &r, unsigned bits)
+{
+    unsigned width = r.getBitWidth();
+    return r.getUnsignedMax().ule(llvm::APInt::getMaxValue(bits).zext(width));
+}
+
+// the operations are done in a type wide enough to hold every result, so
+// the ranges computed there are exact bounds of the true results
+static bool cannotOverflow(llvm::Intrinsic::ID id,
+                           llvm::ConstantRange const &a,
+                           llvm::ConstantRange const &b)
+{
+    if (a.isEmptySet() || b.isEmptySet())
+        return false;
+    unsigned bits = a.getBitWidth();
+    switch (id) {
+    case llvm::Intrinsic::sadd_with_overflow :
+        return fitsSigned(a.signExtend(bits+1).add(b.signExtend(bits+1)), bits);
+    case llvm::Intrinsic::uadd_with_overflow :
+        return fitsUnsigned(a.zeroExtend(bits+1).add(b.zeroExtend(bits+1)), bits);
+    case llvm::Intrinsic::ssub_with_overflow :
+        return fitsSigned(a.signExtend(bits+1).sub(b.signExtend(bits+1)), bits);
+    case llvm::Intrinsic::usub_with_overflow :
+        return fitsUnsigned(a.zeroExtend(bits+1).sub(b.zeroExtend(bits+1)), bits);
+    case llvm::Intrinsic::smul_with_overflow :
+        return fitsSigned(a.signExtend(2*bits).multiply(b.signExtend(2*bits)), bits);
+    case llvm::Intrinsic::umul_with_overflow :
+        return fitsUnsigned(a.zeroExtend(2*bits).multiply(b.zeroExtend(2*bits)), bits);
+    default :
+        assert(false);
+        return false;
+    }
+}
+
+static bool removeCheck(llvm::IntrinsicInst *call)
+{
+    llvm::SmallVector<llvm::ExtractValueInst*, 2> extracts;
+    for (llvm::Value::use_iterator i = call->use_begin();
+         i != call->use_end();
+         ++i)
+    {
+        llvm::ExtractValueInst *extract =
+            llvm::dyn_cast<llvm::ExtractValueInst>(*i);
+        if (extract == NULL || extract->getNumIndices() != 1)
+            return false;
+        extracts.push_back(extract);
+    }
+
+    llvm::Value *a = call->getArgOperand(0);
+    llvm::Value *b = call->getArgOperand(1);
+    llvm::BinaryOperator *result;
+    switch (call->getIntrinsicID()) {
+    case llvm::Intrinsic::sadd_with_overflow :
+        result = llvm::BinaryOperator::CreateNSWAdd(a, b, "", call);
+        break;
+    case llvm::Intrinsic::uadd_with_overflow :
+        result = llvm::BinaryOperator::CreateNUWAdd(a, b, "", call);
+        break;
+    case llvm::Intrinsic::ssub_with_overflow :
+        result = llvm::BinaryOperator::CreateNSWSub(a, b, "", call);
+        break;
+    case llvm::Intrinsic::usub_with_overflow :
+        result = llvm::BinaryOperator::CreateNUWSub(a, b, "", call);
+        break;
+    case llvm::Intrinsic::smul_with_overflow :
+        result = llvm::BinaryOperator::CreateNSWMul(a, b, "", call);
+        break;
+    case llvm::Intrinsic::umul_with_overflow :
+        result = llvm::BinaryOperator::CreateNUWMul(a, b, "", call);
+        break;
+    default :
+        assert(false);
+        return false;
+    }
+    result->takeName(call);
+
+    llvm::Value *noOverflow = llvm::ConstantInt::getFalse(call->getContext());
+    for (size_t i = 0; i < extracts.size(); ++i) {
+        llvm::ExtractValueInst *extract = extracts[i];
+        if (extract->getIndices()[0] == 0)
+            extract->replaceAllUsesWith(result);
+        else
+            extract->replaceAllUsesWith(noOverflow);
+        extract->eraseFromParent();
+    }
+    call->eraseFromParent();
+    return true;
+}
+
+bool OverflowCheckElimination::runOnFunction(llvm::Function &f)
+{
+    llvm::DominatorTree &dt = getAnalysis<llvm::DominatorTree>();
+    llvm::ScalarEvolution &se = getAnalysis<llvm::ScalarEvolution>();
+
+    // in dominator order, so a check whose operand came from a removed
+    // check sees the plain arithmetic that replaced it
+    vector<llvm::IntrinsicInst*> checks;
+    for (llvm::df_iterator<llvm::DomTreeNode*> i = llvm::df_begin(dt.getRootNode()),
+             end = llvm::df_end(dt.getRootNode());
+         i != end;
+         ++i)
+    {
+        llvm::BasicBlock *bb = (*i)->getBlock();
+        for (llvm::BasicBlock::iterator j = bb->begin(); j != bb->end(); ++j) {
+            llvm::IntrinsicInst *call = llvm::dyn_cast<llvm::IntrinsicInst>(&*j);
+            if (call != NULL && isOverflowCheck(call->getIntrinsicID()))
+                checks.push_back(call);
+        }
+    }
+
+    unsigned removed = 0;
+    for (size_t i = 0; i < checks.size(); ++i) {
+        llvm::IntrinsicInst *call = checks[i];
+        llvm::BasicBlock *bb = call->getParent();
+        bool isSigned = isSignedCheck(call->getIntrinsicID());
+        llvm::ConstantRange a =
+            operandRange(call->getArgOperand(0), isSigned, bb, dt, se);
+        llvm::ConstantRange b =
+            operandRange(call->getArgOperand(1), isSigned, bb, dt, se);
+        if (cannotOverflow(call->getIntrinsicID(), a, b) && removeCheck(call))
+            ++removed;
+    }
+
+    if (removed > 0)
+        addStatistic("integer overflow checks proven unnecessary", removed);
+    return removed > 0;
+}
+
+}
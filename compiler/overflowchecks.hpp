@@ -0,0 +1,30 @@
+#ifndef __CLAY_OVERFLOWCHECKS_HPP
+#define __CLAY_OVERFLOWCHECKS_HPP
+
+#include "clay.hpp"
+
+namespace clay {
+
+// The checked integer operators ('+', '-' and '*' when overflowChecks
+// assertions are enabled) inline to the llvm.*.with.overflow intrinsics
+// followed by a branch to an error. This pass finds the intrinsic calls
+// whose operands are bounded tightly enough that the operation cannot
+// overflow and replaces them with plain arithmetic, which lets the error
+// branch fold away.
+//
+// An operand's range is what ScalarEvolution knows about it (constants,
+// extensions, masks, induction variables with known trip counts) narrowed
+// by the comparisons of the conditional branches that must have been taken
+// to reach the call. The latter covers loop counters such as the 'i' of
+// 'for (i in range(n))', whose increment is guarded by 'i < n'. The pass
+// runs before loop rotation, while that guard still dominates the
+// increment.
+//
+// Checked conversions that cannot overflow because the destination type
+// holds every value of the source type are handled at codegen.
+
+llvm::Pass *createOverflowCheckEliminationPass();
+
+}
+
+#endif
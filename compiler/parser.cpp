@@ -1,11 +1,66 @@
 #include "clay.hpp"
 #include "parser.hpp"
 #include "codegen.hpp"
+#include "threads.hpp"
+#include "timing.hpp"
 
 namespace clay {
 
 map<llvm::StringRef, IdentifierPtr> Identifier::freeIdentifiers;
 
+bool threadANodeAllocatorsEnabled = false;
+
+static ThreadLocalPointer threadANodeAllocators;
+static Mutex threadANodeAllocatorsMutex;
+static vector<llvm::BumpPtrAllocator *> allThreadANodeAllocators;
+
+// the allocators outlive their threads, since the nodes do, until
+// freeThreadANodeAllocators
+llvm::BumpPtrAllocator *threadANodeAllocator() {
+    llvm::BumpPtrAllocator *allocator =
+        (llvm::BumpPtrAllocator *)threadANodeAllocators.get();
+    if (allocator == NULL) {
+        allocator = new llvm::BumpPtrAllocator();
+        threadANodeAllocators.set(allocator);
+        threadANodeAllocatorsMutex.lock();
+        allThreadANodeAllocators.push_back(allocator);
+        threadANodeAllocatorsMutex.unlock();
+    }
+    return allocator;
+}
+
+void freeThreadANodeAllocators() {
+    assert(!threadANodeAllocatorsEnabled);
+    for (size_t i = 0; i < allThreadANodeAllocators.size(); ++i)
+        delete allThreadANodeAllocators[i];
+    allThreadANodeAllocators.clear();
+    // the worker threads are gone, but the loading thread parses too
+    threadANodeAllocators.set(NULL);
+}
+
+// the shared table of free identifiers belongs to the loading thread, so
+// worker threads make identifiers of their own
+static Identifier *freeIdentifier(llvm::StringRef str) {
+    if (threadANodeAllocatorsEnabled)
+        return Identifier::get(str, Location());
+    return Identifier::get(str);
+}
+
+namespace {
+    // thrown by a quiet parser instead of reporting a syntax error
+    struct QuietParseFailure {};
+}
+
+static void markReturnSpecs(CodePtr code) {
+    if (code->exprReturnSpecs && code->body != NULL
+        && code->body->stmtKind == RETURN)
+    {
+        Return *x = (Return *)code->body.ptr();
+        if (x->isExprReturn)
+            x->isReturnSpecs = true;
+    }
+}
+
 struct ParserImpl {
 CompilerState* currentCompiler;
 
@@ -18,9 +73,20 @@ AddTokensCallback addTokens;
 
 bool inRepl;
 
+// abandon the parse with QuietParseFailure instead of reporting errors.
+// a quiet parser must not touch anything shared with other threads, which
+// is why it never uses interned identifiers.
+bool quiet;
+
 ParserImpl(CompilerState* cst, AddTokensCallback f = NULL) :
     currentCompiler(cst), addTokens(f), inRepl(false),  
-    parserOptionKeepDocumentation(false) {
+    parserOptionKeepDocumentation(false), quiet(false) {
+}
+
+void parseError(Location const &location, llvm::Twine const &msg) {
+    if (quiet)
+        throw QuietParseFailure();
+    error(location, msg);
 }
 
 bool next(Token *&x) {
@@ -469,7 +535,7 @@ bool staticIndexingSuffix(ExprPtr &x) {
     char *end = b;
     unsigned long c = strtoul(b, &end, 0);
     if (*end != 0)
-        error(t, "invalid static index value");
+        parseError(t->location, "invalid static index value");
     x = new StaticIndexing(NULL, (size_t)c);
     x->location = location;
     return true;
@@ -623,7 +689,7 @@ bool preopExpr(ExprPtr &x) {
     if (!operatorOp(op)) return false;
     ExprPtr y;
     if (!prefixExpr(y)) return false;
-    ExprListPtr exprs = new ExprList(new NameRef(Identifier::get(op)));
+    ExprListPtr exprs = new ExprList(new NameRef(freeIdentifier(op)));
     exprs->add(y);
     x = new VariadicOp(PREFIX_OP, exprs);
     x->location = location;
@@ -654,7 +720,7 @@ bool operatorTail(VariadicOpPtr &x) {
     unsigned p = save();
     while (true) {
         if (!prefixExpr(b)) return false;
-        exprs->add(new NameRef(Identifier::get(op)));
+        exprs->add(new NameRef(freeIdentifier(op)));
         exprs->add(b);
         p = save();
         if (!operatorOp(op)) {
@@ -1169,7 +1235,7 @@ bool prefixUpdate(StatementPtr &x) {
     if (!uopstring(op)) return false;
     if (!expression(z)) return false;
     if (!symbol(";")) return false;
-    ExprListPtr exprs = new ExprList(new NameRef(Identifier::get(op)));
+    ExprListPtr exprs = new ExprList(new NameRef(freeIdentifier(op)));
     if (z->exprKind == VARIADIC_OP) {
         VariadicOp *y = (VariadicOp *)z.ptr();
         exprs->add(y->exprs);
@@ -1189,7 +1255,7 @@ bool updateAssignment(StatementPtr &x) {
     if (!uopstring(op)) return false;
     if (!expression(z)) return false;
     if (!symbol(";")) return false;
-    ExprListPtr exprs = new ExprList(new NameRef(Identifier::get(op)));
+    ExprListPtr exprs = new ExprList(new NameRef(freeIdentifier(op)));
     exprs->add(y);
     if (z->exprKind == VARIADIC_OP) {
         VariadicOp *y = (VariadicOp *)z.ptr();
@@ -1728,11 +1794,11 @@ FormalArgPtr makeStaticFormalArg(size_t index, ExprPtr expr, Location const & lo
     llvm::SmallString<128> buf;
     llvm::raw_svector_ostream sout(buf);
     sout << "%arg" << index;
-    IdentifierPtr argName = Identifier::get(sout.str());
+    IdentifierPtr argName = freeIdentifier(sout.str());
 
     ExprPtr staticName =
         new ForeignExpr("prelude",
-                        new NameRef(Identifier::get("Static")));
+                        new NameRef(freeIdentifier("Static")));
 
     IndexingPtr indexing = new Indexing(staticName, new ExprList(expr));
     indexing->startLocation = location;
@@ -1750,7 +1816,7 @@ bool staticFormalArg(size_t index, FormalArgPtr &x) {
     if (!expression(expr)) return false;
 
     if (expr->exprKind == UNPACK) {
-        error(expr, "#static variadic arguments are not yet supported");
+        parseError(expr->location, "#static variadic arguments are not yet supported");
     }
 
     x = makeStaticFormalArg(index, expr, location);
@@ -1963,6 +2029,54 @@ bool optBody(StatementPtr &x) {
     return false;
 }
 
+// Skips over a procedure body by matching brackets, without parsing it.
+// The body is parsed by ensureBody() when it is first needed.
+bool skipBody(Location &start, unsigned &length) {
+    Token *t;
+    if (!next(t)) return false;
+    bool isBlock;
+    if (t->tokenKind == T_OPSTRING && t->str == "=")
+        isBlock = false;
+    else if (t->tokenKind == T_SYMBOL && t->str == "{")
+        isBlock = true;
+    else
+        return false;
+    start = t->location;
+    int depth = isBlock ? 1 : 0;
+    while (true) {
+        if (!next(t)) return false;
+        if (t->tokenKind != T_SYMBOL)
+            continue;
+        if (t->str == "(" || t->str == "[" || t->str == "{") {
+            ++depth;
+        } else if (t->str == ")" || t->str == "]" || t->str == "}") {
+            if (--depth < 0) return false;
+            if (isBlock && depth == 0) break;
+        } else if (!isBlock && depth == 0 && t->str == ";") {
+            break;
+        }
+    }
+    if (t->location.source != start.source)
+        return false;
+    length = t->location.offset + 1 - start.offset;
+    return true;
+}
+
+bool lazyBody(CodePtr code) {
+    if (!currentCompiler->lazyBodies || inRepl)
+        return false;
+    unsigned p = save();
+    Location start;
+    unsigned length;
+    if (!skipBody(start, length)) {
+        restore(p);
+        return false;
+    }
+    code->lazyBodyLocation = start;
+    code->lazyBodyLength = length;
+    return true;
+}
+
 
 
 //
@@ -2375,6 +2489,25 @@ bool optInline(InlineAttribute &isInline) {
     return true;
 }
 
+bool optMultiversion(vector<string> &featureSets) {
+    unsigned p = save();
+    if (!keyword("multiversion")) {
+        restore(p);
+        return true;
+    }
+    if (!symbol("(")) return false;
+    do {
+        Token* t;
+        if (!next(t) || (t->tokenKind != T_STRING_LITERAL))
+            return false;
+        featureSets.push_back(string(t->str.begin(), t->str.end()));
+        p = save();
+    } while (symbol(","));
+    restore(p);
+    if (!symbol(")")) return false;
+    return true;
+}
+
 bool optCallByName(bool &callByName) {
     unsigned p = save();
     if (!keyword("alias")) {
@@ -2491,6 +2624,8 @@ bool procedureWithBody(vector<TopLevelItemPtr> &x, Module *module, unsigned s) {
     if (!topLevelVisibility(vis)) return false;
     InlineAttribute isInline;
     if (!optInline(isInline)) return false;
+    vector<string> multiversions;
+    if (!optMultiversion(multiversions)) return false;
     bool callByName;
     if (!optCallByName(callByName)) return false;
     IdentifierPtr name;
@@ -2509,13 +2644,10 @@ bool procedureWithBody(vector<TopLevelItemPtr> &x, Module *module, unsigned s) {
     code->hasVarArg = hasVarArg;
     bool exprRetSpecs = false;
     code->returnSpecsDeclared = allReturnSpecsWithFlag(code->returnSpecs, code->varReturnSpec, exprRetSpecs);
-    if (!body(code->body)) return false;
+    code->exprReturnSpecs = exprRetSpecs;
+    if (!lazyBody(code) && !body(code->body)) return false;
     code->location = location;
-    if(exprRetSpecs && code->body->stmtKind == RETURN){
-        Return *x = (Return *)code->body.ptr();    
-        if(x->isExprReturn)
-            x->isReturnSpecs = true;
-    }
+    markReturnSpecs(code);
 
     ProcedurePtr proc = new Procedure(module, name, vis, true);
     proc->location = location;
@@ -2526,6 +2658,7 @@ bool procedureWithBody(vector<TopLevelItemPtr> &x, Module *module, unsigned s) {
     target->startLocation = targetStartLocation;
     target->endLocation = targetEndLocation;
     OverloadPtr oload = new Overload(module, target, code, callByName, isInline, hasAsConversion);
+    oload->multiversions = multiversions;
     oload->location = location;
     x.push_back(oload.ptr());
 
@@ -2552,6 +2685,8 @@ bool procedure(TopLevelItemPtr &x, Module *module) {
 bool overload(TopLevelItemPtr &x, Module *module, unsigned s) {
     InlineAttribute isInline;
     if (!optInline(isInline)) return false;
+    vector<string> multiversions;
+    if (!optMultiversion(multiversions)) return false;
     bool callByName;
     if (!optCallByName(callByName)) return false;
     bool isDefault;
@@ -2572,22 +2707,20 @@ bool overload(TopLevelItemPtr &x, Module *module, unsigned s) {
     code->hasVarArg = hasVarArg;
     bool exprRetSpecs = false;
     code->returnSpecsDeclared = allReturnSpecsWithFlag(code->returnSpecs, code->varReturnSpec, exprRetSpecs);
+    code->exprReturnSpecs = exprRetSpecs;
     unsigned p = save();
-    if (!optBody(code->body)) {
+    if (!lazyBody(code) && !optBody(code->body)) {
         restore(p);
         if (callByName) return false;
         if (!llvmCode(code->llvmBody)) return false;
     }
-    if(exprRetSpecs && code->body->stmtKind == RETURN){
-        Return *x = (Return *)code->body.ptr();    
-        if(x->isExprReturn)
-            x->isReturnSpecs = true;
-    }
+    markReturnSpecs(code);
     target->location = location;
     target->startLocation = targetStartLocation;
     target->endLocation = targetEndLocation;
     code->location = location;
     OverloadPtr oload = new Overload(module, target, code, callByName, isInline, hasAsConversion);
+    oload->multiversions = multiversions;
     oload->location = location;
     oload->isDefault = isDefault;
     x = oload.ptr();
@@ -3265,7 +3398,12 @@ void applyParser(SourcePtr source, unsigned offset, size_t length, Parser parser
 {
     vector<Token> t;
     tokenize(source, offset, length, t);
+    applyParser(source, t, parser, parserParam, node);
+}
 
+template<typename Parser, typename ParserParam, typename Node>
+void applyParser(SourcePtr source, vector<Token> &t, Parser parser, ParserParam parserParam, Node &node)
+{
     tokens = &t;
     position = maxPosition = 0;
 
@@ -3275,6 +3413,8 @@ void applyParser(SourcePtr source, unsigned offset, size_t length, Parser parser
             location = Location(source.ptr(), unsigned(source->size()));
         else
             location = t[maxPosition].location;
+        if (quiet)
+            throw QuietParseFailure();
         pushLocation(location);
         error("parse error");
     }
@@ -3300,6 +3440,10 @@ bool expressionListParser(ParserImpl* self, ExprListPtr& x, bool f) {
     return self->expressionList(x, f);
 }
 
+bool bodyParser(ParserImpl* self, StatementPtr &x, bool) {
+    return self->body(x);
+}
+
 bool blockItemsParser(ParserImpl* self, vector<StatementPtr> &x, bool f) {
     return self->blockItems(x, f);
 }
@@ -3324,6 +3468,31 @@ ModulePtr parse(llvm::StringRef moduleName, SourcePtr source,
     return m;
 }
 
+ModulePtr parse(llvm::StringRef moduleName, SourcePtr source,
+                vector<Token> &tokens, CompilerState* cst) {
+    ParserImpl parserImpl(cst);
+    ModulePtr m;
+    ParserImpl::ModuleParser p = { moduleName };
+    parserImpl.applyParser(source, tokens, p, m.ptr(), m);
+    m->source = source;
+    return m;
+}
+
+ModulePtr parseQuietly(llvm::StringRef moduleName, SourcePtr source,
+                       vector<Token> &tokens, CompilerState* cst) {
+    ParserImpl parserImpl(cst);
+    parserImpl.quiet = true;
+    ModulePtr m;
+    ParserImpl::ModuleParser p = { moduleName };
+    try {
+        parserImpl.applyParser(source, tokens, p, m.ptr(), m);
+    } catch (QuietParseFailure const &) {
+        return NULL;
+    }
+    m->source = source;
+    return m;
+}
+
 
 
 //
@@ -3367,6 +3536,24 @@ void parseStatements(SourcePtr source, unsigned offset, size_t length,
 }
 
 
+//
+// ensureBody
+//
+
+void ensureBody(CodePtr code, CompilerState* cst)
+{
+    if (!code->isLazyBody())
+        return;
+    TimingPhase phase("parse bodies");
+    Location location = code->lazyBodyLocation;
+    ParserImpl parserImpl(cst);
+    parserImpl.applyParser(location.source, location.offset,
+                           code->lazyBodyLength, bodyParser, false, code->body);
+    code->lazyBodyLocation = Location();
+    markReturnSpecs(code);
+}
+
+
 //
 // parseTopLevelItems
 //
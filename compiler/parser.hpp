@@ -22,12 +22,21 @@ struct ReplItem {
 
 ModulePtr parse(llvm::StringRef moduleName, SourcePtr source, 
                 CompilerState* cst, ParserFlags flags = NoParserFlags);
+ModulePtr parse(llvm::StringRef moduleName, SourcePtr source,
+                vector<Token> &tokens, CompilerState* cst);
+// Like parse, but returns NULL instead of reporting a syntax error. Safe to
+// call from worker threads while threadANodeAllocatorsEnabled is set.
+ModulePtr parseQuietly(llvm::StringRef moduleName, SourcePtr source,
+                       vector<Token> &tokens, CompilerState* cst);
 ExprPtr parseExpr(SourcePtr source, unsigned offset, size_t length,
                   CompilerState* cst);
 ExprListPtr parseExprList(SourcePtr source, unsigned offset, size_t length,
                           CompilerState* cst);
 void parseStatements(SourcePtr source, unsigned offset, size_t length,
     vector<StatementPtr> &statements, CompilerState* cst);
+// Parses a body that the module parser skipped. Does nothing if the
+// body has already been parsed.
+void ensureBody(CodePtr code, CompilerState* cst);
 void parseTopLevelItems(SourcePtr source, unsigned offset, size_t length,
     vector<TopLevelItemPtr> &topLevels, Module *, CompilerState* cst);
 ReplItem parseInteractive(SourcePtr source, unsigned offset, size_t length,
@@ -0,0 +1,344 @@
+#include "clay.hpp"
+#include "codegen.hpp"
+#include "pgo.hpp"
+#include <llvm/MDBuilder.h>
+
+
+namespace clay {
+
+bool profileGenerateEnabled = false;
+bool profileUseEnabled = false;
+
+static string profileOutputFile;
+
+namespace {
+    struct ProfileCounter {
+        string key;
+        llvm::GlobalVariable *counter;
+        ProfileCounter(llvm::StringRef key, llvm::GlobalVariable *counter)
+            : key(key), counter(counter) {}
+    };
+}
+
+static vector<ProfileCounter> profileCounters;
+
+static llvm::StringMap<uint64_t> profileCounts;
+static uint64_t maxEntryCount = 0;
+
+// a function whose entry count reaches this fraction of the hottest
+// function's gets an inline hint
+static const unsigned HOT_ENTRY_DIVISOR = 100;
+
+
+
+//
+// -profile-generate, -profile-use
+//
+
+void enableProfileGenerate(llvm::StringRef profileFile)
+{
+    PathString path(profileFile);
+    llvm::sys::fs::make_absolute(path);
+    profileOutputFile = path.str();
+    profileGenerateEnabled = true;
+}
+
+static bool isEntryKey(llvm::StringRef key)
+{
+    return key.endswith(":entry");
+}
+
+bool loadProfile(llvm::StringRef profileFile)
+{
+    llvm::OwningPtr<llvm::MemoryBuffer> buffer;
+    if (llvm::MemoryBuffer::getFile(profileFile, buffer))
+        return false;
+
+    // one "key count" line per counter. keys contain spaces, so the count
+    // is split off at the last one. profiles from several runs are
+    // appended to the same file and summed here.
+    llvm::StringRef rest = buffer->getBuffer();
+    while (!rest.empty()) {
+        std::pair<llvm::StringRef, llvm::StringRef> split = rest.split('\n');
+        rest = split.second;
+        llvm::StringRef line = split.first.rtrim();
+        if (line.empty())
+            continue;
+        size_t space = line.rfind(' ');
+        unsigned long long count;
+        if (space == llvm::StringRef::npos
+            || line.substr(space + 1).getAsInteger(10, count))
+            return false;
+        profileCounts[line.substr(0, space)] += count;
+    }
+
+    llvm::StringMap<uint64_t>::const_iterator i, end;
+    for (i = profileCounts.begin(), end = profileCounts.end(); i != end; ++i)
+        if (isEntryKey(i->getKey()) && i->getValue() > maxEntryCount)
+            maxEntryCount = i->getValue();
+
+    profileUseEnabled = true;
+    return true;
+}
+
+
+
+//
+// keys
+//
+
+static llvm::StringRef profileFunctionName(CodegenContext* ctx)
+{
+    if (!ctx->profileName.empty())
+        return ctx->profileName;
+    return ctx->llvmFunc->getName();
+}
+
+static void edgeKey(llvm::SmallVectorImpl<char> &key,
+                    unsigned site, unsigned edge,
+                    CodegenContext* ctx)
+{
+    llvm::raw_svector_ostream out(key);
+    out << profileFunctionName(ctx) << ":branch" << site << ":" << edge;
+}
+
+static void entryKey(llvm::SmallVectorImpl<char> &key, CodegenContext* ctx)
+{
+    llvm::raw_svector_ostream out(key);
+    out << profileFunctionName(ctx) << ":entry";
+}
+
+static bool lookupCount(llvm::StringRef key, uint64_t &count)
+{
+    llvm::StringMap<uint64_t>::const_iterator i = profileCounts.find(key);
+    if (i == profileCounts.end())
+        return false;
+    count = i->getValue();
+    return true;
+}
+
+
+
+//
+// instrumentation
+//
+
+static void codegenCounterIncrement(llvm::StringRef key,
+                                    llvm::IRBuilder<> *builder,
+                                    CompilerState* cst)
+{
+    llvm::Type *counterType = llvmIntType(64);
+    llvm::GlobalVariable *counter = new llvm::GlobalVariable(
+        *cst->llvmModule, counterType, false,
+        llvm::GlobalVariable::InternalLinkage,
+        llvm::ConstantInt::get(counterType, 0),
+        "clay.profile.counter");
+    profileCounters.push_back(ProfileCounter(key, counter));
+
+    llvm::Value *count = builder->CreateLoad(counter);
+    count = builder->CreateAdd(count, llvm::ConstantInt::get(counterType, 1));
+    builder->CreateStore(count, counter);
+}
+
+unsigned profileBranchSite(CodegenContext* ctx)
+{
+    // sites are numbered whether or not profiling is on, so that a
+    // profile matches the build that uses it
+    return ctx->profileSites++;
+}
+
+void profileCountEdge(unsigned site, unsigned edge, CodegenContext* ctx)
+{
+    if (!profileGenerateEnabled)
+        return;
+    llvm::SmallString<128> key;
+    edgeKey(key, site, edge, ctx);
+    codegenCounterIncrement(key, ctx->builder, ctx->cst);
+}
+
+void profileBranchWeights(llvm::TerminatorInst *branch,
+                          unsigned site,
+                          CodegenContext* ctx)
+{
+    if (!profileUseEnabled)
+        return;
+
+    vector<uint64_t> counts;
+    uint64_t maxCount = 0;
+    bool found = false;
+    for (unsigned i = 0; i < branch->getNumSuccessors(); ++i) {
+        llvm::SmallString<128> key;
+        edgeKey(key, site, i, ctx);
+        uint64_t count = 0;
+        if (lookupCount(key, count))
+            found = true;
+        counts.push_back(count);
+        if (count > maxCount)
+            maxCount = count;
+    }
+    if (!found)
+        return;
+
+    // weights are 32-bit; scale large counts down, and keep every weight
+    // nonzero so an edge the training run missed is unlikely, not dead
+    uint64_t scale = maxCount / 0xffffffffu + 1;
+    vector<uint32_t> weights;
+    for (size_t i = 0; i < counts.size(); ++i)
+        weights.push_back(uint32_t(counts[i] / scale + 1));
+
+    llvm::MDBuilder md(branch->getContext());
+    branch->setMetadata(llvm::LLVMContext::MD_prof,
+                        md.createBranchWeights(weights));
+}
+
+void profileFunctionEntry(CodegenContext* ctx)
+{
+    if (profileGenerateEnabled) {
+        llvm::SmallString<128> key;
+        entryKey(key, ctx);
+        codegenCounterIncrement(key, ctx->initBuilder, ctx->cst);
+    }
+
+    if (profileUseEnabled) {
+        llvm::SmallString<128> key;
+        entryKey(key, ctx);
+        uint64_t count;
+        if (!lookupCount(key, count))
+            return;
+
+        // LLVM 3.2 has no function entry count metadata; the inliner
+        // raises its threshold for inlinehint callees and lowers it in
+        // optsize callers
+        llvm::Function *llFunc = ctx->llvmFunc;
+        if (llFunc->getFnAttributes().hasAttribute(llvm::Attributes::NoInline))
+            return;
+        if (count == 0)
+            llFunc->addFnAttr(llvm::Attributes::OptimizeForSize);
+        else if (count >= maxEntryCount / HOT_ENTRY_DIVISOR)
+            llFunc->addFnAttr(llvm::Attributes::InlineHint);
+    }
+}
+
+
+
+//
+// codegenProfileDump
+//
+
+static llvm::Constant *stringPointer(llvm::StringRef s, CompilerState* cst)
+{
+    llvm::Constant *initializer =
+        llvm::ConstantDataArray::getString(llvm::getGlobalContext(), s, true);
+    llvm::GlobalVariable *gvar = new llvm::GlobalVariable(
+        *cst->llvmModule, initializer->getType(), true,
+        llvm::GlobalVariable::PrivateLinkage,
+        initializer, "clay.profile.string");
+    llvm::Constant *idxs[] = {
+        llvm::ConstantInt::get(llvmIntType(32), 0),
+        llvm::ConstantInt::get(llvmIntType(32), 0),
+    };
+    return llvm::ConstantExpr::getGetElementPtr(gvar, idxs);
+}
+
+static llvm::Constant *libcFunction(llvm::StringRef name,
+                                    llvm::Type *returnType,
+                                    llvm::ArrayRef<llvm::Type *> argTypes,
+                                    bool varArg,
+                                    CompilerState* cst)
+{
+    llvm::FunctionType *type =
+        llvm::FunctionType::get(returnType, argTypes, varArg);
+    return cst->llvmModule->getOrInsertFunction(name, type);
+}
+
+void codegenProfileDump(CompilerState* cst)
+{
+    if (!profileGenerateEnabled || profileCounters.empty())
+        return;
+
+    llvm::Module *module = cst->llvmModule;
+    llvm::Type *charPtrType = llvmPointerType(cst->int8Type);
+    llvm::Type *counterType = llvmIntType(64);
+    llvm::Type *counterPtrType = llvm::PointerType::getUnqual(counterType);
+
+    vector<llvm::Constant *> keys;
+    vector<llvm::Constant *> counters;
+    for (size_t i = 0; i < profileCounters.size(); ++i) {
+        keys.push_back(stringPointer(profileCounters[i].key, cst));
+        counters.push_back(profileCounters[i].counter);
+    }
+    llvm::ArrayType *keysType = llvm::ArrayType::get(charPtrType, keys.size());
+    llvm::GlobalVariable *keysTable = new llvm::GlobalVariable(
+        *module, keysType, true,
+        llvm::GlobalVariable::PrivateLinkage,
+        llvm::ConstantArray::get(keysType, keys),
+        "clay.profile.keys");
+    llvm::ArrayType *countersType =
+        llvm::ArrayType::get(counterPtrType, counters.size());
+    llvm::GlobalVariable *countersTable = new llvm::GlobalVariable(
+        *module, countersType, true,
+        llvm::GlobalVariable::PrivateLinkage,
+        llvm::ConstantArray::get(countersType, counters),
+        "clay.profile.counters");
+
+    llvm::Type *fopenArgs[] = { charPtrType, charPtrType };
+    llvm::Constant *fopenFunc = libcFunction(
+        "fopen", charPtrType, fopenArgs, false, cst);
+    llvm::Type *fprintfArgs[] = { charPtrType, charPtrType };
+    llvm::Constant *fprintfFunc = libcFunction(
+        "fprintf", llvmIntType(32), fprintfArgs, true, cst);
+    llvm::Type *fcloseArgs[] = { charPtrType };
+    llvm::Constant *fcloseFunc = libcFunction(
+        "fclose", llvmIntType(32), fcloseArgs, false, cst);
+
+    llvm::Function *dumpFunc = llvm::Function::Create(
+        llvm::FunctionType::get(llvmVoidType(), false),
+        llvm::Function::InternalLinkage,
+        "clay.profile.dump",
+        module);
+    llvm::LLVMContext &context = module->getContext();
+    llvm::BasicBlock *openBlock = llvm::BasicBlock::Create(context, "open", dumpFunc);
+    llvm::BasicBlock *loopBlock = llvm::BasicBlock::Create(context, "loop", dumpFunc);
+    llvm::BasicBlock *closeBlock = llvm::BasicBlock::Create(context, "close", dumpFunc);
+    llvm::BasicBlock *doneBlock = llvm::BasicBlock::Create(context, "done", dumpFunc);
+
+    // runs are appended so that a profile can accumulate several of them
+    llvm::IRBuilder<> builder(openBlock);
+    llvm::Value *file = builder.CreateCall2(fopenFunc,
+        stringPointer(profileOutputFile, cst),
+        stringPointer("a", cst));
+    builder.CreateCondBr(builder.CreateIsNull(file), doneBlock, loopBlock);
+
+    builder.SetInsertPoint(loopBlock);
+    llvm::PHINode *index = builder.CreatePHI(llvmIntType(32), 2);
+    index->addIncoming(llvm::ConstantInt::get(llvmIntType(32), 0), openBlock);
+    llvm::Value *idxs[] = {
+        llvm::ConstantInt::get(llvmIntType(32), 0),
+        index,
+    };
+    llvm::Value *key = builder.CreateLoad(builder.CreateGEP(keysTable, idxs));
+    llvm::Value *counter = builder.CreateLoad(builder.CreateGEP(countersTable, idxs));
+    builder.CreateCall4(fprintfFunc,
+        file,
+        stringPointer("%s %llu\n", cst),
+        key,
+        builder.CreateLoad(counter));
+    llvm::Value *next = builder.CreateAdd(index,
+        llvm::ConstantInt::get(llvmIntType(32), 1));
+    index->addIncoming(next, loopBlock);
+    llvm::Value *more = builder.CreateICmpULT(next,
+        llvm::ConstantInt::get(llvmIntType(32), profileCounters.size()));
+    builder.CreateCondBr(more, loopBlock, closeBlock);
+
+    builder.SetInsertPoint(closeBlock);
+    builder.CreateCall(fcloseFunc, file);
+    builder.CreateBr(doneBlock);
+
+    builder.SetInsertPoint(doneBlock);
+    builder.CreateRetVoid();
+
+    cst->destructorsCtx->builder->CreateCall(dumpFunc);
+    profileCounters.clear();
+}
+
+}
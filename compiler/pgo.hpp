@@ -0,0 +1,40 @@
+#ifndef __CLAY_PGO_HPP
+#define __CLAY_PGO_HPP
+
+#include "clay.hpp"
+
+namespace clay {
+
+// Profile-guided optimization. -profile-generate instruments conditional
+// branches, dispatch switches and function entries with counters that the
+// program appends to a text profile when it exits; -profile-use reads the
+// counts back as branch weights and inlining hints.
+//
+// Counters are keyed by the printed name of the function being generated
+// (module, callable, argument types and the tempness of its arguments)
+// plus the ordinal of the branch site within that function, so edits to
+// other functions leave keys intact.
+// Edge n of a site counts successor n of its terminator.
+
+extern bool profileGenerateEnabled;
+extern bool profileUseEnabled;
+
+void enableProfileGenerate(llvm::StringRef profileFile);
+bool loadProfile(llvm::StringRef profileFile);
+
+unsigned profileBranchSite(CodegenContext* ctx);
+void profileCountEdge(unsigned site, unsigned edge, CodegenContext* ctx);
+void profileBranchWeights(llvm::TerminatorInst *branch,
+                          unsigned site,
+                          CodegenContext* ctx);
+
+// counts the entry of ctx's function and, with a profile, marks it hot or
+// cold for the inliner
+void profileFunctionEntry(CodegenContext* ctx);
+
+// appends the counters to the profile file from the global destructors
+void codegenProfileDump(CompilerState* cst);
+
+}
+
+#endif
@@ -0,0 +1,1128 @@
+#include "clay.hpp"
+#include "analyzer.hpp"
+#include "codegen.hpp"
+#include "env.hpp"
+#include "evaluator.hpp"
+#include "fingerprint.hpp"
+#include "invoketables.hpp"
+#include "loader.hpp"
+#include "prebuilt.hpp"
+#include "stats.hpp"
+#include "types.hpp"
+#include <llvm/ADT/StringExtras.h>
+#include <algorithm>
+
+
+namespace clay {
+
+static const char PREBUILT_HEADER[] = "clay-prebuilt 6";
+
+namespace {
+    struct PrebuiltInstantiation {
+        string symbol;
+        string returns;
+        bool typePunning;
+        bool exceptions;
+        PrebuiltInstantiation() : typePunning(false), exceptions(false) {}
+    };
+
+    // a module the library was compiled from, which a program must load
+    // from the same source if it loads it at all
+    struct PrebuiltModule {
+        string manifest;
+        string name;
+        string fingerprint;
+    };
+}
+
+struct PrebuiltState {
+    // whether a manifest was loaded with -prebuilt
+    bool useEnabled;
+    // -prebuilt-out or -module
+    bool outputEnabled;
+    // -module
+    bool moduleInterfaceEnabled;
+    // -module-globals
+    bool moduleGlobalsOnly;
+    // whether checkPrebuiltModules found the loaded modules to be those
+    // the manifests describe, before which their types aren't trusted
+    bool modulesChecked;
+    // the instantiations loaded manifests provide, by key
+    llvm::StringMap<PrebuiltInstantiation> instantiations;
+    // the external procedures loaded manifests define
+    llvm::StringSet<> externals;
+    // the modules loaded manifests were compiled from
+    vector<PrebuiltModule> modules;
+    // with -prebuilt-out, the generated instantiations that may be exported
+    vector<InvokeEntry*> candidates;
+    // the global variables loaded interfaces define
+    llvm::StringSet<> globals;
+    // the fields of the records loaded interfaces describe, by
+    // "<module>:<name>"
+    llvm::StringMap<string> records;
+    // the objects of loaded manifests, by the priority of their
+    // constructors
+    vector<pair<unsigned, string> > libraries;
+    // with -module, the root module's global variables
+    vector<llvm::GlobalVariable*> moduleGlobals;
+
+    PrebuiltState()
+        : useEnabled(false), outputEnabled(false),
+          moduleInterfaceEnabled(false), moduleGlobalsOnly(false),
+          modulesChecked(false) {}
+};
+
+static PrebuiltState &prebuiltState(CompilerState* cst)
+{
+    if (cst->prebuiltState == NULL)
+        cst->prebuiltState = new PrebuiltState();
+    return *cst->prebuiltState;
+}
+
+bool prebuiltUseEnabled(CompilerState* cst)
+{
+    return cst->prebuiltState != NULL && cst->prebuiltState->useEnabled;
+}
+
+bool prebuiltOutputEnabled(CompilerState* cst)
+{
+    return cst->prebuiltState != NULL && cst->prebuiltState->outputEnabled;
+}
+
+bool moduleInterfaceEnabled(CompilerState* cst)
+{
+    return cst->prebuiltState != NULL
+        && cst->prebuiltState->moduleInterfaceEnabled;
+}
+
+
+
+//
+// type descriptions
+//
+
+// manifests describe types so that importers can rebuild them without
+// analyzing or evaluating anything:
+//
+//   b                      Bool
+//   i<bits> u<bits>        signed and unsigned integers
+//   f<bits> j<bits>        real and imaginary floats
+//   c<bits>                complex floats
+//   p<T>                   Pointer[T]
+//   a<n>,<T> v<n>,<T>      Array[T, n], Vec[T, n]
+//   t<n>,<T>...            Tuple of n types
+//   o<n>,<T>...            Union of n types
+//   k<n>,<T>...<m>,<R>...  code pointer taking n types and returning m,
+//                          each return prefixed with '&' if by reference
+//   r<item><n>,<T>...      record with n type parameters
+//   w<item><n>,<T>...      variant with n type parameters
+//   e<item> n<item>        enum, newtype
+//
+// where <item> is "<module>:<name>;", naming a top-level item of a loaded
+// module. static types, C code pointers and types with static parameters
+// other than types aren't described.
+
+static bool describeType(llvm::raw_ostream &out, TypePtr t);
+
+static bool describeItem(llvm::raw_ostream &out, TopLevelItem *x, Object *global)
+{
+    if (x->name == NULL)
+        return false;
+    Module *m = x->module;
+    llvm::StringMap<ObjectPtr>::const_iterator i = m->globals.find(x->name->str);
+    if (i == m->globals.end() || i->getValue().ptr() != global)
+        return false;
+    out << m->moduleName << ':' << x->name->str << ';';
+    return true;
+}
+
+static bool describeTypes(llvm::raw_ostream &out, llvm::ArrayRef<TypePtr> types)
+{
+    out << types.size() << ',';
+    for (size_t i = 0; i < types.size(); ++i) {
+        if (!describeType(out, types[i]))
+            return false;
+    }
+    return true;
+}
+
+static bool describeParams(llvm::raw_ostream &out, llvm::ArrayRef<ObjectPtr> params)
+{
+    out << params.size() << ',';
+    for (size_t i = 0; i < params.size(); ++i) {
+        if (params[i]->objKind != TYPE
+            || !describeType(out, (Type *)params[i].ptr()))
+            return false;
+    }
+    return true;
+}
+
+static bool describeType(llvm::raw_ostream &out, TypePtr t)
+{
+    switch (t->typeKind) {
+    case BOOL_TYPE :
+        out << 'b';
+        return true;
+    case INTEGER_TYPE : {
+        IntegerType *x = (IntegerType *)t.ptr();
+        out << (x->isSigned ? 'i' : 'u') << x->bits;
+        return true;
+    }
+    case FLOAT_TYPE : {
+        FloatType *x = (FloatType *)t.ptr();
+        out << (x->isImaginary ? 'j' : 'f') << x->bits;
+        return true;
+    }
+    case COMPLEX_TYPE :
+        out << 'c' << ((ComplexType *)t.ptr())->bits;
+        return true;
+    case POINTER_TYPE :
+        out << 'p';
+        return describeType(out, ((PointerType *)t.ptr())->pointeeType);
+    case ARRAY_TYPE : {
+        ArrayType *x = (ArrayType *)t.ptr();
+        out << 'a' << x->size << ',';
+        return describeType(out, x->elementType);
+    }
+    case VEC_TYPE : {
+        VecType *x = (VecType *)t.ptr();
+        out << 'v' << x->size << ',';
+        return describeType(out, x->elementType);
+    }
+    case TUPLE_TYPE :
+        out << 't';
+        return describeTypes(out, ((TupleType *)t.ptr())->elementTypes);
+    case UNION_TYPE :
+        out << 'o';
+        return describeTypes(out, ((UnionType *)t.ptr())->memberTypes);
+    case CODE_POINTER_TYPE : {
+        CodePointerType *x = (CodePointerType *)t.ptr();
+        out << 'k';
+        if (!describeTypes(out, x->argTypes))
+            return false;
+        out << x->returnTypes.size() << ',';
+        for (size_t i = 0; i < x->returnTypes.size(); ++i) {
+            if (x->returnIsRef[i])
+                out << '&';
+            if (!describeType(out, x->returnTypes[i]))
+                return false;
+        }
+        return true;
+    }
+    case RECORD_TYPE : {
+        RecordType *x = (RecordType *)t.ptr();
+        out << 'r';
+        return describeItem(out, x->record.ptr(), x->record.ptr())
+            && describeParams(out, x->params);
+    }
+    case VARIANT_TYPE : {
+        VariantType *x = (VariantType *)t.ptr();
+        out << 'w';
+        return describeItem(out, x->variant.ptr(), x->variant.ptr())
+            && describeParams(out, x->params);
+    }
+    case ENUM_TYPE : {
+        EnumType *x = (EnumType *)t.ptr();
+        out << 'e';
+        return describeItem(out, x->enumeration.ptr(), x);
+    }
+    case NEW_TYPE : {
+        NewType *x = (NewType *)t.ptr();
+        out << 'n';
+        return describeItem(out, x->newtype.ptr(), x->newtype.ptr());
+    }
+    default :
+        return false;
+    }
+}
+
+static bool readNumber(llvm::StringRef &rest, unsigned &n)
+{
+    size_t digits = std::min(rest.find_first_not_of("0123456789"), rest.size());
+    if (digits == 0 || rest.substr(0, digits).getAsInteger(10, n))
+        return false;
+    rest = rest.substr(digits);
+    return true;
+}
+
+static bool readChar(llvm::StringRef &rest, char c)
+{
+    if (rest.empty() || rest[0] != c)
+        return false;
+    rest = rest.substr(1);
+    return true;
+}
+
+static ObjectPtr readItem(llvm::StringRef &rest, CompilerState* cst)
+{
+    size_t colon = rest.find(':');
+    size_t semicolon = rest.find(';');
+    if (colon == llvm::StringRef::npos || semicolon == llvm::StringRef::npos
+        || semicolon < colon)
+        return NULL;
+    llvm::StringMap<ModulePtr>::const_iterator m =
+        cst->globalModules.find(rest.substr(0, colon));
+    if (m == cst->globalModules.end())
+        return NULL;
+    Module *module = m->getValue().ptr();
+    llvm::StringMap<ObjectPtr>::const_iterator i =
+        module->globals.find(rest.slice(colon + 1, semicolon));
+    if (i == module->globals.end())
+        return NULL;
+    rest = rest.substr(semicolon + 1);
+    return i->getValue();
+}
+
+static TypePtr readType(llvm::StringRef &rest, CompilerState* cst);
+
+static bool readTypes(llvm::StringRef &rest, vector<TypePtr> &types,
+                      CompilerState* cst)
+{
+    unsigned n;
+    if (!readNumber(rest, n) || !readChar(rest, ','))
+        return false;
+    for (unsigned i = 0; i < n; ++i) {
+        TypePtr t = readType(rest, cst);
+        if (t == NULL)
+            return false;
+        types.push_back(t);
+    }
+    return true;
+}
+
+static bool readParams(llvm::StringRef &rest, vector<ObjectPtr> &params,
+                       CompilerState* cst)
+{
+    vector<TypePtr> types;
+    if (!readTypes(rest, types, cst))
+        return false;
+    for (size_t i = 0; i < types.size(); ++i)
+        params.push_back(types[i].ptr());
+    return true;
+}
+
+static TypePtr readType(llvm::StringRef &rest, CompilerState* cst)
+{
+    if (rest.empty())
+        return NULL;
+    char kind = rest[0];
+    rest = rest.substr(1);
+    unsigned n;
+    switch (kind) {
+    case 'b' :
+        return cst->boolType;
+    case 'i' :
+    case 'u' :
+        if (!readNumber(rest, n))
+            return NULL;
+        return integerType(n, kind == 'i', cst);
+    case 'f' :
+        if (!readNumber(rest, n))
+            return NULL;
+        return floatType(n, cst);
+    case 'j' :
+        if (!readNumber(rest, n))
+            return NULL;
+        return imagType(n, cst);
+    case 'c' :
+        if (!readNumber(rest, n))
+            return NULL;
+        return complexType(n, cst);
+    case 'p' : {
+        TypePtr pointee = readType(rest, cst);
+        if (pointee == NULL)
+            return NULL;
+        return pointerType(pointee);
+    }
+    case 'a' :
+    case 'v' : {
+        if (!readNumber(rest, n) || !readChar(rest, ','))
+            return NULL;
+        TypePtr element = readType(rest, cst);
+        if (element == NULL)
+            return NULL;
+        return kind == 'a' ? arrayType(element, n) : vecType(element, n);
+    }
+    case 't' :
+    case 'o' : {
+        vector<TypePtr> types;
+        if (!readTypes(rest, types, cst))
+            return NULL;
+        return kind == 't' ? tupleType(types, cst) : unionType(types, cst);
+    }
+    case 'k' : {
+        vector<TypePtr> argTypes;
+        if (!readTypes(rest, argTypes, cst)
+            || !readNumber(rest, n) || !readChar(rest, ','))
+            return NULL;
+        vector<uint8_t> returnIsRef;
+        vector<TypePtr> returnTypes;
+        for (unsigned i = 0; i < n; ++i) {
+            returnIsRef.push_back(readChar(rest, '&'));
+            TypePtr t = readType(rest, cst);
+            if (t == NULL)
+                return NULL;
+            returnTypes.push_back(t);
+        }
+        return codePointerType(argTypes, returnIsRef, returnTypes, cst);
+    }
+    case 'r' : {
+        ObjectPtr x = readItem(rest, cst);
+        vector<ObjectPtr> params;
+        if (x == NULL || x->objKind != RECORD_DECL
+            || !readParams(rest, params, cst))
+            return NULL;
+        RecordDecl *record = (RecordDecl *)x.ptr();
+        if (record->varParam == NULL && params.size() != record->params.size())
+            return NULL;
+        return recordType(record, params);
+    }
+    case 'w' : {
+        ObjectPtr x = readItem(rest, cst);
+        vector<ObjectPtr> params;
+        if (x == NULL || x->objKind != VARIANT_DECL
+            || !readParams(rest, params, cst))
+            return NULL;
+        VariantDecl *variant = (VariantDecl *)x.ptr();
+        if (variant->varParam == NULL && params.size() != variant->params.size())
+            return NULL;
+        return variantType(variant, params);
+    }
+    case 'e' : {
+        ObjectPtr x = readItem(rest, cst);
+        if (x == NULL || x->objKind != TYPE
+            || ((Type *)x.ptr())->typeKind != ENUM_TYPE)
+            return NULL;
+        return (Type *)x.ptr();
+    }
+    case 'n' : {
+        ObjectPtr x = readItem(rest, cst);
+        if (x == NULL || x->objKind != NEW_TYPE_DECL)
+            return NULL;
+        return newType((NewTypeDecl *)x.ptr());
+    }
+    default :
+        return NULL;
+    }
+}
+
+static bool readReturns(llvm::StringRef rest,
+                        vector<uint8_t> &returnIsRef,
+                        vector<TypePtr> &returnTypes,
+                        CompilerState* cst)
+{
+    while (!rest.empty()) {
+        if (!returnTypes.empty() && !readChar(rest, ' '))
+            return false;
+        returnIsRef.push_back(readChar(rest, '&'));
+        TypePtr t = readType(rest, cst);
+        if (t == NULL)
+            return false;
+        returnTypes.push_back(t);
+    }
+    return true;
+}
+
+
+
+//
+// keys
+//
+
+// type names in the key are qualified with their modules, so that a record
+// named like one in another module doesn't match its instantiations, and the
+// key ends with the module and source offset of the matched overload, so
+// that a program whose overloads match differently generates the body
+// itself.
+static void prebuiltKey(llvm::SmallVectorImpl<char> &key, InvokeEntry* entry)
+{
+    QualifiedPrintNameEnabler enabler;
+    llvm::raw_svector_ostream out(key);
+    printCodeKey(out, entry);
+    printCodeTempness(out, entry);
+    out << " @";
+    Code *code = entry->origCode.ptr();
+    if (code != NULL && code->location.ok())
+        out << safeLookupModule(entry->env)->moduleName
+            << ':' << code->location.offset;
+    out.flush();
+}
+
+// the returns of entry as a space separated list of type descriptions, each
+// prefixed with '&' if returned by reference. fails if a type can't be
+// described.
+static bool prebuiltReturns(llvm::SmallVectorImpl<char> &returns,
+                            InvokeEntry* entry)
+{
+    llvm::raw_svector_ostream out(returns);
+    for (size_t i = 0; i < entry->returnTypes.size(); ++i) {
+        if (i != 0)
+            out << ' ';
+        if (entry->returnIsRef[i])
+            out << '&';
+        if (!describeType(out, entry->returnTypes[i]))
+            return false;
+    }
+    out.flush();
+    return true;
+}
+
+static bool isPrebuiltInline(InvokeEntry* entry)
+{
+    return entry->isInline == INLINE || entry->isInline == FORCE_INLINE;
+}
+
+
+
+//
+// fingerprints
+//
+
+// the target and the options that change what code is generated. a
+// library and the programs using it must agree on all of them.
+static string configurationFingerprint(CompilerState* cst)
+{
+    Fingerprint f;
+    f.add(cst->llvmModule->getTargetTriple());
+    f.add(cst->llvmModule->getDataLayout());
+    f.add(exceptionsEnabled(cst) ? "exceptions" : "no-exceptions");
+    f.add(inlineEnabled(cst) ? "inline" : "no-inline");
+    f.add(cst->_finalOverloadsEnabled ? "final-overloads" : "");
+    f.add(cst->strictAliasing ? "strict-aliasing" : "");
+    // -D flags, in name order
+    map<string, string> flags;
+    for (llvm::StringMap<string>::const_iterator i = cst->globalFlags.begin();
+         i != cst->globalFlags.end(); ++i)
+        flags[i->getKey()] = i->getValue();
+    for (map<string, string>::const_iterator i = flags.begin(); i != flags.end(); ++i) {
+        f.add(i->first);
+        f.add(i->second);
+    }
+    return f.str();
+}
+
+static string moduleFingerprint(Module *m)
+{
+    Fingerprint f;
+    f.add(llvm::StringRef(m->source->data(), m->source->size()));
+    return f.str();
+}
+
+static string moduleGlobalSymbol(llvm::StringRef name)
+{
+    Fingerprint f;
+    f.add(name);
+    return "clayglobal_" + f.str();
+}
+
+
+
+//
+// -prebuilt
+//
+
+bool loadPrebuiltManifest(llvm::StringRef manifestFile,
+                          string &errorInfo,
+                          CompilerState* cst)
+{
+    llvm::OwningPtr<llvm::MemoryBuffer> buffer;
+    errorInfo = "unable to read prebuilt manifest '" + manifestFile.str() + "'";
+    if (llvm::MemoryBuffer::getFile(manifestFile, buffer))
+        return false;
+
+    // a header, a "library <path>" line, a "configuration <fingerprint>"
+    // line, a "priority <n>" line giving the priority of the library's
+    // constructors, one "module <name><TAB><fingerprint>" line per module the
+    // library was compiled from, then one
+    // "symbol<TAB>flags<TAB>key<TAB>returns" line per instantiation, with
+    // the returns described as by prebuiltReturns. external procedures
+    // defined by the library have the flag 'x' and global variables it
+    // defines the flag 'g', both with their symbol as key. records have
+    // the flag 'r', "<module>:<name>" as symbol and key, and their fields
+    // as returns, each "<name>=<type description>", separated by spaces.
+    llvm::StringRef rest = buffer->getBuffer();
+    std::pair<llvm::StringRef, llvm::StringRef> header = rest.split('\n');
+    if (header.first.rtrim() != PREBUILT_HEADER)
+        return false;
+    std::pair<llvm::StringRef, llvm::StringRef> libraryLine =
+        header.second.split('\n');
+    if (!libraryLine.first.startswith("library "))
+        return false;
+    string library = libraryLine.first.substr(8).rtrim();
+    std::pair<llvm::StringRef, llvm::StringRef> configurationLine =
+        libraryLine.second.split('\n');
+    if (!configurationLine.first.startswith("configuration "))
+        return false;
+    if (configurationLine.first.substr(14).rtrim() != configurationFingerprint(cst)) {
+        errorInfo = "prebuilt manifest '" + manifestFile.str()
+            + "' was built for another target or with other options";
+        return false;
+    }
+
+    std::pair<llvm::StringRef, llvm::StringRef> priorityLine =
+        configurationLine.second.split('\n');
+    unsigned priority;
+    if (!priorityLine.first.startswith("priority ")
+        || priorityLine.first.substr(9).rtrim().getAsInteger(10, priority))
+        return false;
+    PrebuiltState &state = prebuiltState(cst);
+    state.libraries.push_back(make_pair(priority, library));
+
+    rest = priorityLine.second;
+    while (!rest.empty()) {
+        std::pair<llvm::StringRef, llvm::StringRef> split = rest.split('\n');
+        rest = split.second;
+        llvm::StringRef line = split.first.rtrim("\r");
+        if (line.empty())
+            continue;
+        llvm::SmallVector<llvm::StringRef, 4> fields;
+        line.split(fields, "\t");
+        if (line.startswith("module ")) {
+            if (fields.size() != 2)
+                return false;
+            PrebuiltModule module;
+            module.manifest = manifestFile;
+            module.name = fields[0].substr(7);
+            module.fingerprint = fields[1];
+            state.modules.push_back(module);
+            continue;
+        }
+        if (fields.size() != 4 || fields[0].empty())
+            return false;
+        if (fields[1] == "x") {
+            state.externals.insert(fields[0]);
+            continue;
+        }
+        if (fields[1] == "g") {
+            state.globals.insert(fields[0]);
+            continue;
+        }
+        if (fields[1] == "r") {
+            state.records[fields[2]] = fields[3];
+            continue;
+        }
+        // the first library to list a key provides it
+        if (state.instantiations.count(fields[2]))
+            continue;
+        PrebuiltInstantiation &x = state.instantiations[fields[2]];
+        x.symbol = fields[0];
+        x.returns = fields[3];
+        x.typePunning = fields[1].find('p') != llvm::StringRef::npos;
+        x.exceptions = fields[1].find('e') != llvm::StringRef::npos;
+    }
+
+    errorInfo.clear();
+    state.useEnabled = true;
+    return true;
+}
+
+bool checkPrebuiltModules(CompilerState* cst, string &errorInfo)
+{
+    vector<PrebuiltModule> const &modules = prebuiltState(cst).modules;
+    for (size_t i = 0; i < modules.size(); ++i) {
+        PrebuiltModule const &x = modules[i];
+        llvm::StringMap<ModulePtr>::const_iterator m =
+            cst->globalModules.find(x.name);
+        if (m == cst->globalModules.end() || m->getValue()->source == NULL)
+            continue;
+        if (moduleFingerprint(m->getValue().ptr()) != x.fingerprint) {
+            errorInfo = "prebuilt manifest '" + x.manifest
+                + "' was built from another version of module " + x.name;
+            return false;
+        }
+    }
+    prebuiltState(cst).modulesChecked = true;
+    return true;
+}
+
+void prebuiltLibraries(CompilerState* cst, vector<string> &libraries)
+{
+    vector<pair<unsigned, string> > sorted = prebuiltState(cst).libraries;
+    std::stable_sort(sorted.begin(), sorted.end());
+    for (size_t i = 0; i < sorted.size(); ++i)
+        libraries.push_back(sorted[i].second);
+}
+
+bool prebuiltExternalDefined(CompilerState* cst, llvm::StringRef symbol)
+{
+    return prebuiltState(cst).externals.count(symbol) != 0;
+}
+
+bool codegenPrebuiltGlobal(GVarInstance *x,
+                           llvm::StringRef name,
+                           llvm::Type *type)
+{
+    CompilerState* cst = x->env->cst;
+    if (!prebuiltUseEnabled(cst) || !x->params.empty())
+        return false;
+    string symbol = moduleGlobalSymbol(name);
+    if (!prebuiltState(cst).globals.count(symbol))
+        return false;
+    x->llGlobal = new llvm::GlobalVariable(
+        *cst->llvmModule, type, false,
+        llvm::GlobalVariable::ExternalLinkage,
+        NULL, symbol);
+    addStatistic("global variables taken from module objects", 1);
+    return true;
+}
+
+// the instantiation a loaded manifest provides for entry, if entry can use
+// it
+static PrebuiltInstantiation const *findPrebuiltInstantiation(InvokeEntry* entry)
+{
+    if (isPrebuiltInline(entry) || !entry->multiversions.empty())
+        return NULL;
+
+    CompilerState* cst = entry->env->cst;
+    llvm::SmallString<128> key;
+    prebuiltKey(key, entry);
+    PrebuiltState &state = prebuiltState(cst);
+    llvm::StringMap<PrebuiltInstantiation>::const_iterator i =
+        state.instantiations.find(key);
+    if (i == state.instantiations.end())
+        return NULL;
+    PrebuiltInstantiation const &x = i->getValue();
+    if (x.exceptions != exceptionsEnabled(cst))
+        return NULL;
+    return &x;
+}
+
+bool analyzePrebuiltEntry(InvokeEntry* entry)
+{
+    if (!prebuiltState(entry->env->cst).modulesChecked)
+        return false;
+    PrebuiltInstantiation const *x = findPrebuiltInstantiation(entry);
+    if (x == NULL)
+        return false;
+    vector<uint8_t> returnIsRef;
+    vector<TypePtr> returnTypes;
+    if (!readReturns(x->returns, returnIsRef, returnTypes, entry->env->cst))
+        return false;
+    entry->returnIsRef = returnIsRef;
+    entry->returnTypes = returnTypes;
+    entry->analyzed = true;
+    addStatistic("instantiations analyzed from prebuilt manifests", 1);
+    return true;
+}
+
+bool prebuiltRecordFields(RecordTypePtr t)
+{
+    RecordDecl *record = t->record.ptr();
+    RecordBody *body = record->body.ptr();
+    if (!t->params.empty() || record->name == NULL
+        || record->varParam != NULL || record->predicate != NULL
+        || body->isComputed || body->hasVarField)
+        return false;
+
+    CompilerState* cst = t->cst;
+    if (!prebuiltState(cst).modulesChecked)
+        return false;
+    llvm::SmallString<64> key;
+    llvm::raw_svector_ostream keyOut(key);
+    keyOut << record->module->moduleName << ':' << record->name->str;
+    keyOut.flush();
+    llvm::StringMap<string> const &records = prebuiltState(cst).records;
+    llvm::StringMap<string>::const_iterator i = records.find(key);
+    if (i == records.end())
+        return false;
+
+    // the names come from the source, which the module's fingerprint
+    // says is the one the interface was written from
+    vector<TypePtr> fieldTypes;
+    llvm::StringRef rest = i->getValue();
+    for (size_t j = 0; j < body->fields.size(); ++j) {
+        llvm::StringRef name = body->fields[j]->name->str;
+        if ((j != 0 && !readChar(rest, ' '))
+            || !rest.startswith(name) || rest.substr(name.size(), 1) != "=")
+            return false;
+        rest = rest.substr(name.size() + 1);
+        TypePtr type = readType(rest, cst);
+        if (type == NULL)
+            return false;
+        fieldTypes.push_back(type);
+    }
+    if (!rest.empty())
+        return false;
+
+    for (size_t j = 0; j < body->fields.size(); ++j) {
+        IdentifierPtr name = body->fields[j]->name;
+        t->fieldIndexMap[name->str] = j;
+        t->fieldTypes.push_back(fieldTypes[j]);
+        t->fieldNames.push_back(name);
+    }
+    addStatistic("record types described by prebuilt manifests", 1);
+    return true;
+}
+
+bool codegenPrebuiltDeclaration(InvokeEntry* entry)
+{
+    PrebuiltInstantiation const *x = findPrebuiltInstantiation(entry);
+    if (x == NULL)
+        return false;
+
+    // entries analyzed before the manifest was consulted, or analyzed
+    // because their returns couldn't be rebuilt, must return the same
+    llvm::SmallString<64> returns;
+    if (!prebuiltReturns(returns, entry) || x->returns != returns.str())
+        return false;
+
+    CompilerState* cst = entry->env->cst;
+    llvm::Function *llFunc = cst->llvmModule->getFunction(x->symbol);
+    if (llFunc == NULL) {
+        llvm::FunctionType *llFuncType = llvmCodeFunctionType(entry);
+        llFunc = llvm::Function::Create(llFuncType,
+                                        llvm::Function::ExternalLinkage,
+                                        x->symbol,
+                                        cst->llvmModule);
+        for (unsigned j = 1; j <= llFuncType->getNumParams(); ++j) {
+            llvm::Attributes attrs = llvm::Attributes::get(
+                llFunc->getContext(),
+                llvm::Attributes::NoAlias);
+            llFunc->addAttribute(j, attrs);
+        }
+    }
+    entry->llvmFunc = llFunc;
+    entry->typePunning = x->typePunning;
+    addStatistic("instantiations taken from prebuilt libraries", 1);
+    return true;
+}
+
+
+
+//
+// -prebuilt-out
+//
+
+void enablePrebuiltOutput(CompilerState* cst)
+{
+    prebuiltState(cst).outputEnabled = true;
+}
+
+void enableModuleInterface(CompilerState* cst, bool globalsOnly)
+{
+    PrebuiltState &state = prebuiltState(cst);
+    state.outputEnabled = true;
+    state.moduleInterfaceEnabled = true;
+    state.moduleGlobalsOnly = globalsOnly;
+}
+
+void notePrebuiltCandidate(InvokeEntry* entry)
+{
+    prebuiltState(entry->env->cst).candidates.push_back(entry);
+}
+
+void prebuiltExportableFunctions(CompilerState* cst,
+                                 vector<llvm::Function *> &functions)
+{
+    vector<InvokeEntry*> const &candidates = prebuiltState(cst).candidates;
+    for (size_t i = 0; i < candidates.size(); ++i)
+        if (candidates[i]->llvmFunc != NULL)
+            functions.push_back(candidates[i]->llvmFunc);
+    for (llvm::Module::iterator f = cst->llvmModule->begin();
+         f != cst->llvmModule->end(); ++f)
+        if (!f->isDeclaration() && f->hasExternalLinkage())
+            functions.push_back(&*f);
+}
+
+void exportModuleGlobal(GVarInstance *x, llvm::StringRef name)
+{
+    CompilerState* cst = x->env->cst;
+    if (!moduleInterfaceEnabled(cst) || !x->params.empty()
+        || x->gvar->module != cst->globalMainModule.ptr())
+        return;
+    x->llGlobal->setName(moduleGlobalSymbol(name));
+    x->llGlobal->setLinkage(llvm::GlobalValue::ExternalLinkage);
+    prebuiltState(cst).moduleGlobals.push_back(x->llGlobal);
+}
+
+// whether c refers to a module global, either directly or through the
+// initializers of internal constants. the internal functions it refers to
+// are added to callees.
+static bool constantUsesLocalState(llvm::Constant *c,
+                                   set<llvm::GlobalValue*> &visited,
+                                   vector<llvm::Function*> &callees)
+{
+    if (llvm::GlobalValue *global = llvm::dyn_cast<llvm::GlobalValue>(c)) {
+        if (!global->hasLocalLinkage() || !visited.insert(global).second)
+            return false;
+        if (llvm::Function *f = llvm::dyn_cast<llvm::Function>(global)) {
+            callees.push_back(f);
+            return false;
+        }
+        llvm::GlobalVariable *gvar = llvm::dyn_cast<llvm::GlobalVariable>(global);
+        if (gvar == NULL || !gvar->isConstant() || !gvar->hasInitializer())
+            return true;
+        return constantUsesLocalState(gvar->getInitializer(), visited, callees);
+    }
+    for (unsigned i = 0; i < c->getNumOperands(); ++i) {
+        llvm::Constant *operand = llvm::dyn_cast<llvm::Constant>(c->getOperand(i));
+        if (operand != NULL && constantUsesLocalState(operand, visited, callees))
+            return true;
+    }
+    return false;
+}
+
+static bool functionUsesLocalState(llvm::Function *root)
+{
+    set<llvm::GlobalValue*> visited;
+    vector<llvm::Function*> worklist;
+    visited.insert(root);
+    worklist.push_back(root);
+    while (!worklist.empty()) {
+        llvm::Function *f = worklist.back();
+        worklist.pop_back();
+        for (llvm::Function::iterator bb = f->begin(); bb != f->end(); ++bb) {
+            for (llvm::BasicBlock::iterator i = bb->begin(); i != bb->end(); ++i) {
+                for (unsigned j = 0; j < i->getNumOperands(); ++j) {
+                    llvm::Constant *c = llvm::dyn_cast<llvm::Constant>(i->getOperand(j));
+                    if (c != NULL && constantUsesLocalState(c, visited, worklist))
+                        return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+static bool prebuiltEligible(InvokeEntry* entry, ModulePtr root)
+{
+    llvm::Function *f = entry->llvmFunc;
+    if (f == NULL || f->isDeclaration() || !f->hasLocalLinkage())
+        return false;
+    if (entry->callByName || isPrebuiltInline(entry)
+        || !entry->multiversions.empty())
+        return false;
+    // a spec file's own procedures are only there to instantiate others,
+    // while a module interface provides nothing but the module's own
+    CompilerState* cst = entry->env->cst;
+    bool inRoot = staticModule(entry->callable, cst) == root;
+    if (inRoot != moduleInterfaceEnabled(cst))
+        return false;
+    return !functionUsesLocalState(f);
+}
+
+// describes the fields of the module's records that have neither
+// parameters nor computed bodies, so importers don't evaluate them
+static void writeRecordFields(llvm::raw_ostream &out, ModulePtr module)
+{
+    for (size_t i = 0; i < module->topLevelItems.size(); ++i) {
+        TopLevelItem *item = module->topLevelItems[i].ptr();
+        if (item->objKind != RECORD_DECL)
+            continue;
+        RecordDecl *x = (RecordDecl *)item;
+        if (x->name == NULL || !x->params.empty() || x->varParam != NULL
+            || x->predicate != NULL || x->body->isComputed
+            || x->body->hasVarField)
+            continue;
+        llvm::StringMap<ObjectPtr>::const_iterator global =
+            module->globals.find(x->name->str);
+        if (global == module->globals.end() || global->getValue().ptr() != x)
+            continue;
+
+        RecordTypePtr t = (RecordType *)recordType(x, vector<ObjectPtr>()).ptr();
+        llvm::ArrayRef<IdentifierPtr> names = recordFieldNames(t);
+        llvm::ArrayRef<TypePtr> types = recordFieldTypes(t);
+        string fields;
+        llvm::raw_string_ostream fieldsOut(fields);
+        bool described = true;
+        for (size_t j = 0; j < names.size() && described; ++j) {
+            if (j != 0)
+                fieldsOut << ' ';
+            fieldsOut << names[j]->str << '=';
+            described = describeType(fieldsOut, types[j]);
+        }
+        fieldsOut.flush();
+        if (!described)
+            continue;
+        out << module->moduleName << ':' << x->name->str << "\tr\t"
+            << module->moduleName << ':' << x->name->str << '\t'
+            << fields << '\n';
+    }
+}
+
+bool writePrebuiltManifest(llvm::StringRef manifestFile,
+                           llvm::StringRef library,
+                           ModulePtr root)
+{
+    string errorInfo;
+    llvm::raw_fd_ostream out(manifestFile.str().c_str(),
+                             errorInfo,
+                             llvm::raw_fd_ostream::F_Binary);
+    if (!errorInfo.empty()) {
+        llvm::errs() << "error: " << errorInfo << '\n';
+        return false;
+    }
+
+    CompilerState* cst = root->cst;
+    out << PREBUILT_HEADER << '\n';
+    out << "library " << library << '\n';
+    out << "configuration " << configurationFingerprint(cst) << '\n';
+    out << "priority " << cst->initPriority << '\n';
+    for (llvm::StringMap<ModulePtr>::const_iterator i = cst->globalModules.begin();
+         i != cst->globalModules.end(); ++i) {
+        Module *m = i->getValue().ptr();
+        if (m->source != NULL && m != root.ptr())
+            out << "module " << i->getKey() << '\t' << moduleFingerprint(m) << '\n';
+    }
+    // a spec file's own source doesn't matter to programs
+    if (moduleInterfaceEnabled(cst))
+        out << "module " << root->moduleName << '\t' << moduleFingerprint(root.ptr()) << '\n';
+
+    llvm::StringSet<> keys;
+    unsigned exported = 0;
+    vector<InvokeEntry*> const &candidates = prebuiltState(cst).candidates;
+    for (size_t i = 0; i < candidates.size(); ++i) {
+        InvokeEntry* entry = candidates[i];
+        if (!prebuiltEligible(entry, root))
+            continue;
+        llvm::SmallString<128> key;
+        prebuiltKey(key, entry);
+        if (key.find('\t') != llvm::StringRef::npos
+            || key.find('\n') != llvm::StringRef::npos
+            || !keys.insert(key))
+            continue;
+        // importers rebuild the returns from the manifest instead of
+        // analyzing the body
+        llvm::SmallString<64> returns;
+        if (!prebuiltReturns(returns, entry))
+            continue;
+
+        llvm::Function *f = entry->llvmFunc;
+        Fingerprint symbol;
+        symbol.add(key);
+        f->setName("clayprebuilt_" + symbol.str());
+        f->setLinkage(llvm::GlobalValue::ExternalLinkage);
+
+        // punned memory reaches f within the library, so importers treat
+        // it as they would a punning body of their own
+        bool punning = cst->punningFunctions.count(f) > 0;
+        out << f->getName() << '\t';
+        if (punning)
+            out << 'p';
+        if (exceptionsEnabled(cst))
+            out << 'e';
+        if (!punning && !exceptionsEnabled(cst))
+            out << '-';
+        out << '\t' << key << '\t' << returns << '\n';
+        ++exported;
+    }
+    addStatistic("instantiations written to prebuilt library", exported);
+
+    if (moduleInterfaceEnabled(cst)) {
+        for (size_t i = 0; i < root->topLevelItems.size(); ++i) {
+            TopLevelItem *item = root->topLevelItems[i].ptr();
+            if (item->objKind != EXTERNAL_PROCEDURE)
+                continue;
+            ExternalProcedure *x = (ExternalProcedure *)item;
+            if (x->body == NULL || x->llvmFunc == NULL || x->attrDLLImport)
+                continue;
+            out << x->llvmFunc->getName() << "\tx\t"
+                << x->llvmFunc->getName() << "\t\n";
+        }
+        vector<llvm::GlobalVariable*> const &moduleGlobals =
+            prebuiltState(cst).moduleGlobals;
+        for (size_t i = 0; i < moduleGlobals.size(); ++i) {
+            llvm::StringRef symbol = moduleGlobals[i]->getName();
+            out << symbol << "\tg\t" << symbol << "\t\n";
+        }
+        writeRecordFields(out, root);
+    }
+    return true;
+}
+
+
+
+//
+// -module
+//
+
+static bool interfaceCallable(ObjectPtr callable, ModulePtr module)
+{
+    switch (callable->objKind) {
+    case PROCEDURE :
+    case RECORD_DECL :
+    case VARIANT_DECL : {
+        TopLevelItem *x = (TopLevelItem *)callable.ptr();
+        return x->module != module.ptr() || x->visibility != PRIVATE;
+    }
+    case TYPE :
+        return true;
+    default :
+        return false;
+    }
+}
+
+static unsigned importHeight(Module *m, map<Module*, unsigned> &heights)
+{
+    map<Module*, unsigned>::iterator i = heights.find(m);
+    if (i != heights.end())
+        return i->second;
+    // an import cycle counts as a leaf where it was entered
+    heights[m] = 0;
+    unsigned height = 0;
+    for (size_t j = 0; j < m->imports.size(); ++j)
+        height = std::max(height, importHeight(m->imports[j]->module.ptr(), heights) + 1);
+    heights[m] = height;
+    return height;
+}
+
+unsigned moduleInitPriority(ModulePtr module)
+{
+    // 0 to 100 are reserved, and programs use 65535
+    map<Module*, unsigned> heights;
+    return std::min(101 + importHeight(module.ptr(), heights), 65534u);
+}
+
+void codegenModuleInterface(ModulePtr module)
+{
+    CompilerState* cst = module->cst;
+    if (module->moduleName == "__main__")
+        error("-module requires a module declaration ('in <name>;') "
+              "or -module-name");
+
+    for (size_t i = 0; i < module->topLevelItems.size(); ++i) {
+        TopLevelItem *item = module->topLevelItems[i].ptr();
+        // the module's globals belong to its object whether or not its
+        // own procedures use them
+        if (item->objKind == GLOBAL_VARIABLE) {
+            GlobalVariable *y = (GlobalVariable *)item;
+            if (!y->hasParams()) {
+                GVarInstancePtr z = defaultGVarInstance(y);
+                if (!z->llGlobal)
+                    codegenGVarInstance(z);
+            }
+            continue;
+        }
+        if (item->objKind != OVERLOAD || prebuiltState(cst).moduleGlobalsOnly)
+            continue;
+        Overload *x = (Overload *)item;
+        CodePtr code = x->code;
+        // generic overloads are instantiated by importers
+        if (x->nameIsPattern || x->callByName
+            || x->isInline == INLINE || x->isInline == FORCE_INLINE
+            || !code->patternVars.empty() || code->predicate != NULL
+            || code->hasVarArg)
+            continue;
+        vector<TypePtr> argsKey;
+        vector<ValueTempness> argsTempness;
+        bool generic = false;
+        for (size_t j = 0; j < code->formalArgs.size(); ++j) {
+            FormalArg *arg = code->formalArgs[j].ptr();
+            if (arg->type == NULL || arg->asArg
+                || arg->tempness == TEMPNESS_FORWARD) {
+                generic = true;
+                break;
+            }
+            argsKey.push_back(evaluateType(arg->type, x->env, cst));
+            argsTempness.push_back(arg->tempness == TEMPNESS_RVALUE
+                                   ? TEMPNESS_RVALUE : TEMPNESS_LVALUE);
+        }
+        if (generic)
+            continue;
+        ObjectPtr callable = evaluateOneStatic(x->target, x->env, cst);
+        if (interfaceCallable(callable, module))
+            codegenCallable(callable, argsKey, argsTempness, cst);
+    }
+}
+
+}
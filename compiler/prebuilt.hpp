@@ -0,0 +1,131 @@
+#ifndef __CLAY_PREBUILT_HPP
+#define __CLAY_PREBUILT_HPP
+
+#include "clay.hpp"
+
+namespace clay {
+
+// Prebuilt instantiation libraries. '-c -prebuilt-out=<manifest>' compiles
+// a spec file whose externals instantiate commonly used library code
+// (Vector[Char], String printing, HashMap[String, ...]) and gives the
+// instantiations from imported modules external names in the object,
+// listing them in the manifest. '-prebuilt=<manifest>' links a program
+// against that object and declares the listed instantiations instead of
+// generating their bodies.
+//
+// Instantiations are keyed by module, callable and argument types, as in
+// the names of generated functions, by argument tempness and rvalue
+// forwarding, as in profile keys, and by the module
+// and source offset of the overload they were matched to. The manifest
+// describes the return types of each instantiation, and a program takes
+// them from there instead of analyzing the body; instantiations whose
+// return types can't be described aren't exported. If the exception
+// setting differs, the body is analyzed and generated as usual. Inline
+// procedures are never prebuilt, and neither is anything that reaches
+// module globals, which would otherwise exist once in the library and once
+// in the program, unless the globals belong to a module object (see
+// -module below).
+//
+// The manifest also records a fingerprint of the target and of the
+// options that affect code generation (-D flags, exceptions, inlining,
+// strict aliasing), and one of the source of every module the library was
+// compiled from.
+// A program with another configuration can't use the manifest, and
+// neither can one that loads a different version of any of those modules.
+// Exported functions have no type-based alias analysis tags, since their
+// callers may pass them memory that was reinterpreted as another type.
+//
+// '-c -module' compiles a module for separate compilation: the object
+// holds the module's externals and its non-generic overloads, and an
+// interface file (a manifest, beside the object with the extension
+// .clayi) lists them. The module's name, from its declaration or from
+// -module-name, must be the one importers use. Importers pass the
+// interface with '-prebuilt' and still load the module's source, which
+// supplies its declarations and generic overloads, but they neither
+// analyze, generate nor optimize the bodies the interface lists. The
+// interface also describes the fields of the module's records that have
+// neither parameters nor computed bodies, which importers then don't
+// evaluate. The module's global variables, other than indexed ones,
+// belong to its object: it defines and initializes all of them under
+// external names, and importers declare them instead of keeping a copy of
+// their own. The object's constructors have a priority below those of its
+// importers, and programs link module objects before their own, in import
+// order, so a module's globals are initialized before those of modules
+// and programs that import it, and destroyed after them. A module object
+// keeps its own copy of the globals of imported modules that have no
+// object, so '-c -module-globals' compiles an object and interface holding
+// just a module's globals; -build does that for the library modules with
+// globals that a program imports.
+
+struct InvokeEntry;
+struct GVarInstance;
+
+// whether a manifest was loaded, and whether -prebuilt-out or -module was
+// given, for cst
+bool prebuiltUseEnabled(CompilerState* cst);
+bool prebuiltOutputEnabled(CompilerState* cst);
+bool moduleInterfaceEnabled(CompilerState* cst);
+
+// reads a manifest, noting the object it describes. fails with errorInfo
+// if the manifest can't be read or was built for another configuration.
+bool loadPrebuiltManifest(llvm::StringRef manifestFile,
+                          string &errorInfo,
+                          CompilerState* cst);
+
+// the objects of the loaded manifests, in the order their constructors
+// run: imported modules before their importers. the program's object
+// comes last.
+void prebuiltLibraries(CompilerState* cst, vector<string> &libraries);
+
+// once the program is loaded, checks that the modules it shares with the
+// loaded manifests have the sources they were built from
+bool checkPrebuiltModules(CompilerState* cst, string &errorInfo);
+
+// takes entry's return types from a loaded manifest, if it lists entry,
+// marking it analyzed
+bool analyzePrebuiltEntry(InvokeEntry* entry);
+
+// fills in t's fields from a loaded interface, if it describes them
+bool prebuiltRecordFields(RecordTypePtr t);
+
+// declares entry's function from a loaded manifest, if it lists entry
+bool codegenPrebuiltDeclaration(InvokeEntry* entry);
+bool prebuiltExternalDefined(CompilerState* cst, llvm::StringRef symbol);
+
+// declares x, whose symbol in a program of its own would be name, if a
+// loaded interface lists it
+bool codegenPrebuiltGlobal(GVarInstance *x,
+                           llvm::StringRef name,
+                           llvm::Type *type);
+
+void enablePrebuiltOutput(CompilerState* cst);
+// globalsOnly for -module-globals
+void enableModuleInterface(CompilerState* cst, bool globalsOnly);
+void notePrebuiltCandidate(InvokeEntry* entry);
+
+// the functions generated so far that -prebuilt-out or -module can export:
+// the candidate instantiations and the externals
+void prebuiltExportableFunctions(CompilerState* cst,
+                                 vector<llvm::Function *> &functions);
+
+// with -module, gives x an external name if the root module owns it
+void exportModuleGlobal(GVarInstance *x, llvm::StringRef name);
+
+// the priority of the constructors and destructors of module's object,
+// below those of the objects of the modules it imports
+unsigned moduleInitPriority(ModulePtr module);
+
+// instantiates the non-generic overloads of module that importers can call,
+// and its global variables
+void codegenModuleInterface(ModulePtr module);
+
+// exports the eligible instantiations generated so far, and with -module
+// the root module's externals, and lists them in manifestFile, describing
+// library as their object
+bool writePrebuiltManifest(llvm::StringRef manifestFile,
+                           llvm::StringRef library,
+                           ModulePtr root);
+
+}
+
+#endif
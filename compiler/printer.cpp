@@ -812,6 +812,25 @@ void disableSafePrintName()
     assert(_safeNames >= 0);
 }
 
+static int _qualifiedNames = 0;
+
+void enableQualifiedPrintName()
+{
+    ++_qualifiedNames;
+}
+
+void disableQualifiedPrintName()
+{
+    --_qualifiedNames;
+    assert(_qualifiedNames >= 0);
+}
+
+static void printQualification(llvm::raw_ostream &out, TopLevelItem *x)
+{
+    if (_qualifiedNames > 0 && x->module != NULL)
+        out << x->module->moduleName << '.';
+}
+
 void printNameList(llvm::raw_ostream &out, llvm::ArrayRef<ObjectPtr> x)
 {
     for (size_t i = 0; i < x.size(); ++i) {
@@ -950,26 +969,31 @@ void printName(llvm::raw_ostream &out, ObjectPtr x)
     }
     case GLOBAL_VARIABLE : {
         GlobalVariable *y = (GlobalVariable *)x.ptr();
+        printQualification(out, y);
         out << y->name->str;
         break;
     }
     case GLOBAL_ALIAS : {
         GlobalAlias *y = (GlobalAlias *)x.ptr();
+        printQualification(out, y);
         out << y->name->str;
         break;
     }
     case RECORD_DECL : {
         RecordDecl *y = (RecordDecl *)x.ptr();
+        printQualification(out, y);
         out << y->name->str;
         break;
     }
     case VARIANT_DECL : {
         VariantDecl *y = (VariantDecl *)x.ptr();
+        printQualification(out, y);
         out << y->name->str;
         break;
     }
     case PROCEDURE : {
         Procedure *y = (Procedure *)x.ptr();
+        printQualification(out, y);
         out << y->name->str;
         break;
     }
@@ -1302,6 +1326,7 @@ void typePrint(llvm::raw_ostream &out, TypePtr t) {
     }
     case RECORD_TYPE : {
         RecordType *x = (RecordType *)t.ptr();
+        printQualification(out, x->record.ptr());
         out << x->record->name->str;
         if (!x->params.empty()) {
             out << "[";
@@ -1312,6 +1337,7 @@ void typePrint(llvm::raw_ostream &out, TypePtr t) {
     }
     case VARIANT_TYPE : {
         VariantType *x = (VariantType *)t.ptr();
+        printQualification(out, x->variant.ptr());
         out << x->variant->name->str;
         if (!x->params.empty()) {
             out << "[";
@@ -1329,11 +1355,13 @@ void typePrint(llvm::raw_ostream &out, TypePtr t) {
     }
     case ENUM_TYPE : {
         EnumType *x = (EnumType *)t.ptr();
+        printQualification(out, x->enumeration.ptr());
         out << x->enumeration->name->str;
         break;
     }
     case NEW_TYPE : {
         NewType *x = (NewType *)t.ptr();
+        printQualification(out, x->newtype.ptr());
         out << x->newtype->name->str;
         break;
     }
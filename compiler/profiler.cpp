@@ -1,35 +1,220 @@
 #include "clay.hpp"
 #include "profiler.hpp"
+#include "invoketables.hpp"
+#include "loader.hpp"
+#include "hirestimer.hpp"
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/Support/Format.h>
 
 namespace clay {
 
-static llvm::StringMap<int> countsMap;
+bool instantiationProfilingEnabled = false;
 
-void incrementCount(ObjectPtr obj) {
-    string buf;
-    llvm::raw_string_ostream sout(buf);
-    sout << obj;
-    string s = sout.str();
-    llvm::StringMap<int>::iterator i = countsMap.find(s);
-    if (i == countsMap.end()) {
-        countsMap[s] = 1;
+namespace {
+    struct EntryProfile {
+        InvokeEntry* entry;
+        HiResTimer timers[PROFILE_KIND_COUNT];
+        size_t instructions;
+
+        explicit EntryProfile(InvokeEntry* entry)
+            : entry(entry), instructions(0) {}
+    };
+
+    struct CallableProfile {
+        Object* callable;
+        InvokeEntry* firstEntry;
+        unsigned instantiations;
+        double millis[PROFILE_KIND_COUNT];
+        size_t instructions;
+
+        CallableProfile()
+            : callable(NULL), firstEntry(NULL), instantiations(0), instructions(0)
+        {
+            for (unsigned i = 0; i < PROFILE_KIND_COUNT; ++i)
+                millis[i] = 0;
+        }
+    };
+
+    struct ProfileFrame {
+        EntryProfile *profile;
+        ProfileKind kind;
+        ProfileFrame(EntryProfile *profile, ProfileKind kind)
+            : profile(profile), kind(kind) {}
+    };
+}
+
+static llvm::DenseMap<InvokeEntry*, EntryProfile*> entryProfiles;
+static vector<EntryProfile*> entryProfileOrder;
+static vector<ProfileFrame> profileStack;
+
+void enableInstantiationProfiling() {
+    instantiationProfilingEnabled = true;
+}
+
+static EntryProfile *entryProfile(InvokeEntry* entry) {
+    EntryProfile *&profile = entryProfiles[entry];
+    if (profile == NULL) {
+        profile = new EntryProfile(entry);
+        entryProfileOrder.push_back(profile);
     }
-    else {
-        i->second += 1;
+    return profile;
+}
+
+void profileInstantiation(InvokeEntry* entry) {
+    if (instantiationProfilingEnabled)
+        entryProfile(entry);
+}
+
+void profileEnter(InvokeEntry* entry, ProfileKind kind) {
+    // only the innermost scope's timer runs, which makes all times self times
+    if (!profileStack.empty()) {
+        ProfileFrame &outer = profileStack.back();
+        outer.profile->timers[outer.kind].stop();
     }
+    EntryProfile *profile = entryProfile(entry);
+    profileStack.push_back(ProfileFrame(profile, kind));
+    profile->timers[kind].start();
+}
+
+static size_t instructionCount(llvm::Function *func) {
+    size_t count = 0;
+    for (llvm::Function::iterator i = func->begin(), end = func->end(); i != end; ++i)
+        count += i->size();
+    return count;
 }
 
-void displayCounts() {
-    vector<pair<int, string> > counts;
-    llvm::StringMap<int>::iterator cmi = countsMap.begin();
-    while (cmi != countsMap.end()) {
-        counts.push_back(make_pair(cmi->getValue(), cmi->getKey()));
-        ++cmi;
+void profileExit(InvokeEntry* entry, ProfileKind kind) {
+    assert(!profileStack.empty());
+    ProfileFrame frame = profileStack.back();
+    assert(frame.profile->entry == entry && frame.kind == kind);
+    frame.profile->timers[kind].stop();
+    profileStack.pop_back();
+    if (!profileStack.empty()) {
+        ProfileFrame &outer = profileStack.back();
+        outer.profile->timers[outer.kind].start();
     }
-    sort(counts.begin(), counts.end());
-    for (size_t i = 0; i < counts.size(); ++i) {
-        llvm::outs() << counts[i].second << " - " << counts[i].first << '\n';
+
+    // counted now, before the optimizer inlines or deletes the function
+    if (kind == PROFILE_CODEGEN && entry->llvmFunc != NULL)
+        frame.profile->instructions = instructionCount(entry->llvmFunc);
+}
+
+
+
+//
+// printInstantiationProfile
+//
+
+static double totalMillis(const double (&millis)[PROFILE_KIND_COUNT]) {
+    double total = 0;
+    for (unsigned i = 0; i < PROFILE_KIND_COUNT; ++i)
+        total += millis[i];
+    return total;
+}
+
+static void entryMillis(EntryProfile *profile, double (&millis)[PROFILE_KIND_COUNT]) {
+    for (unsigned i = 0; i < PROFILE_KIND_COUNT; ++i)
+        millis[i] = profile->timers[i].elapsedMillis();
+}
+
+static bool callableTimeGreater(const CallableProfile *a, const CallableProfile *b) {
+    return totalMillis(a->millis) > totalMillis(b->millis);
+}
+
+static bool callableSizeGreater(const CallableProfile *a, const CallableProfile *b) {
+    return a->instructions > b->instructions;
+}
+
+static bool entryTimeGreater(const pair<double, EntryProfile*> &a,
+                             const pair<double, EntryProfile*> &b) {
+    return a.first > b.first;
+}
+
+static void printCallableName(llvm::raw_ostream &out, InvokeEntry* entry) {
+    ModulePtr module = staticModule(entry->callable, entry->env->cst);
+    if (module != NULL && !module->moduleName.empty())
+        out << module->moduleName << '.';
+    printStaticName(out, entry->callable);
+}
+
+static void printCosts(llvm::raw_ostream &out,
+                       const double (&millis)[PROFILE_KIND_COUNT],
+                       size_t instructions) {
+    out << llvm::format("%11.2f %9.2f %11.2f %9u  ",
+                        millis[PROFILE_ANALYSIS],
+                        millis[PROFILE_EVALUATOR],
+                        millis[PROFILE_CODEGEN],
+                        unsigned(instructions));
+}
+
+static void printCallables(llvm::raw_ostream &out,
+                           llvm::ArrayRef<CallableProfile*> callables,
+                           unsigned topN) {
+    out << "  instances analysis ms   eval ms  codegen ms    instrs  callable\n";
+    for (size_t i = 0; i < callables.size() && i < topN; ++i) {
+        CallableProfile *c = callables[i];
+        out << llvm::format("%11u ", c->instantiations);
+        printCosts(out, c->millis, c->instructions);
+        printCallableName(out, c->firstEntry);
+        out << '\n';
+    }
+}
+
+void printInstantiationProfile(llvm::raw_ostream &out, unsigned topN) {
+    SafePrintNameEnabler enabler;
+
+    llvm::DenseMap<Object*, CallableProfile> callableMap;
+    for (size_t i = 0; i < entryProfileOrder.size(); ++i) {
+        EntryProfile *profile = entryProfileOrder[i];
+        CallableProfile &c = callableMap[profile->entry->callable.ptr()];
+        if (c.firstEntry == NULL) {
+            c.callable = profile->entry->callable.ptr();
+            c.firstEntry = profile->entry;
+        }
+        ++c.instantiations;
+        for (unsigned k = 0; k < PROFILE_KIND_COUNT; ++k)
+            c.millis[k] += profile->timers[k].elapsedMillis();
+        c.instructions += profile->instructions;
+    }
+
+    vector<CallableProfile*> callables;
+    for (llvm::DenseMap<Object*, CallableProfile>::iterator i = callableMap.begin(),
+             end = callableMap.end(); i != end; ++i)
+        callables.push_back(&i->second);
+
+    out << "instantiation profile: " << entryProfileOrder.size()
+        << " instantiations of " << callables.size() << " callables\n";
+    out << "(self times; instruction counts are before optimization)\n";
+
+    out << "\ncallables by compile time:\n";
+    sort(callables.begin(), callables.end(), callableTimeGreater);
+    printCallables(out, callables, topN);
+
+    out << "\ncallables by instruction count:\n";
+    sort(callables.begin(), callables.end(), callableSizeGreater);
+    printCallables(out, callables, topN);
+
+    vector<pair<double, EntryProfile*> > entries;
+    for (size_t i = 0; i < entryProfileOrder.size(); ++i) {
+        double millis[PROFILE_KIND_COUNT];
+        entryMillis(entryProfileOrder[i], millis);
+        entries.push_back(make_pair(totalMillis(millis), entryProfileOrder[i]));
+    }
+    sort(entries.begin(), entries.end(), entryTimeGreater);
+
+    out << "\ninstantiations by compile time:\n";
+    out << "analysis ms   eval ms  codegen ms    instrs  instantiation\n";
+    for (size_t i = 0; i < entries.size() && i < topN; ++i) {
+        EntryProfile *profile = entries[i].second;
+        double millis[PROFILE_KIND_COUNT];
+        entryMillis(profile, millis);
+        printCosts(out, millis, profile->instructions);
+        printCallableName(out, profile->entry);
+        out << '(';
+        printNameList(out, profile->entry->argsKey);
+        out << ")\n";
     }
+    out.flush();
 }
 
 }
@@ -4,8 +4,50 @@
 #include "clay.hpp"
 
 namespace clay {
-void incrementCount(ObjectPtr obj);
-void displayCounts();
+
+// -profile-instantiations: per-InvokeEntry instantiation and compile-cost
+// counters. Entries and callables are keyed by pointer and only resolved
+// to names when the report is printed. Times are self times: time spent
+// in a nested instantiation is charged to that instantiation.
+
+struct InvokeEntry;
+
+enum ProfileKind {
+    PROFILE_ANALYSIS,
+    PROFILE_EVALUATOR,
+    PROFILE_CODEGEN,
+    PROFILE_KIND_COUNT
+};
+
+extern bool instantiationProfilingEnabled;
+
+void enableInstantiationProfiling();
+void profileInstantiation(InvokeEntry* entry);
+void profileEnter(InvokeEntry* entry, ProfileKind kind);
+void profileExit(InvokeEntry* entry, ProfileKind kind);
+
+class InstantiationProfileScope {
+    InvokeEntry* entry;
+    ProfileKind kind;
+public:
+    InstantiationProfileScope(InvokeEntry* entry, ProfileKind kind)
+        : entry(instantiationProfilingEnabled ? entry : NULL), kind(kind)
+    {
+        if (this->entry != NULL)
+            profileEnter(this->entry, kind);
+    }
+    ~InstantiationProfileScope() {
+        if (entry != NULL)
+            profileExit(entry, kind);
+    }
+private:
+    InstantiationProfileScope(const InstantiationProfileScope &);
+    void operator=(const InstantiationProfileScope &);
+};
+
+// prints the topN most expensive callables and instantiations
+void printInstantiationProfile(llvm::raw_ostream &out, unsigned topN);
+
 }
 
 #endif
@@ -0,0 +1,257 @@
+#include "clay.hpp"
+#include "sharing.hpp"
+#include "invoketables.hpp"
+#include "types.hpp"
+#include "stats.hpp"
+
+
+namespace clay {
+
+namespace {
+    enum LayoutClass {
+        LAYOUT_EXACT,
+        LAYOUT_INTEGER,
+        LAYOUT_FLOAT,
+        LAYOUT_X87_FLOAT,
+        LAYOUT_POINTER
+    };
+
+    // a type the body must see as is, or the layout of a scalar type
+    struct LayoutSlot {
+        Type *exact;
+        LayoutClass abiClass;
+        size_t size;
+        size_t alignment;
+
+        bool operator<(LayoutSlot const &other) const {
+            if (exact != other.exact)
+                return exact < other.exact;
+            if (abiClass != other.abiClass)
+                return abiClass < other.abiClass;
+            if (size != other.size)
+                return size < other.size;
+            return alignment < other.alignment;
+        }
+        bool operator==(LayoutSlot const &other) const {
+            return !(*this < other) && !(other < *this);
+        }
+    };
+
+    struct LayoutKey {
+        Code *code;
+        // argument types followed by return types
+        vector<LayoutSlot> slots;
+        vector<uint8_t> returnIsRef;
+        InlineAttribute isInline;
+
+        bool operator<(LayoutKey const &other) const {
+            if (code != other.code)
+                return code < other.code;
+            if (slots != other.slots)
+                return slots < other.slots;
+            if (returnIsRef != other.returnIsRef)
+                return returnIsRef < other.returnIsRef;
+            return isInline < other.isInline;
+        }
+    };
+}
+
+struct LayoutSharingState {
+    map<LayoutKey, InvokeEntry *> sharedBodies;
+};
+
+static LayoutSharingState &layoutSharingState(CompilerState* cst)
+{
+    if (cst->layoutSharingState == NULL)
+        cst->layoutSharingState = new LayoutSharingState();
+    return *cst->layoutSharingState;
+}
+
+
+
+//
+// opaque bodies
+//
+// the walk computes the type of every value the body handles from the
+// entry's argument types. a body is opaque when every name it uses is an
+// argument or one of its own locals, and every assignment is between
+// values of one type, so codegen never has to dispatch on a scalar type.
+//
+
+typedef map<string, TypePtr> OpaqueNames;
+
+static TypePtr opaqueExprType(ExprPtr x, OpaqueNames const &names)
+{
+    switch (x->exprKind) {
+    case NAME_REF : {
+        NameRef *y = (NameRef *)x.ptr();
+        OpaqueNames::const_iterator i = names.find(y->name->str.str());
+        return i != names.end() ? i->second : TypePtr();
+    }
+    case PAREN : {
+        Paren *y = (Paren *)x.ptr();
+        if (y->args->size() != 1)
+            return NULL;
+        return opaqueExprType(y->args->exprs[0], names);
+    }
+    case VARIADIC_OP : {
+        VariadicOp *y = (VariadicOp *)x.ptr();
+        if (y->op != ADDRESS_OF || y->exprs->size() != 1)
+            return NULL;
+        TypePtr t = opaqueExprType(y->exprs->exprs[0], names);
+        return t != NULL ? pointerType(t) : TypePtr();
+    }
+    default :
+        return NULL;
+    }
+}
+
+static bool opaqueExprTypes(ExprListPtr x, OpaqueNames const &names,
+                            vector<TypePtr> &types)
+{
+    for (size_t i = 0; i < x->size(); ++i) {
+        TypePtr t = opaqueExprType(x->exprs[i], names);
+        if (t == NULL)
+            return false;
+        types.push_back(t);
+    }
+    return true;
+}
+
+static bool opaqueStatement(StatementPtr x, OpaqueNames &names)
+{
+    switch (x->stmtKind) {
+    case BLOCK : {
+        Block *y = (Block *)x.ptr();
+        OpaqueNames blockNames = names;
+        for (size_t i = 0; i < y->statements.size(); ++i)
+            if (!opaqueStatement(y->statements[i], blockNames))
+                return false;
+        return true;
+    }
+    case BINDING : {
+        Binding *y = (Binding *)x.ptr();
+        if (y->bindingKind != VAR && y->bindingKind != REF)
+            return false;
+        if (!y->patternVars.empty() || y->predicate != NULL || y->hasVarArg)
+            return false;
+        vector<TypePtr> types;
+        if (!opaqueExprTypes(y->values, names, types))
+            return false;
+        if (types.size() != y->args.size())
+            return false;
+        for (size_t i = 0; i < y->args.size(); ++i) {
+            FormalArgPtr arg = y->args[i];
+            if (arg->type != NULL || arg->varArg || arg->asArg)
+                return false;
+            names[arg->name->str.str()] = types[i];
+        }
+        return true;
+    }
+    case ASSIGNMENT : {
+        Assignment *y = (Assignment *)x.ptr();
+        vector<TypePtr> left, right;
+        if (!opaqueExprTypes(y->left, names, left)
+            || !opaqueExprTypes(y->right, names, right))
+            return false;
+        return left == right;
+    }
+    case RETURN : {
+        Return *y = (Return *)x.ptr();
+        if (y->returnKind == RETURN_FORWARD)
+            return false;
+        vector<TypePtr> types;
+        return opaqueExprTypes(y->values, names, types);
+    }
+    default :
+        return false;
+    }
+}
+
+static bool opaqueBody(InvokeEntry* entry)
+{
+    CodePtr code = entry->code;
+    if (code->isLLVMBody() || code->hasReturnSpecs()
+        || code->hasVarArg || code->hasNamedReturns())
+        return false;
+    for (size_t i = 0; i < code->formalArgs.size(); ++i)
+        if (code->formalArgs[i]->asArg)
+            return false;
+    // assigning to an rvalue argument dispatches to assign
+    for (size_t i = 0; i < entry->forwardedRValueFlags.size(); ++i)
+        if (entry->forwardedRValueFlags[i])
+            return false;
+
+    OpaqueNames names;
+    for (size_t i = 0; i < entry->fixedArgNames.size(); ++i)
+        names[entry->fixedArgNames[i]->str.str()] = entry->fixedArgTypes[i];
+    return opaqueStatement(code->body, names);
+}
+
+
+
+//
+// findLayoutTwin
+//
+
+static LayoutSlot layoutSlot(TypePtr t)
+{
+    LayoutSlot slot;
+    slot.exact = NULL;
+    slot.size = 0;
+    slot.alignment = 0;
+    switch (t->typeKind) {
+    case INTEGER_TYPE :
+        slot.abiClass = LAYOUT_INTEGER;
+        break;
+    case FLOAT_TYPE :
+        // x87 extended floats don't fill their storage
+        if (((FloatType *)t.ptr())->bits == 80)
+            slot.abiClass = LAYOUT_X87_FLOAT;
+        else
+            slot.abiClass = LAYOUT_FLOAT;
+        break;
+    case POINTER_TYPE :
+    case CODE_POINTER_TYPE :
+    case CCODE_POINTER_TYPE :
+        slot.abiClass = LAYOUT_POINTER;
+        break;
+    default :
+        slot.exact = t.ptr();
+        slot.abiClass = LAYOUT_EXACT;
+        return slot;
+    }
+    slot.size = typeSize(t);
+    slot.alignment = typeAlignment(t);
+    return slot;
+}
+
+InvokeEntry* findLayoutTwin(InvokeEntry* entry)
+{
+    if (entry->callByName || entry->isInline == FORCE_INLINE
+        || !entry->multiversions.empty())
+        return NULL;
+    if (!opaqueBody(entry))
+        return NULL;
+
+    LayoutKey key;
+    key.code = entry->origCode.ptr();
+    for (size_t i = 0; i < entry->argsKey.size(); ++i)
+        key.slots.push_back(layoutSlot(entry->argsKey[i]));
+    for (size_t i = 0; i < entry->returnTypes.size(); ++i)
+        key.slots.push_back(layoutSlot(entry->returnTypes[i]));
+    key.returnIsRef = entry->returnIsRef;
+    key.isInline = entry->isInline;
+
+    CompilerState* cst = entry->env->cst;
+    map<LayoutKey, InvokeEntry *> &sharedBodies = layoutSharingState(cst).sharedBodies;
+    map<LayoutKey, InvokeEntry *>::iterator i = sharedBodies.find(key);
+    if (i == sharedBodies.end()) {
+        sharedBodies.insert(make_pair(key, entry));
+        return NULL;
+    }
+    addStatistic("instantiations sharing another's body", 1);
+    return i->second;
+}
+
+}
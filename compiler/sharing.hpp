@@ -0,0 +1,33 @@
+#ifndef __CLAY_SHARING_HPP
+#define __CLAY_SHARING_HPP
+
+#include "clay.hpp"
+
+namespace clay {
+
+// -share-instantiations: instantiations of an overload whose scalar
+// argument and return types have the same size, alignment and ABI class
+// share one generated body, provided the body cannot observe those types.
+// The analyzer picks the shared body once an instantiation is analyzed;
+// codegen then emits the other instantiations as thunks that cast their
+// arguments and call it.
+//
+// The proof is syntactic. A body qualifies when it only binds, copies,
+// assigns and returns its arguments and takes their addresses; any call,
+// dereference, field access, control flow or reference to a name outside
+// the body (including pattern variables, so 'Type(x)', predicates and
+// static dispatch are all excluded) disqualifies it. Copying, assigning and
+// dropping a scalar never dispatches to an overload, so such a body
+// generates the same code for every type of one layout as long as the same
+// equalities hold between its value types, which are part of the key.
+
+struct InvokeEntry;
+
+// called by the analyzer once entry's return types are known. returns an
+// analyzed instantiation whose body entry can share, or NULL; entry
+// becomes the shared body for later instantiations if it has none.
+InvokeEntry* findLayoutTwin(InvokeEntry* entry);
+
+}
+
+#endif
@@ -0,0 +1,1703 @@
+#include "snapshot.hpp"
+#include "fingerprint.hpp"
+#include <llvm/ADT/DenseMap.h>
+#include <cstring>
+
+
+#pragma clang diagnostic ignored "-Wcovered-switch-default"
+
+
+namespace clay {
+
+//
+// file layout, all integers 32-bit in host byte order except the 64-bit
+// sourceSeconds and sourceHash:
+//
+//   "CLAYAST\0" version byteOrderMark parserFlags
+//   sourceSize sourceSeconds sourceNanoseconds sourceHash
+//   stringCount wordCount
+//   stringCount x (length, bytes)
+//   wordCount x word
+//
+// the words hold the module's location, imports, declaration, top-level
+// LLVM code and top-level items. a reference to a node is 0 for NULL, 1
+// for a node whose kind and fields follow, or n + 2 for the nth node
+// already read. nodes are numbered once their fields have been read, so
+// the parser's output, which has no cycles, numbers the same way in the
+// writer and the reader. locations are offset + 1, or 0 for none, and
+// strings are indices into the string pool.
+//
+
+static const char SNAPSHOT_MAGIC[8] = { 'C','L','A','Y','A','S','T','\0' };
+static const uint32_t SNAPSHOT_VERSION = 3;
+static const uint32_t SNAPSHOT_BYTE_ORDER = 0x01020304;
+
+// parser options that change its output
+static const uint32_t SNAPSHOT_LAZY_BODIES = 1;
+
+static uint32_t parserFlags(CompilerState* cst) {
+    return cst->lazyBodies ? SNAPSHOT_LAZY_BODIES : 0;
+}
+
+static uint64_t sourceHash(SourcePtr source) {
+    Fingerprint f;
+    f.add(llvm::StringRef(source->data(), source->size()));
+    return f.hash;
+}
+
+static bool modTime(llvm::StringRef fileName, llvm::sys::TimeValue &time) {
+    llvm::sys::PathWithStatus path(fileName);
+    const llvm::sys::FileStatus *status = path.getFileStatus();
+    if (status == NULL || status->isDir)
+        return false;
+    time = status->getTimestamp();
+    return true;
+}
+
+static bool isTopLevelKind(uint32_t kind) {
+    switch (kind) {
+    case RECORD_DECL :
+    case VARIANT_DECL :
+    case INSTANCE_DECL :
+    case NEW_TYPE_DECL :
+    case OVERLOAD :
+    case PROCEDURE :
+    case ENUM_DECL :
+    case GLOBAL_VARIABLE :
+    case EXTERNAL_PROCEDURE :
+    case EXTERNAL_VARIABLE :
+    case EVAL_TOPLEVEL :
+    case GLOBAL_ALIAS :
+    case DOCUMENTATION :
+    case STATIC_ASSERT_TOP_LEVEL :
+        return true;
+    default :
+        return false;
+    }
+}
+
+
+
+//
+// readModuleSnapshot
+//
+
+namespace {
+    class SnapshotInput {
+        const char *ptr;
+        const char *end;
+    public:
+        SnapshotInput(llvm::StringRef data)
+            : ptr(data.begin()), end(data.end()) {}
+
+        template <class T>
+        bool read(T &x) {
+            if (size_t(end - ptr) < sizeof(x))
+                return false;
+            memcpy(&x, ptr, sizeof(x));
+            ptr += sizeof(x);
+            return true;
+        }
+
+        bool read(llvm::StringRef &s, size_t length) {
+            if (size_t(end - ptr) < length)
+                return false;
+            s = llvm::StringRef(ptr, length);
+            ptr += length;
+            return true;
+        }
+
+        bool atEnd() const { return ptr == end; }
+    };
+
+    // reads the words of a snapshot. once something doesn't check out,
+    // every read yields zeros, which end lists and references, and the
+    // caller throws the result away.
+    class SnapshotReader {
+        SnapshotInput &in;
+        uint32_t wordsLeft;
+        SourcePtr source;
+        Module *module;
+        vector<llvm::StringRef> strings;
+        vector<ObjectPtr> nodes;
+    public:
+        bool ok;
+
+        SnapshotReader(SnapshotInput &in, uint32_t wordCount,
+                       SourcePtr source, Module *module,
+                       llvm::ArrayRef<llvm::StringRef> strings)
+            : in(in), wordsLeft(wordCount), source(source), module(module),
+              strings(strings.begin(), strings.end()), ok(true) {}
+
+        bool atEnd() const { return wordsLeft == 0; }
+
+        ObjectPtr fail() {
+            ok = false;
+            return NULL;
+        }
+
+        uint32_t word() {
+            uint32_t x;
+            if (!ok || wordsLeft == 0 || !in.read(x)) {
+                ok = false;
+                return 0;
+            }
+            --wordsLeft;
+            return x;
+        }
+
+        uint32_t bounded(uint32_t limit) {
+            uint32_t x = word();
+            if (x > limit) {
+                ok = false;
+                return 0;
+            }
+            return x;
+        }
+
+        bool flag() { return bounded(1) != 0; }
+
+        llvm::StringRef str() {
+            uint32_t i = word();
+            if (i >= strings.size()) {
+                ok = false;
+                return llvm::StringRef();
+            }
+            return strings[i];
+        }
+
+        Location location() {
+            uint32_t x = bounded(uint32_t(source->size()) + 1);
+            if (x == 0)
+                return Location();
+            return Location(source, x - 1);
+        }
+
+        Visibility visibility() { return Visibility(bounded(PRIVATE)); }
+
+        ObjectPtr anyNode() {
+            uint32_t tag = word();
+            if (tag == 0)
+                return NULL;
+            if (tag != 1) {
+                if (tag - 2 >= nodes.size())
+                    return fail();
+                return nodes[tag - 2];
+            }
+            ObjectPtr x = newNode();
+            if (!ok || x == NULL)
+                return fail();
+            nodes.push_back(x);
+            return x;
+        }
+
+        ObjectPtr node(ObjectKind kind) {
+            ObjectPtr x = anyNode();
+            if (x != NULL && x->objKind != kind)
+                return fail();
+            return x;
+        }
+
+        IdentifierPtr identifier() { return (Identifier *)node(IDENTIFIER).ptr(); }
+        DottedNamePtr dottedName() { return (DottedName *)node(DOTTED_NAME).ptr(); }
+        ExprPtr expr() { return (Expr *)node(EXPRESSION).ptr(); }
+        ExprListPtr exprList() { return (ExprList *)node(EXPR_LIST).ptr(); }
+        StatementPtr statement() { return (Statement *)node(STATEMENT).ptr(); }
+        CaseBlockPtr caseBlock() { return (CaseBlock *)node(CASE_BLOCK).ptr(); }
+        CatchPtr catchBlock() { return (Catch *)node(CATCH).ptr(); }
+        FormalArgPtr formalArg() { return (FormalArg *)node(FORMAL_ARG).ptr(); }
+        ReturnSpecPtr returnSpec() { return (ReturnSpec *)node(RETURN_SPEC).ptr(); }
+        LLVMCodePtr llvmCode() { return (LLVMCode *)node(LLVM_CODE).ptr(); }
+        CodePtr code() { return (Code *)node(CODE).ptr(); }
+        RecordBodyPtr recordBody() { return (RecordBody *)node(RECORD_BODY).ptr(); }
+        RecordFieldPtr recordField() { return (RecordField *)node(RECORD_FIELD).ptr(); }
+        OverloadPtr overload() { return (Overload *)node(OVERLOAD).ptr(); }
+        EnumMemberPtr enumMember() { return (EnumMember *)node(ENUM_MEMBER).ptr(); }
+        ExternalArgPtr externalArg() { return (ExternalArg *)node(EXTERNAL_ARG).ptr(); }
+        ImportPtr import() { return (Import *)node(IMPORT).ptr(); }
+        ModuleDeclarationPtr moduleDeclaration() {
+            return (ModuleDeclaration *)node(MODULE_DECLARATION).ptr();
+        }
+
+        TopLevelItemPtr topLevelItem() {
+            ObjectPtr x = anyNode();
+            if (x != NULL && !isTopLevelKind(x->objKind))
+                return (TopLevelItem *)fail().ptr();
+            return (TopLevelItem *)x.ptr();
+        }
+
+        void identifiers(vector<IdentifierPtr> &out) {
+            uint32_t n = word();
+            for (uint32_t i = 0; i < n && ok; ++i)
+                out.push_back(identifier());
+        }
+        void exprs(vector<ExprPtr> &out) {
+            uint32_t n = word();
+            for (uint32_t i = 0; i < n && ok; ++i)
+                out.push_back(expr());
+        }
+        void statements(vector<StatementPtr> &out) {
+            uint32_t n = word();
+            for (uint32_t i = 0; i < n && ok; ++i)
+                out.push_back(statement());
+        }
+        void formalArgs(vector<FormalArgPtr> &out) {
+            uint32_t n = word();
+            for (uint32_t i = 0; i < n && ok; ++i)
+                out.push_back(formalArg());
+        }
+        void returnSpecs(vector<ReturnSpecPtr> &out) {
+            uint32_t n = word();
+            for (uint32_t i = 0; i < n && ok; ++i)
+                out.push_back(returnSpec());
+        }
+        void patternVars(vector<PatternVar> &out) {
+            uint32_t n = word();
+            for (uint32_t i = 0; i < n && ok; ++i) {
+                bool isMulti = flag();
+                out.push_back(PatternVar(isMulti, identifier()));
+            }
+        }
+
+        ObjectPtr newNode();
+        ExprPtr newExpr();
+        StatementPtr newStatement();
+        TopLevelItemPtr newTopLevelItem(uint32_t kind);
+        void readModule(ModulePtr m);
+    };
+}
+
+ObjectPtr SnapshotReader::newNode()
+{
+    uint32_t kind = word();
+    if (kind == EXPR_LIST) {
+        ExprListPtr x = new ExprList();
+        exprs(x->exprs);
+        return x.ptr();
+    }
+
+    Location location = this->location();
+    Pointer<ANode> x;
+
+    switch (kind) {
+
+    case IDENTIFIER :
+        x = new Identifier(str());
+        break;
+
+    case DOTTED_NAME : {
+        DottedName *y = new DottedName();
+        x = y;
+        uint32_t n = word();
+        for (uint32_t i = 0; i < n && ok; ++i)
+            y->parts.push_back(identifier());
+        break;
+    }
+
+    case EXPRESSION :
+        x = newExpr().ptr();
+        break;
+
+    case STATEMENT :
+        x = newStatement().ptr();
+        break;
+
+    case CASE_BLOCK : {
+        ExprListPtr caseLabels = exprList();
+        x = new CaseBlock(caseLabels, statement());
+        break;
+    }
+
+    case CATCH : {
+        IdentifierPtr exceptionVar = identifier();
+        ExprPtr exceptionType = expr();
+        IdentifierPtr contextVar = identifier();
+        x = new Catch(exceptionVar, exceptionType, contextVar, statement());
+        break;
+    }
+
+    case FORMAL_ARG : {
+        IdentifierPtr name = identifier();
+        ExprPtr type = expr();
+        ValueTempness tempness = ValueTempness(bounded(TEMPNESS_FORWARD));
+        FormalArg *y = new FormalArg(name, type, tempness);
+        x = y;
+        y->asType = expr();
+        y->varArg = flag();
+        y->asArg = flag();
+        break;
+    }
+
+    case RETURN_SPEC : {
+        ExprPtr type = expr();
+        x = new ReturnSpec(type, identifier());
+        break;
+    }
+
+    case LLVM_CODE :
+        x = new LLVMCode(str());
+        break;
+
+    case CODE : {
+        Code *y = new Code();
+        x = y;
+        patternVars(y->patternVars);
+        y->predicate = expr();
+        formalArgs(y->formalArgs);
+        returnSpecs(y->returnSpecs);
+        y->varReturnSpec = returnSpec();
+        y->body = statement();
+        y->llvmBody = llvmCode();
+        y->lazyBodyLocation = this->location();
+        y->lazyBodyLength = word();
+        y->hasVarArg = flag();
+        y->returnSpecsDeclared = flag();
+        y->exprReturnSpecs = flag();
+        break;
+    }
+
+    case RECORD_BODY : {
+        if (flag()) {
+            x = new RecordBody(exprList());
+        } else {
+            vector<RecordFieldPtr> fields;
+            uint32_t n = word();
+            for (uint32_t i = 0; i < n && ok; ++i)
+                fields.push_back(recordField());
+            x = new RecordBody(fields, flag());
+        }
+        break;
+    }
+
+    case RECORD_FIELD : {
+        IdentifierPtr name = identifier();
+        RecordField *y = new RecordField(name, expr());
+        x = y;
+        y->varField = flag();
+        break;
+    }
+
+    case ENUM_MEMBER :
+        x = new EnumMember(identifier());
+        break;
+
+    case EXTERNAL_ARG : {
+        IdentifierPtr name = identifier();
+        x = new ExternalArg(name, expr());
+        break;
+    }
+
+    case IMPORT : {
+        ImportKind importKind = ImportKind(bounded(IMPORT_MEMBERS));
+        DottedNamePtr dottedName = this->dottedName();
+        Visibility visibility = this->visibility();
+        Import *y;
+        switch (importKind) {
+        case IMPORT_MODULE :
+            y = new ImportModule(dottedName, identifier());
+            break;
+        case IMPORT_STAR :
+            y = new ImportStar(dottedName);
+            break;
+        case IMPORT_MEMBERS : {
+            ImportMembers *z = new ImportMembers(dottedName);
+            y = z;
+            uint32_t n = word();
+            for (uint32_t i = 0; i < n && ok; ++i) {
+                Visibility memberVisibility = this->visibility();
+                IdentifierPtr name = identifier();
+                z->members.push_back(
+                    ImportedMember(memberVisibility, name, identifier()));
+            }
+            break;
+        }
+        default :
+            return fail();
+        }
+        x = y;
+        y->visibility = visibility;
+        break;
+    }
+
+    case MODULE_DECLARATION : {
+        DottedNamePtr name = dottedName();
+        x = new ModuleDeclaration(name, exprList());
+        break;
+    }
+
+    default :
+        if (!isTopLevelKind(kind))
+            return fail();
+        x = newTopLevelItem(kind).ptr();
+        break;
+    }
+
+    if (x == NULL)
+        return fail();
+    x->location = location;
+    return x.ptr();
+}
+
+ExprPtr SnapshotReader::newExpr()
+{
+    ExprKind exprKind = ExprKind(bounded(EVAL_EXPR));
+    Location startLocation = location();
+    Location endLocation = location();
+    ExprPtr x;
+
+    switch (exprKind) {
+
+    case BOOL_LITERAL :
+        x = new BoolLiteral(flag());
+        break;
+
+    case INT_LITERAL : {
+        llvm::StringRef value = str();
+        x = new IntLiteral(value, str());
+        break;
+    }
+
+    case FLOAT_LITERAL : {
+        llvm::StringRef value = str();
+        x = new FloatLiteral(value, str());
+        break;
+    }
+
+    case CHAR_LITERAL :
+        x = new CharLiteral(char(bounded(UCHAR_MAX)));
+        break;
+
+    case STRING_LITERAL :
+        x = new StringLiteral(identifier());
+        break;
+
+    case FILE_EXPR :
+        x = new FILEExpr();
+        break;
+
+    case LINE_EXPR :
+        x = new LINEExpr();
+        break;
+
+    case COLUMN_EXPR :
+        x = new COLUMNExpr();
+        break;
+
+    case ARG_EXPR :
+        x = new ARGExpr(identifier());
+        break;
+
+    case NAME_REF :
+        x = new NameRef(identifier());
+        break;
+
+    case TUPLE :
+        x = new Tuple(exprList());
+        break;
+
+    case PAREN :
+        x = new Paren(exprList());
+        break;
+
+    case INDEXING : {
+        ExprPtr expr = this->expr();
+        x = new Indexing(expr, exprList());
+        break;
+    }
+
+    case CALL : {
+        ExprPtr expr = this->expr();
+        x = new Call(expr, exprList());
+        break;
+    }
+
+    case FIELD_REF : {
+        ExprPtr expr = this->expr();
+        x = new FieldRef(expr, identifier());
+        break;
+    }
+
+    case STATIC_INDEXING : {
+        ExprPtr expr = this->expr();
+        x = new StaticIndexing(expr, word());
+        break;
+    }
+
+    case VARIADIC_OP : {
+        VariadicOpKind op = VariadicOpKind(bounded(IF_EXPR));
+        x = new VariadicOp(op, exprList());
+        break;
+    }
+
+    case AND : {
+        ExprPtr expr1 = expr();
+        x = new And(expr1, expr());
+        break;
+    }
+
+    case OR : {
+        ExprPtr expr1 = expr();
+        x = new Or(expr1, expr());
+        break;
+    }
+
+    case LAMBDA : {
+        LambdaCapture captureBy = LambdaCapture(bounded(STATELESS));
+        vector<FormalArgPtr> args;
+        formalArgs(args);
+        bool hasVarArg = flag();
+        bool hasAsConversion = flag();
+        x = new Lambda(captureBy, args, hasVarArg, hasAsConversion, statement());
+        break;
+    }
+
+    case UNPACK :
+        x = new Unpack(expr());
+        break;
+
+    case STATIC_EXPR :
+        x = new StaticExpr(expr());
+        break;
+
+    case DISPATCH_EXPR :
+        x = new DispatchExpr(expr());
+        break;
+
+    case FOREIGN_EXPR : {
+        llvm::StringRef moduleName = str();
+        x = new ForeignExpr(moduleName, expr());
+        break;
+    }
+
+    case EVAL_EXPR :
+        x = new EvalExpr(expr());
+        break;
+
+    default :
+        return (Expr *)fail().ptr();
+    }
+
+    x->startLocation = startLocation;
+    x->endLocation = endLocation;
+    return x;
+}
+
+StatementPtr SnapshotReader::newStatement()
+{
+    StatementKind stmtKind = StatementKind(bounded(STATIC_ASSERT_STATEMENT));
+
+    switch (stmtKind) {
+
+    case BLOCK : {
+        BlockPtr x = new Block();
+        statements(x->statements);
+        return x.ptr();
+    }
+
+    case LABEL :
+        return new Label(identifier());
+
+    case BINDING : {
+        BindingKind bindingKind = BindingKind(bounded(FORWARD));
+        vector<PatternVar> vars;
+        patternVars(vars);
+        ExprPtr predicate = expr();
+        vector<FormalArgPtr> args;
+        formalArgs(args);
+        ExprListPtr values = exprList();
+        return new Binding(bindingKind, vars, vector<ObjectPtr>(),
+                           predicate, args, values, flag());
+    }
+
+    case ASSIGNMENT : {
+        ExprListPtr left = exprList();
+        return new Assignment(left, exprList());
+    }
+
+    case INIT_ASSIGNMENT : {
+        ExprListPtr left = exprList();
+        return new InitAssignment(left, exprList());
+    }
+
+    case VARIADIC_ASSIGNMENT : {
+        int op = int(word());
+        return new VariadicAssignment(op, exprList());
+    }
+
+    case GOTO :
+        return new Goto(identifier());
+
+    case RETURN : {
+        ReturnKind returnKind = ReturnKind(bounded(RETURN_FORWARD));
+        ExprListPtr values = exprList();
+        bool isExprReturn = flag();
+        ReturnPtr x = new Return(returnKind, values, isExprReturn);
+        x->isReturnSpecs = flag();
+        return x.ptr();
+    }
+
+    case IF : {
+        vector<StatementPtr> conditionStatements;
+        statements(conditionStatements);
+        ExprPtr condition = expr();
+        StatementPtr thenPart = statement();
+        return new If(conditionStatements, condition, thenPart, statement());
+    }
+
+    case SWITCH : {
+        vector<StatementPtr> exprStatements;
+        statements(exprStatements);
+        ExprPtr expr = this->expr();
+        vector<CaseBlockPtr> caseBlocks;
+        uint32_t n = word();
+        for (uint32_t i = 0; i < n && ok; ++i)
+            caseBlocks.push_back(caseBlock());
+        return new Switch(exprStatements, expr, caseBlocks, statement());
+    }
+
+    case EXPR_STATEMENT :
+        return new ExprStatement(expr());
+
+    case WHILE : {
+        vector<StatementPtr> conditionStatements;
+        statements(conditionStatements);
+        ExprPtr condition = expr();
+        return new While(conditionStatements, condition, statement());
+    }
+
+    case BREAK :
+        return new Break();
+
+    case CONTINUE :
+        return new Continue();
+
+    case FOR : {
+        vector<IdentifierPtr> variables;
+        identifiers(variables);
+        ExprPtr expr = this->expr();
+        return new For(variables, expr, statement());
+    }
+
+    case TRY : {
+        StatementPtr tryBlock = statement();
+        vector<CatchPtr> catchBlocks;
+        uint32_t n = word();
+        for (uint32_t i = 0; i < n && ok; ++i)
+            catchBlocks.push_back(catchBlock());
+        return new Try(tryBlock, catchBlocks);
+    }
+
+    case THROW : {
+        ExprPtr expr = this->expr();
+        return new Throw(expr, this->expr());
+    }
+
+    case STATIC_FOR : {
+        IdentifierPtr variable = identifier();
+        ExprListPtr values = exprList();
+        return new StaticFor(variable, values, statement());
+    }
+
+    case FINALLY :
+        return new Finally(statement());
+
+    case ONERROR :
+        return new OnError(statement());
+
+    case UNREACHABLE :
+        return new Unreachable();
+
+    case EVAL_STATEMENT :
+        return new EvalStatement(exprList());
+
+    case STATIC_ASSERT_STATEMENT : {
+        ExprPtr cond = expr();
+        return new StaticAssertStatement(cond, exprList());
+    }
+
+    default :
+        return (Statement *)fail().ptr();
+    }
+}
+
+TopLevelItemPtr SnapshotReader::newTopLevelItem(uint32_t kind)
+{
+    IdentifierPtr name = identifier();
+    Visibility visibility = this->visibility();
+    TopLevelItemPtr x;
+
+    switch (kind) {
+
+    case RECORD_DECL : {
+        vector<PatternVar> vars;
+        patternVars(vars);
+        ExprPtr predicate = expr();
+        vector<IdentifierPtr> params;
+        identifiers(params);
+        IdentifierPtr varParam = identifier();
+        x = new RecordDecl(module, name, visibility, vars, predicate,
+                           params, varParam, recordBody());
+        break;
+    }
+
+    case VARIANT_DECL : {
+        vector<PatternVar> vars;
+        patternVars(vars);
+        ExprPtr predicate = expr();
+        vector<IdentifierPtr> params;
+        identifiers(params);
+        IdentifierPtr varParam = identifier();
+        bool open = flag();
+        x = new VariantDecl(module, name, visibility, vars, predicate,
+                            params, varParam, open, exprList());
+        break;
+    }
+
+    case INSTANCE_DECL : {
+        vector<PatternVar> vars;
+        patternVars(vars);
+        ExprPtr predicate = expr();
+        ExprPtr target = expr();
+        x = new InstanceDecl(module, vars, predicate, target, exprList());
+        break;
+    }
+
+    case NEW_TYPE_DECL :
+        x = new NewTypeDecl(module, name, visibility, expr());
+        break;
+
+    case OVERLOAD : {
+        ExprPtr target = expr();
+        CodePtr code = this->code();
+        bool callByName = flag();
+        InlineAttribute isInline = InlineAttribute(bounded(NEVER_INLINE));
+        OverloadPtr y = new Overload(module, target, code, callByName,
+                                     isInline, flag());
+        x = y.ptr();
+        uint32_t n = word();
+        for (uint32_t i = 0; i < n && ok; ++i)
+            y->multiversions.push_back(str().str());
+        y->isDefault = flag();
+        break;
+    }
+
+    case PROCEDURE : {
+        bool privateOverload = flag();
+        OverloadPtr interface = overload();
+        ProcedurePtr y = new Procedure(module, name, visibility,
+                                       privateOverload, interface);
+        x = y.ptr();
+        y->singleOverload = overload();
+        break;
+    }
+
+    case ENUM_DECL : {
+        vector<PatternVar> vars;
+        patternVars(vars);
+        ExprPtr predicate = expr();
+        EnumDeclPtr y = new EnumDecl(module, name, visibility, vars, predicate);
+        x = y.ptr();
+        uint32_t n = word();
+        for (uint32_t i = 0; i < n && ok; ++i)
+            y->members.push_back(enumMember());
+        break;
+    }
+
+    case GLOBAL_VARIABLE : {
+        vector<PatternVar> vars;
+        patternVars(vars);
+        ExprPtr predicate = expr();
+        vector<IdentifierPtr> params;
+        identifiers(params);
+        IdentifierPtr varParam = identifier();
+        x = new GlobalVariable(module, name, visibility, vars, predicate,
+                               params, varParam, expr());
+        break;
+    }
+
+    case EXTERNAL_PROCEDURE : {
+        vector<ExternalArgPtr> args;
+        uint32_t n = word();
+        for (uint32_t i = 0; i < n && ok; ++i)
+            args.push_back(externalArg());
+        bool hasVarArgs = flag();
+        ExprPtr returnType = expr();
+        StatementPtr body = statement();
+        x = new ExternalProcedure(module, name, visibility, args, hasVarArgs,
+                                  returnType, body, exprList());
+        break;
+    }
+
+    case EXTERNAL_VARIABLE : {
+        ExprPtr type = expr();
+        x = new ExternalVariable(module, name, visibility, type, exprList());
+        break;
+    }
+
+    case EVAL_TOPLEVEL :
+        x = new EvalTopLevel(module, exprList());
+        break;
+
+    case GLOBAL_ALIAS : {
+        vector<PatternVar> vars;
+        patternVars(vars);
+        ExprPtr predicate = expr();
+        vector<IdentifierPtr> params;
+        identifiers(params);
+        IdentifierPtr varParam = identifier();
+        x = new GlobalAlias(module, name, visibility, vars, predicate,
+                            params, varParam, expr());
+        break;
+    }
+
+    case DOCUMENTATION : {
+        std::map<DocumentationAnnotation, string> annotation;
+        uint32_t n = word();
+        for (uint32_t i = 0; i < n && ok; ++i) {
+            DocumentationAnnotation key =
+                DocumentationAnnotation(bounded(InvalidAnnotation));
+            annotation[key] = str().str();
+        }
+        x = new Documentation(module, annotation, str().str());
+        break;
+    }
+
+    case STATIC_ASSERT_TOP_LEVEL : {
+        ExprPtr cond = expr();
+        x = new StaticAssertTopLevel(module, cond, exprList());
+        break;
+    }
+
+    default :
+        return (TopLevelItem *)fail().ptr();
+    }
+
+    x->name = name;
+    x->visibility = visibility;
+    return x;
+}
+
+void SnapshotReader::readModule(ModulePtr m)
+{
+    m->location = location();
+    uint32_t n = word();
+    for (uint32_t i = 0; i < n && ok; ++i)
+        m->imports.push_back(import());
+    m->declaration = moduleDeclaration();
+    m->topLevelLLVM = llvmCode();
+    n = word();
+    for (uint32_t i = 0; i < n && ok; ++i)
+        m->topLevelItems.push_back(topLevelItem());
+}
+
+ModulePtr readModuleSnapshot(llvm::StringRef snapshotPath,
+                             llvm::StringRef moduleName,
+                             SourcePtr source,
+                             CompilerState* cst)
+{
+    // large files are mapped rather than read
+    llvm::OwningPtr<llvm::MemoryBuffer> buffer;
+    if (llvm::MemoryBuffer::getFile(snapshotPath, buffer, -1, false))
+        return NULL;
+
+    SnapshotInput in(buffer->getBuffer());
+    llvm::StringRef magic;
+    uint32_t version, byteOrder, flags, sourceSize, sourceNanoseconds;
+    uint64_t sourceSeconds, hash;
+    if (!in.read(magic, sizeof(SNAPSHOT_MAGIC))
+        || magic != llvm::StringRef(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC))
+        || !in.read(version) || version != SNAPSHOT_VERSION
+        || !in.read(byteOrder) || byteOrder != SNAPSHOT_BYTE_ORDER
+        || !in.read(flags) || flags != parserFlags(cst)
+        || !in.read(sourceSize) || sourceSize != source->size()
+        || !in.read(sourceSeconds) || !in.read(sourceNanoseconds)
+        || !in.read(hash))
+        return NULL;
+
+    // an unchanged modification time is trusted; a changed one may just
+    // mean the file was touched or checked out again
+    llvm::sys::TimeValue sourceTime;
+    if (!modTime(source->fileName, sourceTime))
+        return NULL;
+    if (sourceSeconds == 0
+        || uint64_t(sourceTime.toEpochTime()) != sourceSeconds
+        || uint32_t(sourceTime.nanoseconds()) != sourceNanoseconds)
+    {
+        if (hash != sourceHash(source))
+            return NULL;
+    }
+
+    uint32_t stringCount, wordCount;
+    if (!in.read(stringCount) || !in.read(wordCount))
+        return NULL;
+    vector<llvm::StringRef> strings;
+    for (uint32_t i = 0; i < stringCount; ++i) {
+        uint32_t length;
+        llvm::StringRef s;
+        if (!in.read(length) || !in.read(s, length))
+            return NULL;
+        strings.push_back(s);
+    }
+
+    ModulePtr m = new Module(cst, moduleName);
+    m->source = source;
+    SnapshotReader reader(in, wordCount, source, m.ptr(), strings);
+    reader.readModule(m);
+    if (!reader.ok || !reader.atEnd() || !in.atEnd())
+        return NULL;
+    return m;
+}
+
+
+
+//
+// writeModuleSnapshot
+//
+
+namespace {
+    // writes the words of a snapshot. anything the reader couldn't rebuild
+    // as it was clears ok.
+    class SnapshotWriter {
+        SourcePtr source;
+        llvm::StringMap<uint32_t> stringIndices;
+        llvm::DenseMap<Object *, uint32_t> nodeIds;
+        uint32_t nodeCount;
+    public:
+        vector<llvm::StringRef> strings;
+        vector<uint32_t> words;
+        bool ok;
+
+        SnapshotWriter(SourcePtr source)
+            : source(source), nodeCount(0), ok(true) {}
+
+        void word(uint32_t x) { words.push_back(x); }
+        void flag(bool x) { word(x ? 1 : 0); }
+
+        void str(llvm::StringRef s) {
+            llvm::StringMapEntry<uint32_t> &entry =
+                stringIndices.GetOrCreateValue(s, uint32_t(strings.size()));
+            if (entry.getValue() == strings.size())
+                strings.push_back(entry.getKey());
+            word(entry.getValue());
+        }
+
+        void location(Location const &x) {
+            if (!x.ok()) {
+                word(0);
+                return;
+            }
+            if (x.source != source)
+                ok = false;
+            word(x.offset + 1);
+        }
+
+        // a node that is still being written is numbered UINT_MAX, which
+        // no finished node is
+        void node(Object *x) {
+            if (x == NULL) {
+                word(0);
+                return;
+            }
+            llvm::DenseMap<Object *, uint32_t>::const_iterator i = nodeIds.find(x);
+            if (i != nodeIds.end()) {
+                if (i->second >= nodeCount)
+                    ok = false;
+                word(i->second + 2);
+                return;
+            }
+            nodeIds[x] = UINT_MAX;
+            word(1);
+            nodeFields(x);
+            nodeIds[x] = nodeCount++;
+        }
+
+        template <class T>
+        void nodes(vector<Pointer<T> > const &xs) {
+            word(uint32_t(xs.size()));
+            for (size_t i = 0; i < xs.size(); ++i)
+                node(xs[i].ptr());
+        }
+
+        void patternVars(vector<PatternVar> const &xs) {
+            word(uint32_t(xs.size()));
+            for (size_t i = 0; i < xs.size(); ++i) {
+                flag(xs[i].isMulti);
+                node(xs[i].name.ptr());
+            }
+        }
+
+        void nodeFields(Object *x);
+        void exprFields(Expr *x);
+        void statementFields(Statement *x);
+        void topLevelItemFields(TopLevelItem *x);
+        void writeModule(Module *m);
+    };
+}
+
+void SnapshotWriter::nodeFields(Object *x)
+{
+    word(x->objKind);
+    if (x->objKind == EXPR_LIST) {
+        nodes(((ExprList *)x)->exprs);
+        return;
+    }
+
+    location(((ANode *)x)->location);
+
+    switch (x->objKind) {
+
+    case IDENTIFIER :
+        str(((Identifier *)x)->str);
+        break;
+
+    case DOTTED_NAME : {
+        DottedName *y = (DottedName *)x;
+        word(uint32_t(y->parts.size()));
+        for (size_t i = 0; i < y->parts.size(); ++i)
+            node(y->parts[i].ptr());
+        break;
+    }
+
+    case EXPRESSION :
+        exprFields((Expr *)x);
+        break;
+
+    case STATEMENT :
+        statementFields((Statement *)x);
+        break;
+
+    case CASE_BLOCK : {
+        CaseBlock *y = (CaseBlock *)x;
+        node(y->caseLabels.ptr());
+        node(y->body.ptr());
+        break;
+    }
+
+    case CATCH : {
+        Catch *y = (Catch *)x;
+        node(y->exceptionVar.ptr());
+        node(y->exceptionType.ptr());
+        node(y->contextVar.ptr());
+        node(y->body.ptr());
+        break;
+    }
+
+    case FORMAL_ARG : {
+        FormalArg *y = (FormalArg *)x;
+        node(y->name.ptr());
+        node(y->type.ptr());
+        word(y->tempness);
+        node(y->asType.ptr());
+        flag(y->varArg);
+        flag(y->asArg);
+        break;
+    }
+
+    case RETURN_SPEC : {
+        ReturnSpec *y = (ReturnSpec *)x;
+        node(y->type.ptr());
+        node(y->name.ptr());
+        break;
+    }
+
+    case LLVM_CODE :
+        str(((LLVMCode *)x)->body);
+        break;
+
+    case CODE : {
+        Code *y = (Code *)x;
+        patternVars(y->patternVars);
+        node(y->predicate.ptr());
+        nodes(y->formalArgs);
+        nodes(y->returnSpecs);
+        node(y->varReturnSpec.ptr());
+        node(y->body.ptr());
+        node(y->llvmBody.ptr());
+        location(y->lazyBodyLocation);
+        word(y->lazyBodyLength);
+        flag(y->hasVarArg);
+        flag(y->returnSpecsDeclared);
+        flag(y->exprReturnSpecs);
+        break;
+    }
+
+    case RECORD_BODY : {
+        RecordBody *y = (RecordBody *)x;
+        flag(y->isComputed);
+        if (y->isComputed) {
+            node(y->computed.ptr());
+        } else {
+            nodes(y->fields);
+            flag(y->hasVarField);
+        }
+        break;
+    }
+
+    case RECORD_FIELD : {
+        RecordField *y = (RecordField *)x;
+        node(y->name.ptr());
+        node(y->type.ptr());
+        flag(y->varField);
+        break;
+    }
+
+    case ENUM_MEMBER :
+        node(((EnumMember *)x)->name.ptr());
+        break;
+
+    case EXTERNAL_ARG : {
+        ExternalArg *y = (ExternalArg *)x;
+        node(y->name.ptr());
+        node(y->type.ptr());
+        break;
+    }
+
+    case IMPORT : {
+        Import *y = (Import *)x;
+        word(y->importKind);
+        node(y->dottedName.ptr());
+        word(y->visibility);
+        switch (y->importKind) {
+        case IMPORT_MODULE :
+            node(((ImportModule *)y)->alias.ptr());
+            break;
+        case IMPORT_STAR :
+            break;
+        case IMPORT_MEMBERS : {
+            vector<ImportedMember> const &members = ((ImportMembers *)y)->members;
+            word(uint32_t(members.size()));
+            for (size_t i = 0; i < members.size(); ++i) {
+                word(members[i].visibility);
+                node(members[i].name.ptr());
+                node(members[i].alias.ptr());
+            }
+            break;
+        }
+        default :
+            ok = false;
+        }
+        break;
+    }
+
+    case MODULE_DECLARATION : {
+        ModuleDeclaration *y = (ModuleDeclaration *)x;
+        node(y->name.ptr());
+        node(y->attributes.ptr());
+        break;
+    }
+
+    default :
+        if (isTopLevelKind(x->objKind))
+            topLevelItemFields((TopLevelItem *)x);
+        else
+            ok = false;
+        break;
+    }
+}
+
+void SnapshotWriter::exprFields(Expr *x)
+{
+    word(x->exprKind);
+    location(x->startLocation);
+    location(x->endLocation);
+
+    switch (x->exprKind) {
+
+    case BOOL_LITERAL :
+        flag(((BoolLiteral *)x)->value);
+        break;
+
+    case INT_LITERAL : {
+        IntLiteral *y = (IntLiteral *)x;
+        str(y->value);
+        str(y->suffix);
+        break;
+    }
+
+    case FLOAT_LITERAL : {
+        FloatLiteral *y = (FloatLiteral *)x;
+        str(y->value);
+        str(y->suffix);
+        break;
+    }
+
+    case CHAR_LITERAL :
+        word((unsigned char)((CharLiteral *)x)->value);
+        break;
+
+    case STRING_LITERAL :
+        node(((StringLiteral *)x)->value.ptr());
+        break;
+
+    case FILE_EXPR :
+    case LINE_EXPR :
+    case COLUMN_EXPR :
+        break;
+
+    case ARG_EXPR :
+        node(((ARGExpr *)x)->name.ptr());
+        break;
+
+    case NAME_REF :
+        node(((NameRef *)x)->name.ptr());
+        break;
+
+    case TUPLE :
+        node(((Tuple *)x)->args.ptr());
+        break;
+
+    case PAREN :
+        node(((Paren *)x)->args.ptr());
+        break;
+
+    case INDEXING : {
+        Indexing *y = (Indexing *)x;
+        node(y->expr.ptr());
+        node(y->args.ptr());
+        break;
+    }
+
+    case CALL : {
+        Call *y = (Call *)x;
+        node(y->expr.ptr());
+        node(y->parenArgs.ptr());
+        break;
+    }
+
+    case FIELD_REF : {
+        FieldRef *y = (FieldRef *)x;
+        node(y->expr.ptr());
+        node(y->name.ptr());
+        break;
+    }
+
+    case STATIC_INDEXING : {
+        StaticIndexing *y = (StaticIndexing *)x;
+        node(y->expr.ptr());
+        if (y->index > UINT_MAX)
+            ok = false;
+        word(uint32_t(y->index));
+        break;
+    }
+
+    case VARIADIC_OP : {
+        VariadicOp *y = (VariadicOp *)x;
+        word(y->op);
+        node(y->exprs.ptr());
+        break;
+    }
+
+    case AND : {
+        And *y = (And *)x;
+        node(y->expr1.ptr());
+        node(y->expr2.ptr());
+        break;
+    }
+
+    case OR : {
+        Or *y = (Or *)x;
+        node(y->expr1.ptr());
+        node(y->expr2.ptr());
+        break;
+    }
+
+    case LAMBDA : {
+        Lambda *y = (Lambda *)x;
+        word(y->captureBy);
+        nodes(y->formalArgs);
+        flag(y->hasVarArg);
+        flag(y->hasAsConversion);
+        node(y->body.ptr());
+        break;
+    }
+
+    case UNPACK :
+        node(((Unpack *)x)->expr.ptr());
+        break;
+
+    case STATIC_EXPR :
+        node(((StaticExpr *)x)->expr.ptr());
+        break;
+
+    case DISPATCH_EXPR :
+        node(((DispatchExpr *)x)->expr.ptr());
+        break;
+
+    case FOREIGN_EXPR : {
+        ForeignExpr *y = (ForeignExpr *)x;
+        if (y->foreignEnv != NULL)
+            ok = false;
+        str(y->moduleName);
+        node(y->expr.ptr());
+        break;
+    }
+
+    case EVAL_EXPR :
+        node(((EvalExpr *)x)->args.ptr());
+        break;
+
+    default :
+        ok = false;
+        break;
+    }
+}
+
+void SnapshotWriter::statementFields(Statement *x)
+{
+    word(x->stmtKind);
+
+    switch (x->stmtKind) {
+
+    case BLOCK :
+        nodes(((Block *)x)->statements);
+        break;
+
+    case LABEL :
+        node(((Label *)x)->name.ptr());
+        break;
+
+    case BINDING : {
+        Binding *y = (Binding *)x;
+        if (!y->patternTypes.empty())
+            ok = false;
+        word(y->bindingKind);
+        patternVars(y->patternVars);
+        node(y->predicate.ptr());
+        nodes(y->args);
+        node(y->values.ptr());
+        flag(y->hasVarArg);
+        break;
+    }
+
+    case ASSIGNMENT : {
+        Assignment *y = (Assignment *)x;
+        node(y->left.ptr());
+        node(y->right.ptr());
+        break;
+    }
+
+    case INIT_ASSIGNMENT : {
+        InitAssignment *y = (InitAssignment *)x;
+        node(y->left.ptr());
+        node(y->right.ptr());
+        break;
+    }
+
+    case VARIADIC_ASSIGNMENT : {
+        VariadicAssignment *y = (VariadicAssignment *)x;
+        word(uint32_t(y->op));
+        node(y->exprs.ptr());
+        break;
+    }
+
+    case GOTO :
+        node(((Goto *)x)->labelName.ptr());
+        break;
+
+    case RETURN : {
+        Return *y = (Return *)x;
+        word(y->returnKind);
+        node(y->values.ptr());
+        flag(y->isExprReturn);
+        flag(y->isReturnSpecs);
+        break;
+    }
+
+    case IF : {
+        If *y = (If *)x;
+        nodes(y->conditionStatements);
+        node(y->condition.ptr());
+        node(y->thenPart.ptr());
+        node(y->elsePart.ptr());
+        break;
+    }
+
+    case SWITCH : {
+        Switch *y = (Switch *)x;
+        nodes(y->exprStatements);
+        node(y->expr.ptr());
+        nodes(y->caseBlocks);
+        node(y->defaultCase.ptr());
+        break;
+    }
+
+    case EXPR_STATEMENT :
+        node(((ExprStatement *)x)->expr.ptr());
+        break;
+
+    case WHILE : {
+        While *y = (While *)x;
+        nodes(y->conditionStatements);
+        node(y->condition.ptr());
+        node(y->body.ptr());
+        break;
+    }
+
+    case BREAK :
+    case CONTINUE :
+    case UNREACHABLE :
+        break;
+
+    case FOR : {
+        For *y = (For *)x;
+        nodes(y->variables);
+        node(y->expr.ptr());
+        node(y->body.ptr());
+        break;
+    }
+
+    case TRY : {
+        Try *y = (Try *)x;
+        node(y->tryBlock.ptr());
+        nodes(y->catchBlocks);
+        break;
+    }
+
+    case THROW : {
+        Throw *y = (Throw *)x;
+        node(y->expr.ptr());
+        node(y->context.ptr());
+        break;
+    }
+
+    case STATIC_FOR : {
+        StaticFor *y = (StaticFor *)x;
+        node(y->variable.ptr());
+        node(y->values.ptr());
+        node(y->body.ptr());
+        break;
+    }
+
+    case FINALLY :
+        node(((Finally *)x)->body.ptr());
+        break;
+
+    case ONERROR :
+        node(((OnError *)x)->body.ptr());
+        break;
+
+    case EVAL_STATEMENT :
+        node(((EvalStatement *)x)->args.ptr());
+        break;
+
+    case STATIC_ASSERT_STATEMENT : {
+        StaticAssertStatement *y = (StaticAssertStatement *)x;
+        node(y->cond.ptr());
+        node(y->message.ptr());
+        break;
+    }
+
+    default :
+        // foreign statements only come from desugaring
+        ok = false;
+        break;
+    }
+}
+
+void SnapshotWriter::topLevelItemFields(TopLevelItem *x)
+{
+    node(x->name.ptr());
+    word(x->visibility);
+
+    switch (x->objKind) {
+
+    case RECORD_DECL : {
+        RecordDecl *y = (RecordDecl *)x;
+        patternVars(y->patternVars);
+        node(y->predicate.ptr());
+        nodes(y->params);
+        node(y->varParam.ptr());
+        node(y->body.ptr());
+        break;
+    }
+
+    case VARIANT_DECL : {
+        VariantDecl *y = (VariantDecl *)x;
+        patternVars(y->patternVars);
+        node(y->predicate.ptr());
+        nodes(y->params);
+        node(y->varParam.ptr());
+        flag(y->open);
+        node(y->defaultInstances.ptr());
+        break;
+    }
+
+    case INSTANCE_DECL : {
+        InstanceDecl *y = (InstanceDecl *)x;
+        patternVars(y->patternVars);
+        node(y->predicate.ptr());
+        node(y->target.ptr());
+        node(y->members.ptr());
+        break;
+    }
+
+    case NEW_TYPE_DECL :
+        node(((NewTypeDecl *)x)->expr.ptr());
+        break;
+
+    case OVERLOAD : {
+        Overload *y = (Overload *)x;
+        node(y->target.ptr());
+        node(y->code.ptr());
+        flag(y->callByName);
+        word(y->isInline);
+        flag(y->hasAsConversion);
+        word(uint32_t(y->multiversions.size()));
+        for (size_t i = 0; i < y->multiversions.size(); ++i)
+            str(y->multiversions[i]);
+        flag(y->isDefault);
+        break;
+    }
+
+    case PROCEDURE : {
+        Procedure *y = (Procedure *)x;
+        flag(y->privateOverload);
+        node(y->interface.ptr());
+        node(y->singleOverload.ptr());
+        break;
+    }
+
+    case ENUM_DECL : {
+        EnumDecl *y = (EnumDecl *)x;
+        patternVars(y->patternVars);
+        node(y->predicate.ptr());
+        nodes(y->members);
+        break;
+    }
+
+    case GLOBAL_VARIABLE : {
+        GlobalVariable *y = (GlobalVariable *)x;
+        patternVars(y->patternVars);
+        node(y->predicate.ptr());
+        nodes(y->params);
+        node(y->varParam.ptr());
+        node(y->expr.ptr());
+        break;
+    }
+
+    case EXTERNAL_PROCEDURE : {
+        ExternalProcedure *y = (ExternalProcedure *)x;
+        nodes(y->args);
+        flag(y->hasVarArgs);
+        node(y->returnType.ptr());
+        node(y->body.ptr());
+        node(y->attributes.ptr());
+        break;
+    }
+
+    case EXTERNAL_VARIABLE : {
+        ExternalVariable *y = (ExternalVariable *)x;
+        node(y->type.ptr());
+        node(y->attributes.ptr());
+        break;
+    }
+
+    case EVAL_TOPLEVEL :
+        node(((EvalTopLevel *)x)->args.ptr());
+        break;
+
+    case GLOBAL_ALIAS : {
+        GlobalAlias *y = (GlobalAlias *)x;
+        patternVars(y->patternVars);
+        node(y->predicate.ptr());
+        nodes(y->params);
+        node(y->varParam.ptr());
+        node(y->expr.ptr());
+        break;
+    }
+
+    case DOCUMENTATION : {
+        Documentation *y = (Documentation *)x;
+        word(uint32_t(y->annotation.size()));
+        std::map<DocumentationAnnotation, string>::const_iterator i, end;
+        for (i = y->annotation.begin(), end = y->annotation.end(); i != end; ++i) {
+            word(i->first);
+            str(i->second);
+        }
+        str(y->text);
+        break;
+    }
+
+    case STATIC_ASSERT_TOP_LEVEL : {
+        StaticAssertTopLevel *y = (StaticAssertTopLevel *)x;
+        node(y->cond.ptr());
+        node(y->message.ptr());
+        break;
+    }
+
+    default :
+        ok = false;
+        break;
+    }
+}
+
+void SnapshotWriter::writeModule(Module *m)
+{
+    location(m->location);
+    nodes(m->imports);
+    node(m->declaration.ptr());
+    node(m->topLevelLLVM.ptr());
+    nodes(m->topLevelItems);
+}
+
+template <class T>
+static void write(llvm::raw_ostream &out, T x) {
+    out.write((const char *)&x, sizeof(x));
+}
+
+bool writeModuleSnapshot(llvm::StringRef snapshotPath, ModulePtr module)
+{
+    SourcePtr source = module->source;
+    SnapshotWriter writer(source);
+    writer.writeModule(module.ptr());
+    if (!writer.ok)
+        return false;
+
+    llvm::sys::TimeValue sourceTime;
+    if (!modTime(source->fileName, sourceTime))
+        return false;
+    // a source written within the last couple of seconds could still
+    // change without its time changing, so its snapshot is checked against
+    // the hash instead
+    uint64_t sourceSeconds = uint64_t(sourceTime.toEpochTime());
+    uint64_t now = uint64_t(llvm::sys::TimeValue::now().toEpochTime());
+    if (sourceSeconds + 2 > now)
+        sourceSeconds = 0;
+
+    // write to a temporary file and rename, so that concurrent compilers
+    // never see a partially written snapshot
+    PathString model(snapshotPath);
+    model.append("-%%%%%%%%");
+    int fd;
+    PathString tempPath;
+    if (llvm::sys::fs::unique_file(model.str(), fd, tempPath))
+        return false;
+    {
+        llvm::raw_fd_ostream out(fd, /*shouldClose=*/ true);
+        out.write(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+        write(out, SNAPSHOT_VERSION);
+        write(out, SNAPSHOT_BYTE_ORDER);
+        write(out, parserFlags(module->cst));
+        write(out, uint32_t(source->size()));
+        write(out, sourceSeconds);
+        write(out, uint32_t(sourceTime.nanoseconds()));
+        write(out, sourceHash(source));
+        write(out, uint32_t(writer.strings.size()));
+        write(out, uint32_t(writer.words.size()));
+        for (size_t i = 0; i < writer.strings.size(); ++i) {
+            write(out, uint32_t(writer.strings[i].size()));
+            out << writer.strings[i];
+        }
+        if (!writer.words.empty())
+            out.write((const char *)&writer.words[0],
+                      writer.words.size() * sizeof(uint32_t));
+    }
+    bool dontcare;
+    if (llvm::sys::fs::rename(tempPath.str(), snapshotPath)) {
+        llvm::sys::fs::remove(tempPath.str(), dontcare);
+        return false;
+    }
+    return true;
+}
+
+}
@@ -0,0 +1,35 @@
+#ifndef __CLAY_SNAPSHOT_HPP
+#define __CLAY_SNAPSHOT_HPP
+
+#include "clay.hpp"
+
+namespace clay {
+
+// AST snapshots (.clayast files) hold a module as the parser left it: its
+// imports, declaration and top-level items, down to the expressions and
+// statements of the bodies that were parsed. Loading a module from a
+// snapshot skips both lexing and parsing. Strings are pooled, nodes that
+// are referenced from several places are stored once, and locations are
+// stored as offsets into the source, which is still loaded for lazily
+// parsed bodies and for error messages.
+//
+// A snapshot records the size and modification time of its source, and a
+// hash of its contents. When the size and time still match, the source
+// isn't hashed; when only the time differs, the hash decides.
+
+// Returns NULL if the snapshot is missing, was written for another source
+// or with other parser options, or is damaged. Safe to call from worker
+// threads.
+ModulePtr readModuleSnapshot(llvm::StringRef snapshotPath,
+                             llvm::StringRef moduleName,
+                             SourcePtr source,
+                             CompilerState* cst);
+
+// Fails if module holds nodes the parser doesn't produce, or can't be
+// written. Must be called before anything but the parser has touched
+// module.
+bool writeModuleSnapshot(llvm::StringRef snapshotPath, ModulePtr module);
+
+}
+
+#endif
@@ -0,0 +1,55 @@
+#include "stats.hpp"
+#include <llvm/ADT/Statistic.h>
+#include <llvm/Support/Format.h>
+#include <cstring>
+
+
+namespace clay {
+
+bool statsEnabled = false;
+
+namespace {
+    struct Statistic {
+        const char *description;
+        uint64_t value;
+        Statistic(const char *description)
+            : description(description), value(0) {}
+    };
+}
+
+static vector<Statistic> statistics;
+
+void enableStatistics()
+{
+    statsEnabled = true;
+    llvm::EnableStatistics();
+}
+
+void addStatistic(const char *description, uint64_t amount)
+{
+    if (!statsEnabled)
+        return;
+    for (size_t i = 0; i < statistics.size(); ++i) {
+        if (strcmp(statistics[i].description, description) == 0) {
+            statistics[i].value += amount;
+            return;
+        }
+    }
+    statistics.push_back(Statistic(description));
+    statistics.back().value = amount;
+}
+
+void printStatistics(llvm::raw_ostream &out)
+{
+    if (!statsEnabled)
+        return;
+    out << "clay statistics:\n";
+    for (size_t i = 0; i < statistics.size(); ++i)
+        out << llvm::format("%12llu", (unsigned long long)statistics[i].value)
+            << " " << statistics[i].description << "\n";
+    // static destructors would print these, but the compiler exits with
+    // _exit
+    llvm::PrintStatistics(out);
+}
+
+}
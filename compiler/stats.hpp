@@ -0,0 +1,20 @@
+#ifndef __CLAY_STATS_HPP
+#define __CLAY_STATS_HPP
+
+#include "clay.hpp"
+
+namespace clay {
+
+// -stats: named counters reported after compilation, in the order they
+// were first added to. LLVM's own pass statistics follow when LLVM was
+// built with them.
+
+extern bool statsEnabled;
+
+void enableStatistics();
+void addStatistic(const char *description, uint64_t amount);
+void printStatistics(llvm::raw_ostream &out);
+
+}
+
+#endif
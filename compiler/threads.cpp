@@ -0,0 +1,294 @@
+#include "threads.hpp"
+#include <deque>
+#include <vector>
+
+
+namespace clay {
+
+struct ParallelForState {
+    void (*fn)(size_t, void *);
+    void *arg;
+    size_t count;
+    volatile long next;
+};
+
+}
+
+
+#if defined(_WIN32) || defined(_WIN64)
+
+// condition variables need Vista
+#ifndef _WIN32_WINNT
+#define _WIN32_WINNT 0x0600
+#endif
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <process.h>
+
+namespace clay {
+
+static long fetchAndIncrement(volatile long *x) {
+    return InterlockedIncrement(x) - 1;
+}
+
+namespace {
+    struct ThreadStart {
+        void (*worker)(void *);
+        void *state;
+    };
+
+    class Monitor {
+        CRITICAL_SECTION section;
+        CONDITION_VARIABLE condition;
+    public:
+        Monitor() {
+            InitializeCriticalSection(&section);
+            InitializeConditionVariable(&condition);
+        }
+        ~Monitor() { DeleteCriticalSection(&section); }
+        void lock() { EnterCriticalSection(&section); }
+        void unlock() { LeaveCriticalSection(&section); }
+        void wait() { SleepConditionVariableCS(&condition, &section, INFINITE); }
+        void notifyAll() { WakeAllConditionVariable(&condition); }
+    };
+}
+
+static unsigned __stdcall threadEntry(void *arg) {
+    ThreadStart *start = (ThreadStart *)arg;
+    start->worker(start->state);
+    return 0;
+}
+
+static void runThreads(void (*worker)(void *), void *state,
+                       unsigned extraThreads) {
+    ThreadStart start = { worker, state };
+    std::vector<HANDLE> threads;
+    for (unsigned i = 0; i < extraThreads; ++i) {
+        HANDLE h = (HANDLE)_beginthreadex(NULL, 0, threadEntry, &start, 0, NULL);
+        if (h != NULL)
+            threads.push_back(h);
+    }
+    worker(state);
+    for (size_t i = 0; i < threads.size(); ++i) {
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+    }
+}
+
+unsigned hardwareThreadCount() {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? info.dwNumberOfProcessors : 1;
+}
+
+ThreadLocalPointer::ThreadLocalPointer() : key(TlsAlloc()) {}
+ThreadLocalPointer::~ThreadLocalPointer() { TlsFree((DWORD)key); }
+void *ThreadLocalPointer::get() const { return TlsGetValue((DWORD)key); }
+void ThreadLocalPointer::set(void *value) { TlsSetValue((DWORD)key, value); }
+
+Mutex::Mutex() : impl(new CRITICAL_SECTION) {
+    InitializeCriticalSection((CRITICAL_SECTION *)impl);
+}
+Mutex::~Mutex() {
+    DeleteCriticalSection((CRITICAL_SECTION *)impl);
+    delete (CRITICAL_SECTION *)impl;
+}
+void Mutex::lock() { EnterCriticalSection((CRITICAL_SECTION *)impl); }
+void Mutex::unlock() { LeaveCriticalSection((CRITICAL_SECTION *)impl); }
+
+}
+
+#else // Unixes
+
+#include <pthread.h>
+#include <unistd.h>
+
+namespace clay {
+
+static long fetchAndIncrement(volatile long *x) {
+    return __sync_fetch_and_add(x, 1);
+}
+
+namespace {
+    struct ThreadStart {
+        void (*worker)(void *);
+        void *state;
+    };
+
+    class Monitor {
+        pthread_mutex_t mutex;
+        pthread_cond_t condition;
+    public:
+        Monitor() {
+            pthread_mutex_init(&mutex, NULL);
+            pthread_cond_init(&condition, NULL);
+        }
+        ~Monitor() {
+            pthread_cond_destroy(&condition);
+            pthread_mutex_destroy(&mutex);
+        }
+        void lock() { pthread_mutex_lock(&mutex); }
+        void unlock() { pthread_mutex_unlock(&mutex); }
+        void wait() { pthread_cond_wait(&condition, &mutex); }
+        void notifyAll() { pthread_cond_broadcast(&condition); }
+    };
+}
+
+static void *threadEntry(void *arg) {
+    ThreadStart *start = (ThreadStart *)arg;
+    start->worker(start->state);
+    return NULL;
+}
+
+static void runThreads(void (*worker)(void *), void *state,
+                       unsigned extraThreads) {
+    ThreadStart start = { worker, state };
+    std::vector<pthread_t> threads;
+    for (unsigned i = 0; i < extraThreads; ++i) {
+        pthread_t t;
+        if (pthread_create(&t, NULL, threadEntry, &start) == 0)
+            threads.push_back(t);
+    }
+    worker(state);
+    for (size_t i = 0; i < threads.size(); ++i)
+        pthread_join(threads[i], NULL);
+}
+
+unsigned hardwareThreadCount() {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (unsigned)n : 1;
+}
+
+ThreadLocalPointer::ThreadLocalPointer() {
+    pthread_key_t k;
+    pthread_key_create(&k, NULL);
+    key = (size_t)k;
+}
+ThreadLocalPointer::~ThreadLocalPointer() { pthread_key_delete((pthread_key_t)key); }
+void *ThreadLocalPointer::get() const { return pthread_getspecific((pthread_key_t)key); }
+void ThreadLocalPointer::set(void *value) { pthread_setspecific((pthread_key_t)key, value); }
+
+Mutex::Mutex() : impl(new pthread_mutex_t) {
+    pthread_mutex_init((pthread_mutex_t *)impl, NULL);
+}
+Mutex::~Mutex() {
+    pthread_mutex_destroy((pthread_mutex_t *)impl);
+    delete (pthread_mutex_t *)impl;
+}
+void Mutex::lock() { pthread_mutex_lock((pthread_mutex_t *)impl); }
+void Mutex::unlock() { pthread_mutex_unlock((pthread_mutex_t *)impl); }
+
+}
+
+#endif
+
+
+namespace clay {
+
+static void runWorker(void *arg) {
+    ParallelForState *state = (ParallelForState *)arg;
+    for (;;) {
+        size_t i = (size_t)fetchAndIncrement(&state->next);
+        if (i >= state->count)
+            break;
+        state->fn(i, state->arg);
+    }
+}
+
+void parallelFor(size_t count, unsigned threadCount,
+                 void (*fn)(size_t, void *), void *arg) {
+    ParallelForState state;
+    state.fn = fn;
+    state.arg = arg;
+    state.count = count;
+    state.next = 0;
+
+    if (threadCount > count)
+        threadCount = (unsigned)count;
+    if (threadCount <= 1) {
+        runWorker(&state);
+        return;
+    }
+    runThreads(runWorker, &state, threadCount - 1);
+}
+
+
+namespace {
+    // everything but fn and arg is guarded by monitor
+    struct DependencyState {
+        Monitor monitor;
+        bool (*fn)(size_t, void *);
+        void (*done)(size_t, void *);
+        void *arg;
+        std::vector<size_t> waitingFor;
+        std::vector<std::vector<size_t> > dependents;
+        std::deque<size_t> ready;
+        size_t running;
+    };
+}
+
+static void runDependencyWorker(void *arg) {
+    DependencyState *state = (DependencyState *)arg;
+    state->monitor.lock();
+    for (;;) {
+        while (state->ready.empty() && state->running > 0)
+            state->monitor.wait();
+        // nothing left to start, and nothing running that could make more
+        // ready
+        if (state->ready.empty())
+            break;
+        size_t i = state->ready.front();
+        state->ready.pop_front();
+        ++state->running;
+        state->monitor.unlock();
+
+        bool succeeded = state->fn(i, state->arg);
+
+        state->monitor.lock();
+        --state->running;
+        if (state->done != NULL)
+            state->done(i, state->arg);
+        // the dependents of a failed call are never started, but calls
+        // that don't depend on it still are
+        if (succeeded) {
+            std::vector<size_t> const &dependents = state->dependents[i];
+            for (size_t j = 0; j < dependents.size(); ++j) {
+                if (--state->waitingFor[dependents[j]] == 0)
+                    state->ready.push_back(dependents[j]);
+            }
+        }
+        state->monitor.notifyAll();
+    }
+    state->monitor.unlock();
+}
+
+void parallelForDependencies(size_t count, unsigned threadCount,
+                             std::vector<std::vector<size_t> > const &dependencies,
+                             bool (*fn)(size_t, void *),
+                             void (*done)(size_t, void *),
+                             void *arg) {
+    DependencyState state;
+    state.fn = fn;
+    state.done = done;
+    state.arg = arg;
+    state.waitingFor.resize(count);
+    state.dependents.resize(count);
+    state.running = 0;
+    for (size_t i = 0; i < count; ++i) {
+        state.waitingFor[i] = dependencies[i].size();
+        for (size_t j = 0; j < dependencies[i].size(); ++j)
+            state.dependents[dependencies[i][j]].push_back(i);
+        if (dependencies[i].empty())
+            state.ready.push_back(i);
+    }
+
+    if (threadCount > count)
+        threadCount = (unsigned)count;
+    if (threadCount <= 1) {
+        runDependencyWorker(&state);
+        return;
+    }
+    runThreads(runDependencyWorker, &state, threadCount - 1);
+}
+
+}
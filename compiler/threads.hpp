@@ -0,0 +1,56 @@
+#ifndef __CLAY_THREADS_HPP
+#define __CLAY_THREADS_HPP
+
+#include <cstddef>
+#include <vector>
+
+namespace clay {
+
+// Calls fn(i, arg) for each i in [0, count) using up to threadCount
+// threads, one of which is the calling thread. Returns when all calls
+// have finished.
+void parallelFor(size_t count, unsigned threadCount,
+                 void (*fn)(size_t, void *), void *arg);
+
+// Calls fn(i, arg) for each i in [0, count) using up to threadCount
+// threads, like parallelFor, but calls it only once fn has returned for
+// each of dependencies[i], which must not lead back to i. If fn returns
+// false for i, nothing that depends on i, directly or not, is called; all
+// other calls still are. done(i, arg), if not NULL, is called as each call
+// returns, one at a time.
+void parallelForDependencies(size_t count, unsigned threadCount,
+                             std::vector<std::vector<size_t> > const &dependencies,
+                             bool (*fn)(size_t, void *),
+                             void (*done)(size_t, void *),
+                             void *arg);
+
+unsigned hardwareThreadCount();
+
+// A pointer with a value of its own in each thread, NULL until the thread
+// sets it.
+class ThreadLocalPointer {
+    size_t key;
+    ThreadLocalPointer(ThreadLocalPointer const &);
+    void operator=(ThreadLocalPointer const &);
+public:
+    ThreadLocalPointer();
+    ~ThreadLocalPointer();
+    void *get() const;
+    void set(void *value);
+};
+
+// A lock that one thread holds at a time.
+class Mutex {
+    void *impl;
+    Mutex(Mutex const &);
+    void operator=(Mutex const &);
+public:
+    Mutex();
+    ~Mutex();
+    void lock();
+    void unlock();
+};
+
+}
+
+#endif
@@ -0,0 +1,308 @@
+#include "timing.hpp"
+#include <llvm/Support/Format.h>
+#include <cstdlib>
+#include <cstring>
+
+
+namespace clay {
+
+TimingNode *currentTimingNode = NULL;
+
+static TimingNode *timingRoot = NULL;
+static llvm::StringMap<unsigned> activeTimingPhases;
+
+void enableTiming() {
+    if (timingRoot == NULL)
+        timingRoot = new TimingNode("", NULL);
+    currentTimingNode = timingRoot;
+}
+
+TimingNode *enterTimingPhase(llvm::StringRef name) {
+    assert(currentTimingNode != NULL);
+    unsigned &active = activeTimingPhases[name];
+    if (active > 0)
+        return NULL;
+    ++active;
+
+    TimingNode *parent = currentTimingNode;
+    TimingNode *node = NULL;
+    for (size_t i = 0; i < parent->children.size(); ++i) {
+        if (parent->children[i]->name == name) {
+            node = parent->children[i];
+            break;
+        }
+    }
+    if (node == NULL) {
+        node = new TimingNode(name, parent);
+        parent->children.push_back(node);
+    }
+    ++node->count;
+    currentTimingNode = node;
+    node->timer.start();
+    node->cpuTimer.start();
+    return node;
+}
+
+void exitTimingPhase(TimingNode *node) {
+    node->cpuTimer.stop();
+    node->timer.stop();
+    assert(currentTimingNode == node);
+    currentTimingNode = node->parent;
+    --activeTimingPhases[node->name];
+}
+
+
+
+//
+// printTimingTree
+//
+
+static void printTimingTree(llvm::raw_ostream &out, TimingNode *node, unsigned depth) {
+    out.indent(depth * 2) << node->name;
+    unsigned column = depth * 2 + unsigned(node->name.size());
+    out.indent(column < 48 ? 48 - column : 1);
+    out << llvm::format("%10.3f ms", node->timer.elapsedMillis());
+    out << llvm::format("  (cpu %.3f ms)", node->cpuTimer.elapsedMillis());
+    if (node->count > 1)
+        out << "  (" << node->count << " times)";
+    out << '\n';
+    for (size_t i = 0; i < node->children.size(); ++i)
+        printTimingTree(out, node->children[i], depth + 1);
+}
+
+void printTimingTree(llvm::raw_ostream &out) {
+    if (timingRoot == NULL)
+        return;
+    for (size_t i = 0; i < timingRoot->children.size(); ++i)
+        printTimingTree(out, timingRoot->children[i], 0);
+    out.flush();
+}
+
+
+
+//
+// printTimingJSON
+//
+
+void printJSONString(llvm::raw_ostream &out, llvm::StringRef s) {
+    out << '"';
+    for (size_t i = 0; i < s.size(); ++i) {
+        unsigned char c = (unsigned char)s[i];
+        switch (c) {
+        case '"' : out << "\\\""; break;
+        case '\\' : out << "\\\\"; break;
+        case '\n' : out << "\\n"; break;
+        case '\t' : out << "\\t"; break;
+        default :
+            if (c < 0x20)
+                out << llvm::format("\\u%04x", c);
+            else
+                out << (char)c;
+            break;
+        }
+    }
+    out << '"';
+}
+
+static void printTimingJSON(llvm::raw_ostream &out, llvm::ArrayRef<TimingNode *> nodes) {
+    out << '[';
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        TimingNode *node = nodes[i];
+        if (i > 0)
+            out << ',';
+        out << "{\"name\":";
+        printJSONString(out, node->name);
+        out << ",\"ms\":" << llvm::format("%.3f", node->timer.elapsedMillis());
+        out << ",\"cpuMs\":" << llvm::format("%.3f", node->cpuTimer.elapsedMillis());
+        out << ",\"count\":" << node->count;
+        out << ",\"children\":";
+        printTimingJSON(out, node->children);
+        out << '}';
+    }
+    out << ']';
+}
+
+// LLVM prints each timer group as a banner with the group's name, a header
+// naming the columns it has ("---User Time---", "--System Time--",
+// "--User+System--", "---Wall Time---", "---Mem---", "--- Name ---"), then
+// a row per timer and a "Total" row. Time columns are seconds followed by a
+// percentage of the total, or "-----" if the total is zero.
+
+namespace {
+    enum PassColumn {
+        PASS_USER,
+        PASS_SYSTEM,
+        PASS_CPU,
+        PASS_WALL,
+        PASS_MEMORY
+    };
+
+    struct PassRow {
+        string name;
+        vector<pair<PassColumn, double> > values;
+    };
+
+    struct PassGroup {
+        string name;
+        vector<PassRow> rows;
+    };
+}
+
+static bool parsePassColumns(llvm::StringRef header,
+                             vector<PassColumn> &columns) {
+    static const struct { const char *text; PassColumn column; } names[] = {
+        { "---User Time---", PASS_USER },
+        { "--System Time--", PASS_SYSTEM },
+        { "--User+System--", PASS_CPU },
+        { "---Wall Time---", PASS_WALL },
+        { "---Mem---", PASS_MEMORY },
+    };
+    columns.clear();
+    for (;;) {
+        header = header.ltrim();
+        if (header.startswith("--- Name ---"))
+            return true;
+        size_t i = 0;
+        while (i < sizeof(names) / sizeof(names[0])
+               && !header.startswith(names[i].text))
+            ++i;
+        if (i == sizeof(names) / sizeof(names[0]))
+            return false;
+        columns.push_back(names[i].column);
+        header = header.substr(strlen(names[i].text));
+    }
+}
+
+static bool parsePassRow(llvm::StringRef line,
+                         llvm::ArrayRef<PassColumn> columns,
+                         PassRow &row) {
+    for (size_t i = 0; i < columns.size(); ++i) {
+        line = line.ltrim();
+        if (line.startswith("-----")) {
+            line = line.substr(5);
+            continue;
+        }
+        size_t end = line.find_first_of(" \t");
+        if (end == llvm::StringRef::npos)
+            return false;
+        string number = line.substr(0, end).str();
+        char *numberEnd;
+        double value = strtod(number.c_str(), &numberEnd);
+        if (number.empty() || *numberEnd != '\0')
+            return false;
+        row.values.push_back(make_pair(columns[i], value));
+        line = line.substr(end).ltrim();
+        // the percentage of the group's total
+        if (columns[i] != PASS_MEMORY) {
+            if (!line.startswith("("))
+                return false;
+            size_t close = line.find(')');
+            if (close == llvm::StringRef::npos)
+                return false;
+            line = line.substr(close + 1);
+        }
+    }
+    row.name = line.trim().str();
+    return !row.name.empty();
+}
+
+static void parsePassReport(llvm::StringRef report, vector<PassGroup> &groups) {
+    vector<PassColumn> columns;
+    bool inBanner = false;
+    bool inRows = false;
+    while (!report.empty()) {
+        std::pair<llvm::StringRef, llvm::StringRef> split = report.split('\n');
+        report = split.second;
+        llvm::StringRef line = split.first.rtrim();
+        if (line.startswith("===")) {
+            // the line between the banner's two rules names the group
+            if (!inBanner) {
+                std::pair<llvm::StringRef, llvm::StringRef> title =
+                    report.split('\n');
+                groups.push_back(PassGroup());
+                llvm::StringRef name = title.first.trim();
+                if (name.startswith("... ") && name.endswith(" ..."))
+                    name = name.substr(4, name.size() - 8);
+                groups.back().name = name.str();
+            }
+            inBanner = !inBanner;
+            inRows = false;
+        }
+        else if (line.endswith("--- Name ---")) {
+            inRows = !groups.empty() && parsePassColumns(line, columns);
+        }
+        else if (line.empty()) {
+            inRows = false;
+        }
+        else if (inRows) {
+            PassRow row;
+            if (parsePassRow(line, columns, row))
+                groups.back().rows.push_back(row);
+        }
+    }
+}
+
+static void printPassRow(llvm::raw_ostream &out, PassRow const &row) {
+    static const char *keys[] = {
+        "userMs", "systemMs", "cpuMs", "ms", "memoryBytes"
+    };
+    out << "{\"name\":";
+    printJSONString(out, row.name);
+    for (size_t i = 0; i < row.values.size(); ++i) {
+        PassColumn column = row.values[i].first;
+        out << ",\"" << keys[column] << "\":";
+        if (column == PASS_MEMORY)
+            out << llvm::format("%.0f", row.values[i].second);
+        else
+            out << llvm::format("%.3f", row.values[i].second * 1000);
+    }
+    out << '}';
+}
+
+static void printPassGroups(llvm::raw_ostream &out,
+                            llvm::ArrayRef<PassGroup> groups) {
+    out << '[';
+    for (size_t i = 0; i < groups.size(); ++i) {
+        PassGroup const &group = groups[i];
+        if (i > 0)
+            out << ',';
+        out << "{\"name\":";
+        printJSONString(out, group.name);
+        out << ",\"passes\":[";
+        bool first = true;
+        for (size_t j = 0; j < group.rows.size(); ++j) {
+            if (group.rows[j].name == "Total")
+                continue;
+            if (!first)
+                out << ',';
+            first = false;
+            printPassRow(out, group.rows[j]);
+        }
+        out << ']';
+        for (size_t j = 0; j < group.rows.size(); ++j) {
+            if (group.rows[j].name == "Total") {
+                out << ",\"total\":";
+                printPassRow(out, group.rows[j]);
+                break;
+            }
+        }
+        out << '}';
+    }
+    out << ']';
+}
+
+void printTimingJSON(llvm::raw_ostream &out, llvm::StringRef llvmPassReport) {
+    out << "{\"phases\":";
+    if (timingRoot != NULL)
+        printTimingJSON(out, timingRoot->children);
+    else
+        out << "[]";
+    vector<PassGroup> groups;
+    parsePassReport(llvmPassReport, groups);
+    out << ",\"llvmPasses\":";
+    printPassGroups(out, groups);
+    out << "}\n";
+    out.flush();
+}
+
+}
@@ -0,0 +1,70 @@
+#ifndef __CLAY_TIMING_HPP
+#define __CLAY_TIMING_HPP
+
+#include "clay.hpp"
+#include "hirestimer.hpp"
+
+namespace clay {
+
+// Hierarchical phase timing for -timing. Phases nest by dynamic scope and
+// their times are inclusive. Entering a phase that is already running
+// further up the stack is attributed to the outer one, so recursion
+// through the analyzer and evaluator does not produce unbounded trees.
+// Only the loading thread may time phases. Phases are reported in
+// wall-clock time, with the process's CPU time alongside: a phase that waits
+// on the linker uses little CPU, and one that runs threads uses more CPU
+// than wall-clock time.
+
+struct TimingNode {
+    string name;
+    WallTimer timer;
+    HiResTimer cpuTimer;
+    unsigned long long count;
+    TimingNode *parent;
+    vector<TimingNode *> children;
+
+    TimingNode(llvm::StringRef name, TimingNode *parent)
+        : name(name), count(0), parent(parent) {}
+};
+
+// NULL unless timing is enabled
+extern TimingNode *currentTimingNode;
+
+TimingNode *enterTimingPhase(llvm::StringRef name);
+void exitTimingPhase(TimingNode *node);
+
+class TimingPhase {
+    TimingNode *node;
+public:
+    // name is only put together if timing is enabled
+    explicit TimingPhase(llvm::Twine const &name) : node(NULL) {
+        if (currentTimingNode != NULL) {
+            llvm::SmallString<64> buffer;
+            node = enterTimingPhase(name.toStringRef(buffer));
+        }
+    }
+    ~TimingPhase() { stop(); }
+    void stop() {
+        if (node != NULL) {
+            exitTimingPhase(node);
+            node = NULL;
+        }
+    }
+private:
+    TimingPhase(const TimingPhase &);
+    void operator=(const TimingPhase &);
+};
+
+void enableTiming();
+
+void printTimingTree(llvm::raw_ostream &out);
+// llvmPassReport is LLVM's own -time-passes report, which is parsed into an
+// entry per timer group and pass
+void printTimingJSON(llvm::raw_ostream &out, llvm::StringRef llvmPassReport);
+
+// writes s as a quoted JSON string
+void printJSONString(llvm::raw_ostream &out, llvm::StringRef s);
+
+}
+
+#endif
@@ -0,0 +1,107 @@
+#include "trace.hpp"
+#include "timing.hpp"
+#include <llvm/Support/TimeValue.h>
+
+
+namespace clay {
+
+bool traceEnabled = false;
+
+namespace {
+    struct TraceFrame {
+        const char *category;
+        string name;
+        uint64_t start;
+    };
+}
+
+static llvm::raw_fd_ostream *traceOut = NULL;
+static bool firstTraceEvent = true;
+static uint64_t traceStart = 0;
+static vector<TraceFrame> traceStack;
+
+static uint64_t nowMicros() {
+    llvm::sys::TimeValue now = llvm::sys::TimeValue::now();
+    return uint64_t(now.seconds()) * 1000000 + now.microseconds();
+}
+
+bool openTraceFile(llvm::StringRef fileName) {
+    string errorInfo;
+    traceOut = new llvm::raw_fd_ostream(fileName.str().c_str(), errorInfo,
+                                        llvm::raw_fd_ostream::F_Binary);
+    if (!errorInfo.empty()) {
+        llvm::errs() << "error: " << errorInfo << '\n';
+        delete traceOut;
+        traceOut = NULL;
+        return false;
+    }
+    // JSON array format; viewers also accept it without the closing ']'
+    // if the compiler stops early
+    *traceOut << "[\n";
+    traceStart = nowMicros();
+    traceEnabled = true;
+    return true;
+}
+
+void closeTraceFile() {
+    if (traceOut == NULL)
+        return;
+    while (!traceStack.empty())
+        traceEnd();
+    traceEnabled = false;
+    *traceOut << "\n]\n";
+    delete traceOut;
+    traceOut = NULL;
+}
+
+static void pushFrame(const char *category, llvm::StringRef name) {
+    traceStack.push_back(TraceFrame());
+    TraceFrame &frame = traceStack.back();
+    frame.category = category;
+    frame.name = name;
+    frame.start = nowMicros();
+}
+
+void traceBegin(const char *category, llvm::StringRef name) {
+    pushFrame(category, name);
+}
+
+void traceBegin(const char *category, ObjectPtr obj,
+                llvm::ArrayRef<ObjectPtr> params) {
+    string buf;
+    llvm::raw_string_ostream sout(buf);
+    printStaticName(sout, obj);
+    if (!params.empty() || obj->objKind == PROCEDURE) {
+        sout << '(';
+        printNameList(sout, params);
+        sout << ')';
+    }
+    pushFrame(category, sout.str());
+}
+
+void traceBegin(const char *category, ObjectPtr obj,
+                llvm::ArrayRef<TypePtr> params) {
+    vector<ObjectPtr> params2;
+    for (size_t i = 0; i < params.size(); ++i)
+        params2.push_back((Object *)params[i].ptr());
+    traceBegin(category, obj, params2);
+}
+
+void traceEnd() {
+    if (traceStack.empty())
+        return;
+    TraceFrame &frame = traceStack.back();
+    uint64_t end = nowMicros();
+    llvm::raw_ostream &out = *traceOut;
+    if (!firstTraceEvent)
+        out << ",\n";
+    firstTraceEvent = false;
+    out << "{\"name\":";
+    printJSONString(out, frame.name);
+    out << ",\"cat\":\"" << frame.category << "\",\"ph\":\"X\",\"ts\":"
+        << (frame.start - traceStart) << ",\"dur\":" << (end - frame.start)
+        << ",\"pid\":1,\"tid\":1}";
+    traceStack.pop_back();
+}
+
+}
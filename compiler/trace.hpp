@@ -0,0 +1,50 @@
+#ifndef __CLAY_TRACE_HPP
+#define __CLAY_TRACE_HPP
+
+#include "clay.hpp"
+
+namespace clay {
+
+// -trace-file=<file>: Chrome trace events (about:tracing, Perfetto) for
+// nested compiler work. Spans are recorded as complete ("X") events when
+// they end. When tracing is off a span costs one flag test.
+
+extern bool traceEnabled;
+
+bool openTraceFile(llvm::StringRef fileName);
+void closeTraceFile();
+
+void traceBegin(const char *category, llvm::StringRef name);
+void traceBegin(const char *category, ObjectPtr obj,
+                llvm::ArrayRef<ObjectPtr> params);
+void traceBegin(const char *category, ObjectPtr obj,
+                llvm::ArrayRef<TypePtr> params);
+void traceEnd();
+
+class TraceSpan {
+    bool active;
+public:
+    TraceSpan(const char *category, llvm::StringRef name)
+        : active(traceEnabled)
+    {
+        if (active)
+            traceBegin(category, name);
+    }
+    TraceSpan(const char *category, ObjectPtr obj, llvm::ArrayRef<TypePtr> params)
+        : active(traceEnabled)
+    {
+        if (active)
+            traceBegin(category, obj, params);
+    }
+    ~TraceSpan() {
+        if (active)
+            traceEnd();
+    }
+private:
+    TraceSpan(const TraceSpan &);
+    void operator=(const TraceSpan &);
+};
+
+}
+
+#endif
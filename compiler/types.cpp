@@ -9,6 +9,7 @@
 #include "loader.hpp"
 #include "env.hpp"
 #include "objects.hpp"
+#include "prebuilt.hpp"
 
 
 #pragma clang diagnostic ignored "-Wcovered-switch-default"
@@ -626,6 +627,8 @@ void initializeRecordFields(RecordTypePtr t, CompilerState* cst) {
 
     assert(!t->fieldsInitialized);
     t->fieldsInitialized = true;
+    if (prebuiltUseEnabled(cst) && prebuiltRecordFields(t))
+        return;
     RecordDeclPtr r = t->record;
     if (r->varParam.ptr())
         assert(t->params.size() >= r->params.size());
@@ -1070,7 +1073,9 @@ static void declareLLVMType(TypePtr t) {
     assert(t->llType == NULL);
 
     CompilerState* cst = t->cst;
-    llvm::DIBuilder* llvmDIBuilder = cst->llvmDIBuilder;
+    // -gline-tables-only describes no types
+    llvm::DIBuilder* llvmDIBuilder =
+        cst->debugLineTablesOnly ? NULL : cst->llvmDIBuilder;
 
     switch (t->typeKind) {
     case BOOL_TYPE : {
@@ -1353,7 +1358,8 @@ static void declareLLVMType(TypePtr t) {
 
 static void defineLLVMType(TypePtr t) {
     CompilerState* cst = t->cst;
-    llvm::DIBuilder* llvmDIBuilder = cst->llvmDIBuilder;
+    llvm::DIBuilder* llvmDIBuilder =
+        cst->debugLineTablesOnly ? NULL : cst->llvmDIBuilder;
 
     assert(t->llType != NULL && !t->defined);
 
@@ -0,0 +1,61 @@
+from subprocess import Popen, PIPE
+from sys import argv
+import os
+import shutil
+
+clay = os.environ["CLAY"]
+buildFlags = argv[2:]
+
+sources = ["main.clay", "shapes.clay", "greeting.clay", "geometry/points.clay"]
+
+def build(showErrors=True):
+    process = Popen([clay] + buildFlags + ["-build", "-Itemp-project",
+        "-build-dir", "temp-project/build", "-o", "temp-project/program",
+        "temp-project/main.clay"], stdout=PIPE, stderr=PIPE)
+    out, err = process.communicate()
+    # jobs finish in any order, and their times vary
+    jobs = []
+    summary = "build: no summary"
+    for line in err.splitlines():
+        words = line.split()
+        if line.startswith("  ") and words:
+            jobs.append("%s %s" % (words[0], words[-1]))
+        elif line.startswith("build:"):
+            summary = line[:line.rfind(" in ")]
+        elif showErrors:
+            print line
+    for job in sorted(jobs):
+        print job
+    print summary
+    return process.returncode == 0
+
+def run():
+    process = Popen(["temp-project/program"], stdout=PIPE)
+    print process.communicate()[0].strip()
+
+os.makedirs("temp-project/geometry")
+try:
+    for source in sources:
+        shutil.copy(source, os.path.join("temp-project", source))
+
+    if build():
+        run()
+    # nothing changed
+    build()
+
+    points = open("temp-project/geometry/points.clay", "w")
+    points.write("side() : Int = 4;\n")
+    points.close()
+    if build():
+        run()
+
+    # a failed job only keeps the jobs that import it from running
+    points = open("temp-project/geometry/points.clay", "w")
+    points.write("side() : Int = undefinedSide;\n")
+    points.close()
+    greeting = open("temp-project/greeting.clay", "w")
+    greeting.write("greet() { }\n")
+    greeting.close()
+    build(showErrors=False)
+finally:
+    shutil.rmtree("temp-project")
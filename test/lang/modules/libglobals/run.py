@@ -0,0 +1,37 @@
+from subprocess import Popen, PIPE
+from sys import argv
+import os
+import shutil
+
+clay = os.environ["CLAY"]
+buildFlags = argv[2:]
+
+def build():
+    process = Popen([clay] + buildFlags + ["-build", "-Itemp-project",
+        "-Itemp-lib", "-build-dir", "temp-project/build",
+        "-o", "temp-project/program", "temp-project/main.clay"],
+        stdout=PIPE, stderr=PIPE)
+    out, err = process.communicate()
+    jobs = []
+    for line in err.splitlines():
+        words = line.split()
+        if line.startswith("  ") and words:
+            jobs.append("%s %s" % (words[0], words[-1]))
+        elif not line.startswith("build:"):
+            print line
+    for job in sorted(jobs):
+        print job
+    return process.returncode == 0
+
+os.makedirs("temp-project")
+os.makedirs("temp-lib")
+try:
+    shutil.copy("main.clay", "temp-project/main.clay")
+    shutil.copy("twice.clay", "temp-project/twice.clay")
+    shutil.copy("lib/tally.clay", "temp-lib/tally.clay")
+    if build():
+        process = Popen(["temp-project/program"], stdout=PIPE)
+        print process.communicate()[0].strip()
+finally:
+    shutil.rmtree("temp-project")
+    shutil.rmtree("temp-lib")
@@ -0,0 +1,48 @@
+from subprocess import Popen, PIPE
+from sys import argv
+import os
+import shutil
+
+clay = os.environ["CLAY"]
+buildFlags = argv[2:]
+
+def compile(args):
+    process = Popen([clay] + buildFlags + args, stdout=PIPE, stderr=PIPE)
+    out, err = process.communicate()
+    return process.returncode, err
+
+def report(what, returncode, err):
+    if returncode != 0:
+        print what, "failed:", err.strip()
+        return False
+    return True
+
+returncode, err = compile(["-c", "-prebuilt-out=temp-library.manifest",
+    "-o", "temp-library.o", "library.clay"])
+if report("library", returncode, err):
+    returncode, err = compile(["-prebuilt=temp-library.manifest", "-stats",
+        "-o", "temp-main.exe", "main.clay"])
+    if report("program", returncode, err):
+        if "instantiations taken from prebuilt libraries" in err:
+            print "prebuilt instantiations used"
+        process = Popen(["./temp-main.exe"], stdout=PIPE)
+        print process.communicate()[0].strip()
+
+    # other -D flags
+    returncode, err = compile(["-Dprebuilt.other", "-prebuilt=temp-library.manifest",
+        "-o", "temp-other.exe", "main.clay"])
+    if "other options" in err:
+        print "rejected other options"
+
+    # another version of counting
+    os.mkdir("temp-edited")
+    try:
+        edited = open("temp-edited/counting.clay", "w")
+        edited.write(open("counting.clay").read() + "\n// edited\n")
+        edited.close()
+        returncode, err = compile(["-Itemp-edited", "-prebuilt=temp-library.manifest",
+            "-o", "temp-edited.exe", "main.clay"])
+        if "another version of module counting" in err:
+            print "rejected edited module"
+    finally:
+        shutil.rmtree("temp-edited")
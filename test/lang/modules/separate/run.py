@@ -0,0 +1,28 @@
+from subprocess import Popen, PIPE
+from sys import argv
+import os
+
+clay = os.environ["CLAY"]
+buildFlags = argv[2:]
+
+def compile(args):
+    process = Popen([clay] + buildFlags + args, stdout=PIPE, stderr=PIPE)
+    out, err = process.communicate()
+    if process.returncode != 0:
+        print "compiling", args[-1], "failed:", err.strip()
+        return None
+    return err
+
+if compile(["-c", "-module", "-module-name", "counter",
+        "-o", "temp-counter.o", "counter.clay"]) is not None:
+    err = compile(["-prebuilt=temp-counter.clayi", "-stats",
+        "-o", "temp-main.exe", "main.clay"])
+    if err is not None:
+        if "global variables taken from module objects" in err:
+            print "module globals shared"
+        if "instantiations analyzed from prebuilt manifests" in err:
+            print "module bodies not analyzed"
+        if "record types described by prebuilt manifests" in err:
+            print "module records described"
+        process = Popen(["./temp-main.exe"], stdout=PIPE)
+        print process.communicate()[0].strip()
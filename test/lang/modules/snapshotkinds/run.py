@@ -0,0 +1,40 @@
+from subprocess import Popen, PIPE
+from sys import argv
+import os
+import shutil
+
+clay = os.environ["CLAY"]
+buildFlags = argv[2:]
+
+# -check-all parses every body eagerly so the snapshot holds them all, and
+# -g makes the debug locations part of the comparison
+def compile(output):
+    args = ["-check-all", "-g", "-emit-llvm", "-ast-cache", "temp-cache",
+            "-o", output, "main.clay"]
+    process = Popen([clay] + buildFlags + args, stdout=PIPE, stderr=PIPE)
+    out, err = process.communicate()
+    if process.returncode != 0:
+        print "compiling main.clay failed:", err.strip()
+        return False
+    return True
+
+def snapshots():
+    return [f for f in os.listdir("temp-cache") if "kinds.clay" in f]
+
+def contents(path):
+    f = open(path)
+    try:
+        return f.read()
+    finally:
+        f.close()
+
+os.mkdir("temp-cache")
+try:
+    if compile("temp-parsed.ll"):
+        if len(snapshots()) == 1:
+            print "snapshot written"
+        if compile("temp-loaded.ll"):
+            if contents("temp-loaded.ll") == contents("temp-parsed.ll"):
+                print "same code from the snapshot"
+finally:
+    shutil.rmtree("temp-cache")
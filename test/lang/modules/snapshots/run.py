@@ -0,0 +1,35 @@
+from subprocess import Popen, PIPE
+from sys import argv
+import os
+import shutil
+
+clay = os.environ["CLAY"]
+buildFlags = argv[2:]
+
+def compile(args):
+    process = Popen([clay] + buildFlags + args, stdout=PIPE, stderr=PIPE)
+    out, err = process.communicate()
+    if process.returncode != 0:
+        print "compiling", args[-1], "failed:", err.strip()
+        return False
+    return True
+
+def run(exe):
+    process = Popen([exe], stdout=PIPE)
+    return process.communicate()[0].strip()
+
+def snapshots():
+    return [f for f in os.listdir("temp-cache") if "shapes.clay" in f]
+
+os.mkdir("temp-cache")
+try:
+    if compile(["-ast-cache", "temp-cache", "-o", "temp-parsed.exe", "main.clay"]):
+        parsed = run("./temp-parsed.exe")
+        print parsed
+        if len(snapshots()) == 1:
+            print "snapshot written"
+        if compile(["-ast-cache", "temp-cache", "-o", "temp-loaded.exe", "main.clay"]):
+            if run("./temp-loaded.exe") == parsed:
+                print "snapshot loaded"
+finally:
+    shutil.rmtree("temp-cache")
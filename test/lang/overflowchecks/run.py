@@ -0,0 +1,31 @@
+from subprocess import Popen, PIPE
+from sys import argv
+import os
+
+clay = os.environ["CLAY"]
+buildFlags = argv[2:]
+
+process = Popen([argv[1]], stdout=PIPE)
+print process.communicate()[0].strip()
+
+process = Popen([clay] + buildFlags + ["-O2", "-stats", "-emit-llvm",
+    "-o", "temp-main.ll", "main.clay"], stdout=PIPE, stderr=PIPE)
+err = process.communicate()[1]
+if process.returncode != 0:
+    print "compile failed:", err.strip()
+else:
+    removed = 0
+    for line in err.splitlines():
+        if line.endswith(" integer overflow checks proven unnecessary"):
+            removed = int(line.split()[0])
+    if removed > 0:
+        print "checks removed"
+    else:
+        print "no checks removed"
+
+    checks = None
+    for function in open("temp-main.ll").read().split("\n}\n"):
+        define = function.find("\ndefine ")
+        if define >= 0 and "@countTo(" in function[define:].split("\n")[1]:
+            checks = function[define:].count(".with.overflow")
+    print "checks left in countTo:", checks
@@ -0,0 +1,26 @@
+from subprocess import Popen, PIPE
+from sys import argv
+import os
+
+clay = os.environ["CLAY"]
+buildFlags = argv[2:]
+
+process = Popen([argv[1]], stdout=PIPE)
+print process.communicate()[0].strip()
+
+process = Popen([clay] + buildFlags + ["-share-instantiations", "-stats",
+    "-o", "temp-main.exe", "main.clay"], stdout=PIPE, stderr=PIPE)
+out, err = process.communicate()
+if process.returncode != 0:
+    print "compile failed:", err.strip()
+else:
+    shared = 0
+    for line in err.splitlines():
+        if line.endswith(" instantiations sharing another's body"):
+            shared = int(line.split()[0])
+    # swapPointers, second, addressOfFirst and swapValues for UInt32, along
+    # with whatever the library shares
+    if shared >= 4:
+        print "bodies shared"
+    else:
+        print "bodies shared:", shared
@@ -0,0 +1,24 @@
+from subprocess import Popen, PIPE
+from sys import argv
+import os
+
+clay = os.environ["CLAY"]
+buildFlags = argv[2:]
+
+def reread(flags, output):
+    process = Popen([clay] + buildFlags + ["-O2", "-emit-llvm"] + flags
+        + ["-o", output, "main.clay"], stdout=PIPE, stderr=PIPE)
+    err = process.communicate()[1]
+    if process.returncode != 0:
+        print "compile failed:", err.strip()
+        return None
+    ir = open(output).read()
+    start = ir.find("@reread(")
+    body = ir[start:ir.find("\n}\n", start)]
+    return body.count("load float"), body.count("store i32")
+
+strict = reread([], "temp-strict.ll")
+loose = reread(["-no-strict-aliasing"], "temp-loose.ll")
+if strict is not None and loose is not None:
+    print "loads:", strict[0], "with strict aliasing,", loose[0], "without"
+    print "stores:", strict[1], "with strict aliasing,", loose[1], "without"
@@ -526,6 +526,8 @@ def main() :
         opt.clayCompiler = os.path.abspath(args.clayCompiler)
     else:
         opt.clayCompiler = getClayCompiler(opt)
+    # for run.py scripts that drive the compiler themselves
+    os.environ["CLAY"] = opt.clayCompiler
 
     startTime = time.time()
     opt.clayPlatform = getClayPlatform(opt)